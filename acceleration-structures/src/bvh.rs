@@ -0,0 +1,464 @@
+//! Bounding volume hierarchy over triangles, built top down with binned SAH (Wald 2007).
+//!
+//! Nodes are stored depth first in one array, the children of an inner node next to each other, and triangles are
+//! reordered so every leaf references a contiguous range of them.
+
+const BINS: usize = 16;
+/// Leaves hold at most this many triangles, splitting further even when SAH would rather keep them.
+const MAX_LEAF_TRIANGLES: usize = 8;
+/// Deeper nodes are made leaves, which also bounds the traversal stack.
+const MAX_DEPTH: usize = 64;
+/// Cost of visiting a node relative to intersecting a triangle.
+const TRAVERSAL_COST: f32 = 1.0;
+const EPSILON: f32 = 1e-12;
+
+pub type Vec3 = [f32; 3];
+
+fn sub(a: Vec3, b: Vec3) -> Vec3 {
+    [a[0] - b[0], a[1] - b[1], a[2] - b[2]]
+}
+
+fn dot(a: Vec3, b: Vec3) -> f32 {
+    a[0] * b[0] + a[1] * b[1] + a[2] * b[2]
+}
+
+fn cross(a: Vec3, b: Vec3) -> Vec3 {
+    [a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]]
+}
+
+#[derive(Clone, Copy)]
+pub struct Bounds {
+    pub min: Vec3,
+    pub max: Vec3,
+}
+
+impl Bounds {
+    pub const EMPTY: Bounds = Bounds { min: [f32::INFINITY; 3], max: [f32::NEG_INFINITY; 3] };
+
+    fn grow(&mut self, point: Vec3) {
+        for axis in 0..3 {
+            self.min[axis] = self.min[axis].min(point[axis]);
+            self.max[axis] = self.max[axis].max(point[axis]);
+        }
+    }
+
+    fn union(&mut self, other: &Bounds) {
+        self.grow(other.min);
+        self.grow(other.max);
+    }
+
+    fn half_area(&self) -> f32 {
+        let [x, y, z] = sub(self.max, self.min);
+        if x < 0.0 { 0.0 } else { x * y + y * z + z * x }
+    }
+
+    /// Distance at which the ray enters the box, `None` when it misses it within `t_far`.
+    fn enter(&self, origin: Vec3, inverse_direction: Vec3, t_near: f32, t_far: f32) -> Option<f32> {
+        let (mut enter, mut exit) = (t_near, t_far);
+        for axis in 0..3 {
+            let t0 = (self.min[axis] - origin[axis]) * inverse_direction[axis];
+            let t1 = (self.max[axis] - origin[axis]) * inverse_direction[axis];
+            // 0 * inf for rays parallel to the axis starting on a face, the slab does not constrain them.
+            if t0.is_nan() || t1.is_nan() {
+                continue;
+            }
+            enter = enter.max(t0.min(t1));
+            exit = exit.min(t0.max(t1));
+        }
+        (enter <= exit).then_some(enter)
+    }
+}
+
+/// A triangle by one corner and the edges to the other two, what Moller-Trumbore reads.
+#[derive(Clone, Copy)]
+struct Triangle {
+    v0: Vec3,
+    e1: Vec3,
+    e2: Vec3,
+}
+
+impl Triangle {
+    /// Distance and barycentrics of a hit within (`t_near`, `t_far`).
+    fn intersect(&self, origin: Vec3, direction: Vec3, t_near: f32, t_far: f32) -> Option<(f32, f32, f32)> {
+        let p = cross(direction, self.e2);
+        let determinant = dot(self.e1, p);
+        if determinant.abs() < EPSILON {
+            return None; // Ray is parallel to the triangle
+        }
+        let inverse = 1.0 / determinant;
+        let s = sub(origin, self.v0);
+        let u = dot(s, p) * inverse;
+        if !(0.0..=1.0).contains(&u) {
+            return None;
+        }
+        let q = cross(s, self.e1);
+        let v = dot(direction, q) * inverse;
+        if v < 0.0 || u + v > 1.0 {
+            return None;
+        }
+        let t = dot(self.e2, q) * inverse;
+        (t > t_near && t < t_far).then_some((t, u, v))
+    }
+}
+
+#[derive(Clone, Copy)]
+struct Node {
+    bounds: Bounds,
+    /// First triangle of a leaf, left child of an inner node, the right one follows it.
+    first: u32,
+    /// Triangles of a leaf, 0 for inner nodes.
+    count: u32,
+}
+
+pub struct Ray {
+    pub origin: Vec3,
+    pub direction: Vec3,
+    pub t_near: f32,
+    pub t_far: f32,
+}
+
+pub struct Hit {
+    pub t: f32,
+    pub u: f32,
+    pub v: f32,
+    /// Index of the triangle in the index buffer the hierarchy was built from.
+    pub primitive: u32,
+    /// Unnormalized `(v0 - v1) x (v2 - v0)`, the geometric normal Embree reports.
+    pub normal: Vec3,
+}
+
+pub struct Bvh {
+    nodes: Vec<Node>,
+    triangles: Vec<Triangle>,
+    /// Index buffer position of every entry of `triangles`.
+    primitives: Vec<u32>,
+    depth: usize,
+}
+
+/// Per triangle inputs of the build, shuffled into leaf order.
+struct BuildPrimitive {
+    bounds: Bounds,
+    centroid: Vec3,
+    index: u32,
+}
+
+#[derive(Clone, Copy)]
+struct Bin {
+    bounds: Bounds,
+    count: usize,
+}
+
+impl Bvh {
+    pub fn build(positions: &[Vec3], indices: &[[u32; 3]]) -> Self {
+        let mut primitives: Vec<BuildPrimitive> = indices
+            .iter()
+            .enumerate()
+            .map(|(index, corners)| {
+                let mut bounds = Bounds::EMPTY;
+                corners.iter().for_each(|&c| bounds.grow(positions[c as usize]));
+                let centroid = [0, 1, 2].map(|axis| 0.5 * (bounds.min[axis] + bounds.max[axis]));
+                BuildPrimitive { bounds, centroid, index: index as u32 }
+            })
+            .collect();
+
+        let mut bvh = Bvh { nodes: Vec::with_capacity(2 * primitives.len().max(1)), triangles: Vec::new(), primitives: Vec::new(), depth: 0 };
+        bvh.nodes.push(Node { bounds: Bounds::EMPTY, first: 0, count: 0 });
+        bvh.subdivide(0, &mut primitives, 0, 1);
+
+        bvh.primitives = primitives.iter().map(|p| p.index).collect();
+        bvh.triangles = bvh
+            .primitives
+            .iter()
+            .map(|&index| {
+                let [a, b, c] = indices[index as usize].map(|corner| positions[corner as usize]);
+                Triangle { v0: a, e1: sub(b, a), e2: sub(c, a) }
+            })
+            .collect();
+        bvh
+    }
+
+    /// Turns `nodes[node]` over `primitives`, starting at `first` in the final order, into a subtree.
+    fn subdivide(&mut self, node: usize, primitives: &mut [BuildPrimitive], first: usize, depth: usize) {
+        self.depth = self.depth.max(depth);
+        let mut bounds = Bounds::EMPTY;
+        let mut centroids = Bounds::EMPTY;
+        for primitive in primitives.iter() {
+            bounds.union(&primitive.bounds);
+            centroids.grow(primitive.centroid);
+        }
+        self.nodes[node] = Node { bounds, first: first as u32, count: primitives.len() as u32 };
+        if primitives.len() <= 1 || depth >= MAX_DEPTH {
+            return;
+        }
+
+        let Some((axis, split, cost)) = Self::best_split(primitives, &centroids) else { return };
+        let leaf_cost = primitives.len() as f32 * bounds.half_area();
+        if cost + TRAVERSAL_COST * bounds.half_area() >= leaf_cost && primitives.len() <= MAX_LEAF_TRIANGLES {
+            return;
+        }
+
+        let scale = BINS as f32 / (centroids.max[axis] - centroids.min[axis]);
+        let bin_of = |p: &BuildPrimitive| (((p.centroid[axis] - centroids.min[axis]) * scale) as usize).min(BINS - 1);
+        let mut n_left = 0;
+        for i in 0..primitives.len() {
+            if bin_of(&primitives[i]) < split {
+                primitives.swap(i, n_left);
+                n_left += 1;
+            }
+        }
+
+        let left = self.nodes.len();
+        self.nodes.push(Node { bounds: Bounds::EMPTY, first: 0, count: 0 });
+        self.nodes.push(Node { bounds: Bounds::EMPTY, first: 0, count: 0 });
+        self.nodes[node].first = left as u32;
+        self.nodes[node].count = 0;
+        let (lower, upper) = primitives.split_at_mut(n_left);
+        self.subdivide(left, lower, first, depth + 1);
+        self.subdivide(left + 1, upper, first + n_left, depth + 1);
+    }
+
+    /// Axis, first bin right of the split and SAH cost of the cheapest split between centroid bins, `None` when every
+    /// centroid falls into one bin.
+    fn best_split(primitives: &[BuildPrimitive], centroids: &Bounds) -> Option<(usize, usize, f32)> {
+        let mut best: Option<(usize, usize, f32)> = None;
+        for axis in 0..3 {
+            let extent = centroids.max[axis] - centroids.min[axis];
+            if extent <= 0.0 {
+                continue;
+            }
+            let scale = BINS as f32 / extent;
+            let mut bins = [Bin { bounds: Bounds::EMPTY, count: 0 }; BINS];
+            for primitive in primitives {
+                let bin = (((primitive.centroid[axis] - centroids.min[axis]) * scale) as usize).min(BINS - 1);
+                bins[bin].bounds.union(&primitive.bounds);
+                bins[bin].count += 1;
+            }
+
+            // Area times count of everything right of each split, swept from the right.
+            let mut right_costs = [0.0f32; BINS];
+            let mut right = Bounds::EMPTY;
+            let mut n_right = 0;
+            for split in (1..BINS).rev() {
+                right.union(&bins[split].bounds);
+                n_right += bins[split].count;
+                right_costs[split] = n_right as f32 * right.half_area();
+            }
+            let mut left = Bounds::EMPTY;
+            let mut n_left = 0;
+            for split in 1..BINS {
+                left.union(&bins[split - 1].bounds);
+                n_left += bins[split - 1].count;
+                if n_left == 0 || n_left == primitives.len() {
+                    continue;
+                }
+                let cost = n_left as f32 * left.half_area() + right_costs[split];
+                if best.map_or(true, |(_, _, best_cost)| cost < best_cost) {
+                    best = Some((axis, split, cost));
+                }
+            }
+        }
+        best
+    }
+
+    pub fn node_count(&self) -> usize {
+        self.nodes.len()
+    }
+
+    pub fn depth(&self) -> usize {
+        self.depth
+    }
+
+    /// Visits leaves front to back, stopping once `visit` returns true.
+    ///
+    /// `visit` gets the triangles of a leaf and the current `t_far`, which it may shorten by returning a closer hit.
+    fn traverse(&self, ray: &Ray, mut visit: impl FnMut(usize, &mut f32) -> bool) {
+        let inverse_direction = ray.direction.map(|d| 1.0 / d);
+        let mut t_far = ray.t_far;
+        let mut stack = [0u32; MAX_DEPTH + 1];
+        let mut n_stack = 0;
+        if self.nodes[0].bounds.enter(ray.origin, inverse_direction, ray.t_near, t_far).is_none() {
+            return;
+        }
+        let mut node = &self.nodes[0];
+        loop {
+            if node.count > 0 {
+                let leaf = node.first as usize..(node.first + node.count) as usize;
+                for triangle in leaf {
+                    if visit(triangle, &mut t_far) {
+                        return;
+                    }
+                }
+            } else {
+                let left = &self.nodes[node.first as usize];
+                let right = &self.nodes[node.first as usize + 1];
+                let enter_left = left.bounds.enter(ray.origin, inverse_direction, ray.t_near, t_far);
+                let enter_right = right.bounds.enter(ray.origin, inverse_direction, ray.t_near, t_far);
+                match (enter_left, enter_right) {
+                    (Some(l), Some(r)) => {
+                        // Nearer child first, the other waits on the stack.
+                        let (near, far) = if l <= r { (node.first, node.first + 1) } else { (node.first + 1, node.first) };
+                        stack[n_stack] = far;
+                        n_stack += 1;
+                        node = &self.nodes[near as usize];
+                        continue;
+                    }
+                    (Some(_), None) => {
+                        node = left;
+                        continue;
+                    }
+                    (None, Some(_)) => {
+                        node = right;
+                        continue;
+                    }
+                    (None, None) => {}
+                }
+            }
+            // Pop nodes until one is still in front of the closest hit.
+            loop {
+                if n_stack == 0 {
+                    return;
+                }
+                n_stack -= 1;
+                let candidate = &self.nodes[stack[n_stack] as usize];
+                if candidate.bounds.enter(ray.origin, inverse_direction, ray.t_near, t_far).is_some() {
+                    node = candidate;
+                    break;
+                }
+            }
+        }
+    }
+
+    pub fn intersect(&self, ray: &Ray) -> Option<Hit> {
+        let mut closest: Option<(usize, f32, f32, f32)> = None;
+        self.traverse(ray, |triangle, t_far| {
+            if let Some((t, u, v)) = self.triangles[triangle].intersect(ray.origin, ray.direction, ray.t_near, *t_far) {
+                *t_far = t;
+                closest = Some((triangle, t, u, v));
+            }
+            false
+        });
+        closest.map(|(triangle, t, u, v)| {
+            let Triangle { e1, e2, .. } = self.triangles[triangle];
+            Hit { t, u, v, primitive: self.primitives[triangle], normal: cross(e2, e1) }
+        })
+    }
+
+    pub fn occluded(&self, ray: &Ray) -> bool {
+        let mut occluded = false;
+        self.traverse(ray, |triangle, t_far| {
+            occluded = self.triangles[triangle].intersect(ray.origin, ray.direction, ray.t_near, *t_far).is_some();
+            occluded
+        });
+        occluded
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Deterministic values in [0, 1), enough to scatter test geometry.
+    struct Lcg(u64);
+
+    impl Lcg {
+        fn next(&mut self) -> f32 {
+            self.0 = self.0.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+            (self.0 >> 40) as f32 / (1u64 << 24) as f32
+        }
+    }
+
+    fn scattered_triangles(n: usize) -> (Vec<Vec3>, Vec<[u32; 3]>) {
+        let mut random = Lcg(7);
+        let mut positions = Vec::new();
+        let mut indices = Vec::new();
+        for i in 0..n as u32 {
+            let center = [0, 1, 2].map(|_| 4.0 * random.next() - 2.0);
+            for _ in 0..3 {
+                positions.push([0, 1, 2].map(|axis| center[axis] + 0.4 * random.next() - 0.2));
+            }
+            indices.push([3 * i, 3 * i + 1, 3 * i + 2]);
+        }
+        (positions, indices)
+    }
+
+    fn brute_force(positions: &[Vec3], indices: &[[u32; 3]], ray: &Ray) -> Option<(u32, f32)> {
+        let mut closest = None;
+        let mut t_far = ray.t_far;
+        for (i, corners) in indices.iter().enumerate() {
+            let [a, b, c] = corners.map(|corner| positions[corner as usize]);
+            let triangle = Triangle { v0: a, e1: sub(b, a), e2: sub(c, a) };
+            if let Some((t, _, _)) = triangle.intersect(ray.origin, ray.direction, ray.t_near, t_far) {
+                t_far = t;
+                closest = Some((i as u32, t));
+            }
+        }
+        closest
+    }
+
+    fn random_ray(random: &mut Lcg) -> Ray {
+        Ray {
+            origin: [0, 1, 2].map(|_| 6.0 * random.next() - 3.0),
+            direction: [0, 1, 2].map(|_| 2.0 * random.next() - 1.0),
+            t_near: 0.001,
+            t_far: f32::INFINITY,
+        }
+    }
+
+    #[test]
+    fn test_intersect_matches_brute_force() {
+        let (positions, indices) = scattered_triangles(500);
+        let bvh = Bvh::build(&positions, &indices);
+        let mut random = Lcg(11);
+        let mut n_hits = 0;
+        for _ in 0..2000 {
+            let ray = random_ray(&mut random);
+            let expected = brute_force(&positions, &indices, &ray);
+            let hit = bvh.intersect(&ray).map(|hit| (hit.primitive, hit.t));
+            assert_eq!(hit, expected);
+            n_hits += hit.is_some() as usize;
+        }
+        assert!(n_hits > 100);
+    }
+
+    #[test]
+    fn test_occluded_matches_intersect() {
+        let (positions, indices) = scattered_triangles(500);
+        let bvh = Bvh::build(&positions, &indices);
+        let mut random = Lcg(13);
+        for _ in 0..2000 {
+            let mut ray = random_ray(&mut random);
+            ray.t_far = 2.0;
+            assert_eq!(bvh.occluded(&ray), bvh.intersect(&ray).is_some());
+        }
+    }
+
+    #[test]
+    fn test_rays_in_the_plane_of_a_face() {
+        // The box of the triangle is flat in y, the rays run along it without a y component.
+        let positions = vec![[-1.0, 0.0, -1.0], [1.0, 0.0, -1.0], [0.0, 0.0, 1.0], [0.0, 1.0, 0.0]];
+        let indices = vec![[0, 1, 3], [1, 2, 3], [2, 0, 3]];
+        let bvh = Bvh::build(&positions, &indices);
+        let ray = Ray { origin: [0.0, 0.0, -3.0], direction: [0.0, 0.0, 1.0], t_near: 0.0, t_far: f32::INFINITY };
+        assert_eq!(bvh.intersect(&ray).is_some(), brute_force(&positions, &indices, &ray).is_some());
+        assert!(bvh.intersect(&ray).is_some());
+    }
+
+    #[test]
+    fn test_identical_centroids_make_a_leaf() {
+        let positions = vec![[-1.0, -1.0, 0.0], [1.0, -1.0, 0.0], [0.0, 1.0, 0.0]];
+        let indices = vec![[0, 1, 2]; 20];
+        let bvh = Bvh::build(&positions, &indices);
+        assert_eq!(bvh.node_count(), 1);
+        let ray = Ray { origin: [0.0, 0.0, -1.0], direction: [0.0, 0.0, 1.0], t_near: 0.0, t_far: 10.0 };
+        assert_eq!(bvh.intersect(&ray).map(|hit| hit.t), Some(1.0));
+    }
+
+    #[test]
+    fn test_normal_matches_embree() {
+        // Embree's normal points to the side the corners run clockwise on, -z for these.
+        let positions = vec![[-1.0, -1.0, 0.0], [1.0, -1.0, 0.0], [0.0, 1.0, 0.0]];
+        let bvh = Bvh::build(&positions, &[[0, 1, 2]]);
+        let ray = Ray { origin: [0.0, 0.0, -1.0], direction: [0.0, 0.0, 1.0], t_near: 0.0, t_far: 10.0 };
+        assert_eq!(bvh.intersect(&ray).map(|hit| hit.normal), Some([0.0, 0.0, -4.0]));
+    }
+}
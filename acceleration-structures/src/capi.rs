@@ -0,0 +1,162 @@
+//! C interface of `Bvh`, mirrored by `ray-tracer-baby/include/accel.h`.
+
+use std::time::Instant;
+
+use crate::bvh::{Bvh, Ray, Vec3};
+
+/// Primitive id of rays that hit nothing.
+pub const ACCEL_NO_HIT: u32 = u32::MAX;
+
+/// Outcome of `BuildAccel`, panicking across the C boundary would abort the renderer.
+#[repr(C)]
+#[derive(Debug, PartialEq, Eq)]
+pub enum AccelStatus {
+    Ok = 0,
+    /// A buffer is null while its count is not 0.
+    NullBuffer = 1,
+    /// An index lies past the end of the position buffer.
+    IndexOutOfRange = 2,
+}
+
+#[repr(C)]
+pub struct AccelRay {
+    pub origin: Vec3,
+    pub t_near: f32,
+    pub direction: Vec3,
+    pub t_far: f32,
+}
+
+#[repr(C)]
+pub struct AccelHit {
+    pub t: f32,
+    pub u: f32,
+    pub v: f32,
+    /// Triangle of the index buffer hit, `ACCEL_NO_HIT` for misses.
+    pub prim_id: u32,
+    /// Unnormalized geometric normal `(v0 - v1) x (v2 - v0)`, with the sign Embree gives it.
+    pub normal: Vec3,
+}
+
+#[repr(C)]
+#[derive(Default)]
+pub struct AccelStats {
+    pub n_nodes: u32,
+    pub depth: u32,
+    pub build_ns: u64,
+}
+
+impl AccelRay {
+    fn ray(&self) -> Ray {
+        Ray { origin: self.origin, direction: self.direction, t_near: self.t_near, t_far: self.t_far }
+    }
+}
+
+/// Slice of `len` elements at `data`, which may only be null when `len` is 0.
+unsafe fn slice_or_empty<'a, T>(data: *const T, len: usize) -> Option<&'a [T]> {
+    match (data.is_null(), len) {
+        (true, 0) => Some(&[]),
+        (true, _) => None,
+        (false, _) => Some(std::slice::from_raw_parts(data, len)),
+    }
+}
+
+/// Builds a hierarchy over `n_triangles` triangles of `indices` into `positions`, stored in `accel`. `stats` may be null.
+///
+/// Nothing of the buffers is referenced afterwards. `accel` is left untouched unless the status is `Ok`.
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn BuildAccel(
+    positions: *const Vec3,
+    n_positions: usize,
+    indices: *const [u32; 3],
+    n_triangles: usize,
+    stats: *mut AccelStats,
+    accel: *mut *mut Bvh,
+) -> AccelStatus {
+    let Some(positions) = slice_or_empty(positions, n_positions) else {
+        return AccelStatus::NullBuffer;
+    };
+    let Some(indices) = slice_or_empty(indices, n_triangles) else {
+        return AccelStatus::NullBuffer;
+    };
+    if accel.is_null() {
+        return AccelStatus::NullBuffer;
+    }
+    if !indices.iter().flatten().all(|&corner| (corner as usize) < n_positions) {
+        return AccelStatus::IndexOutOfRange;
+    }
+
+    let build_start = Instant::now();
+    let bvh = Bvh::build(positions, indices);
+    if let Some(stats) = stats.as_mut() {
+        stats.n_nodes = bvh.node_count() as u32;
+        stats.depth = bvh.depth() as u32;
+        stats.build_ns = build_start.elapsed().as_nanos() as u64;
+    }
+    *accel = Box::into_raw(Box::new(bvh));
+    AccelStatus::Ok
+}
+
+/// Closest hit of every ray, `hits` has to hold `n_rays` records.
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn TraceAccel(accel: *const Bvh, rays: *const AccelRay, n_rays: usize, hits: *mut AccelHit) {
+    let bvh = &*accel;
+    let rays = std::slice::from_raw_parts(rays, n_rays);
+    let hits = std::slice::from_raw_parts_mut(hits, n_rays);
+    for (ray, hit) in rays.iter().zip(hits.iter_mut()) {
+        *hit = match bvh.intersect(&ray.ray()) {
+            Some(closest) => AccelHit {
+                t: closest.t,
+                u: closest.u,
+                v: closest.v,
+                prim_id: closest.primitive,
+                normal: closest.normal,
+            },
+            None => AccelHit { t: f32::INFINITY, u: 0.0, v: 0.0, prim_id: ACCEL_NO_HIT, normal: [0.0; 3] },
+        };
+    }
+}
+
+/// Whether anything lies along each ray within its range, stopping at the first hit found.
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn OccludedAccel(accel: *const Bvh, rays: *const AccelRay, n_rays: usize, occluded: *mut bool) {
+    let bvh = &*accel;
+    let rays = std::slice::from_raw_parts(rays, n_rays);
+    let occluded = std::slice::from_raw_parts_mut(occluded, n_rays);
+    for (ray, result) in rays.iter().zip(occluded.iter_mut()) {
+        *result = bvh.occluded(&ray.ray());
+    }
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn FreeAccel(accel: *mut Bvh) {
+    if !accel.is_null() {
+        drop(Box::from_raw(accel));
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_build_rejects_bad_buffers() {
+        let positions = [[0.0, 0.0, 0.0], [1.0, 0.0, 0.0], [0.0, 1.0, 0.0]];
+        let mut accel = std::ptr::null_mut();
+        unsafe {
+            let status = BuildAccel(positions.as_ptr(), 3, [[0, 1, 3]].as_ptr(), 1, std::ptr::null_mut(), &mut accel);
+            assert_eq!(status, AccelStatus::IndexOutOfRange);
+            let status = BuildAccel(std::ptr::null(), 3, [[0, 1, 2]].as_ptr(), 1, std::ptr::null_mut(), &mut accel);
+            assert_eq!(status, AccelStatus::NullBuffer);
+            assert!(accel.is_null());
+
+            let status = BuildAccel(positions.as_ptr(), 3, [[0, 1, 2]].as_ptr(), 1, std::ptr::null_mut(), &mut accel);
+            assert_eq!(status, AccelStatus::Ok);
+            assert!(!accel.is_null());
+            FreeAccel(accel);
+        }
+    }
+}
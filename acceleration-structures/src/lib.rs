@@ -1,8 +1,16 @@
 pub mod bvh;
+mod capi;
+
+#[cfg(feature = "kd-tree")]
 pub mod kd_tree;
+#[cfg(feature = "kd-tree")]
 pub mod ray;
+#[cfg(feature = "kd-tree")]
 pub mod primitive;
+#[cfg(feature = "kd-tree")]
 pub mod aabb;
+#[cfg(feature = "kd-tree")]
 pub mod triangle;
 
+#[cfg(feature = "kd-tree")]
 pub use aabb::Aabb3 as Aabb;
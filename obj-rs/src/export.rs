@@ -4,8 +4,8 @@ use crate::raw;
 
 use crate::error::make_error;
 use crate::raw::object::Polygon;
+use crate::weld::{remap_positions, weld_positions, Welder};
 use num_traits::FromPrimitive;
-use std::collections::hash_map::{Entry, HashMap};
 use std::io::BufRead;
 
 /// Load a wavefront OBJ file into Rust & OpenGL friendly format.
@@ -38,6 +38,15 @@ impl<V: FromRawVertex<I>, I> Obj<V, I> {
             indices,
         })
     }
+
+    /// Create `Obj` from `RawObj` object, first merging positions closer than `epsilon`.
+    pub fn new_welded(mut raw: raw::RawObj, epsilon: f32) -> ObjResult<Self> {
+        if epsilon > 0.0 {
+            let remap = weld_positions(&raw.positions, epsilon);
+            remap_positions(&mut raw.polygons, &remap);
+        }
+        Self::new(raw)
+    }
 }
 
 /// Conversion from `RawObj`'s raw data.
@@ -71,33 +80,21 @@ impl<I: FromPrimitive + Copy> FromRawVertex<I> for Vertex {
         let mut vb = Vec::with_capacity(polygons.len() * 3);
         let mut ib = Vec::with_capacity(polygons.len() * 3);
         {
-            let mut cache = HashMap::new();
+            let mut welder = Welder::with_corners(polygons.len() * 3);
             let mut map = |pi: usize, ni: usize| -> ObjResult<()> {
-                // Look up cache
-                let index = match cache.entry((pi, ni)) {
-                    // Cache miss -> make new, store it on cache
-                    Entry::Vacant(entry) => {
-                        let p = positions[pi];
-                        let n = normals[ni];
-                        let vertex = Vertex {
-                            position: [p.0, p.1, p.2],
-                            normal: [n.0, n.1, n.2],
-                        };
-                        let index = match I::from_usize(vb.len()) {
-                            Some(val) => val,
-                            None => make_error!(
-                                IndexOutOfRange,
-                                "Unable to convert the index from usize"
-                            ),
-                        };
-                        vb.push(vertex);
-                        entry.insert(index);
-                        index
-                    }
-                    // Cache hit -> use it
-                    Entry::Occupied(entry) => *entry.get(),
-                };
-                ib.push(index);
+                let (index, inserted) = welder.insert((pi, ni));
+                if inserted {
+                    let p = positions[pi];
+                    let n = normals[ni];
+                    vb.push(Vertex {
+                        position: [p.0, p.1, p.2],
+                        normal: [n.0, n.1, n.2],
+                    });
+                }
+                match I::from_usize(index) {
+                    Some(val) => ib.push(val),
+                    None => make_error!(IndexOutOfRange, "Unable to convert the index from usize"),
+                }
                 Ok(())
             };
 
@@ -210,35 +207,23 @@ impl<I: FromPrimitive + Copy> FromRawVertex<I> for TexturedVertex {
         let mut vb = Vec::with_capacity(polygons.len() * 3);
         let mut ib = Vec::with_capacity(polygons.len() * 3);
         {
-            let mut cache = HashMap::new();
+            let mut welder = Welder::with_corners(polygons.len() * 3);
             let mut map = |pi: usize, ni: usize, ti: usize| -> ObjResult<()> {
-                // Look up cache
-                let index = match cache.entry((pi, ni, ti)) {
-                    // Cache miss -> make new, store it on cache
-                    Entry::Vacant(entry) => {
-                        let p = positions[pi];
-                        let n = normals[ni];
-                        let t = tex_coords[ti];
-                        let vertex = TexturedVertex {
-                            position: [p.0, p.1, p.2],
-                            normal: [n.0, n.1, n.2],
-                            texture: [t.0, t.1, t.2],
-                        };
-                        let index = match I::from_usize(vb.len()) {
-                            Some(val) => val,
-                            None => make_error!(
-                                IndexOutOfRange,
-                                "Unable to convert the index from usize"
-                            ),
-                        };
-                        vb.push(vertex);
-                        entry.insert(index);
-                        index
-                    }
-                    // Cache hit -> use it
-                    Entry::Occupied(entry) => *entry.get(),
-                };
-                ib.push(index);
+                let (index, inserted) = welder.insert((pi, ni, ti));
+                if inserted {
+                    let p = positions[pi];
+                    let n = normals[ni];
+                    let t = tex_coords[ti];
+                    vb.push(TexturedVertex {
+                        position: [p.0, p.1, p.2],
+                        normal: [n.0, n.1, n.2],
+                        texture: [t.0, t.1, t.2],
+                    });
+                }
+                match I::from_usize(index) {
+                    Some(val) => ib.push(val),
+                    None => make_error!(IndexOutOfRange, "Unable to convert the index from usize"),
+                }
                 Ok(())
             };
 
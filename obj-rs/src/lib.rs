@@ -1,10 +1,17 @@
 mod error;
 mod raw;
 mod export;
+mod optimize;
+mod simplify;
+mod weld;
 
-use std::{fs::File, ffi::CStr};
+use std::{fs::File, ffi::{CStr, CString}};
 use std::io::BufReader;
+use std::os::raw::c_char;
+use std::path::Path;
+use std::time::Instant;
 pub use export::Vertex;
+pub use optimize::MeshStats;
 
 #[repr(C)]
 pub struct Obj {
@@ -12,21 +19,86 @@ pub struct Obj {
     pub n_indices: usize,
     pub vertices: *const Vertex,
     pub indices: *const u16,
+    /// One per vertex, null when the model has no texture coordinates on every polygon.
+    pub tex_coords: *const [f32; 2],
+    /// Path of the first `map_Kd` of the model's material libraries, null when there is none.
+    pub albedo_texture: *const c_char,
+}
+
+/// Resolves the diffuse map of the material libraries of `raw`, relative to the directory of the model.
+///
+/// Models are drawn with a single material, the first one by name with a diffuse map is picked.
+fn albedo_texture(obj_path: &Path, raw: &raw::RawObj) -> Option<CString> {
+    let directory = obj_path.parent().unwrap_or(Path::new(""));
+    raw.material_libraries.iter().find_map(|library| {
+        let file = File::open(directory.join(library)).ok()?;
+        let mtl = raw::parse_mtl(BufReader::new(file)).ok()?;
+        let mut materials: Vec<_> = mtl.materials.into_iter().filter_map(|(name, m)| Some((name, m.diffuse_map?))).collect();
+        materials.sort_by(|a, b| a.0.cmp(&b.0));
+        let (_, map) = materials.into_iter().next()?;
+        CString::new(directory.join(map.file).to_str()?).ok()
+    })
+}
+
+/// Wall time of `LoadOBJTimed` stages in nanoseconds.
+#[repr(C)]
+#[derive(Default)]
+pub struct ObjLoadTimings {
+    /// Reading and lexing the file into `RawObj`.
+    pub parse_ns: u64,
+    /// Welding raw polygons into vertex and index buffers.
+    pub process_ns: u64,
 }
 
 #[allow(non_snake_case)]
 #[no_mangle]
 pub unsafe extern "C" fn LoadOBJ(path: *const i8, obj: *mut Obj) {
+    LoadOBJTimed(path, obj, std::ptr::null_mut());
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn LoadOBJTimed(path: *const i8, obj: *mut Obj, timings: *mut ObjLoadTimings) {
+    LoadOBJWelded(path, 0.0, obj, timings);
+}
+
+/// Like `LoadOBJTimed`, merging positions closer than `epsilon` before welding vertices. `timings` may be null.
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn LoadOBJWelded(path: *const i8, epsilon: f32, obj: *mut Obj, timings: *mut ObjLoadTimings) {
     let cstr = unsafe { CStr::from_ptr(path) };
-    let file = File::open(cstr.to_str().expect("path is valid utf-8")).expect(".obj file exists");
+    let obj_path = Path::new(cstr.to_str().expect("path is valid utf-8"));
+    let file = File::open(obj_path).expect(".obj file exists");
     let input = BufReader::new(file);
-    let scene: export::Obj  = export::load_obj(input).expect("model loading is successful");
-    let export::Obj { vertices, indices, .. } = scene;
+
+    let parse_start = Instant::now();
+    let raw = raw::parse_obj(input).expect("model parsing is successful");
+    let albedo = albedo_texture(obj_path, &raw);
+    let textured = !raw.tex_coords.is_empty() && raw.polygons.iter().all(|p| matches!(p, raw::object::Polygon::PTN(_)));
+    let process_start = Instant::now();
+    let (vertices, indices, tex_coords) = if textured {
+        let scene: export::Obj<export::TexturedVertex> =
+            export::Obj::new_welded(raw, epsilon).expect("model loading is successful");
+        let vertices: Vec<Vertex> = scene.vertices.iter().map(|v| Vertex { position: v.position, normal: v.normal }).collect();
+        let tex_coords: Box<[[f32; 2]]> = scene.vertices.iter().map(|v| [v.texture[0], v.texture[1]]).collect();
+        (vertices, scene.indices, Box::into_raw(tex_coords) as *const [f32; 2])
+    } else {
+        let scene: export::Obj = export::Obj::new_welded(raw, epsilon).expect("model loading is successful");
+        (scene.vertices, scene.indices, std::ptr::null())
+    };
+    let process_end = Instant::now();
+
+    if let Some(timings) = timings.as_mut() {
+        timings.parse_ns = (process_start - parse_start).as_nanos() as u64;
+        timings.process_ns = (process_end - process_start).as_nanos() as u64;
+    }
 
     (*obj).n_vertices = vertices.len();
     (*obj).n_indices = indices.len();
     (*obj).vertices = vertices.as_ptr();
     (*obj).indices = indices.as_ptr();
+    (*obj).tex_coords = tex_coords;
+    (*obj).albedo_texture = albedo.map_or(std::ptr::null(), |path| path.into_raw() as *const c_char);
 
     std::mem::forget(vertices);
     std::mem::forget(indices);
@@ -34,6 +106,159 @@ pub unsafe extern "C" fn LoadOBJ(path: *const i8, obj: *mut Obj) {
 
 #[no_mangle]
 pub unsafe extern "C" fn FreeOBJ(obj: Obj) {
-    Vec::from_raw_parts(obj.vertices as *mut Vertex, obj.n_vertices, obj.n_vertices);
+    if !obj.vertices.is_null() {
+        Vec::from_raw_parts(obj.vertices as *mut Vertex, obj.n_vertices, obj.n_vertices);
+    }
     Vec::from_raw_parts(obj.indices as *mut u16, obj.n_indices, obj.n_indices);
+    if !obj.tex_coords.is_null() {
+        drop(Box::from_raw(std::ptr::slice_from_raw_parts_mut(obj.tex_coords as *mut [f32; 2], obj.n_vertices)));
+    }
+    if !obj.albedo_texture.is_null() {
+        drop(CString::from_raw(obj.albedo_texture as *mut c_char));
+    }
+}
+
+/// Frees only the vertex buffer, `n_vertices` is kept as it still sizes the texture coordinates.
+#[no_mangle]
+pub unsafe extern "C" fn FreeOBJVertices(obj: *mut Obj) {
+    if (*obj).vertices.is_null() {
+        return;
+    }
+    Vec::from_raw_parts((*obj).vertices as *mut Vertex, (*obj).n_vertices, (*obj).n_vertices);
+    (*obj).vertices = std::ptr::null();
+}
+
+/// Options of `OptimizeOBJ`, mirrors `optimize::OptimizeOptions`.
+#[repr(C)]
+pub struct MeshOptimizeParams {
+    pub reorder_triangles: bool,
+    pub sort_clusters: bool,
+    /// 0 keeps the vertex order, 1 orders by first use, 2 along a Morton curve.
+    pub vertex_order: u32,
+    /// Post-transform cache size targeted by triangle reordering, 0 selects the default.
+    pub cache_size: u32,
+}
+
+/// Statistics of `OptimizeOBJ`.
+#[repr(C)]
+#[derive(Default)]
+pub struct MeshOptimizeReport {
+    pub before: MeshStats,
+    pub after: MeshStats,
+    pub n_clusters: u32,
+    pub optimize_ns: u64,
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn AnalyzeOBJ(obj: *const Obj, cache_size: u32, stats: *mut MeshStats) {
+    let obj = &*obj;
+    let indices = std::slice::from_raw_parts(obj.indices, obj.n_indices);
+    let cache_size = if cache_size == 0 { optimize::DEFAULT_CACHE_SIZE } else { cache_size as usize };
+    *stats = optimize::analyze(indices, obj.n_vertices, std::mem::size_of::<Vertex>(), cache_size);
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn OptimizeOBJ(obj: *mut Obj, params: MeshOptimizeParams, report: *mut MeshOptimizeReport) {
+    let obj = &mut *obj;
+    let vertices = std::slice::from_raw_parts_mut(obj.vertices as *mut Vertex, obj.n_vertices);
+    let indices = std::slice::from_raw_parts_mut(obj.indices as *mut u16, obj.n_indices);
+    let options = optimize::OptimizeOptions {
+        reorder_triangles: params.reorder_triangles,
+        sort_clusters: params.sort_clusters,
+        vertex_order: match params.vertex_order {
+            0 => optimize::VertexOrder::Unchanged,
+            1 => optimize::VertexOrder::FirstUse,
+            2 => optimize::VertexOrder::Morton,
+            order => panic!("unknown vertex order {}", order),
+        },
+        cache_size: if params.cache_size == 0 { optimize::DEFAULT_CACHE_SIZE } else { params.cache_size as usize },
+    };
+    let vertex_size = std::mem::size_of::<Vertex>();
+
+    let before = optimize::analyze(indices, vertices.len(), vertex_size, optimize::DEFAULT_CACHE_SIZE);
+    let start = Instant::now();
+    let n_clusters = if obj.tex_coords.is_null() {
+        optimize::optimize(vertices, indices, |v| v.position, options)
+    } else {
+        // Texture coordinates follow their vertices through the reordering.
+        let tex_coords = std::slice::from_raw_parts_mut(obj.tex_coords as *mut [f32; 2], obj.n_vertices);
+        let mut textured: Vec<(Vertex, [f32; 2])> = vertices.iter().copied().zip(tex_coords.iter().copied()).collect();
+        let n_clusters = optimize::optimize(&mut textured, indices, |v| v.0.position, options);
+        for ((vertex, tex_coord), (v, t)) in vertices.iter_mut().zip(tex_coords.iter_mut()).zip(textured) {
+            *vertex = v;
+            *tex_coord = t;
+        }
+        n_clusters
+    };
+    let optimize_ns = start.elapsed().as_nanos() as u64;
+
+    if let Some(report) = report.as_mut() {
+        report.before = before;
+        report.after = optimize::analyze(indices, vertices.len(), vertex_size, optimize::DEFAULT_CACHE_SIZE);
+        report.n_clusters = n_clusters as u32;
+        report.optimize_ns = optimize_ns;
+    }
+}
+
+/// Options of `GenerateLODs`.
+#[repr(C)]
+pub struct LodParams {
+    pub max_levels: u32,
+    /// Triangle count of every level relative to the previous one.
+    pub reduction: f32,
+    /// Largest error of any level relative to the largest extent of the mesh bounds.
+    pub max_error: f32,
+}
+
+/// Simplified index buffer of an `Obj`, indexing its vertex buffer.
+#[repr(C)]
+pub struct ObjLod {
+    pub n_indices: usize,
+    pub indices: *const u16,
+    /// Largest distance the surface moved, in mesh units.
+    pub error: f32,
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn GenerateLODs(obj: *const Obj, params: LodParams, lods: *mut ObjLod) -> u32 {
+    let obj = &*obj;
+    let vertices = std::slice::from_raw_parts(obj.vertices, obj.n_vertices);
+    let indices = std::slice::from_raw_parts(obj.indices, obj.n_indices);
+    let positions: Vec<[f32; 3]> = vertices.iter().map(|v| v.position).collect();
+
+    let mut lower = [f32::INFINITY; 3];
+    let mut upper = [f32::NEG_INFINITY; 3];
+    for p in &positions {
+        for axis in 0..3 {
+            lower[axis] = lower[axis].min(p[axis]);
+            upper[axis] = upper[axis].max(p[axis]);
+        }
+    }
+    let extent = (0..3).map(|axis| upper[axis] - lower[axis]).fold(0.0, f32::max);
+
+    let levels = simplify::generate_lods(
+        &positions,
+        indices,
+        params.max_levels as usize,
+        params.reduction,
+        params.max_error * extent,
+    );
+    let n_levels = levels.len();
+    let lods = std::slice::from_raw_parts_mut(lods, n_levels);
+    for (lod, level) in lods.iter_mut().zip(levels) {
+        let indices = level.indices.into_boxed_slice();
+        lod.n_indices = indices.len();
+        lod.error = level.error;
+        lod.indices = Box::into_raw(indices) as *const u16;
+    }
+    n_levels as u32
+}
+
+#[allow(non_snake_case)]
+#[no_mangle]
+pub unsafe extern "C" fn FreeLOD(lod: ObjLod) {
+    drop(Box::from_raw(std::ptr::slice_from_raw_parts_mut(lod.indices as *mut u16, lod.n_indices)));
 }
@@ -0,0 +1,455 @@
+//! Cache friendly reordering of triangle and vertex buffers.
+//!
+//! Triangles are reordered with Tipsify (Sander, Nehab, Barczak 2007), which fans around vertices that are
+//! still in a simulated FIFO post-transform cache. The fans naturally break the mesh into clusters wherever the
+//! algorithm has to restart from a vertex that is no longer cached; these clusters can then be sorted so outward
+//! facing ones are drawn first, which reduces overdraw without hurting cache efficiency.
+//!
+//! Vertices are then renumbered either in order of first use by the index buffer, which turns vertex fetches
+//! into a mostly linear stream, or along a Morton curve over their positions, which keeps spatially close
+//! vertices close in memory for ray tracing.
+
+use num_traits::{FromPrimitive, ToPrimitive};
+
+/// FIFO size used for statistics, matches the post-transform cache of most current GPUs.
+pub const DEFAULT_CACHE_SIZE: usize = 16;
+
+const FETCH_LINE_SIZE: usize = 64;
+/// Lines of the direct mapped cache simulated for vertex fetch statistics, 16 KiB in total.
+const FETCH_CACHE_LINES: usize = 256;
+const MORTON_BITS: u32 = 10;
+
+/// Order of the vertex buffer after optimization.
+#[derive(Copy, Clone, Debug, PartialEq)]
+pub enum VertexOrder {
+    /// Keep vertices where they are.
+    Unchanged,
+    /// Order in which the index buffer first references each vertex.
+    FirstUse,
+    /// Morton curve over quantized positions.
+    Morton,
+}
+
+/// Vertex cache and fetch efficiency of an index buffer.
+#[repr(C)]
+#[derive(Default, Copy, Clone, Debug, PartialEq)]
+pub struct MeshStats {
+    /// Average cache miss ratio, vertex shader invocations per triangle. 0.5 is the ideal for large meshes, 3
+    /// the worst case.
+    pub acmr: f32,
+    /// Average transform to vertex ratio, vertex shader invocations per unique vertex. 1 is ideal.
+    pub atvr: f32,
+    /// Bytes read from the vertex buffer per byte of vertex data. 1 is ideal.
+    pub overfetch: f32,
+}
+
+/// Simulates a FIFO post-transform cache of `cache_size` entries and a 16 KiB vertex fetch cache.
+pub fn analyze<I: ToPrimitive>(indices: &[I], n_vertices: usize, vertex_size: usize, cache_size: usize) -> MeshStats {
+    if indices.is_empty() || n_vertices == 0 {
+        return MeshStats::default();
+    }
+
+    let mut fifo = vec![usize::MAX; cache_size.max(1)];
+    let mut head = 0;
+    let mut in_cache = vec![false; n_vertices];
+    let mut lines = [usize::MAX; FETCH_CACHE_LINES];
+    let mut transformed = 0usize;
+    let mut fetched = 0usize;
+
+    for index in indices {
+        let v = index.to_usize().expect("index fits usize");
+        if in_cache[v] {
+            continue;
+        }
+        transformed += 1;
+        if fifo[head] != usize::MAX {
+            in_cache[fifo[head]] = false;
+        }
+        fifo[head] = v;
+        in_cache[v] = true;
+        head = (head + 1) % fifo.len();
+
+        let first = v * vertex_size / FETCH_LINE_SIZE;
+        let last = ((v + 1) * vertex_size - 1) / FETCH_LINE_SIZE;
+        for line in first..=last {
+            let slot = &mut lines[line % FETCH_CACHE_LINES];
+            if *slot != line {
+                *slot = line;
+                fetched += FETCH_LINE_SIZE;
+            }
+        }
+    }
+
+    MeshStats {
+        acmr: transformed as f32 / (indices.len() / 3) as f32,
+        atvr: transformed as f32 / n_vertices as f32,
+        overfetch: fetched as f32 / (n_vertices * vertex_size) as f32,
+    }
+}
+
+/// Vertex to triangle adjacency in compressed row form.
+struct Adjacency {
+    offsets: Vec<usize>,
+    triangles: Vec<usize>,
+}
+
+impl Adjacency {
+    fn new(indices: &[usize], n_vertices: usize) -> Self {
+        let mut offsets = vec![0; n_vertices + 1];
+        for &v in indices {
+            offsets[v + 1] += 1;
+        }
+        for v in 0..n_vertices {
+            offsets[v + 1] += offsets[v];
+        }
+        let mut cursor = offsets.clone();
+        let mut triangles = vec![0; indices.len()];
+        for (i, &v) in indices.iter().enumerate() {
+            triangles[cursor[v]] = i / 3;
+            cursor[v] += 1;
+        }
+        Adjacency { offsets, triangles }
+    }
+
+    fn of(&self, v: usize) -> &[usize] {
+        &self.triangles[self.offsets[v]..self.offsets[v + 1]]
+    }
+}
+
+/// Triangle order produced by `tipsify`, with the first triangle of every cluster.
+pub struct TriangleOrder {
+    pub triangles: Vec<usize>,
+    pub cluster_starts: Vec<usize>,
+}
+
+/// Orders triangles for a FIFO cache of `cache_size` entries.
+pub fn tipsify(indices: &[usize], n_vertices: usize, cache_size: usize) -> TriangleOrder {
+    let n_triangles = indices.len() / 3;
+    let adjacency = Adjacency::new(indices, n_vertices);
+    let mut live: Vec<usize> = (0..n_vertices).map(|v| adjacency.of(v).len()).collect();
+    let mut cache_time = vec![0usize; n_vertices];
+    let mut emitted = vec![false; n_triangles];
+    let mut dead_end = Vec::new();
+    let mut candidates = Vec::new();
+    let mut time = cache_size + 1;
+    let mut cursor = 0;
+
+    let mut order = TriangleOrder {
+        triangles: Vec::with_capacity(n_triangles),
+        cluster_starts: Vec::new(),
+    };
+    let mut fanning = (0..n_vertices).find(|&v| live[v] > 0);
+    let mut restarted = true;
+
+    while let Some(f) = fanning {
+        if restarted {
+            order.cluster_starts.push(order.triangles.len());
+        }
+        candidates.clear();
+        for &t in adjacency.of(f) {
+            if emitted[t] {
+                continue;
+            }
+            for &v in &indices[t * 3..t * 3 + 3] {
+                dead_end.push(v);
+                candidates.push(v);
+                live[v] -= 1;
+                if time - cache_time[v] > cache_size {
+                    cache_time[v] = time;
+                    time += 1;
+                }
+            }
+            emitted[t] = true;
+            order.triangles.push(t);
+        }
+
+        // Prefer the cached 1-ring vertex that stays in cache while its remaining fan is emitted.
+        let mut best = None;
+        let mut best_priority = None;
+        for &v in &candidates {
+            if live[v] == 0 {
+                continue;
+            }
+            let age = time - cache_time[v];
+            let priority = if age + 2 * live[v] <= cache_size { age } else { 0 };
+            if best_priority.map_or(true, |p| priority > p) {
+                best = Some(v);
+                best_priority = Some(priority);
+            }
+        }
+        restarted = best.is_none();
+        fanning = best.or_else(|| {
+            while let Some(v) = dead_end.pop() {
+                if live[v] > 0 {
+                    return Some(v);
+                }
+            }
+            while cursor < n_vertices && live[cursor] == 0 {
+                cursor += 1;
+            }
+            (cursor < n_vertices).then_some(cursor)
+        });
+    }
+    order
+}
+
+fn position_of(positions: &[[f32; 3]], indices: &[usize], t: usize) -> [[f32; 3]; 3] {
+    [
+        positions[indices[t * 3]],
+        positions[indices[t * 3 + 1]],
+        positions[indices[t * 3 + 2]],
+    ]
+}
+
+fn sub(a: [f32; 3], b: [f32; 3]) -> [f32; 3] {
+    [a[0] - b[0], a[1] - b[1], a[2] - b[2]]
+}
+
+fn cross(a: [f32; 3], b: [f32; 3]) -> [f32; 3] {
+    [a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]]
+}
+
+fn dot(a: [f32; 3], b: [f32; 3]) -> f32 {
+    a[0] * b[0] + a[1] * b[1] + a[2] * b[2]
+}
+
+/// Sorts the clusters of `order` so clusters facing away from the mesh centroid are drawn first.
+///
+/// This is the view independent overdraw sort of Nehab et al.: outward facing clusters are the ones most likely
+/// to occlude the rest of the mesh from any direction.
+pub fn sort_clusters(order: &mut TriangleOrder, indices: &[usize], positions: &[[f32; 3]]) {
+    let n_triangles = order.triangles.len();
+    let mut mesh_centroid = [0f32; 3];
+    let mut mesh_area = 0f32;
+    let mut clusters = Vec::with_capacity(order.cluster_starts.len());
+
+    for (c, &start) in order.cluster_starts.iter().enumerate() {
+        let end = order.cluster_starts.get(c + 1).copied().unwrap_or(n_triangles);
+        let mut centroid = [0f32; 3];
+        let mut normal = [0f32; 3];
+        let mut area = 0f32;
+        for &t in &order.triangles[start..end] {
+            let [a, b, c] = position_of(positions, indices, t);
+            let n = cross(sub(b, a), sub(c, a));
+            let weight = dot(n, n).sqrt();
+            for k in 0..3 {
+                centroid[k] += (a[k] + b[k] + c[k]) / 3.0 * weight;
+                normal[k] += n[k];
+            }
+            area += weight;
+        }
+        for k in 0..3 {
+            mesh_centroid[k] += centroid[k];
+        }
+        mesh_area += area;
+        clusters.push((start, end, centroid, area, normal));
+    }
+    if mesh_area > 0.0 {
+        mesh_centroid.iter_mut().for_each(|x| *x /= mesh_area);
+    }
+
+    let mut keyed: Vec<(f32, usize, usize)> = clusters
+        .into_iter()
+        .map(|(start, end, centroid, area, normal)| {
+            let length = dot(normal, normal).sqrt();
+            let key = if area > 0.0 && length > 0.0 {
+                let centroid = centroid.map(|x| x / area);
+                dot(sub(centroid, mesh_centroid), normal) / length
+            } else {
+                0.0
+            };
+            (key, start, end)
+        })
+        .collect();
+    keyed.sort_by(|a, b| b.0.total_cmp(&a.0));
+
+    let mut triangles = Vec::with_capacity(n_triangles);
+    let mut cluster_starts = Vec::with_capacity(keyed.len());
+    for (_, start, end) in keyed {
+        cluster_starts.push(triangles.len());
+        triangles.extend_from_slice(&order.triangles[start..end]);
+    }
+    *order = TriangleOrder { triangles, cluster_starts };
+}
+
+fn spread_bits(x: u32) -> u32 {
+    let mut x = x & 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    (x | (x << 2)) & 0x09249249
+}
+
+/// 30 bit Morton code of `p` quantized to 10 bits per axis within `[min, max]`.
+fn morton(p: [f32; 3], min: [f32; 3], max: [f32; 3]) -> u32 {
+    let scale = ((1 << MORTON_BITS) - 1) as f32;
+    let q = |k: usize| {
+        let extent = max[k] - min[k];
+        let t = if extent > 0.0 { (p[k] - min[k]) / extent } else { 0.0 };
+        (t.clamp(0.0, 1.0) * scale) as u32
+    };
+    spread_bits(q(0)) | (spread_bits(q(1)) << 1) | (spread_bits(q(2)) << 2)
+}
+
+/// Maps every old vertex index to its new position for `order`, unreferenced vertices go last.
+pub fn vertex_remap(indices: &[usize], positions: &[[f32; 3]], order: VertexOrder) -> Vec<usize> {
+    let n_vertices = positions.len();
+    match order {
+        VertexOrder::Unchanged => (0..n_vertices).collect(),
+        VertexOrder::FirstUse => {
+            let mut remap = vec![usize::MAX; n_vertices];
+            let mut next = 0;
+            for &v in indices {
+                if remap[v] == usize::MAX {
+                    remap[v] = next;
+                    next += 1;
+                }
+            }
+            for slot in remap.iter_mut().filter(|slot| **slot == usize::MAX) {
+                *slot = next;
+                next += 1;
+            }
+            remap
+        }
+        VertexOrder::Morton => {
+            let mut min = [f32::MAX; 3];
+            let mut max = [f32::MIN; 3];
+            for p in positions {
+                for k in 0..3 {
+                    min[k] = min[k].min(p[k]);
+                    max[k] = max[k].max(p[k]);
+                }
+            }
+            let mut sorted: Vec<(u32, usize)> = positions.iter().enumerate().map(|(v, &p)| (morton(p, min, max), v)).collect();
+            sorted.sort_unstable();
+            let mut remap = vec![0; n_vertices];
+            for (new, (_, old)) in sorted.into_iter().enumerate() {
+                remap[old] = new;
+            }
+            remap
+        }
+    }
+}
+
+/// Options of `optimize`.
+#[derive(Copy, Clone, Debug)]
+pub struct OptimizeOptions {
+    pub reorder_triangles: bool,
+    pub sort_clusters: bool,
+    pub vertex_order: VertexOrder,
+    pub cache_size: usize,
+}
+
+impl Default for OptimizeOptions {
+    fn default() -> Self {
+        OptimizeOptions {
+            reorder_triangles: true,
+            sort_clusters: true,
+            vertex_order: VertexOrder::FirstUse,
+            cache_size: DEFAULT_CACHE_SIZE,
+        }
+    }
+}
+
+/// Reorders `vertices` and `indices` in place, `position` extracts the position of a vertex.
+///
+/// @returns the number of clusters formed by triangle reordering.
+pub fn optimize<V: Copy, I: ToPrimitive + FromPrimitive + Copy>(
+    vertices: &mut [V],
+    indices: &mut [I],
+    position: impl Fn(&V) -> [f32; 3],
+    options: OptimizeOptions,
+) -> usize {
+    let positions: Vec<[f32; 3]> = vertices.iter().map(&position).collect();
+    let mut wide: Vec<usize> = indices.iter().map(|i| i.to_usize().expect("index fits usize")).collect();
+    let mut n_clusters = 0;
+
+    if options.reorder_triangles {
+        let mut order = tipsify(&wide, vertices.len(), options.cache_size);
+        if options.sort_clusters {
+            sort_clusters(&mut order, &wide, &positions);
+        }
+        n_clusters = order.cluster_starts.len();
+        wide = order.triangles.iter().flat_map(|&t| wide[t * 3..t * 3 + 3].to_vec()).collect();
+    }
+
+    if options.vertex_order != VertexOrder::Unchanged {
+        let remap = vertex_remap(&wide, &positions, options.vertex_order);
+        let original = vertices.to_vec();
+        for (old, vertex) in original.into_iter().enumerate() {
+            vertices[remap[old]] = vertex;
+        }
+        wide.iter_mut().for_each(|v| *v = remap[*v]);
+    }
+
+    for (index, &v) in indices.iter_mut().zip(&wide) {
+        *index = I::from_usize(v).expect("remapped index fits the index type");
+    }
+    n_clusters
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// `n` x `n` quad grid split into triangles, emitted column by column to defeat the cache.
+    fn grid(n: usize) -> (Vec<[f32; 3]>, Vec<u32>) {
+        let mut positions = Vec::new();
+        for y in 0..=n {
+            for x in 0..=n {
+                positions.push([x as f32, y as f32, 0.0]);
+            }
+        }
+        let mut indices = Vec::new();
+        for x in 0..n {
+            for y in 0..n {
+                let a = (y * (n + 1) + x) as u32;
+                let b = a + (n + 1) as u32;
+                indices.extend_from_slice(&[a, b, a + 1, a + 1, b, b + 1]);
+            }
+        }
+        (positions, indices)
+    }
+
+    fn sorted_triangles(positions: &[[f32; 3]], indices: &[u32]) -> Vec<[[i32; 3]; 3]> {
+        let mut triangles: Vec<[[i32; 3]; 3]> = indices
+            .chunks(3)
+            .map(|t| {
+                // Rotate so the smallest position comes first, winding is preserved.
+                let corners: Vec<[i32; 3]> = t.iter().map(|&v| positions[v as usize].map(|x| x as i32)).collect();
+                let first = (0..3).min_by_key(|&k| corners[k]).unwrap();
+                [corners[first], corners[(first + 1) % 3], corners[(first + 2) % 3]]
+            })
+            .collect();
+        triangles.sort();
+        triangles
+    }
+
+    #[test]
+    fn test_analyze_worst_case() {
+        let stats = analyze(&[0u32, 1, 2, 3, 4, 5], 6, 24, 16);
+        assert_eq!(stats.acmr, 3.0);
+        assert_eq!(stats.atvr, 1.0);
+    }
+
+    #[test]
+    fn test_optimize_preserves_mesh_and_improves_acmr() {
+        let (positions, indices) = grid(64);
+        let before = analyze(&indices, positions.len(), 24, DEFAULT_CACHE_SIZE);
+
+        for vertex_order in [VertexOrder::FirstUse, VertexOrder::Morton] {
+            let mut vertices = positions.clone();
+            let mut optimized = indices.clone();
+            let options = OptimizeOptions { vertex_order, ..Default::default() };
+            let n_clusters = optimize(&mut vertices, &mut optimized, |p| *p, options);
+            let after = analyze(&optimized, vertices.len(), 24, DEFAULT_CACHE_SIZE);
+
+            assert!(n_clusters > 0);
+            assert_eq!(sorted_triangles(&positions, &indices), sorted_triangles(&vertices, &optimized));
+            assert!(after.acmr < 0.8 * before.acmr, "{:?} -> {:?}", before, after);
+            if vertex_order == VertexOrder::FirstUse {
+                assert!(after.overfetch <= before.overfetch);
+            }
+        }
+    }
+}
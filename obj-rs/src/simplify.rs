@@ -0,0 +1,302 @@
+//! Level of detail generation by quadric error edge collapse (Garland, Heckbert 1997).
+//!
+//! Every vertex accumulates the area weighted plane quadrics of its triangles, the cost of moving a vertex onto a
+//! neighbour is the mean squared distance of the new position from those planes, normalized by their total area so
+//! its square root is a distance in mesh units whatever the size of the triangles. Only half edge collapses are
+//! performed, a vertex is always moved onto an existing vertex, so every level indexes the original vertex buffer
+//! and all levels of a mesh can share it.
+//!
+//! Vertices on open borders and on attribute seams (several vertices at the same position, e.g. split normals)
+//! never move, which keeps silhouettes and seams free of cracks.
+
+use std::collections::{HashMap, HashSet};
+
+use num_traits::{FromPrimitive, ToPrimitive};
+
+/// Symmetric 4x4 matrix, upper triangle in row major order, followed by the total area of its planes.
+type Quadric = [f64; 11];
+
+fn plane_quadric(p: [[f32; 3]; 3]) -> Quadric {
+    let e1 = [(p[1][0] - p[0][0]) as f64, (p[1][1] - p[0][1]) as f64, (p[1][2] - p[0][2]) as f64];
+    let e2 = [(p[2][0] - p[0][0]) as f64, (p[2][1] - p[0][1]) as f64, (p[2][2] - p[0][2]) as f64];
+    let n = [e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]];
+    let length = (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]).sqrt();
+    if length == 0.0 {
+        return [0.0; 11];
+    }
+    let (a, b, c) = (n[0] / length, n[1] / length, n[2] / length);
+    let d = -(a * p[0][0] as f64 + b * p[0][1] as f64 + c * p[0][2] as f64);
+    // Weighted by area so slivers do not dominate.
+    let w = length * 0.5;
+    [a * a * w, a * b * w, a * c * w, a * d * w, b * b * w, b * c * w, b * d * w, c * c * w, c * d * w, d * d * w, w]
+}
+
+fn add(q: &mut Quadric, r: &Quadric) {
+    q.iter_mut().zip(r).for_each(|(a, b)| *a += b);
+}
+
+/// Mean squared distance of `p` from the planes of `q`, weighted by their area.
+fn evaluate(q: &Quadric, p: [f32; 3]) -> f64 {
+    if q[10] == 0.0 {
+        return 0.0;
+    }
+    let (x, y, z) = (p[0] as f64, p[1] as f64, p[2] as f64);
+    let value = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+        + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+        + q[7] * z * z + 2.0 * q[8] * z
+        + q[9];
+    value.max(0.0) / q[10]
+}
+
+fn normal(p: [[f32; 3]; 3]) -> [f32; 3] {
+    let e1 = [p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]];
+    let e2 = [p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]];
+    [e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]]
+}
+
+fn dot(a: [f32; 3], b: [f32; 3]) -> f32 {
+    a[0] * b[0] + a[1] * b[1] + a[2] * b[2]
+}
+
+/// Vertices which must not move: seam vertices sharing their position and vertices on open borders.
+fn locked_vertices(positions: &[[f32; 3]], indices: &[usize]) -> Vec<bool> {
+    let mut at_position: HashMap<[u32; 3], usize> = HashMap::new();
+    for p in positions {
+        *at_position.entry([p[0].to_bits(), p[1].to_bits(), p[2].to_bits()]).or_default() += 1;
+    }
+    let mut locked: Vec<bool> = positions
+        .iter()
+        .map(|p| at_position[&[p[0].to_bits(), p[1].to_bits(), p[2].to_bits()]] > 1)
+        .collect();
+
+    let edges: HashSet<(usize, usize)> = indices
+        .chunks_exact(3)
+        .flat_map(|t| [(t[0], t[1]), (t[1], t[2]), (t[2], t[0])])
+        .collect();
+    for &(a, b) in &edges {
+        if !edges.contains(&(b, a)) {
+            locked[a] = true;
+            locked[b] = true;
+        }
+    }
+    locked
+}
+
+/// Triangles around every vertex in compressed row form.
+struct Adjacency {
+    offsets: Vec<usize>,
+    triangles: Vec<usize>,
+}
+
+impl Adjacency {
+    fn new(indices: &[usize], n_vertices: usize) -> Self {
+        let mut offsets = vec![0; n_vertices + 1];
+        indices.iter().for_each(|&v| offsets[v + 1] += 1);
+        (0..n_vertices).for_each(|v| offsets[v + 1] += offsets[v]);
+        let mut fill = offsets.clone();
+        let mut triangles = vec![0; indices.len()];
+        for (i, &v) in indices.iter().enumerate() {
+            triangles[fill[v]] = i / 3;
+            fill[v] += 1;
+        }
+        Adjacency { offsets, triangles }
+    }
+
+    fn of(&self, v: usize) -> &[usize] {
+        &self.triangles[self.offsets[v]..self.offsets[v + 1]]
+    }
+}
+
+/// Collapses edges of `indices` until at most `target_index_count` indices remain or every remaining collapse
+/// would move the surface further than `max_error`.
+///
+/// @returns the simplified index buffer and the largest distance any collapse moved the surface by, the root of
+/// the mean squared distance from the original planes around the collapsed vertex.
+pub fn simplify(
+    positions: &[[f32; 3]],
+    indices: &[usize],
+    target_index_count: usize,
+    max_error: f32,
+) -> (Vec<usize>, f32) {
+    let n_vertices = positions.len();
+    let locked = locked_vertices(positions, indices);
+    let mut quadrics = vec![[0.0; 11]; n_vertices];
+    for t in indices.chunks_exact(3) {
+        let q = plane_quadric([positions[t[0]], positions[t[1]], positions[t[2]]]);
+        t.iter().for_each(|&v| add(&mut quadrics[v], &q));
+    }
+
+    let max_cost = (max_error as f64) * (max_error as f64);
+    let mut result = indices.to_vec();
+    let mut error = 0.0f64;
+
+    while result.len() > target_index_count {
+        // Both directions of every edge, only unlocked vertices move.
+        let mut candidates: Vec<(f64, usize, usize)> = result
+            .chunks_exact(3)
+            .flat_map(|t| [(t[0], t[1]), (t[1], t[0]), (t[1], t[2]), (t[2], t[1]), (t[2], t[0]), (t[0], t[2])])
+            .filter(|&(from, _)| !locked[from])
+            .map(|(from, to)| {
+                let mut q = quadrics[from];
+                add(&mut q, &quadrics[to]);
+                (evaluate(&q, positions[to]), from, to)
+            })
+            .filter(|&(cost, _, _)| cost <= max_cost)
+            .collect();
+        candidates.sort_by(|a, b| a.0.total_cmp(&b.0));
+
+        // Every collapse changes the triangles around `from`, vertices of those are left alone until the next
+        // pass so flip checks always see current geometry.
+        let adjacency = Adjacency::new(&result, n_vertices);
+        let mut touched = vec![false; n_vertices];
+        let mut remap: Vec<usize> = (0..n_vertices).collect();
+        let mut n_removed = 0;
+        for (cost, from, to) in candidates {
+            if result.len() - n_removed <= target_index_count {
+                break;
+            }
+            if touched[from] || touched[to] {
+                continue;
+            }
+            let around = adjacency.of(from);
+            let flips = around.iter().any(|&t| {
+                let triangle = &result[t * 3..t * 3 + 3];
+                if triangle.contains(&to) {
+                    return false;
+                }
+                let before = [positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]];
+                let mut after = before;
+                triangle.iter().zip(after.iter_mut()).filter(|(&v, _)| v == from).for_each(|(_, p)| *p = positions[to]);
+                dot(normal(before), normal(after)) <= 0.0
+            });
+            if flips {
+                continue;
+            }
+
+            remap[from] = to;
+            let q = quadrics[from];
+            add(&mut quadrics[to], &q);
+            error = error.max(cost);
+            for &t in around {
+                result[t * 3..t * 3 + 3].iter().for_each(|&v| touched[v] = true);
+                if result[t * 3..t * 3 + 3].contains(&to) {
+                    n_removed += 3;
+                }
+            }
+        }
+        if n_removed == 0 {
+            break;
+        }
+
+        result = result
+            .chunks_exact(3)
+            .map(|t| [remap[t[0]], remap[t[1]], remap[t[2]]])
+            .filter(|t| t[0] != t[1] && t[1] != t[2] && t[2] != t[0])
+            .flatten()
+            .collect();
+    }
+    (result, error.sqrt() as f32)
+}
+
+/// One simplified level of a mesh.
+pub struct Level<I> {
+    pub indices: Vec<I>,
+    /// Largest distance the surface moved relative to the full resolution mesh.
+    pub error: f32,
+}
+
+/// Simplifies `indices` to `reduction`, `reduction^2`, ... of its triangles, up to `max_levels` levels.
+///
+/// Every level is simplified from the full resolution mesh so its error is measured against the original. The
+/// chain ends early once a level no longer removes at least a tenth of the triangles of the previous one.
+pub fn generate_lods<I: ToPrimitive + FromPrimitive + Copy>(
+    positions: &[[f32; 3]],
+    indices: &[I],
+    max_levels: usize,
+    reduction: f32,
+    max_error: f32,
+) -> Vec<Level<I>> {
+    let wide: Vec<usize> = indices.iter().map(|i| i.to_usize().expect("index fits usize")).collect();
+    let mut levels = Vec::new();
+    let mut previous = wide.len();
+    let mut ratio = 1.0;
+    for _ in 0..max_levels {
+        ratio *= reduction;
+        let target = (wide.len() / 3) as f32 * ratio;
+        let (simplified, error) = simplify(positions, &wide, target as usize * 3, max_error);
+        if simplified.is_empty() || simplified.len() as f32 > previous as f32 * 0.9 {
+            break;
+        }
+        previous = simplified.len();
+        levels.push(Level {
+            indices: simplified.iter().map(|&v| I::from_usize(v).expect("index fits the index type")).collect(),
+            error,
+        });
+    }
+    levels
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// `n` x `n` quad grid, flat or bent into a bump by `height`.
+    fn grid(n: usize, height: f32) -> (Vec<[f32; 3]>, Vec<usize>) {
+        let mut positions = Vec::new();
+        for y in 0..=n {
+            for x in 0..=n {
+                let (u, v) = (x as f32 / n as f32 - 0.5, y as f32 / n as f32 - 0.5);
+                positions.push([u, v, height * (1.0 - 4.0 * (u * u + v * v)).max(0.0)]);
+            }
+        }
+        let mut indices = Vec::new();
+        for y in 0..n {
+            for x in 0..n {
+                let a = y * (n + 1) + x;
+                let b = a + n + 1;
+                indices.extend([a, a + 1, b, a + 1, b + 1, b]);
+            }
+        }
+        (positions, indices)
+    }
+
+    #[test]
+    fn test_flat_grid_collapses_without_error() {
+        let (positions, indices) = grid(16, 0.0);
+        let (simplified, error) = simplify(&positions, &indices, 0, 1e-3);
+        // Only the locked border remains.
+        assert!(simplified.len() * 4 < indices.len(), "{} of {} indices left", simplified.len(), indices.len());
+        assert!(error < 1e-5);
+        let area = |indices: &[usize]| -> f32 {
+            indices.chunks_exact(3).map(|t| normal([positions[t[0]], positions[t[1]], positions[t[2]]])[2] * 0.5).sum()
+        };
+        assert!((area(&simplified) - area(&indices)).abs() < 1e-4);
+    }
+
+    #[test]
+    fn test_error_is_a_distance() {
+        let (positions, indices) = grid(16, 0.2);
+        let (simplified, error) = simplify(&positions, &indices, indices.len() / 4, 1.0);
+        // Scaling the mesh scales its error linearly, area weighting alone would scale it quadratically. A power of
+        // two keeps the scaled positions exact, so the same edges collapse.
+        let scaled: Vec<[f32; 3]> = positions.iter().map(|p| [p[0] * 8.0, p[1] * 8.0, p[2] * 8.0]).collect();
+        let (scaled_simplified, scaled_error) = simplify(&scaled, &indices, indices.len() / 4, 8.0);
+        assert_eq!(simplified, scaled_simplified);
+        assert!(error > 0.0 && (scaled_error / error - 8.0).abs() < 1e-3, "{} vs {}", scaled_error, error);
+        // No vertex of the bump moves further than its height.
+        assert!(error < 0.2);
+    }
+
+    #[test]
+    fn test_lod_chain_shrinks_and_errors_grow() {
+        let (positions, indices) = grid(32, 0.2);
+        let levels = generate_lods(&positions, &indices, 4, 0.5, 0.1);
+        assert!(levels.len() >= 2);
+        let mut previous = (indices.len(), 0.0);
+        for level in &levels {
+            assert!(level.indices.len() < previous.0);
+            assert!(level.error >= previous.1 && level.error <= 0.1);
+            previous = (level.indices.len(), level.error);
+        }
+    }
+}
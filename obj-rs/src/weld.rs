@@ -0,0 +1,251 @@
+//! Vertex welding for `FromRawVertex::process`.
+//!
+//! Polygon corners reference positions, normals and texture coordinates separately, every distinct combination
+//! becomes one output vertex. `Welder` dedupes those combinations with a pre-sized open addressing table keyed by
+//! a multiplicative hash, which is several times faster than a `HashMap` with SipHash and assigns indices in
+//! exactly the same first seen order.
+
+use crate::raw::object::Polygon;
+
+/// Corner key which can be hashed into a `Welder`.
+pub trait WeldKey: Copy + Eq {
+    fn hash(&self) -> u64;
+}
+
+const MULTIPLIER: u64 = 0x9E37_79B9_7F4A_7C15;
+
+impl WeldKey for (usize, usize) {
+    #[inline]
+    fn hash(&self) -> u64 {
+        (((self.0 as u64) << 32) ^ self.1 as u64).wrapping_mul(MULTIPLIER)
+    }
+}
+
+impl WeldKey for (usize, usize, usize) {
+    #[inline]
+    fn hash(&self) -> u64 {
+        let mixed = ((self.0 as u64) << 42) ^ ((self.1 as u64) << 21) ^ self.2 as u64;
+        (mixed ^ (self.0 as u64 >> 22)).wrapping_mul(MULTIPLIER)
+    }
+}
+
+/// Assigns consecutive indices to distinct keys in the order they are first inserted.
+pub struct Welder<K> {
+    /// Index + 1 of the key occupying each slot, 0 marks an empty slot.
+    slots: Vec<u32>,
+    keys: Vec<K>,
+    shift: u32,
+}
+
+impl<K: WeldKey> Welder<K> {
+    /// Creates a table which holds up to `n_corners` distinct keys without growing.
+    pub fn with_corners(n_corners: usize) -> Self {
+        // At most 80% load even when every corner is distinct.
+        let capacity = (n_corners + n_corners / 4).max(16).next_power_of_two();
+        Welder {
+            slots: vec![0; capacity],
+            keys: Vec::with_capacity(n_corners),
+            shift: 64 - capacity.trailing_zeros(),
+        }
+    }
+
+    /// @returns the index of `key` and whether it was inserted by this call.
+    #[inline]
+    pub fn insert(&mut self, key: K) -> (usize, bool) {
+        if self.keys.len() + self.keys.len() / 4 >= self.slots.len() {
+            self.grow();
+        }
+        let mask = self.slots.len() - 1;
+        let mut slot = (key.hash() >> self.shift) as usize;
+        loop {
+            match self.slots[slot] {
+                0 => {
+                    self.keys.push(key);
+                    self.slots[slot] = self.keys.len() as u32;
+                    return (self.keys.len() - 1, true);
+                }
+                occupant if self.keys[occupant as usize - 1] == key => return (occupant as usize - 1, false),
+                _ => slot = (slot + 1) & mask,
+            }
+        }
+    }
+
+    fn grow(&mut self) {
+        let capacity = self.slots.len() * 2;
+        self.shift -= 1;
+        self.slots = vec![0; capacity];
+        let mask = capacity - 1;
+        for (index, key) in self.keys.iter().enumerate() {
+            let mut slot = (key.hash() >> self.shift) as usize;
+            while self.slots[slot] != 0 {
+                slot = (slot + 1) & mask;
+            }
+            self.slots[slot] = index as u32 + 1;
+        }
+    }
+}
+
+/// Maps every position to the first position within `epsilon` of it, for scans with duplicated seams.
+///
+/// Positions are bucketed into a grid of `epsilon` sized cells so each lookup only compares against the 27
+/// neighbouring cells. Positions which end up merged are not necessarily all within `epsilon` of each other,
+/// each one is within `epsilon` of its representative.
+pub fn weld_positions(positions: &[(f32, f32, f32, f32)], epsilon: f32) -> Vec<usize> {
+    let cell = |x: f32| (x / epsilon).floor() as i64;
+    let cell_key = |x: i64, y: i64, z: i64| {
+        (((x as u64).wrapping_mul(73_856_093)) ^ ((y as u64).wrapping_mul(19_349_663)) ^ ((z as u64).wrapping_mul(83_492_791)))
+            .wrapping_mul(MULTIPLIER)
+    };
+    let epsilon2 = epsilon * epsilon;
+
+    // Representatives per cell, chained through `next`.
+    let capacity = (positions.len() + positions.len() / 4).max(16).next_power_of_two();
+    let shift = 64 - capacity.trailing_zeros();
+    let mut heads: Vec<(u64, usize)> = vec![(0, usize::MAX); capacity];
+    let mut next = vec![usize::MAX; positions.len()];
+    let mut remap = Vec::with_capacity(positions.len());
+
+    let find_head = |heads: &Vec<(u64, usize)>, key: u64| -> usize {
+        let mut slot = (key >> shift) as usize;
+        while heads[slot].1 != usize::MAX && heads[slot].0 != key {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slot
+    };
+
+    for (i, &(x, y, z, _)) in positions.iter().enumerate() {
+        let (cx, cy, cz) = (cell(x), cell(y), cell(z));
+        let mut representative = None;
+        'search: for dx in -1..=1 {
+            for dy in -1..=1 {
+                for dz in -1..=1 {
+                    let slot = find_head(&heads, cell_key(cx + dx, cy + dy, cz + dz));
+                    let mut candidate = heads[slot].1;
+                    while candidate != usize::MAX {
+                        let (px, py, pz, _) = positions[candidate];
+                        let d2 = (px - x) * (px - x) + (py - y) * (py - y) + (pz - z) * (pz - z);
+                        if d2 <= epsilon2 {
+                            representative = Some(candidate);
+                            break 'search;
+                        }
+                        candidate = next[candidate];
+                    }
+                }
+            }
+        }
+        match representative {
+            Some(r) => remap.push(r),
+            None => {
+                let key = cell_key(cx, cy, cz);
+                let slot = find_head(&heads, key);
+                next[i] = heads[slot].1;
+                heads[slot] = (key, i);
+                remap.push(i);
+            }
+        }
+    }
+    remap
+}
+
+/// Replaces position indices of `polygons` by `remap`.
+pub fn remap_positions(polygons: &mut [Polygon], remap: &[usize]) {
+    for polygon in polygons {
+        match polygon {
+            Polygon::P(ref mut vec) => vec.iter_mut().for_each(|pi| *pi = remap[*pi]),
+            Polygon::PT(ref mut vec) | Polygon::PN(ref mut vec) => vec.iter_mut().for_each(|c| c.0 = remap[c.0]),
+            Polygon::PTN(ref mut vec) => vec.iter_mut().for_each(|c| c.0 = remap[c.0]),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::hash_map::{Entry, HashMap};
+    use std::time::Instant;
+
+    /// Corners of an `n` x `n` grid with per face normals, like a flat shaded export.
+    fn grid_corners(n: usize) -> Vec<(usize, usize)> {
+        let mut corners = Vec::with_capacity(n * n * 6);
+        for y in 0..n {
+            for x in 0..n {
+                let a = y * (n + 1) + x;
+                let b = a + n + 1;
+                let normal = (x * 7 + y) % 64;
+                corners.extend([(a, normal), (b, normal), (a + 1, normal), (a + 1, normal), (b, normal), (b + 1, normal)]);
+            }
+        }
+        corners
+    }
+
+    fn weld_hash_map(corners: &[(usize, usize)]) -> Vec<usize> {
+        let mut cache = HashMap::new();
+        let mut next = 0;
+        corners
+            .iter()
+            .map(|&key| match cache.entry(key) {
+                Entry::Vacant(entry) => {
+                    entry.insert(next);
+                    next += 1;
+                    next - 1
+                }
+                Entry::Occupied(entry) => *entry.get(),
+            })
+            .collect()
+    }
+
+    fn weld_table(corners: &[(usize, usize)]) -> Vec<usize> {
+        let mut welder = Welder::with_corners(corners.len());
+        corners.iter().map(|&key| welder.insert(key).0).collect()
+    }
+
+    #[test]
+    fn test_welder_matches_hash_map() {
+        let corners = grid_corners(100);
+        assert_eq!(weld_table(&corners), weld_hash_map(&corners));
+
+        // Starting small exercises growing.
+        let mut welder = Welder::with_corners(0);
+        let indices: Vec<usize> = corners.iter().map(|&key| welder.insert(key).0).collect();
+        assert_eq!(indices, weld_hash_map(&corners));
+    }
+
+    #[test]
+    fn test_weld_positions() {
+        let positions = [
+            (0.0, 0.0, 0.0, 1.0),
+            (1.0, 0.0, 0.0, 1.0),
+            (1.0 + 1e-6, 0.0, 0.0, 1.0),
+            (0.0, 1e-6, -1e-6, 1.0),
+            (0.0, 0.5, 0.0, 1.0),
+        ];
+        assert_eq!(weld_positions(&positions, 1e-4), vec![0, 1, 1, 0, 4]);
+        assert_eq!(weld_positions(&positions, 1e-9), vec![0, 1, 2, 3, 4]);
+    }
+
+    /// `cargo test --release -- --ignored --nocapture bench_weld`
+    #[test]
+    #[ignore]
+    fn bench_weld() {
+        for n_triangles in [10_000, 100_000, 1_000_000, 10_000_000] {
+            let n = ((n_triangles / 2) as f64).sqrt() as usize;
+            let corners = grid_corners(n);
+
+            let start = Instant::now();
+            let reference = weld_hash_map(&corners);
+            let hash_map = start.elapsed();
+            let start = Instant::now();
+            let welded = weld_table(&corners);
+            let table = start.elapsed();
+            assert_eq!(welded, reference);
+
+            println!(
+                "{:>9} triangles | HashMap {:>9.3} ms | open addressing {:>9.3} ms | {:.2}x",
+                corners.len() / 3,
+                hash_map.as_secs_f64() * 1e3,
+                table.as_secs_f64() * 1e3,
+                hash_map.as_secs_f64() / table.as_secs_f64()
+            );
+        }
+    }
+}
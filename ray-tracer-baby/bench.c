@@ -0,0 +1,2055 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/resource.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <embree3/rtcore.h>
+#include <cglm/cglm.h>
+#include <cmm/cmm.h>
+
+#include "renderer.h"
+#include "ray_tracing.h"
+#include "render_job.h"
+#include "scene.h"
+#include "obj.h"
+#include "arena.h"
+#include "denoise.h"
+#include "visibility.h"
+#include "lights.h"
+#include "radiance_cache.h"
+#include "render_context.h"
+#include "paged_mesh.h"
+#include "accel_scene.h"
+#include "animation.h"
+#include "profiler.h"
+
+/*
+ * Renders a fixed set of scenes at several thread counts and reports throughput as JSON.
+ *
+ * Every result is written on its own line so `--compare` can read a previous run back with `sscanf`.
+ *
+ * With `--denoise-report` the throughput runs are skipped. Instead the first scene is rendered once at
+ * `--reference-spp` and then at increasing sample counts, reporting PSNR against the reference before and after
+ * denoising.
+ *
+ * With `--mesh-report` every scene is rendered once per mesh layout of `MeshLayouts`, reporting vertex cache
+ * statistics together with BVH build and render times. There is no GL context here, so raster cost is reported as
+ * the vertex shader invocations the simulated post-transform cache predicts for one draw of every instance.
+ *
+ * With `--visibility-report` every scene's camera rays are resolved both ways, by `IntersectRays` and by
+ * `RasterizeVisibility`, single threaded and with the last thread count. It reports the time of each, the share of
+ * pixels whose first hit agrees, and the frame time with and without the visibility buffer.
+ *
+ * With `--light-report` `LIGHT_REPORT_LIGHTS` lights are scattered through the first scene, which is rendered once
+ * at `--reference-spp` and then at increasing sample counts with uniform and light tree selection, reporting render
+ * time and PSNR against the reference. Paths stop after one bounce so light selection dominates the noise. Building
+ * the tree, refitting it after small moves and updating it after the lights were scattered anew are timed too.
+ *
+ * With `--radiance-cache-report` the first scene is rendered once at `--reference-spp` without the radiance cache and
+ * then at increasing sample counts by brute force, with a cache started empty for the frame and with one kept over
+ * `RADIANCE_REPORT_WARMUP_FRAMES` earlier frames, at both cache depths. It reports render time, rays traced, PSNR
+ * against the reference and the relative error of the mean image radiance, the bias the cache trades noise for.
+ *
+ * With `--context-report` every scene gets a `RenderContext`, all of them instancing meshes loaded once and sharing
+ * a pool of the last thread count. Each is rendered alone, then all at once from a thread per context. It reports
+ * both times and whether the concurrent frames came out identical to the ones rendered alone.
+ *
+ * With `--paging-report` the high poly mesh is baked as a `PAGING_REPORT_GRID` square grid into a paged mesh and
+ * rendered out of core with the last thread count, under budgets of a shrinking share of its pages, with rays
+ * traced in queue order and sorted by cluster. Every frame starts cold, with the file dropped from the page cache.
+ * It reports the resident cap, cluster page ins and evictions per thousand rays, the process' page faults, its
+ * resident set after the frame and whether the image matches the unlimited one.
+ *
+ * With `--backend-report` every scene is traced by Embree and by `Accel`, our own BVH built over the instances baked
+ * into world space. It reports the build time of each, single threaded camera ray time, whole frames with the last
+ * thread count, the share of pixels whose first hit agrees between the two and how far apart the rendered radiance
+ * is: the sum of absolute differences relative to the sum of Embree's, and whether the images are identical.
+ *
+ * With `--preview-report` every scene is rendered with the last thread count by the path tracer and by every preview
+ * integrator of `PreviewIntegrators`, reporting the frame time, rays traced and the speedup over the path tracer.
+ *
+ * With `--animation-report` a `ANIMATION_REPORT_GRID` square grid of spheres, keyframed to drift and spin, is
+ * rendered for `ANIMATION_REPORT_FRAMES` frames with the last thread count. Once serially, building a fresh instance
+ * scene before tracing every frame, and once by an `AnimationRenderer` committing the next frame while the current one
+ * traces. It reports the mean build, trace, stall and frame time of each and whether the last frames are identical.
+ *
+ * With `--threading-report` every scene is set up and rendered for `THREADING_REPORT_FRAMES` frames with the last
+ * thread count per mode of `ThreadingModes`: by threads started for every frame next to Embree's own build threads,
+ * and by the pool of a `RenderShared` unpinned, pinned and pinned with scenes replicated per NUMA node. It reports
+ * the setup time, the mean frame time, rays per second and whether the pool frames are identical.
+ *
+ * usage: ray-tracer-baby-bench [--threads 1,2,4,8] [--spp N] [--size N] [--out FILE] [--compare FILE] [--threshold PCT]
+ *                              [--denoise-report] [--reference-spp N] [--mesh-report]
+ *                              [--visibility-report] [--light-report] [--radiance-cache-report] [--context-report]
+ *                              [--paging-report] [--backend-report] [--preview-report] [--animation-report]
+ *                              [--threading-report]
+ */
+
+#define MAX_THREAD_COUNTS 16
+#define MAX_RESULTS 128
+#define HIGH_POLY_PATH "./target/bench-highpoly.obj"
+#define HIGH_POLY_RINGS 128
+#define HIGH_POLY_SEGMENTS 255
+#define MAX_DENOISE_RESULTS 16
+#define MAX_MESH_RESULTS 32
+/// Timed repetitions of every step of `--visibility-report`, the fastest counts.
+#define VISIBILITY_REPETITIONS 5
+#define LIGHT_REPORT_LIGHTS 10000
+#define LIGHT_REPORT_POWER 40.f
+#define MAX_RADIANCE_CACHE_RESULTS 16
+#define RADIANCE_REPORT_CAPACITY ((usize)1 << 20)
+#define RADIANCE_REPORT_CELL 0.05f
+/// Frames rendered into a persistent cache before the measured one.
+#define RADIANCE_REPORT_WARMUP_FRAMES 4
+#define PAGED_MESH_PATH "./target/bench-paged.bin"
+#define PAGING_REPORT_GRID 10
+/// 316^2 = 99,856, about 100k instances.
+#define ANIMATION_REPORT_GRID 316
+#define ANIMATION_REPORT_FRAMES 8
+#define THREADING_REPORT_FRAMES 4
+
+typedef struct {
+    const char* name;
+    const char* objPath;
+    /// Instances are laid out by `SceneNxN`, 0 places a single mesh in front of the camera.
+    usize gridSize;
+} BenchScene;
+
+internal const BenchScene BenchScenes[] = {
+    { .name = "grid",           .objPath = "../scenes/sphere.obj", .gridSize = 3   },
+    { .name = "sphere",         .objPath = "../scenes/sphere.obj", .gridSize = 0   },
+    { .name = "highpoly",       .objPath = HIGH_POLY_PATH,         .gridSize = 0   },
+    { .name = "many-instances", .objPath = "../scenes/sphere.obj", .gridSize = 100 },
+};
+
+typedef struct {
+    char scene[64];
+    usize threads;
+    f64 primaryRaysPerSec;
+    f64 totalRaysPerSec;
+    /// Time spent in `IntersectRays` per ray, generating and shading rays is not included.
+    f64 nsPerIntersection;
+    f64 parseMs;
+    f64 buildMs;
+    f64 renderMs;
+    /// Resident set high water mark while loading the scene and rendering at this thread count, above the resident
+    /// set before the scene was loaded. Where the kernel can not reset the high water mark it is the process wide
+    /// peak instead, rising monotonically over the run.
+    usize peakRssKb;
+} BenchResult;
+
+typedef struct {
+    usize spp;
+    f64 renderMs;
+    f64 denoiseMs;
+    f64 psnrNoisy;
+    f64 psnrDenoised;
+} DenoiseResult;
+
+typedef struct {
+    char scene[64];
+    const char* layout;
+    MeshStats stats;
+    u32 nClusters;
+    f64 optimizeMs;
+    f64 buildMs;
+    f64 renderMs;
+    /// Vertex shader invocations to draw every instance once.
+    f64 rasterVertices;
+} MeshResult;
+
+typedef struct {
+    char scene[64];
+    usize nTriangles;
+    usize threads;
+    /// Camera rays of one frame through `IntersectRays` on a single thread.
+    f64 traceMs;
+    f64 rasterMs;
+    /// `RasterizeVisibility` with `threads` threads.
+    f64 rasterThreadsMs;
+    /// Pixels with the same first hit both ways, ties between triangles sharing an edge make up most of the rest.
+    f64 agreement;
+    /// Whole frames with `threads` workers.
+    f64 renderMs;
+    f64 renderVisibilityMs;
+} VisibilityResult;
+
+typedef struct {
+    const char* selection;
+    usize spp;
+    f64 renderMs;
+    f64 psnr;
+} LightResult;
+
+typedef struct {
+    f64 buildMs;
+    /// `UpdateLightTree` after moving every light a little, which refits.
+    f64 refitMs;
+    /// `UpdateLightTree` after scattering the lights anew, which rebuilds unless `rebuilt` says otherwise.
+    f64 updateMs;
+    bool rebuilt;
+    LightResult results[MAX_DENOISE_RESULTS];
+    usize nResults;
+} LightReport;
+
+typedef struct {
+    /// "brute-force", "cache" for a cache started empty or "persistent" for one kept from earlier frames.
+    const char* mode;
+    /// Bounces before paths end in the cache, 0 for brute force.
+    u32 depth;
+    usize spp;
+    f64 renderMs;
+    usize nRays;
+    f64 psnr;
+    /// Mean radiance of the image over that of the reference, minus one.
+    f64 bias;
+    usize nRecords;
+} RadianceCacheResult;
+
+typedef struct {
+    char scene[64];
+    usize nInstances;
+    /// The context's frame rendered with the pool to itself.
+    f64 aloneMs;
+    /// The same frame while every context renders at once.
+    f64 concurrentMs;
+    bool identical;
+} ContextResult;
+
+typedef struct {
+    char scene[64];
+    usize nTriangles;
+    usize threads;
+    /// Embree's BLAS and TLAS against baking the instances and building the accel.
+    f64 embreeBuildMs;
+    f64 accelBuildMs;
+    u32 accelNodes;
+    u32 accelDepth;
+    /// Camera rays of one frame through `IntersectRays` on a single thread.
+    f64 embreeTraceMs;
+    f64 accelTraceMs;
+    /// Whole frames with `threads` workers.
+    f64 embreeRenderMs;
+    f64 accelRenderMs;
+    f64 agreement;
+    /// Sum of absolute radiance differences over the sum of Embree's radiance.
+    f64 radianceError;
+    bool identical;
+} BackendResult;
+
+typedef struct {
+    char scene[64];
+    const char* integrator;
+    usize threads;
+    f64 renderMs;
+    usize nRays;
+    /// Frame time of the path tracer over this one.
+    f64 speedup;
+} PreviewResult;
+
+typedef struct {
+    const char* name;
+    /// NULL keeps the file order.
+    const MeshOptimizeParams* params;
+} MeshLayout;
+
+internal const MeshOptimizeParams FirstUseLayout = MESH_OPTIMIZE_DEFAULTS;
+internal const MeshOptimizeParams MortonLayout = {
+    .reorderTriangles = true,
+    .sortClusters = true,
+    .vertexOrder = VertexOrderMorton,
+    .cacheSize = 0,
+};
+
+/// Mesh layouts compared by `--mesh-report`.
+internal const MeshLayout MeshLayouts[] = {
+    { .name = "file",      .params = NULL            },
+    { .name = "first-use", .params = &FirstUseLayout },
+    { .name = "morton",    .params = &MortonLayout   },
+};
+
+/// Sample counts compared against the reference by `--denoise-report`.
+internal const usize DenoiseSampleCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+/// Sample counts compared against the reference by `--light-report`, once per selection.
+internal const usize LightSampleCounts[] = { 1, 4, 16, 64 };
+
+/// Sample counts compared against the reference by `--radiance-cache-report`, once per mode.
+internal const usize RadianceCacheSampleCounts[] = { 1, 4, 16 };
+
+/// Shares of the paged mesh's pages `--paging-report` allows to be resident, once traced in queue order and once
+/// sorted by cluster.
+internal const f64 PagingBudgetShares[] = { 1.0, 0.25, 0.0625, 0.015625 };
+
+typedef struct {
+    const char* name;
+    enum Integrator integrator;
+} PreviewIntegrator;
+
+typedef struct {
+    const char* mode;
+    usize nInstances;
+    usize nFrames;
+    usize threads;
+    /// Means per frame.
+    f64 buildMs;
+    f64 traceMs;
+    f64 stallMs;
+    f64 frameMs;
+    bool identical;
+} AnimationResult;
+
+typedef struct {
+    const char* name;
+    /// `NULL` for threads started per frame on a device with Embree's own build threads.
+    const RenderSharedConfig* config;
+} ThreadingMode;
+
+internal const RenderSharedConfig PinnedWorkers = { .pinWorkers = true, .replicatePerNode = false };
+internal const RenderSharedConfig ReplicatedWorkers = { .pinWorkers = true, .replicatePerNode = true };
+internal const RenderSharedConfig UnpinnedWorkers = { .pinWorkers = false, .replicatePerNode = false };
+
+/// Threading setups compared by `--threading-report`, the unpinned pool second as the reference image of the others.
+internal const ThreadingMode ThreadingModes[] = {
+    { .name = "threads",    .config = NULL               },
+    { .name = "pool",       .config = &UnpinnedWorkers   },
+    { .name = "pinned",     .config = &PinnedWorkers     },
+    { .name = "replicated", .config = &ReplicatedWorkers },
+};
+
+typedef struct {
+    char scene[64];
+    const char* mode;
+    usize threads;
+    usize nReplicas;
+    /// Parsing the mesh and building its BVH and the instance scene.
+    f64 setupMs;
+    /// Means per frame.
+    f64 renderMs;
+    f64 raysPerSec;
+    /// The frame equals the one of the unpinned pool, bands of the threads mode are cut differently.
+    bool identical;
+} ThreadingResult;
+
+/// Integrators compared by `--preview-report`, the path tracer first as the baseline.
+internal const PreviewIntegrator PreviewIntegrators[] = {
+    { .name = "path",   .integrator = IntegratorPath             },
+    { .name = "albedo", .integrator = IntegratorAlbedo           },
+    { .name = "normal", .integrator = IntegratorNormal           },
+    { .name = "depth",  .integrator = IntegratorDepth            },
+    { .name = "ao",     .integrator = IntegratorAmbientOcclusion },
+    { .name = "direct", .integrator = IntegratorDirect           },
+};
+
+/// Shadow rays per sample and their length for the ambient occlusion of `--preview-report`.
+#define PREVIEW_AO_SAMPLES 16
+#define PREVIEW_AO_DISTANCE 1.f
+
+/// Everything `RunScene` and `RunDenoiseReport` need to render one of `BenchScenes`.
+typedef struct {
+    Obj obj;
+    Instances instances;
+    Arena geometryArena;
+    RTCScene meshScene;
+    RTCScene instanceScene;
+    RayTracer rt;
+    f64 parseMs;
+    f64 buildMs;
+    MeshOptimizeReport optimizeReport;
+} LoadedScene;
+
+internal struct {
+    usize threadCounts[MAX_THREAD_COUNTS];
+    usize nThreadCounts;
+    usize spp;
+    usize size;
+    usize maxReflections;
+    const char* outPath;
+    const char* comparePath;
+    f64 threshold;
+    bool denoiseReport;
+    usize referenceSpp;
+    bool meshReport;
+    bool visibilityReport;
+    bool lightReport;
+    bool radianceCacheReport;
+    bool contextReport;
+    bool pagingReport;
+    bool backendReport;
+    bool previewReport;
+    bool animationReport;
+    bool threadingReport;
+} BenchConfig = {
+    .threadCounts = { 1, 2, 4, 8 },
+    .nThreadCounts = 4,
+    .spp = 4,
+    .size = 256,
+    .maxReflections = 15,
+    .outPath = NULL,
+    .comparePath = NULL,
+    .threshold = 5.0,
+    .denoiseReport = false,
+    .referenceSpp = 256,
+    .meshReport = false,
+    .visibilityReport = false,
+    .lightReport = false,
+    .radianceCacheReport = false,
+    .contextReport = false,
+    .pagingReport = false,
+    .backendReport = false,
+    .previewReport = false,
+    .animationReport = false,
+    .threadingReport = false,
+};
+
+internal BenchResult Results[MAX_RESULTS];
+internal BenchResult Baseline[MAX_RESULTS];
+
+internal f32 Palette[4][3] = {
+    { 0.82f, 0.51f, 0.35f },
+    { 1.00f, 0.67f, 0.37f },
+    { 0.55f, 0.41f, 0.48f },
+    { 1.00f, 0.83f, 0.64f },
+};
+
+/// @returns the `field` line of `/proc/self/status` in KiB, 0 when it can not be read.
+internal usize ReadStatusKb(const char* const field) {
+    FILE* const file = fopen("/proc/self/status", "r");
+    if (file == NULL) return 0;
+    const usize fieldLen = strlen(field);
+    char line[256];
+    usize kb = 0;
+    while (fgets(line, sizeof line, file) != NULL) {
+        if (strncmp(line, field, fieldLen) == 0 && line[fieldLen] == ':') {
+            kb = strtoull(&line[fieldLen + 1], NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+/// Lowers the resident set high water mark to the current resident set, so `PeakRssKb` covers only what follows.
+///
+/// @returns false when the kernel does not allow it, `PeakRssKb` then keeps the peak of the whole process.
+internal bool ResetPeakRss(void) {
+    FILE* const file = fopen("/proc/self/clear_refs", "w");
+    if (file == NULL) return false;
+    const bool written = fputs("5", file) >= 0;
+    return 0 == fclose(file) && written;
+}
+
+/// Resident set of the process from `/proc/self/statm`, 0 where there is none.
+internal usize CurrentRssKb(void) {
+    FILE* const file = fopen("/proc/self/statm", "r");
+    if (file == NULL) return 0;
+    unsigned long size = 0, resident = 0;
+    const bool read = fscanf(file, "%lu %lu", &size, &resident) == 2;
+    fclose(file);
+    return read ? (usize)resident * (usize)sysconf(_SC_PAGESIZE) / 1024 : 0;
+}
+
+/// Resident set high water mark of the process, see `ResetPeakRss`.
+internal usize PeakRssKb(void) {
+    const usize peakKb = ReadStatusKb("VmHWM");
+    if (peakKb != 0) return peakKb;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usize)usage.ru_maxrss;
+}
+
+/// Writes a deterministic UV sphere just under the 16-bit index limit of `Obj`.
+internal void WriteHighPolyObj(const char* const path) {
+    FILE* const file = fopen(path, "w");
+    if (file == NULL) PANIC("Failed to create %s", path);
+
+    for (usize ring = 0; ring <= HIGH_POLY_RINGS; ring++) {
+        const f64 theta = M_PI * (f64)ring / HIGH_POLY_RINGS;
+        for (usize segment = 0; segment <= HIGH_POLY_SEGMENTS; segment++) {
+            const f64 phi = 2.0 * M_PI * (f64)segment / HIGH_POLY_SEGMENTS;
+            const f64 x = sin(theta) * cos(phi);
+            const f64 y = cos(theta);
+            const f64 z = sin(theta) * sin(phi);
+            fprintf(file, "v %f %f %f\nvn %f %f %f\n", x, y, z, x, y, z);
+        }
+    }
+    const usize stride = HIGH_POLY_SEGMENTS + 1;
+    for (usize ring = 0; ring < HIGH_POLY_RINGS; ring++) {
+        for (usize segment = 0; segment < HIGH_POLY_SEGMENTS; segment++) {
+            const usize a = ring * stride + segment + 1;
+            const usize b = a + stride;
+            fprintf(file, "f %zu//%zu %zu//%zu %zu//%zu\n", a, a, b, b, a + 1, a + 1);
+            fprintf(file, "f %zu//%zu %zu//%zu %zu//%zu\n", a + 1, a + 1, b, b, b + 1, b + 1);
+        }
+    }
+    fclose(file);
+}
+
+internal Instances CreateBenchInstances(const BenchScene* const scene) {
+    if (scene->gridSize > 0) {
+        Instances instances = AllocateArray(Instance, scene->gridSize * scene->gridSize);
+        SceneNxN(instances, scene->gridSize);
+        return instances;
+    }
+    Instances instances = AllocateArray(Instance, 1);
+    Transform transform = {
+        .translation = { 0.f, 0.f, -1.5f },
+        .rotation = { 0.f, 0.f, 0.f },
+        .scale = { 1.f, 1.f, 1.f },
+    };
+    const MaterialRaster material = { .albedo = { 1.f, 1.f, 1.f }, .matte = 0.8f };
+    CreateInstance(&transform, &material, &instances.data[0]);
+    return instances;
+}
+
+/// Loads `scene`, reordering its mesh with `optimize` unless NULL.
+internal LoadedScene LoadBenchScene(const RTCDevice device, const BenchScene* const scene, const MeshOptimizeParams* const optimize) {
+    LoadedScene loaded;
+    const f64 parseStart = NowSeconds();
+    LoadOBJ(scene->objPath, &loaded.obj);
+    loaded.parseMs = (NowSeconds() - parseStart) * 1e3;
+
+    loaded.optimizeReport = (MeshOptimizeReport) { .nClusters = 0, .optimizeNs = 0 };
+    if (optimize != NULL) {
+        OptimizeOBJ(&loaded.obj, *optimize, &loaded.optimizeReport);
+    } else {
+        AnalyzeOBJ(&loaded.obj, 0, &loaded.optimizeReport.before);
+        loaded.optimizeReport.after = loaded.optimizeReport.before;
+    }
+
+    loaded.instances = CreateBenchInstances(scene);
+
+    loaded.geometryArena = CreateArena(MeshSceneArenaSize(&loaded.obj));
+    const f64 buildStart = NowSeconds();
+    loaded.meshScene = CreateMeshScene(device, &loaded.obj, &loaded.geometryArena);
+    loaded.instanceScene = CreateInstanceScene(device, loaded.meshScene, loaded.instances);
+    loaded.buildMs = (NowSeconds() - buildStart) * 1e3;
+
+    loaded.rt = (RayTracer) {
+        .materials = AllocateArray(Material, loaded.instances.len),
+        .nMaxReflections = BenchConfig.maxReflections,
+        .nRaysPerSample = BenchConfig.spp,
+        .rtcScene = loaded.instanceScene,
+        .skyColor = { 0.5f, 0.7f, 1.0f },
+    };
+    for (usize i = 0; i < loaded.instances.len; i++) {
+        CreateLambertian(&loaded.rt.materials.data[i], Palette[i % ARRAY_LENGTH(Palette)], 0.8f);
+    }
+    return loaded;
+}
+
+internal void DropBenchScene(LoadedScene* const loaded) {
+    FreeArray(loaded->rt.materials);
+    FreeArray(loaded->instances);
+    rtcReleaseScene(loaded->instanceScene);
+    rtcReleaseScene(loaded->meshScene);
+    DropArena(&loaded->geometryArena);
+    FreeOBJ(loaded->obj);
+}
+
+/// Renders a single frame with `nThreads` workers.
+internal RayStats RenderFrame(RayTracer* const rt, const Buffer2d framebuffer, const Aovs aovs, const usize nThreads) {
+    const Tasks tasks = {
+        .pTasks = AllocatePTasks(nThreads),
+        .sTasks = (Array(STask)) { .len = 0 },
+    };
+    Display display;
+    InitializeDisplay(&display, tasks);
+    const Array(Arena) workerArenas = CreateWorkerArenas(nThreads);
+
+    const RayStats stats = JoinRenderJobs(StartRenderJobs(rt, framebuffer, aovs, &display, workerArenas));
+
+    DropWorkerArenas(workerArenas);
+    DropDisplay(&display);
+    FreeArray(tasks.pTasks);
+    return stats;
+}
+
+internal void RunScene(const RTCDevice device, const BenchScene* const scene, BenchResult* const results, usize* const nResults) {
+    // Earlier scenes must not count towards the peak of this one, see `BenchResult::peakRssKb`.
+    const bool resetPeak = ResetPeakRss();
+    const usize baseRssKb = CurrentRssKb();
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+
+    const usize size = BenchConfig.size;
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+    const usize loadPeakKb = PeakRssKb();
+
+    for (usize i = 0; i < BenchConfig.nThreadCounts; i++) {
+        const usize nThreads = BenchConfig.threadCounts[i];
+
+        if (resetPeak) ResetPeakRss();
+        const f64 renderStart = NowSeconds();
+        const RayStats stats = RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+        const f64 renderSec = NowSeconds() - renderStart;
+        const usize renderPeakKb = PeakRssKb();
+        const usize peakKb = renderPeakKb > loadPeakKb ? renderPeakKb : loadPeakKb;
+
+        if (*nResults == MAX_RESULTS) PANICM("Too many benchmark results");
+        BenchResult* const result = &results[(*nResults)++];
+        snprintf(result->scene, sizeof result->scene, "%s", scene->name);
+        result->threads = nThreads;
+        result->primaryRaysPerSec = (f64)stats.nPrimaryRays / renderSec;
+        result->totalRaysPerSec = (f64)stats.nRays / renderSec;
+        // Summed over the workers, so this is the time a single thread spends per intersection.
+        result->nsPerIntersection = stats.intersectSec * 1e9 / (f64)stats.nRays;
+        result->parseMs = loaded.parseMs;
+        result->buildMs = loaded.buildMs;
+        result->renderMs = renderSec * 1e3;
+        result->peakRssKb = peakKb > baseRssKb ? peakKb - baseRssKb : 0;
+
+        fprintf(
+            stderr,
+            "%-16s threads %2zu | %8.3f Mrays/s primary | %8.3f Mrays/s total | %7.1f ns/isect\n",
+            result->scene,
+            result->threads,
+            result->primaryRaysPerSec * 1e-6,
+            result->totalRaysPerSec * 1e-6,
+            result->nsPerIntersection
+        );
+    }
+
+    DropArena(&frameArena);
+    DropBenchScene(&loaded);
+}
+
+/// @returns number of sample counts measured.
+internal usize RunDenoiseReport(const RTCDevice device, const BenchScene* const scene, DenoiseResult* const results) {
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    Arena frameArena = CreateArena(size * size * (sizeof(Rgb256) + sizeof(vec3)) + 2 * AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs reference = CreateAovs(&frameArena, size, size);
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+    vec3* const denoised = ArenaPush(&frameArena, size * size * sizeof(vec3), _Alignof(vec3));
+    Arena denoiseArena = CreateArena(DenoiseArenaSize(size, size));
+
+    loaded.rt.nRaysPerSample = BenchConfig.referenceSpp;
+    RenderFrame(&loaded.rt, framebuffer, reference, nThreads);
+
+    const DenoiseParams params = DENOISE_DEFAULTS;
+    WorkerPool pool;
+    CreateWorkerPool(&pool, nThreads);
+
+    usize nResults = 0;
+    for (usize i = 0; i < ARRAY_LENGTH(DenoiseSampleCounts) && DenoiseSampleCounts[i] < BenchConfig.referenceSpp; i++) {
+        DenoiseResult* const result = &results[nResults++];
+        result->spp = DenoiseSampleCounts[i];
+        loaded.rt.nRaysPerSample = result->spp;
+
+        const f64 renderStart = NowSeconds();
+        RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+        result->renderMs = (NowSeconds() - renderStart) * 1e3;
+
+        ResetArena(&denoiseArena);
+        const f64 denoiseStart = NowSeconds();
+        Denoise(&aovs, params, &pool, &denoiseArena, denoised);
+        result->denoiseMs = (NowSeconds() - denoiseStart) * 1e3;
+
+        result->psnrNoisy = Psnr(aovs.color, reference.color, size * size);
+        result->psnrDenoised = Psnr(denoised, reference.color, size * size);
+        fprintf(
+            stderr,
+            "%-16s spp %3zu | %6.2f dB noisy | %6.2f dB denoised | %8.1f ms render | %6.1f ms denoise\n",
+            scene->name,
+            result->spp,
+            result->psnrNoisy,
+            result->psnrDenoised,
+            result->renderMs,
+            result->denoiseMs
+        );
+    }
+
+    DestroyWorkerPool(&pool);
+    DropArena(&denoiseArena);
+    DropArena(&frameArena);
+    DropBenchScene(&loaded);
+    return nResults;
+}
+
+/// @returns number of results appended to `results`, one per entry of `MeshLayouts`.
+internal usize RunMeshReport(const RTCDevice device, const BenchScene* const scene, MeshResult* const results) {
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+
+    for (usize i = 0; i < ARRAY_LENGTH(MeshLayouts); i++) {
+        LoadedScene loaded = LoadBenchScene(device, scene, MeshLayouts[i].params);
+        const f64 renderStart = NowSeconds();
+        RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+        const f64 renderMs = (NowSeconds() - renderStart) * 1e3;
+
+        MeshResult* const result = &results[i];
+        snprintf(result->scene, sizeof result->scene, "%s", scene->name);
+        result->layout = MeshLayouts[i].name;
+        result->stats = loaded.optimizeReport.after;
+        result->nClusters = loaded.optimizeReport.nClusters;
+        result->optimizeMs = loaded.optimizeReport.optimizeNs * 1e-6;
+        result->buildMs = loaded.buildMs;
+        result->renderMs = renderMs;
+        result->rasterVertices = (f64)result->stats.acmr * (f64)(loaded.obj.nIndices / 3) * (f64)loaded.instances.len;
+
+        const MeshResult* const baseline = &results[0];
+        fprintf(
+            stderr,
+            "%-16s %-9s | ACMR %5.3f | ATVR %5.3f | overfetch %5.2f | raster %+6.1f%% | build %+6.1f%% | render %+6.1f%%\n",
+            result->scene,
+            result->layout,
+            result->stats.acmr,
+            result->stats.atvr,
+            result->stats.overfetch,
+            (result->rasterVertices / baseline->rasterVertices - 1.0) * 100.0,
+            (result->buildMs / baseline->buildMs - 1.0) * 100.0,
+            (result->renderMs / baseline->renderMs - 1.0) * 100.0
+        );
+        DropBenchScene(&loaded);
+    }
+
+    DropArena(&frameArena);
+    return ARRAY_LENGTH(MeshLayouts);
+}
+
+/// @returns the time of the fastest of `VISIBILITY_REPETITIONS` calls of `IntersectRays` for every camera ray.
+internal f64 TracePrimaryRays(const RayTracer* const rt, const usize size, HitRecord* const hits) {
+    Arena arena = CreateArena(RayQueueArenaSize(size * size));
+    RayQueue queue = CreateRayQueue(&arena, size * size);
+    const vec3 origin = { 0.f, 0.f, CAMERA_ORIGIN_Z };
+    for (usize y = 0; y < size; y++) {
+        for (usize x = 0; x < size; x++) {
+            // Same directions as `GeneratePrimaryRays`.
+            const vec3 direction = { (2.0f * ((f32)x / size)) - 1.0f, 1.0f - (2.0f * ((f32)y / size)), -1.0f };
+            PushRay(&queue, origin, direction, (u32)(y * size + x));
+        }
+    }
+    f64 best = INFINITY;
+    for (usize r = 0; r < VISIBILITY_REPETITIONS; r++) {
+        RayStats stats = { 0 };
+        const f64 start = NowSeconds();
+        IntersectRays(rt, &queue, hits, &stats);
+        best = fmin(best, (NowSeconds() - start) * 1e3);
+    }
+    DropArena(&arena);
+    return best;
+}
+
+internal f64 RasterizePrimaryHits(VisibilityBuffer* const visibility, const VisibilityScene* const scene, WorkerPool* const pool) {
+    f64 best = INFINITY;
+    for (usize r = 0; r < VISIBILITY_REPETITIONS; r++) {
+        const f64 start = NowSeconds();
+        RasterizeVisibility(visibility, scene, (FrameRegion) { 0, 0, visibility->width, visibility->height }, pool);
+        best = fmin(best, (NowSeconds() - start) * 1e3);
+    }
+    return best;
+}
+
+internal void RunVisibilityReport(const RTCDevice device, const BenchScene* const scene, VisibilityResult* const result) {
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    const VisibilityMesh mesh = { .obj = &loaded.obj, .compact = NULL, .instances = loaded.instances, .firstInstanceId = 0 };
+    const VisibilityScene visibilityScene = { .meshes = &mesh, .nMeshes = 1, .primitives = NULL };
+
+    HitRecord* const traced = malloc(size * size * sizeof(HitRecord));
+    if (traced == NULL) PANICM("Failed to allocate hit records");
+    result->traceMs = TracePrimaryRays(&loaded.rt, size, traced);
+
+    WorkerPool pool;
+    VisibilityBuffer visibility;
+    CreateWorkerPool(&pool, 1);
+    CreateVisibilityBuffer(&visibility, size, size, 1);
+    result->rasterMs = RasterizePrimaryHits(&visibility, &visibilityScene, &pool);
+    DestroyVisibilityBuffer(&visibility);
+    DestroyWorkerPool(&pool);
+    CreateWorkerPool(&pool, nThreads);
+    CreateVisibilityBuffer(&visibility, size, size, nThreads);
+    result->rasterThreadsMs = RasterizePrimaryHits(&visibility, &visibilityScene, &pool);
+
+    usize nAgree = 0;
+    for (usize i = 0; i < size * size; i++) {
+        const HitRecord* const a = &traced[i];
+        const HitRecord* const b = &visibility.hits[i];
+        nAgree += a->geomID == b->geomID && (a->geomID == RTC_INVALID_GEOMETRY_ID || (a->instID == b->instID && a->primID == b->primID));
+    }
+    free(traced);
+
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+    f64 renderStart = NowSeconds();
+    RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+    result->renderMs = (NowSeconds() - renderStart) * 1e3;
+    renderStart = NowSeconds();
+    RasterizeVisibility(&visibility, &visibilityScene, FULL_FRAME(framebuffer), &pool);
+    loaded.rt.primaryHits = visibility.hits;
+    RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+    result->renderVisibilityMs = (NowSeconds() - renderStart) * 1e3;
+
+    snprintf(result->scene, sizeof result->scene, "%s", scene->name);
+    result->nTriangles = visibility.nTriangles;
+    result->threads = nThreads;
+    result->agreement = (f64)nAgree / (f64)(size * size);
+    fprintf(
+        stderr,
+        "%-16s %8zu tris | trace %8.3f ms | raster %8.3f ms (%5.2fx) | %2zu threads %8.3f ms | agree %6.2f%% | frame %+6.1f%%\n",
+        result->scene,
+        result->nTriangles,
+        result->traceMs,
+        result->rasterMs,
+        result->traceMs / result->rasterMs,
+        result->threads,
+        result->rasterThreadsMs,
+        result->agreement * 100.0,
+        (result->renderVisibilityMs / result->renderMs - 1.0) * 100.0
+    );
+
+    DestroyVisibilityBuffer(&visibility);
+    DestroyWorkerPool(&pool);
+    DropArena(&frameArena);
+    DropBenchScene(&loaded);
+}
+
+internal void RunLightReport(const RTCDevice device, const BenchScene* const scene, LightReport* const report) {
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+    Array(Light) lights = AllocateArray(Light, LIGHT_REPORT_LIGHTS);
+    ScatterLights(lights.data, lights.len, 42, LIGHT_REPORT_POWER);
+    LightTree tree;
+    CreateLightTree(&tree, lights.len);
+
+    f64 start = NowSeconds();
+    BuildLightTree(&tree, lights.data, lights.len);
+    report->buildMs = (NowSeconds() - start) * 1e3;
+    for (usize i = 0; i < lights.len; i++) lights.data[i].position[1] += i % 2 == 0 ? 0.05f : -0.05f;
+    start = NowSeconds();
+    UpdateLightTree(&tree);
+    report->refitMs = (NowSeconds() - start) * 1e3;
+    ScatterLights(lights.data, lights.len, 43, LIGHT_REPORT_POWER);
+    start = NowSeconds();
+    report->rebuilt = UpdateLightTree(&tree);
+    report->updateMs = (NowSeconds() - start) * 1e3;
+    fprintf(
+        stderr,
+        "%-16s %zu lights | build %8.3f ms | refit %8.3f ms | update %8.3f ms (%s)\n",
+        scene->name,
+        lights.len,
+        report->buildMs,
+        report->refitMs,
+        report->updateMs,
+        report->rebuilt ? "rebuilt" : "refit"
+    );
+
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + 2 * AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs reference = CreateAovs(&frameArena, size, size);
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+
+    loaded.rt.lights = &tree;
+    loaded.rt.nMaxReflections = 2;
+    loaded.rt.lightSelection = LightSelectionTree;
+    loaded.rt.nRaysPerSample = BenchConfig.referenceSpp;
+    RenderFrame(&loaded.rt, framebuffer, reference, nThreads);
+
+    const enum LightSelection selections[] = { LightSelectionUniform, LightSelectionTree };
+    const char* const selectionNames[] = { "uniform", "tree" };
+    report->nResults = 0;
+    for (usize s = 0; s < ARRAY_LENGTH(selections); s++) {
+        for (usize i = 0; i < ARRAY_LENGTH(LightSampleCounts) && LightSampleCounts[i] < BenchConfig.referenceSpp; i++) {
+            LightResult* const result = &report->results[report->nResults++];
+            result->selection = selectionNames[s];
+            result->spp = LightSampleCounts[i];
+            loaded.rt.lightSelection = selections[s];
+            loaded.rt.nRaysPerSample = result->spp;
+
+            const f64 renderStart = NowSeconds();
+            RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+            result->renderMs = (NowSeconds() - renderStart) * 1e3;
+            result->psnr = Psnr(aovs.color, reference.color, size * size);
+            fprintf(
+                stderr,
+                "%-16s %-7s spp %3zu | %6.2f dB | %8.1f ms render\n",
+                scene->name,
+                result->selection,
+                result->spp,
+                result->psnr,
+                result->renderMs
+            );
+        }
+    }
+
+    DropArena(&frameArena);
+    DestroyLightTree(&tree);
+    FreeArray(lights);
+    DropBenchScene(&loaded);
+}
+
+internal void WriteLightReport(FILE* const file, const char* const scene, const LightReport* const report) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"scene\": \"%s\",\n", scene);
+    fprintf(file, "  \"lights\": %d,\n", LIGHT_REPORT_LIGHTS);
+    fprintf(file, "  \"referenceSpp\": %zu,\n", BenchConfig.referenceSpp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"buildMs\": %.3f,\n", report->buildMs);
+    fprintf(file, "  \"refitMs\": %.3f,\n", report->refitMs);
+    fprintf(file, "  \"updateMs\": %.3f,\n", report->updateMs);
+    fprintf(file, "  \"rebuilt\": %s,\n", report->rebuilt ? "true" : "false");
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < report->nResults; i++) {
+        const LightResult* const r = &report->results[i];
+        fprintf(
+            file,
+            "    { \"selection\": \"%s\", \"spp\": %zu, \"renderMs\": %.3f, \"psnr\": %.3f }%s\n",
+            r->selection, r->spp, r->renderMs, r->psnr,
+            i + 1 < report->nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+internal f64 MeanRadiance(const vec3* const color, const usize nPixels) {
+    f64 sum = 0.0;
+    for (usize i = 0; i < nPixels; i++) sum += (f64)color[i][0] + (f64)color[i][1] + (f64)color[i][2];
+    return sum / (3.0 * (f64)nPixels);
+}
+
+/// @returns number of results, one per mode and cache depth of every entry of `RadianceCacheSampleCounts`.
+internal usize RunRadianceCacheReport(const RTCDevice device, const BenchScene* const scene, RadianceCacheResult* const results) {
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + 2 * AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs reference = CreateAovs(&frameArena, size, size);
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+
+    loaded.rt.nRaysPerSample = BenchConfig.referenceSpp;
+    RenderFrame(&loaded.rt, framebuffer, reference, nThreads);
+    const f64 referenceMean = MeanRadiance(reference.color, size * size);
+
+    RadianceCache cache;
+    CreateRadianceCache(&cache, RADIANCE_REPORT_CAPACITY, RADIANCE_REPORT_CELL, 1);
+
+    usize nResults = 0;
+    for (usize i = 0; i < ARRAY_LENGTH(RadianceCacheSampleCounts) && RadianceCacheSampleCounts[i] < BenchConfig.referenceSpp; i++) {
+        for (usize run = 0; run < 5; run++) {
+            // Brute force first, then a fresh and a persistent cache at either depth.
+            const u32 depth = run == 0 ? 0 : (u32)(run + 1) / 2;
+            const bool persistent = run > 0 && run % 2 == 0;
+            RadianceCacheResult* const result = &results[nResults++];
+            result->mode = run == 0 ? "brute-force" : persistent ? "persistent" : "cache";
+            result->depth = depth;
+            result->spp = RadianceCacheSampleCounts[i];
+            loaded.rt.nRaysPerSample = result->spp;
+            loaded.rt.radianceCache = depth > 0 ? &cache : NULL;
+            cache.depth = depth;
+            ResetRadianceCache(&cache);
+            if (persistent) {
+                for (usize frame = 0; frame < RADIANCE_REPORT_WARMUP_FRAMES; frame++) {
+                    // Every frame draws fresh samples, as successive passes of the renderer do.
+                    loaded.rt.seed = frame + 1;
+                    RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+                }
+            }
+            // Samples the reference did not draw, so its noise does not favour brute force.
+            loaded.rt.seed = RADIANCE_REPORT_WARMUP_FRAMES + 1;
+
+            const f64 renderStart = NowSeconds();
+            const RayStats stats = RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+            result->renderMs = (NowSeconds() - renderStart) * 1e3;
+            result->nRays = stats.nRays;
+            result->psnr = Psnr(aovs.color, reference.color, size * size);
+            result->bias = MeanRadiance(aovs.color, size * size) / referenceMean - 1.0;
+            result->nRecords = depth > 0 ? RadianceCacheRecords(&cache) : 0;
+            fprintf(
+                stderr,
+                "%-16s %-11s depth %u spp %3zu | %6.2f dB | %+7.3f %% bias | %10zu rays | %8.1f ms render | %8zu records\n",
+                scene->name,
+                result->mode,
+                result->depth,
+                result->spp,
+                result->psnr,
+                result->bias * 100.0,
+                result->nRays,
+                result->renderMs,
+                result->nRecords
+            );
+        }
+    }
+
+    DestroyRadianceCache(&cache);
+    DropArena(&frameArena);
+    DropBenchScene(&loaded);
+    return nResults;
+}
+
+internal void WriteRadianceCacheResults(FILE* const file, const char* const scene, const RadianceCacheResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"scene\": \"%s\",\n", scene);
+    fprintf(file, "  \"referenceSpp\": %zu,\n", BenchConfig.referenceSpp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"cellSize\": %.3f,\n", RADIANCE_REPORT_CELL);
+    fprintf(file, "  \"warmupFrames\": %d,\n", RADIANCE_REPORT_WARMUP_FRAMES);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const RadianceCacheResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"mode\": \"%s\", \"depth\": %u, \"spp\": %zu, \"renderMs\": %.3f, \"rays\": %zu, \"psnr\": %.3f, "
+            "\"bias\": %.5f, \"records\": %zu }%s\n",
+            r->mode, r->depth, r->spp, r->renderMs, r->nRays, r->psnr,
+            r->bias, r->nRecords,
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+typedef struct {
+    /// Share of the mesh's pages allowed to be resident.
+    f64 budgetShare;
+    bool sorted;
+    usize budgetBytes;
+    f64 renderMs;
+    usize nRays;
+    u64 nPageIns;
+    u64 nEvictions;
+    u64 majorFaults;
+    u64 minorFaults;
+    usize peakResidentBytes;
+    usize rssKb;
+    bool identical;
+} PagingResult;
+
+typedef struct {
+    RenderContext* context;
+    Rgb256* buffer;
+    f64 renderMs;
+} ContextFrame;
+
+internal void* RenderContextFrame(void* args) {
+    ContextFrame* const frame = args;
+    const f64 renderStart = NowSeconds();
+    RenderContextToBuffer(frame->context, BenchConfig.spp, frame->buffer);
+    frame->renderMs = (NowSeconds() - renderStart) * 1e3;
+    return NULL;
+}
+
+/// @returns the wall time of rendering every context at once, `results` holds one entry per scene.
+internal f64 RunContextReport(ContextResult* const results) {
+    const usize nScenes = ARRAY_LENGTH(BenchScenes);
+    const usize size = BenchConfig.size;
+    RenderShared shared;
+    CreateRenderShared(&shared, BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1], RENDER_SHARED_DEFAULTS);
+
+    // Scenes instancing the same file share its mesh.
+    SharedMesh meshes[ARRAY_LENGTH(BenchScenes)];
+    usize meshOf[ARRAY_LENGTH(BenchScenes)];
+    usize nMeshes = 0;
+    for (usize i = 0; i < nScenes; i++) {
+        meshOf[i] = nMeshes;
+        for (usize j = 0; j < i; j++) {
+            if (strcmp(BenchScenes[j].objPath, BenchScenes[i].objPath) == 0) meshOf[i] = meshOf[j];
+        }
+        if (meshOf[i] == nMeshes) LoadSharedMesh(&shared, BenchScenes[i].objPath, &meshes[nMeshes++]);
+    }
+
+    RenderContext contexts[ARRAY_LENGTH(BenchScenes)];
+    Array(Rgb256) alone = AllocateArray(Rgb256, nScenes * size * size);
+    Array(Rgb256) concurrent = AllocateArray(Rgb256, nScenes * size * size);
+    ContextFrame frames[ARRAY_LENGTH(BenchScenes)];
+    for (usize i = 0; i < nScenes; i++) {
+        const Instances instances = CreateBenchInstances(&BenchScenes[i]);
+        CreateRenderContext(&contexts[i], &shared, size, size, instances.len);
+        contexts[i].rt.nMaxReflections = BenchConfig.maxReflections;
+        Material material;
+        CreateLambertian(&material, Palette[i % ARRAY_LENGTH(Palette)], 0.8f);
+        AddContextInstances(&contexts[i], &meshes[meshOf[i]], instances, &material);
+        FreeArray(instances);
+
+        snprintf(results[i].scene, sizeof results[i].scene, "%s", BenchScenes[i].name);
+        results[i].nInstances = contexts[i].nInstances;
+        frames[i] = (ContextFrame) { .context = &contexts[i], .buffer = &alone.data[i * size * size] };
+        RenderContextFrame(&frames[i]);
+        results[i].aloneMs = frames[i].renderMs;
+    }
+
+    pthread_t threads[ARRAY_LENGTH(BenchScenes)];
+    const f64 concurrentStart = NowSeconds();
+    for (usize i = 0; i < nScenes; i++) {
+        frames[i].buffer = &concurrent.data[i * size * size];
+        if (0 != pthread_create(&threads[i], NULL, RenderContextFrame, &frames[i])) PANIC("Failed to start context" FS(usize), i);
+    }
+    for (usize i = 0; i < nScenes; i++) pthread_join(threads[i], NULL);
+    const f64 concurrentMs = (NowSeconds() - concurrentStart) * 1e3;
+
+    for (usize i = 0; i < nScenes; i++) {
+        results[i].concurrentMs = frames[i].renderMs;
+        results[i].identical = memcmp(&alone.data[i * size * size], &concurrent.data[i * size * size], size * size * sizeof(Rgb256)) == 0;
+        fprintf(
+            stderr,
+            "%-16s %6zu instances | %8.1f ms alone | %8.1f ms concurrent | %s\n",
+            results[i].scene,
+            results[i].nInstances,
+            results[i].aloneMs,
+            results[i].concurrentMs,
+            results[i].identical ? "identical" : "DIFFERENT"
+        );
+        DestroyRenderContext(&contexts[i]);
+    }
+    fprintf(stderr, "%zu contexts at once in %.1f ms\n", nScenes, concurrentMs);
+
+    FreeArray(concurrent);
+    FreeArray(alone);
+    for (usize i = 0; i < nMeshes; i++) DestroySharedMesh(&meshes[i]);
+    DestroyRenderShared(&shared);
+    return concurrentMs;
+}
+
+internal void WriteContextResults(FILE* const file, const ContextResult* const results, const usize nResults, const f64 concurrentMs) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"threads\": %zu,\n", BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1]);
+    fprintf(file, "  \"concurrentMs\": %.3f,\n", concurrentMs);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const ContextResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"instances\": %zu, \"aloneMs\": %.3f, \"concurrentMs\": %.3f, \"identical\": %s }%s\n",
+            r->scene, r->nInstances, r->aloneMs, r->concurrentMs, r->identical ? "true" : "false",
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/// @returns the number of runs, `ARRAY_LENGTH(PagingBudgetShares)` budgets in queue and cluster order.
+internal usize RunPagingReport(const RTCDevice device, PagingResult* const results) {
+    {
+        const BenchScene highPoly = { .name = "paged", .objPath = HIGH_POLY_PATH, .gridSize = PAGING_REPORT_GRID };
+        Obj obj;
+        LoadOBJ(highPoly.objPath, &obj);
+        const Instances instances = CreateBenchInstances(&highPoly);
+        WritePagedMesh(PAGED_MESH_PATH, &obj, instances);
+        FreeArray(instances);
+        FreeOBJ(obj);
+    }
+    PagedMesh probe;
+    OpenPagedMesh(PAGED_MESH_PATH, 0, &probe);
+    const usize pagesBytes = probe.pagesBytes;
+    ClosePagedMesh(&probe);
+
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+    Array(Rgb256) reference = AllocateArray(Rgb256, size * size);
+    Material material;
+    CreateLambertian(&material, Palette[0], 0.8f);
+
+    usize nResults = 0;
+    for (usize b = 0; b < ARRAY_LENGTH(PagingBudgetShares); b++) {
+        for (usize order = 0; order < 2; order++) {
+            // Opened per run, each gets a BVH of its own like a fresh process would.
+            PagedMesh mesh;
+            const usize budgetBytes = (usize)(PagingBudgetShares[b] * (f64)pagesBytes);
+            OpenPagedMesh(PAGED_MESH_PATH, budgetBytes > 0 ? budgetBytes : PAGED_MESH_PAGE_BYTES, &mesh);
+            const RTCScene scene = rtcNewScene(device);
+            AttachPagedMesh(device, &scene, 1, &mesh);
+            rtcCommitScene(scene);
+            RayTracer rt = {
+                .materials = (Array(Material)) { .len = 0, .data = NULL },
+                .nMaxReflections = BenchConfig.maxReflections,
+                .nRaysPerSample = BenchConfig.spp,
+                .rtcScene = scene,
+                .skyColor = { 0.5f, 0.7f, 1.0f },
+                .pagedMesh = &mesh,
+                .pagedMaterial = &material,
+                .sortByCluster = order == 1,
+            };
+
+            EvictPagedMesh(&mesh);
+            struct rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            const f64 renderStart = NowSeconds();
+            const RayStats stats = RenderFrame(&rt, framebuffer, aovs, nThreads);
+            const f64 renderMs = (NowSeconds() - renderStart) * 1e3;
+            getrusage(RUSAGE_SELF, &after);
+            PagedMeshStats pagedStats;
+            GetPagedMeshStats(&mesh, &pagedStats);
+
+            if (nResults == 0) memcpy(reference.data, buffer.data, size * size * sizeof(Rgb256));
+            PagingResult* const result = &results[nResults++];
+            *result = (PagingResult) {
+                .budgetShare = PagingBudgetShares[b],
+                .sorted = rt.sortByCluster,
+                .budgetBytes = pagedStats.budgetBytes,
+                .renderMs = renderMs,
+                .nRays = stats.nRays,
+                .nPageIns = pagedStats.nPageIns,
+                .nEvictions = pagedStats.nEvictions,
+                .majorFaults = (u64)(after.ru_majflt - before.ru_majflt),
+                .minorFaults = (u64)(after.ru_minflt - before.ru_minflt),
+                .peakResidentBytes = pagedStats.peakResidentBytes,
+                .rssKb = CurrentRssKb(),
+                .identical = memcmp(reference.data, buffer.data, size * size * sizeof(Rgb256)) == 0,
+            };
+            fprintf(
+                stderr,
+                "budget %6.2f %% %-8s | %8.1f ms | %8.3f page ins / kray | %8lu major faults | %8zu KiB rss | %s\n",
+                100.0 * result->budgetShare,
+                result->sorted ? "sorted" : "unsorted",
+                result->renderMs,
+                1e3 * (f64)result->nPageIns / (f64)result->nRays,
+                (unsigned long)result->majorFaults,
+                result->rssKb,
+                result->identical ? "identical" : "DIFFERENT"
+            );
+
+            rtcReleaseScene(scene);
+            ClosePagedMesh(&mesh);
+        }
+    }
+
+    FreeArray(reference);
+    DropArena(&frameArena);
+    return nResults;
+}
+
+internal void WritePagingResults(FILE* const file, const PagingResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"threads\": %zu,\n", BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1]);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const PagingResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"budgetShare\": %.6f, \"sorted\": %s, \"budgetBytes\": %zu, \"renderMs\": %.3f, \"rays\": %zu, "
+            "\"pageIns\": %lu, \"evictions\": %lu, \"pageInsPerKiloRay\": %.3f, \"majorFaults\": %lu, "
+            "\"minorFaults\": %lu, \"peakResidentBytes\": %zu, \"rssKb\": %zu, \"identical\": %s }%s\n",
+            r->budgetShare, r->sorted ? "true" : "false", r->budgetBytes, r->renderMs, r->nRays,
+            (unsigned long)r->nPageIns, (unsigned long)r->nEvictions, 1e3 * (f64)r->nPageIns / (f64)r->nRays,
+            (unsigned long)r->majorFaults, (unsigned long)r->minorFaults, r->peakResidentBytes, r->rssKb,
+            r->identical ? "true" : "false",
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+internal void RunBackendReport(const RTCDevice device, const BenchScene* const scene, BackendResult* const result) {
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+
+    const f64 buildStart = NowSeconds();
+    AccelScene accelScene;
+    CreateAccelScene(&loaded.obj, NULL, loaded.instances, 0, &accelScene);
+    result->accelBuildMs = (NowSeconds() - buildStart) * 1e3;
+
+    HitRecord* const embreeHits = malloc(size * size * sizeof(HitRecord));
+    HitRecord* const accelHits = malloc(size * size * sizeof(HitRecord));
+    if (embreeHits == NULL || accelHits == NULL) PANICM("Failed to allocate hit records");
+    result->embreeTraceMs = TracePrimaryRays(&loaded.rt, size, embreeHits);
+    loaded.rt.accelScene = &accelScene;
+    result->accelTraceMs = TracePrimaryRays(&loaded.rt, size, accelHits);
+    usize nAgree = 0;
+    for (usize i = 0; i < size * size; i++) {
+        const HitRecord* const a = &embreeHits[i];
+        const HitRecord* const b = &accelHits[i];
+        nAgree += a->geomID == b->geomID && (a->geomID == RTC_INVALID_GEOMETRY_ID || (a->instID == b->instID && a->primID == b->primID));
+    }
+    free(accelHits);
+    free(embreeHits);
+
+    Arena frameArena = CreateArena(2 * (size * size * sizeof(Rgb256) + AovsArenaSize(size, size)));
+    Array(Rgb256) accelBuffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Aovs accelAovs = CreateAovs(&frameArena, size, size);
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+    f64 renderStart = NowSeconds();
+    RenderFrame(&loaded.rt, (Buffer2d) { .width = size, .height = size, .buffer = accelBuffer.data }, accelAovs, nThreads);
+    result->accelRenderMs = (NowSeconds() - renderStart) * 1e3;
+    loaded.rt.accelScene = NULL;
+    renderStart = NowSeconds();
+    RenderFrame(&loaded.rt, (Buffer2d) { .width = size, .height = size, .buffer = buffer.data }, aovs, nThreads);
+    result->embreeRenderMs = (NowSeconds() - renderStart) * 1e3;
+    // Random streams are seeded per tile, so both frames draw the same samples until the backends disagree on a hit.
+    f64 difference = 0.0, total = 0.0;
+    for (usize i = 0; i < size * size; i++) {
+        for (usize c = 0; c < 3; c++) {
+            difference += fabs((f64)accelAovs.color[i][c] - (f64)aovs.color[i][c]);
+            total += fabs((f64)aovs.color[i][c]);
+        }
+    }
+    result->radianceError = total > 0.0 ? difference / total : difference;
+    result->identical = memcmp(accelBuffer.data, buffer.data, size * size * sizeof(Rgb256)) == 0;
+
+    snprintf(result->scene, sizeof result->scene, "%s", scene->name);
+    result->nTriangles = loaded.obj.nIndices / 3 * loaded.instances.len;
+    result->threads = nThreads;
+    result->embreeBuildMs = loaded.buildMs;
+    result->accelNodes = accelScene.stats.nNodes;
+    result->accelDepth = accelScene.stats.depth;
+    result->agreement = (f64)nAgree / (f64)(size * size);
+    fprintf(
+        stderr,
+        "%-16s %8zu tris | build %8.3f / %8.3f ms | trace %8.3f / %8.3f ms | %2zu threads %8.3f / %8.3f ms | agree %6.2f%% | "
+        "radiance error %8.5f %s\n",
+        result->scene,
+        result->nTriangles,
+        result->embreeBuildMs,
+        result->accelBuildMs,
+        result->embreeTraceMs,
+        result->accelTraceMs,
+        result->threads,
+        result->embreeRenderMs,
+        result->accelRenderMs,
+        result->agreement * 100.0,
+        result->radianceError,
+        result->identical ? "identical" : "DIFFERENT"
+    );
+
+    DropArena(&frameArena);
+    DestroyAccelScene(&accelScene);
+    DropBenchScene(&loaded);
+}
+
+internal void WriteBackendResults(FILE* const file, const BackendResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const BackendResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"triangles\": %zu, \"threads\": %zu, \"embreeBuildMs\": %.3f, \"accelBuildMs\": %.3f, "
+            "\"accelNodes\": %u, \"accelDepth\": %u, \"embreeTraceMs\": %.3f, \"accelTraceMs\": %.3f, "
+            "\"embreeRenderMs\": %.3f, \"accelRenderMs\": %.3f, \"agreement\": %.5f, \"radianceError\": %.6f, "
+            "\"identical\": %s }%s\n",
+            r->scene, r->nTriangles, r->threads, r->embreeBuildMs, r->accelBuildMs,
+            r->accelNodes, r->accelDepth, r->embreeTraceMs, r->accelTraceMs,
+            r->embreeRenderMs, r->accelRenderMs, r->agreement, r->radianceError, r->identical ? "true" : "false",
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/// @returns number of integrators measured.
+internal usize RunPreviewReport(const RTCDevice device, const BenchScene* const scene, PreviewResult* const results) {
+    LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + AovsArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = {
+        .width = size,
+        .height = size,
+        .buffer = buffer.data,
+    };
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+    loaded.rt.nAoSamples = PREVIEW_AO_SAMPLES;
+    loaded.rt.aoDistance = PREVIEW_AO_DISTANCE;
+
+    for (usize i = 0; i < ARRAY_LENGTH(PreviewIntegrators); i++) {
+        loaded.rt.integrator = PreviewIntegrators[i].integrator;
+        const f64 renderStart = NowSeconds();
+        const RayStats stats = RenderFrame(&loaded.rt, framebuffer, aovs, nThreads);
+        const f64 renderMs = (NowSeconds() - renderStart) * 1e3;
+
+        PreviewResult* const result = &results[i];
+        snprintf(result->scene, sizeof result->scene, "%s", scene->name);
+        result->integrator = PreviewIntegrators[i].name;
+        result->threads = nThreads;
+        result->renderMs = renderMs;
+        result->nRays = stats.nRays;
+        result->speedup = results[0].renderMs / renderMs;
+        fprintf(
+            stderr,
+            "%-16s %-6s | %2zu threads %8.3f ms | %10zu rays | %7.1fx\n",
+            result->scene,
+            result->integrator,
+            result->threads,
+            result->renderMs,
+            result->nRays,
+            result->speedup
+        );
+    }
+
+    DropArena(&frameArena);
+    DropBenchScene(&loaded);
+    return ARRAY_LENGTH(PreviewIntegrators);
+}
+
+internal void WritePreviewResults(FILE* const file, const PreviewResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"aoSamples\": %d,\n", PREVIEW_AO_SAMPLES);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const PreviewResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"integrator\": \"%s\", \"threads\": %zu, \"renderMs\": %.3f, \"rays\": %zu, "
+            "\"speedup\": %.3f }%s\n",
+            r->scene, r->integrator, r->threads, r->renderMs, r->nRays, r->speedup,
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/// Renders `scene` with the last thread count once per mode of `ThreadingModes`.
+///
+/// @returns number of modes measured.
+internal usize RunThreadingReport(const RTCDevice device, const BenchScene* const scene, ThreadingResult* const results) {
+    const usize size = BenchConfig.size;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    Array(Rgb256) buffer = AllocateArray(Rgb256, size * size);
+    Array(Rgb256) reference = AllocateArray(Rgb256, size * size);
+
+    for (usize m = 0; m < ARRAY_LENGTH(ThreadingModes); m++) {
+        const ThreadingMode* const mode = &ThreadingModes[m];
+        ThreadingResult* const result = &results[m];
+        *result = (ThreadingResult) { .mode = mode->name, .threads = nThreads, .nReplicas = 1 };
+        snprintf(result->scene, sizeof result->scene, "%s", scene->name);
+        usize nRays = 0;
+
+        if (mode->config == NULL) {
+            LoadedScene loaded = LoadBenchScene(device, scene, NULL);
+            result->setupMs = loaded.parseMs + loaded.buildMs;
+            Arena frameArena = CreateArena(AovsArenaSize(size, size));
+            const Aovs aovs = CreateAovs(&frameArena, size, size);
+            const Buffer2d framebuffer = { .width = size, .height = size, .buffer = buffer.data };
+            const f64 renderStart = NowSeconds();
+            for (usize f = 0; f < THREADING_REPORT_FRAMES; f++) nRays += RenderFrame(&loaded.rt, framebuffer, aovs, nThreads).nRays;
+            result->renderMs = (NowSeconds() - renderStart) * 1e3;
+            DropArena(&frameArena);
+            DropBenchScene(&loaded);
+        } else {
+            RenderShared shared;
+            CreateRenderShared(&shared, nThreads, *mode->config);
+            result->nReplicas = shared.nReplicas;
+            const Instances instances = CreateBenchInstances(scene);
+            const f64 setupStart = NowSeconds();
+            SharedMesh mesh;
+            LoadSharedMesh(&shared, scene->objPath, &mesh);
+            RenderContext context;
+            CreateRenderContext(&context, &shared, size, size, instances.len);
+            // One instance at a time for the palette of `LoadBenchScene`.
+            for (usize i = 0; i < instances.len; i++) {
+                Material material;
+                CreateLambertian(&material, Palette[i % ARRAY_LENGTH(Palette)], 0.8f);
+                AddContextInstances(&context, &mesh, (Instances) { .len = 1, .data = &instances.data[i] }, &material);
+            }
+            CommitReplicatedScenes(&shared, context.scenes);
+            context.dirty = false;
+            result->setupMs = (NowSeconds() - setupStart) * 1e3;
+            context.rt.nMaxReflections = BenchConfig.maxReflections;
+
+            const f64 renderStart = NowSeconds();
+            for (usize f = 0; f < THREADING_REPORT_FRAMES; f++) nRays += RenderContextToBuffer(&context, BenchConfig.spp, buffer.data).nRays;
+            result->renderMs = (NowSeconds() - renderStart) * 1e3;
+            DestroyRenderContext(&context);
+            DestroySharedMesh(&mesh);
+            FreeArray(instances);
+            DestroyRenderShared(&shared);
+        }
+
+        result->raysPerSec = (f64)nRays / (result->renderMs * 1e-3);
+        result->renderMs /= THREADING_REPORT_FRAMES;
+        if (mode->config == &UnpinnedWorkers) memcpy(reference.data, buffer.data, size * size * sizeof(Rgb256));
+        result->identical = mode->config != NULL && memcmp(reference.data, buffer.data, size * size * sizeof(Rgb256)) == 0;
+        fprintf(
+            stderr,
+            "%-16s %-10s | %2zu threads %zu replicas | setup %8.3f ms | frame %8.3f ms | %12.0f rays/s | %s\n",
+            result->scene,
+            result->mode,
+            result->threads,
+            result->nReplicas,
+            result->setupMs,
+            result->renderMs,
+            result->raysPerSec,
+            mode->config == NULL ? "-" : result->identical ? "identical" : "DIFFERENT"
+        );
+    }
+
+    FreeArray(reference);
+    FreeArray(buffer);
+    return ARRAY_LENGTH(ThreadingModes);
+}
+
+internal void WriteThreadingResults(FILE* const file, const ThreadingResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"frames\": %d,\n", THREADING_REPORT_FRAMES);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const ThreadingResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"mode\": \"%s\", \"threads\": %zu, \"replicas\": %zu, \"setupMs\": %.3f, "
+            "\"renderMs\": %.3f, \"raysPerSec\": %.3f, \"identical\": %s }%s\n",
+            r->scene, r->mode, r->threads, r->nReplicas, r->setupMs,
+            r->renderMs, r->raysPerSec, r->identical ? "true" : "false",
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/// Two keys a second apart, every instance of the `SceneNxN` layout drifts up and turns half a revolution.
+internal void CreateAnimationKeyframes(const usize n, f32* const times, Transform* const transforms) {
+    const isize h = n / 2;
+    times[0] = 0.f;
+    times[1] = 1.f;
+    for (usize i = 0; i < n * n; i++) {
+        const f32 norm = (f32)i / (f32)(n * n);
+        const isize xi = i % n - h;
+        const isize yi = (i / n) % n - h;
+        transforms[i] = (Transform) {
+            .translation = { (f32)xi, (f32)yi, -0.7f },
+            .rotation = { 0.f, norm * (f32)M_PI, 0.f },
+            .scale = { 0.3f, 0.3f, 0.3f },
+        };
+        transforms[n * n + i] = transforms[i];
+        transforms[n * n + i].translation[1] += 0.5f;
+        transforms[n * n + i].rotation[1] += (f32)M_PI;
+    }
+}
+
+internal void SumAnimationFrame(void* const user, const AnimationFrame* const frame, const RenderContext* const _, const Rgb256* const __) {
+    AnimationResult* const result = user;
+    result->buildMs += frame->buildMs;
+    result->traceMs += frame->traceMs;
+    result->stallMs += frame->stallMs;
+}
+
+internal void RunAnimationReport(AnimationResult* const results) {
+    const usize size = BenchConfig.size;
+    const usize n = ANIMATION_REPORT_GRID;
+    const usize nThreads = BenchConfig.threadCounts[BenchConfig.nThreadCounts - 1];
+    RenderShared shared;
+    CreateRenderShared(&shared, nThreads, RENDER_SHARED_DEFAULTS);
+    SharedMesh mesh;
+    LoadSharedMesh(&shared, BenchScenes[0].objPath, &mesh);
+
+    f32 times[2];
+    Transform* const transforms = malloc(2 * n * n * sizeof(Transform));
+    if (transforms == NULL) PANICM("Failed to allocate keyframes");
+    CreateAnimationKeyframes(n, times, transforms);
+    const InstanceKeyframes keyframes = { .times = times, .nKeys = 2, .transforms = transforms, .nInstances = n * n };
+    const f32 frameTime = 1.f / (f32)(ANIMATION_REPORT_FRAMES - 1);
+    Material material;
+    CreateLambertian(&material, Palette[0], 0.8f);
+    Array(Rgb256) serialBuffer = AllocateArray(Rgb256, size * size);
+    Array(Rgb256) pipelinedBuffer = AllocateArray(Rgb256, size * size);
+
+    // Serially, a new instance scene for every frame as the application would set one up.
+    AnimationResult* const serial = &results[0];
+    *serial = (AnimationResult) { .mode = "serial" };
+    RenderContext context;
+    CreateRenderContext(&context, &shared, size, size, n * n);
+    context.rt.nMaxReflections = BenchConfig.maxReflections;
+    Instances instances = AllocateArray(Instance, n * n);
+    InterpolateInstances(&keyframes, 0.f, instances);
+    AddContextInstances(&context, &mesh, instances, &material);
+    const RTCScene contextScene = context.scenes[0];
+    f64 start = NowSeconds();
+    for (usize i = 0; i < ANIMATION_REPORT_FRAMES; i++) {
+        // Built on the pool like any other commit, so only the pipelining differs between the two modes.
+        const f64 buildStart = NowSeconds();
+        InterpolateInstances(&keyframes, (f32)i * frameTime, instances);
+        const RTCScene scene = rtcNewScene(shared.device);
+        AttachInstances(shared.device, scene, mesh.scenes[0], instances);
+        CommitSharedScene(&shared, scene);
+        serial->buildMs += (NowSeconds() - buildStart) * 1e3;
+
+        const f64 traceStart = NowSeconds();
+        context.scenes[0] = scene;
+        context.dirty = false;
+        RenderContextToBuffer(&context, BenchConfig.spp, serialBuffer.data);
+        serial->traceMs += (NowSeconds() - traceStart) * 1e3;
+        rtcReleaseScene(scene);
+    }
+    serial->frameMs = (NowSeconds() - start) * 1e3;
+    context.scenes[0] = contextScene;
+    FreeArray(instances);
+    DestroyRenderContext(&context);
+
+    AnimationResult* const pipelined = &results[1];
+    *pipelined = (AnimationResult) { .mode = "pipelined" };
+    AnimationRenderer renderer;
+    CreateAnimationRenderer(&renderer, &shared, &mesh, &keyframes, &material, size, size);
+    renderer.contexts[0].rt.nMaxReflections = BenchConfig.maxReflections;
+    start = NowSeconds();
+    RenderAnimation(&renderer, ANIMATION_REPORT_FRAMES, 0.f, frameTime, BenchConfig.spp, pipelinedBuffer.data, SumAnimationFrame, pipelined);
+    pipelined->frameMs = (NowSeconds() - start) * 1e3;
+    DestroyAnimationRenderer(&renderer);
+
+    const bool identical = memcmp(serialBuffer.data, pipelinedBuffer.data, size * size * sizeof(Rgb256)) == 0;
+    for (usize m = 0; m < 2; m++) {
+        AnimationResult* const r = &results[m];
+        r->nInstances = n * n;
+        r->nFrames = ANIMATION_REPORT_FRAMES;
+        r->threads = nThreads;
+        r->buildMs /= ANIMATION_REPORT_FRAMES;
+        r->traceMs /= ANIMATION_REPORT_FRAMES;
+        r->stallMs /= ANIMATION_REPORT_FRAMES;
+        r->frameMs /= ANIMATION_REPORT_FRAMES;
+        r->identical = identical;
+        fprintf(
+            stderr,
+            "%-9s %6zu instances | build %8.3f ms | trace %8.3f ms | stall %8.3f ms | frame %8.3f ms | %s\n",
+            r->mode,
+            r->nInstances,
+            r->buildMs,
+            r->traceMs,
+            r->stallMs,
+            r->frameMs,
+            r->identical ? "identical" : "DIFFERENT"
+        );
+    }
+
+    FreeArray(pipelinedBuffer);
+    FreeArray(serialBuffer);
+    free(transforms);
+    DestroySharedMesh(&mesh);
+    DestroyRenderShared(&shared);
+}
+
+internal void WriteAnimationResults(FILE* const file, const AnimationResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const AnimationResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"mode\": \"%s\", \"instances\": %zu, \"frames\": %zu, \"threads\": %zu, \"buildMs\": %.3f, "
+            "\"traceMs\": %.3f, \"stallMs\": %.3f, \"frameMs\": %.3f, \"identical\": %s }%s\n",
+            r->mode, r->nInstances, r->nFrames, r->threads, r->buildMs,
+            r->traceMs, r->stallMs, r->frameMs, r->identical ? "true" : "false",
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+internal void WriteVisibilityResults(FILE* const file, const VisibilityResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const VisibilityResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"triangles\": %zu, \"threads\": %zu, \"traceMs\": %.3f, \"rasterMs\": %.3f, "
+            "\"rasterThreadsMs\": %.3f, \"agreement\": %.5f, \"renderMs\": %.3f, \"renderVisibilityMs\": %.3f }%s\n",
+            r->scene, r->nTriangles, r->threads, r->traceMs, r->rasterMs,
+            r->rasterThreadsMs, r->agreement, r->renderMs, r->renderVisibilityMs,
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+internal void WriteMeshResults(FILE* const file, const MeshResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const MeshResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"layout\": \"%s\", \"acmr\": %.4f, \"atvr\": %.4f, \"overfetch\": %.4f, "
+            "\"clusters\": %u, \"optimizeMs\": %.3f, \"buildMs\": %.3f, \"renderMs\": %.3f, \"rasterVertices\": %.0f }%s\n",
+            r->scene, r->layout, r->stats.acmr, r->stats.atvr, r->stats.overfetch,
+            r->nClusters, r->optimizeMs, r->buildMs, r->renderMs, r->rasterVertices,
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+internal void WriteDenoiseResults(FILE* const file, const char* const scene, const DenoiseResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"scene\": \"%s\",\n", scene);
+    fprintf(file, "  \"referenceSpp\": %zu,\n", BenchConfig.referenceSpp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"maxReflections\": %zu,\n", BenchConfig.maxReflections);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const DenoiseResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"spp\": %zu, \"renderMs\": %.3f, \"denoiseMs\": %.3f, \"psnrNoisy\": %.3f, \"psnrDenoised\": %.3f }%s\n",
+            r->spp, r->renderMs, r->denoiseMs, r->psnrNoisy, r->psnrDenoised,
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+internal void WriteResults(FILE* const file, const BenchResult* const results, const usize nResults) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"spp\": %zu,\n", BenchConfig.spp);
+    fprintf(file, "  \"width\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"height\": %zu,\n", BenchConfig.size);
+    fprintf(file, "  \"maxReflections\": %zu,\n", BenchConfig.maxReflections);
+    fprintf(file, "  \"results\": [\n");
+    for (usize i = 0; i < nResults; i++) {
+        const BenchResult* const r = &results[i];
+        fprintf(
+            file,
+            "    { \"scene\": \"%s\", \"threads\": %zu, \"primaryRaysPerSec\": %.1f, \"totalRaysPerSec\": %.1f, "
+            "\"nsPerIntersection\": %.3f, \"parseMs\": %.3f, \"buildMs\": %.3f, \"renderMs\": %.3f, \"peakRssKb\": %zu }%s\n",
+            r->scene, r->threads, r->primaryRaysPerSec, r->totalRaysPerSec,
+            r->nsPerIntersection, r->parseMs, r->buildMs, r->renderMs, r->peakRssKb,
+            i + 1 < nResults ? "," : ""
+        );
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/// Reads results previously written by `WriteResults`.
+internal usize ReadResults(const char* const path, BenchResult* const results) {
+    FILE* const file = fopen(path, "r");
+    if (file == NULL) PANIC("Failed to open baseline %s", path);
+
+    usize nResults = 0;
+    char line[1024];
+    while (fgets(line, sizeof line, file) != NULL && nResults < MAX_RESULTS) {
+        BenchResult* const r = &results[nResults];
+        const i32 matched = sscanf(
+            line,
+            " { \"scene\": \"%63[^\"]\", \"threads\": %zu, \"primaryRaysPerSec\": %lf, \"totalRaysPerSec\": %lf, "
+            "\"nsPerIntersection\": %lf, \"parseMs\": %lf, \"buildMs\": %lf, \"renderMs\": %lf, \"peakRssKb\": %zu",
+            r->scene, &r->threads, &r->primaryRaysPerSec, &r->totalRaysPerSec,
+            &r->nsPerIntersection, &r->parseMs, &r->buildMs, &r->renderMs, &r->peakRssKb
+        );
+        if (matched == 9) nResults++;
+    }
+    fclose(file);
+    return nResults;
+}
+
+internal f64 PercentChange(const f64 current, const f64 baseline) {
+    return baseline == 0.0 ? 0.0 : (current - baseline) / baseline * 100.0;
+}
+
+/// @returns number of results whose total throughput regressed past the threshold.
+internal usize Compare(const BenchResult* const results, const usize nResults, const char* const baselinePath) {
+    const usize nBaseline = ReadResults(baselinePath, Baseline);
+
+    usize nRegressions = 0;
+    fprintf(stderr, "\n%-16s %7s | %12s | %12s | %10s | %10s\n", "scene", "threads", "total rays", "ns/isect", "parse", "build");
+    for (usize i = 0; i < nResults; i++) {
+        const BenchResult* const r = &results[i];
+        const BenchResult* b = NULL;
+        for (usize j = 0; j < nBaseline; j++) {
+            if (Baseline[j].threads == r->threads && strcmp(Baseline[j].scene, r->scene) == 0) b = &Baseline[j];
+        }
+        if (b == NULL) {
+            fprintf(stderr, "%-16s %7zu | missing from baseline\n", r->scene, r->threads);
+            continue;
+        }
+        const f64 throughput = PercentChange(r->totalRaysPerSec, b->totalRaysPerSec);
+        const bool regressed = throughput < -BenchConfig.threshold;
+        nRegressions += regressed;
+        fprintf(
+            stderr,
+            "%-16s %7zu | %+11.1f%% | %+11.1f%% | %+9.1f%% | %+9.1f%%%s\n",
+            r->scene,
+            r->threads,
+            throughput,
+            PercentChange(r->nsPerIntersection, b->nsPerIntersection),
+            PercentChange(r->parseMs, b->parseMs),
+            PercentChange(r->buildMs, b->buildMs),
+            regressed ? "  <-- regression" : ""
+        );
+    }
+    return nRegressions;
+}
+
+internal void ParseThreadCounts(const char* list) {
+    BenchConfig.nThreadCounts = 0;
+    while (*list != '\0' && BenchConfig.nThreadCounts < MAX_THREAD_COUNTS) {
+        char* end;
+        const usize count = strtoul(list, &end, 10);
+        if (end == list || count == 0) PANIC("Invalid thread count list: %s", list);
+        BenchConfig.threadCounts[BenchConfig.nThreadCounts++] = count;
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+internal void ParseArgs(const i32 argc, char** const argv) {
+    for (i32 i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--threads") == 0 && hasValue) ParseThreadCounts(argv[++i]);
+        else if (strcmp(argv[i], "--spp") == 0 && hasValue) BenchConfig.spp = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--size") == 0 && hasValue) BenchConfig.size = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--out") == 0 && hasValue) BenchConfig.outPath = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && hasValue) BenchConfig.comparePath = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && hasValue) BenchConfig.threshold = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--denoise-report") == 0) BenchConfig.denoiseReport = true;
+        else if (strcmp(argv[i], "--reference-spp") == 0 && hasValue) BenchConfig.referenceSpp = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--mesh-report") == 0) BenchConfig.meshReport = true;
+        else if (strcmp(argv[i], "--visibility-report") == 0) BenchConfig.visibilityReport = true;
+        else if (strcmp(argv[i], "--light-report") == 0) BenchConfig.lightReport = true;
+        else if (strcmp(argv[i], "--radiance-cache-report") == 0) BenchConfig.radianceCacheReport = true;
+        else if (strcmp(argv[i], "--context-report") == 0) BenchConfig.contextReport = true;
+        else if (strcmp(argv[i], "--paging-report") == 0) BenchConfig.pagingReport = true;
+        else if (strcmp(argv[i], "--backend-report") == 0) BenchConfig.backendReport = true;
+        else if (strcmp(argv[i], "--preview-report") == 0) BenchConfig.previewReport = true;
+        else if (strcmp(argv[i], "--animation-report") == 0) BenchConfig.animationReport = true;
+        else if (strcmp(argv[i], "--threading-report") == 0) BenchConfig.threadingReport = true;
+        else PANIC("Unknown argument: %s", argv[i]);
+    }
+}
+
+#if defined(RTC_NAMESPACE_USE)
+RTC_NAMESPACE_USE
+#endif
+
+internal void EmbreeErrorCallback(void* const _, enum RTCError error, const char* const str) {
+    PANIC("embree error ::" FS(i32) ":: %s", error, str);
+}
+
+i32 main(const i32 argc, char** const argv) {
+    ParseArgs(argc, argv);
+    WriteHighPolyObj(HIGH_POLY_PATH);
+
+    const RTCDevice device = rtcNewDevice(NULL);
+    if (!device) PANIC("error %d: cannot create device", rtcGetDeviceError(NULL));
+    rtcSetDeviceErrorFunction(device, EmbreeErrorCallback, NULL);
+
+    if (BenchConfig.denoiseReport) {
+        DenoiseResult results[MAX_DENOISE_RESULTS];
+        const usize nResults = RunDenoiseReport(device, &BenchScenes[0], results);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteDenoiseResults(file, BenchScenes[0].name, results, nResults);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.meshReport) {
+        MeshResult results[MAX_MESH_RESULTS];
+        usize nResults = 0;
+        for (usize i = 0; i < ARRAY_LENGTH(BenchScenes); i++) {
+            if (nResults + ARRAY_LENGTH(MeshLayouts) > MAX_MESH_RESULTS) PANICM("Too many mesh results");
+            nResults += RunMeshReport(device, &BenchScenes[i], &results[nResults]);
+        }
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteMeshResults(file, results, nResults);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.lightReport) {
+        LightReport report;
+        RunLightReport(device, &BenchScenes[0], &report);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteLightReport(file, BenchScenes[0].name, &report);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.contextReport) {
+        // Contexts bring their own device.
+        rtcReleaseDevice(device);
+        ContextResult results[ARRAY_LENGTH(BenchScenes)];
+        const f64 concurrentMs = RunContextReport(results);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteContextResults(file, results, ARRAY_LENGTH(BenchScenes), concurrentMs);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.pagingReport) {
+        PagingResult results[2 * ARRAY_LENGTH(PagingBudgetShares)];
+        const usize nResults = RunPagingReport(device, results);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WritePagingResults(file, results, nResults);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.radianceCacheReport) {
+        RadianceCacheResult results[MAX_RADIANCE_CACHE_RESULTS];
+        const usize nResults = RunRadianceCacheReport(device, &BenchScenes[0], results);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteRadianceCacheResults(file, BenchScenes[0].name, results, nResults);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.backendReport) {
+        BackendResult results[ARRAY_LENGTH(BenchScenes)];
+        for (usize i = 0; i < ARRAY_LENGTH(BenchScenes); i++) RunBackendReport(device, &BenchScenes[i], &results[i]);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteBackendResults(file, results, ARRAY_LENGTH(BenchScenes));
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.animationReport) {
+        // The renderers bring their own device.
+        rtcReleaseDevice(device);
+        AnimationResult results[2];
+        RunAnimationReport(results);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteAnimationResults(file, results, ARRAY_LENGTH(results));
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.threadingReport) {
+        ThreadingResult results[ARRAY_LENGTH(BenchScenes) * ARRAY_LENGTH(ThreadingModes)];
+        usize nResults = 0;
+        for (usize i = 0; i < ARRAY_LENGTH(BenchScenes); i++) nResults += RunThreadingReport(device, &BenchScenes[i], &results[nResults]);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteThreadingResults(file, results, nResults);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.previewReport) {
+        PreviewResult results[ARRAY_LENGTH(BenchScenes) * ARRAY_LENGTH(PreviewIntegrators)];
+        usize nResults = 0;
+        for (usize i = 0; i < ARRAY_LENGTH(BenchScenes); i++) nResults += RunPreviewReport(device, &BenchScenes[i], &results[nResults]);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WritePreviewResults(file, results, nResults);
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (BenchConfig.visibilityReport) {
+        VisibilityResult results[ARRAY_LENGTH(BenchScenes)];
+        for (usize i = 0; i < ARRAY_LENGTH(BenchScenes); i++) RunVisibilityReport(device, &BenchScenes[i], &results[i]);
+        rtcReleaseDevice(device);
+
+        FILE* const file = BenchConfig.outPath != NULL ? fopen(BenchConfig.outPath, "w") : stdout;
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteVisibilityResults(file, results, ARRAY_LENGTH(BenchScenes));
+        if (file != stdout) fclose(file);
+        exit(EXIT_SUCCESS);
+    }
+
+    usize nResults = 0;
+    for (usize i = 0; i < ARRAY_LENGTH(BenchScenes); i++) {
+        RunScene(device, &BenchScenes[i], Results, &nResults);
+    }
+    rtcReleaseDevice(device);
+
+    if (BenchConfig.outPath != NULL) {
+        FILE* const file = fopen(BenchConfig.outPath, "w");
+        if (file == NULL) PANIC("Failed to open %s", BenchConfig.outPath);
+        WriteResults(file, Results, nResults);
+        fclose(file);
+    } else {
+        WriteResults(stdout, Results, nResults);
+    }
+
+    if (BenchConfig.comparePath != NULL && Compare(Results, nResults, BenchConfig.comparePath) > 0) {
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
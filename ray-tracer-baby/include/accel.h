@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cmm/cmm.h>
+
+#include "attributes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Our own triangle BVH from `acceleration-structures`, linked as `libaccel.a`.
+ *
+ * The hierarchy is built once over a flat triangle buffer, there are no instances, and rays are traced in batches.
+ * See `AccelScene` for tracing the scenes of the renderer with it instead of Embree.
+ */
+
+/// Primitive id of rays that hit nothing.
+#define ACCEL_NO_HIT UINT32_MAX
+
+/// Outcome of `BuildAccel`.
+typedef enum AccelStatus {
+	AccelStatusOk = 0,
+	/// A buffer is NULL while its count is not 0.
+	AccelStatusNullBuffer = 1,
+	/// An index lies past the end of the position buffer.
+	AccelStatusIndexOutOfRange = 2,
+} AccelStatus;
+
+typedef struct Accel Accel;
+
+typedef struct AccelRay {
+	f32 origin[3];
+	f32 tNear;
+	f32 direction[3];
+	f32 tFar;
+} AccelRay;
+
+typedef struct AccelHit {
+	f32 t;
+	f32 u;
+	f32 v;
+	/// Triangle of the index buffer hit, `ACCEL_NO_HIT` for misses.
+	u32 primId;
+	/// Unnormalized geometric normal `(v0 - v1) x (v2 - v0)`, with the sign Embree gives it.
+	f32 normal[3];
+} AccelHit;
+
+typedef struct AccelStats {
+	u32 nNodes;
+	u32 depth;
+	u64 buildNs;
+} AccelStats;
+
+/// Builds a binned SAH hierarchy over `nTriangles` triangles of `indices` into `positions`, stored in `accel`. `stats`
+/// may be NULL.
+///
+/// The buffers are copied, free them whenever. `accel` is only written when the build succeeds.
+AccelStatus BuildAccel(const Position* positions, usize nPositions, const u32 (*indices)[3], usize nTriangles, AccelStats* stats, Accel** accel);
+
+/// Closest hit of every ray within (`tNear`, `tFar`), `hits` has to hold `nRays` records.
+void TraceAccel(const Accel* accel, const AccelRay* rays, usize nRays, AccelHit* hits);
+
+/// Whether anything lies along every ray within (`tNear`, `tFar`), `occluded` has to hold `nRays` entries.
+void OccludedAccel(const Accel* accel, const AccelRay* rays, usize nRays, bool* occluded);
+
+void FreeAccel(Accel* accel);
+
+#ifdef __cplusplus
+}
+#endif
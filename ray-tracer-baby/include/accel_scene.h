@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cmm/cmm.h>
+
+#include "renderer.h"
+#include "obj.h"
+#include "accel.h"
+#include "vertex_format.h"
+
+/*
+ * Instances of a mesh traced through `Accel` instead of Embree, see `RayTracer.accelScene`.
+ *
+ * `Accel` knows no instancing, so every instance is baked into world space and one hierarchy is built over all of
+ * them. Triangles of instance `i` follow those of instance `i - 1`, which is how hits are mapped back to the
+ * instance and triangle ids Embree would report: shading reads the same `HitRecord` from either backend.
+ *
+ * Embree reports the geometric normal of an instance in object space. `Accel` only sees the baked world space
+ * triangle, whose normal `normalToObject` of the instance takes back to the one Embree computes from the mesh.
+ */
+
+typedef struct {
+    Accel* accel;
+    u32 nMeshTriangles;
+    usize nInstances;
+    /// Instance id of the first instance, as `AttachInstances` returned it for the Embree scene.
+    u32 firstInstanceId;
+    /// Per instance, `transpose(A) / det(A)` of the linear part `A` of its model matrix, column major.
+    mat3* normalToObject;
+    AccelStats stats;
+} AccelScene;
+
+/// Bakes one copy of `obj` per entry of `instances` and builds the hierarchy over them.
+///
+/// Positions come from `compact` when given, so both backends trace the same quantized geometry.
+void CreateAccelScene(const Obj* obj, const CompactMesh* compact, Instances instances, u32 firstInstanceId, AccelScene* scene);
+
+void DestroyAccelScene(AccelScene* scene);
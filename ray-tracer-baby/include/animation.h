@@ -0,0 +1,104 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+
+#include "renderer.h"
+#include "attributes.h"
+#include "ray_tracing.h"
+#include "render_context.h"
+
+/*
+ * Frame sequences of keyframed instances, the top level scene of the next frame built while the current one traces.
+ *
+ * Instances move along `InstanceKeyframes`, transforms at key times shared by every instance. In between transforms
+ * are interpolated linearly, before the first and after the last key they hold. All frames instance one
+ * `SharedMesh`, so its BLAS is built once by `LoadSharedMesh` and only the instance scene changes from frame to frame.
+ *
+ * An `AnimationRenderer` double buffers the instance scene over two `RenderContext`s holding the same instances,
+ * attached once. While frame N traces on the shared pool through one context, a builder thread interpolates the
+ * transforms of frame N + 1, writes them into the instance geometries of the other context and commits its scene.
+ * Both scenes are dynamic and built at low quality, a fast rebuild pays off over a single frame.
+ *
+ * The device of `RenderShared` starts no build threads, so the builder commits through `CommitReplicatedScenes`:
+ * every worker joins the build once done with the band it is tracing and returns to the frame when the build is
+ * done, a frame costs its trace time plus a build on all cores. The render loop only waits for the builder when a
+ * frame traces faster than the next one builds. With scenes replicated per NUMA node the replicas are committed in
+ * turn, each by the workers of its node.
+ */
+
+typedef struct {
+    /// Increasing key times.
+    const f32* times;
+    usize nKeys;
+    /// `nKeys * nInstances` transforms, the transforms of all instances at the first key, then at the second...
+    const Transform* transforms;
+    usize nInstances;
+} InstanceKeyframes;
+
+/// Transforms of every instance at `time`, `instances` holds `keyframes->nInstances` of them.
+void InterpolateInstances(const InstanceKeyframes* keyframes, f32 time, Instances instances);
+
+/// Timings of one frame of `RenderAnimation`.
+typedef struct {
+    usize index;
+    f32 time;
+    RayStats stats;
+    f64 traceMs;
+    /// Interpolating, updating and committing the instance scene of this frame on the builder thread.
+    f64 buildMs;
+    /// Time the render loop waited for the builder before tracing this frame, 0 when building was hidden entirely.
+    f64 stallMs;
+} AnimationFrame;
+
+/// Receives every frame once it is traced, `buffer` holds it tonemapped and `context->aovs` its linear outputs.
+typedef void (*AnimationFrameCallback)(void* user, const AnimationFrame* frame, const RenderContext* context, const Rgb256* buffer);
+
+typedef struct {
+    /// Frame N is traced through `contexts[N % 2]`.
+    RenderContext contexts[2];
+    const InstanceKeyframes* keyframes;
+    /// Builder thread and the frame it builds, owned by the builder while `busy`.
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    RenderContext* target;
+    f32 targetTime;
+    /// Transforms of the frame being built.
+    Instances instances;
+    f64 buildMs;
+    bool pending;
+    bool busy;
+    bool stop;
+} AnimationRenderer;
+
+/// Creates both contexts at `width` x `height`, instancing `mesh` once per instance of `keyframes`, all of them shaded
+/// with `material`, and starts the builder thread.
+///
+/// Tracer settings are taken from `renderer->contexts[0].rt` for every frame, adjust them there.
+void CreateAnimationRenderer(
+    AnimationRenderer* renderer,
+    RenderShared* shared,
+    const SharedMesh* mesh,
+    const InstanceKeyframes* keyframes,
+    const Material* material,
+    usize width,
+    usize height
+);
+
+/// Stops the builder and destroys both contexts, before the mesh and `RenderShared` they use.
+void DestroyAnimationRenderer(AnimationRenderer* renderer);
+
+/// Renders `nFrames` frames at times `firstTime + i * frameTime` with `nSamples` samples per pixel into `buffer`,
+/// `width * height` pixels, calling `callback` after each.
+void RenderAnimation(
+    AnimationRenderer* renderer,
+    usize nFrames,
+    f32 firstTime,
+    f32 frameTime,
+    usize nSamples,
+    Rgb256* buffer,
+    AnimationFrameCallback callback,
+    void* user
+);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cmm/cmm.h>
+
+/*
+ * Linear allocator over a single anonymous mapping.
+ *
+ * Allocation bumps an offset and `ResetArena` releases everything at once, so per-frame and per-thread
+ * scratch memory never goes through malloc. Mappings of at least `HUGE_PAGE_SIZE` try `MAP_HUGETLB` first and
+ * fall back to transparent huge pages via `madvise`.
+ *
+ * Pages are not touched on creation. Under the default first-touch policy they are placed on the NUMA node of
+ * the thread that writes them first, so an arena used by a single worker stays local to that worker.
+ *
+ * Huge page arenas take their whole capacity out of the hugetlb pool when they are created, however little of it
+ * gets used, so the pool runs dry for arenas created later rather than faulting halfway through a frame. Regular
+ * arenas only reserve address space and commit pages as they are touched.
+ */
+
+#define HUGE_PAGE_SIZE ((usize)2 << 20)
+
+typedef struct {
+    u8* base;
+    usize capacity;
+    usize offset;
+    bool hugeTlb;
+} Arena;
+
+DeclareArray(Arena);
+
+/// Maps `capacity` bytes rounded up to whole pages, reserving huge pages up front when backed by hugetlbfs.
+Arena CreateArena(usize capacity);
+
+void DropArena(Arena* arena);
+
+/// @returns `size` bytes aligned to `alignment`, panics when the arena is exhausted.
+void* ArenaPush(Arena* arena, usize size, usize alignment);
+
+/// Releases all allocations, the mapping is kept for reuse.
+void ResetArena(Arena* arena);
+
+#define ArenaAllocateArray(arena, T, n) ((Array(T)) { .len = (n), .data = (T*)ArenaPush((arena), (n) * sizeof(T), _Alignof(T)) })
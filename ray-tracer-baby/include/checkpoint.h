@@ -0,0 +1,72 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "ray_tracing.h"
+
+/*
+ * Checkpoints of a progressive render.
+ *
+ * A checkpoint holds the running radiance sums and per pixel sample counts of `Aovs` together with the render
+ * seed. Every tile samples from a stream of its own derived from the seed, advanced by the sample count of its
+ * pixels (see `RenderRange`), so these fully determine how a resumed render continues, bit for bit. The albedo,
+ * normal and depth of the last pass are stored as well, so a resumed render that needs no further pass can still
+ * be denoised.
+ *
+ * Payload bytes are shuffled into planes (all first bytes of every 32 bit value, then all second bytes, ...)
+ * before zlib compression, which groups the slowly varying exponent bytes of neighbouring pixels. Files are
+ * written to a temporary path, synced and renamed over the previous checkpoint so a crash never leaves a torn
+ * file behind.
+ */
+
+#define CHECKPOINT_VERSION 2
+
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 width;
+    u32 height;
+    u32 crc;
+    u64 seed;
+    u64 rawSize;
+    u64 compressedSize;
+} CheckpointHeader;
+
+/*
+ * Writes checkpoints on a background thread.
+ *
+ * `SubmitCheckpoint` only copies the accumulation buffers, compression and IO happen on the writer thread.
+ */
+typedef struct {
+    const char* path;
+    usize width;
+    usize height;
+    u64 seed;
+    /// Snapshot being written, owned by the writer thread while `busy`. Its `color` is not stored and stays NULL.
+    Aovs snapshot;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool pending;
+    bool busy;
+    bool stop;
+    usize nWritten;
+} CheckpointWriter;
+
+void StartCheckpointWriter(CheckpointWriter* writer, const char* path, usize width, usize height, u64 seed);
+
+/// Queues a snapshot of the sums, sample counts and denoiser inputs of `aovs`, call it while no worker is writing to them.
+///
+/// @returns false without copying anything when the previous checkpoint is still being written, unless `wait`.
+bool SubmitCheckpoint(CheckpointWriter* writer, const Aovs* aovs, bool wait);
+
+/// Writes the last submitted snapshot, if any, and stops the writer thread.
+void StopCheckpointWriter(CheckpointWriter* writer);
+
+/// Restores sums, sample counts, means and denoiser inputs of `aovs` from `path`, the frame sizes have to match.
+///
+/// @returns false when there is no checkpoint at `path`.
+bool LoadCheckpoint(const char* path, Aovs* aovs, u64* seed);
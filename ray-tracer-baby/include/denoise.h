@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "ray_tracing.h"
+#include "arena.h"
+#include "worker_pool.h"
+
+/*
+ * Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) guided by the first hit AOVs.
+ *
+ * Color is divided by albedo before filtering and multiplied back afterwards so texture and material detail
+ * survive, only the lighting is blurred. Every iteration applies a 5x5 B3 spline kernel with taps `2^i` pixels
+ * apart, weights are stopped across differences in color, normal and relative depth. The color tolerance halves
+ * each iteration as the noise left in the image drops.
+ *
+ * Color and normals are split into planes of a single component, so with SSE2 four neighbouring pixels are filtered
+ * at once. Pixels closer to the left or right border than the kernel reaches are filtered one at a time. Every
+ * iteration is split into bands of rows run on a `WorkerPool`.
+ */
+
+typedef struct {
+    usize nIterations;
+    f32 sigmaColor;
+    f32 sigmaNormal;
+    /// Tolerated depth difference relative to the depth of the filtered pixel.
+    f32 sigmaDepth;
+} DenoiseParams;
+
+#define DENOISE_DEFAULTS (DenoiseParams) { \
+    .nIterations = 5,                      \
+    .sigmaColor = 0.6f,                    \
+    .sigmaNormal = 0.3f,                   \
+    .sigmaDepth = 0.05f,                   \
+}
+
+/// @returns bytes `Denoise` takes from an arena for a frame of the given size.
+usize DenoiseArenaSize(usize width, usize height);
+
+/// Filters `aovs->color` into `result` on the workers of `pool`, `result` may alias `aovs->color`.
+///
+/// Scratch buffers come from `arena` and stay allocated, reset the arena between frames.
+void Denoise(const Aovs* aovs, DenoiseParams params, WorkerPool* pool, Arena* arena, vec3* result);
+
+/// Peak signal to noise ratio in dB of `image` against `reference`, both clamped to [0, 1].
+f64 Psnr(const vec3* image, const vec3* reference, usize nPixels);
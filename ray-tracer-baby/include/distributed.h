@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cmm/cmm.h>
+
+#include "ray_tracing.h"
+
+/*
+ * Coordinator / worker tile distribution over stream sockets.
+ *
+ * The coordinator splits the frame into square tiles and hands them out to any number of worker processes,
+ * which may connect at any time, also in the middle of a frame. Each worker keeps up to
+ * `WORKER_PIPELINE_DEPTH` tiles assigned so the next tile is already queued while it renders the current one,
+ * and streams back the tile's `Aovs` as raw floats which the coordinator merges into the frame.
+ *
+ * Once no tile is pending, tiles whose worker has been busy for much longer than the average tile time are
+ * issued a second time to idle workers, the first result wins. Tiles of disconnected workers are reissued.
+ *
+ * Addresses are `unix:/path/to/socket` or `host:port` for TCP. Messages are sent in native byte order, all
+ * processes are expected to run on the same architecture.
+ */
+
+#define DISTRIBUTED_PROTOCOL_VERSION 1
+#define WORKER_PIPELINE_DEPTH 2
+
+enum MessageType {
+    MessageTypeHello = 1,
+    MessageTypeFrame,
+    MessageTypeTile,
+    MessageTypeResult,
+    MessageTypeShutdown,
+};
+
+typedef struct {
+    u32 type;
+    /// Bytes of payload following the header.
+    u32 size;
+} MessageHeader;
+
+typedef struct {
+    u32 id;
+    u32 width;
+    u32 height;
+    u32 nRaysPerSample;
+    u32 nMaxReflections;
+    u32 tileSize;
+} FrameDesc;
+
+typedef struct {
+    u32 id;
+    u32 x;
+    u32 y;
+    u32 width;
+    u32 height;
+} TileDesc;
+
+typedef struct {
+    FrameDesc frame;
+    /// Tiles running longer than this multiple of the average tile time get issued again.
+    f64 reissueFactor;
+} CoordinatorConfig;
+
+/// Renders tiles on behalf of a worker, `context` is passed through unchanged.
+typedef struct {
+    void* context;
+    /// Called once per frame before its first tile.
+    void (*prepare)(void* context, const FrameDesc* frame);
+    /// Fills `aovs`, sized to the tile, with the tile's pixels.
+    void (*render)(void* context, const FrameDesc* frame, const TileDesc* tile, Aovs aovs);
+} TileRenderer;
+
+/// Creates a listening socket for `RunCoordinator`, workers may connect as soon as this returns.
+i32 ListenCoordinator(const char* address);
+
+/// Distributes `config->frame` over connected workers and merges their results into `aovs`.
+///
+/// Blocks until every tile is done, then shuts the workers down and closes `listener`. Panics when no worker is
+/// connected for `NO_WORKERS_TIMEOUT_SEC`.
+void RunCoordinator(i32 listener, const CoordinatorConfig* config, Aovs aovs);
+
+/// Connects to the coordinator at `address` and renders tiles until it shuts the worker down.
+void RunWorker(const char* address, TileRenderer renderer);
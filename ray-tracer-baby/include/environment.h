@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+/*
+ * Image based lighting from an equirectangular HDR image.
+ *
+ * The image spans every direction: columns sweep around the vertical axis with the center column looking down -z
+ * like the camera, rows go from straight up to straight down. Texels are nearest filtered so radiance is constant
+ * over a texel, just like the sampling density below.
+ *
+ * Every escaping path of every bounce looks the environment up, so texels are stored in
+ * `ENVIRONMENT_TILE_SIZE`^2 tiles of linear RGB rather than in rows: paths leaving nearby points in similar directions
+ * read the same few cache lines instead of one line per row.
+ *
+ * `SampleEnvironment` picks texels with probability proportional to their luminance times the solid angle they
+ * cover. The distribution is flattened into a single alias table (Walker 1977, built with Vose's method), so a sample
+ * costs one table lookup and one comparison regardless of resolution.
+ */
+
+#define ENVIRONMENT_TILE_SIZE 16
+
+/// Texel `i` is kept with probability `threshold`, `alias` is taken otherwise.
+typedef struct {
+    f32 threshold;
+    u32 alias;
+} AliasEntry;
+
+typedef struct {
+    u32 width;
+    u32 height;
+    u32 tilesX;
+    /// Tiles of `ENVIRONMENT_TILE_SIZE`^2 RGB texels, row major within a tile and across tiles.
+    f32* texels;
+    /// One entry per texel, NULL for a black image which is never sampled.
+    AliasEntry* alias;
+    /// Sum of the sampling weights of all texels.
+    f64 totalWeight;
+} Environment;
+
+/// Loads a PFM image, or any HDR image `stbi_loadf` reads such as Radiance `.hdr`.
+void LoadEnvironment(const char* path, Environment* environment);
+
+/// Builds an environment from `rgb`, `width * height` linear texels in rows from the top of the image.
+void CreateEnvironment(Environment* environment, const f32* rgb, u32 width, u32 height);
+
+void DestroyEnvironment(Environment* environment);
+
+/// Radiance arriving from `direction`, which does not need to be normalized.
+void EnvironmentRadiance(const Environment* environment, const vec3 direction, vec3 radiance);
+
+/// @returns the solid angle density `SampleEnvironment` picks the normalized `direction` with.
+f32 EnvironmentPdf(const Environment* environment, const vec3 direction);
+
+/// Picks a direction by importance, `random` holds four uniform numbers in [0, 1).
+///
+/// @returns the solid angle density of `direction`, 0 when the environment is black.
+f32 SampleEnvironment(const Environment* environment, const f32 random[4], vec3 direction, vec3 radiance);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+/*
+ * Many-light sampling with a light hierarchy (Conty Estevez and Kulla 2018).
+ *
+ * Lights are kept in a binary tree whose nodes bound the position, total power and emission directions of the lights
+ * below them. Directions are bounded by a cone: `axis` with spread `thetaO` around it, plus `thetaE` beyond which
+ * the surface stops emitting. Point and sphere lights emit everywhere, discs only into the cone of their normal.
+ *
+ * `SampleLightTree` walks from the root and at every node picks a child with probability proportional to how much
+ * light it could at most send towards the shading point, so one light out of N is chosen in O(log N) steps with
+ * close, bright and facing lights preferred. The returned probability is the product of the choices made, and
+ * `LightTreePdf` retraces the same choices to the leaf of a given light.
+ *
+ * Nodes are built by binned SAOH, the surface area heuristic weighted by power and an orientation measure of the
+ * cone, and stored depth first: the left child directly follows its parent. `UpdateLightTree` refits bounds in
+ * place after lights moved and rebuilds once refitting let the tree degrade too far.
+ */
+
+enum LightKind {
+    LightKindPoint,
+    /// One sided, emits into the hemisphere of its normal.
+    LightKindDisc,
+    /// Sampled at its center, stands in for emissive objects seen from further away than their radius.
+    LightKindSphere,
+};
+
+typedef struct {
+    enum LightKind kind;
+    vec3 position;
+    /// Facing direction of discs.
+    vec3 normal;
+    /// Zero for point lights.
+    f32 radius;
+    /// Radiant intensity of point lights, radiance of discs and spheres.
+    vec3 color;
+} Light;
+
+DeclareArray(Light);
+
+/// Where the lights below a node are, how bright they are and where they shine.
+typedef struct {
+    vec3 min;
+    vec3 max;
+    vec3 axis;
+    f32 thetaO;
+    f32 thetaE;
+    f32 power;
+} LightBounds;
+
+typedef struct {
+    LightBounds bounds;
+    /// Cosines of `bounds.thetaO` and `bounds.thetaE` for sampling.
+    f32 cosThetaO;
+    f32 cosThetaE;
+    /// Second child of inner nodes, the light of leaves.
+    u32 index;
+    u32 leaf;
+} LightNode;
+
+DeclareArray(LightNode);
+
+/// Refits beyond this multiple of the cost after the last build trigger a rebuild.
+#define LIGHT_TREE_REBUILD_RATIO 1.5f
+
+typedef struct {
+    /// Owned by the caller, refit or rebuild after changing them.
+    const Light* lights;
+    usize nLights;
+    /// `2 * nLights - 1` nodes, the root first.
+    Array(LightNode) nodes;
+    usize nNodes;
+    /// Light indices partitioned during builds and the bounds of every light.
+    u32* order;
+    LightBounds* lightBounds;
+    /// Leaf node of every light.
+    u32* lightLeaves;
+    /// SAOH cost of all nodes after the last build.
+    f32 builtCost;
+} LightTree;
+
+void CreatePointLight(Light* light, const vec3 position, const vec3 intensity);
+
+void CreateDiscLight(Light* light, const vec3 position, const vec3 normal, f32 radius, const vec3 radiance);
+
+void CreateSphereLight(Light* light, const vec3 position, f32 radius, const vec3 radiance);
+
+/// Allocates a tree for up to `capacity` lights.
+void CreateLightTree(LightTree* tree, usize capacity);
+
+void DestroyLightTree(LightTree* tree);
+
+void BuildLightTree(LightTree* tree, const Light* lights, usize nLights);
+
+/// Refits every node to the current state of the lights, rebuilds when that made the tree too costly.
+///
+/// @returns true when the tree was rebuilt.
+bool UpdateLightTree(LightTree* tree);
+
+/// Picks a light for a surface at `position` facing `normal`, `u` is uniform in [0, 1).
+///
+/// @returns the probability `light` was picked with, 0 when the bounds of the root rule out any light reaching the
+/// surface. Otherwise the probabilities of all lights sum to one.
+f32 SampleLightTree(const LightTree* tree, const vec3 position, const vec3 normal, f32 u, u32* light);
+
+/// @returns the probability `SampleLightTree` picks `light` for a surface at `position` facing `normal`.
+f32 LightTreePdf(const LightTree* tree, const vec3 position, const vec3 normal, u32 light);
+
+/// Point on `light` for direct lighting of `position`.
+///
+/// `radiance` is set to the light arriving at `position` times the inverse of the sampling density, before the cosine
+/// at the receiver and visibility. Occluders have to be searched up to `distance` along `direction`.
+///
+/// @returns false when the sample carries no light.
+bool SampleLight(const Light* light, const vec3 position, f32 u, f32 v, vec3 direction, f32* distance, vec3 radiance);
+
+/// Fills `lights` with a random mix of point lights, downward facing discs and small spheres in the box around the
+/// instance grids of `SceneNxN`, sharing `totalPower` evenly.
+void ScatterLights(Light* lights, usize nLights, u64 seed, f32 totalPower);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+
+#include "renderer.h"
+#include "obj.h"
+
+/*
+ * Loads meshes on a pool of background threads.
+ *
+ * Every loader thread claims the next unclaimed path, parses it (and optionally welds close positions, optimizes,
+ * simplifies, quantizes and tiles its texture, see `MeshLoaderConfig`) into its slot of `meshes` and queues the mesh
+ * id as ready. Meshes become ready in completion order, not in path order, so the caller can publish each one (GL
+ * upload, BLAS build, instance attach) while the rest are still being parsed.
+ *
+ * A slot is written only by the thread loading it and read by the caller only after its id has been returned by
+ * `PollLoadedMesh` or `WaitLoadedMesh`.
+ */
+
+typedef struct {
+    const char* const* paths;
+    usize nThreads;
+    /// Merges positions closer than this before welding corners, see `LoadOBJWelded`, NULL only welds identical
+    /// corners.
+    const f32* weldEpsilon;
+    /// Reorders meshes for cache efficiency after loading, NULL keeps the file order.
+    const MeshOptimizeParams* optimize;
+    /// Also fills `Mesh.compact` and frees the full precision vertices of `Mesh.obj`, see `vertex_format.h`.
+    bool compactVertices;
+    /// Generates `Mesh.lods`, NULL keeps only full resolution.
+    const LodParams* lods;
+    /// Converts the diffuse map of every mesh with texture coordinates into `Mesh.albedoTexture`, see `texture.h`.
+    bool textures;
+} MeshLoaderConfig;
+
+typedef struct {
+    MeshLoaderConfig config;
+    Meshes meshes;
+    pthread_t* threads;
+    usize nThreads;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    /// Next path to be claimed by a loader thread.
+    usize nextPath;
+    /// Ids of loaded meshes in completion order, `[nTaken, nReady)` are not yet handed to the caller.
+    usize* ready;
+    usize nReady;
+    usize nTaken;
+} MeshLoader;
+
+/// Starts loading `config.paths[i]` into `meshes.data[i]` for every slot of `meshes`.
+void StartMeshLoader(MeshLoader* loader, Meshes meshes, MeshLoaderConfig config);
+
+/// @returns false without blocking when no mesh finished loading since the last call.
+bool PollLoadedMesh(MeshLoader* loader, usize* meshId);
+
+/// Blocks until the next mesh finished loading.
+///
+/// @returns false once every mesh has been handed out.
+bool WaitLoadedMesh(MeshLoader* loader, usize* meshId);
+
+/// @returns true when every mesh has been handed out by `PollLoadedMesh` or `WaitLoadedMesh`.
+bool MeshLoaderDone(const MeshLoader* loader);
+
+/// Waits for the loader threads, meshes which were not handed out yet stay loaded.
+void StopMeshLoader(MeshLoader* loader);
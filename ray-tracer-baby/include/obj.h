@@ -20,12 +20,117 @@ typedef struct Obj {
 	usize nIndices;
 	Vertex* vertices;
 	u16* indices;
+	/// One per vertex with v pointing up the image, NULL unless every polygon of the model has texture coordinates.
+	TexCoord* texCoords;
+	/// Path of the diffuse map (`map_Kd`) of the model's material library, NULL when there is none.
+	char* albedoTexture;
 } Obj;
 
+/// Wall time of `LoadOBJTimed` stages in nanoseconds.
+typedef struct ObjLoadTimings {
+	u64 parseNs;
+	u64 processNs;
+} ObjLoadTimings;
+
+/// Vertex cache and fetch efficiency of an index buffer, see `AnalyzeOBJ`.
+typedef struct MeshStats {
+	/// Vertex shader invocations per triangle with a FIFO post-transform cache, 0.5 to 3.
+	f32 acmr;
+	/// Vertex shader invocations per unique vertex, 1 is ideal.
+	f32 atvr;
+	/// Bytes read from the vertex buffer per byte of vertex data through a 16 KiB cache, 1 is ideal.
+	f32 overfetch;
+} MeshStats;
+
+enum VertexOrder {
+	VertexOrderUnchanged,
+	/// Order in which the index buffer first references each vertex.
+	VertexOrderFirstUse,
+	/// Morton curve over quantized positions.
+	VertexOrderMorton,
+};
+
+/// Options of `OptimizeOBJ`.
+typedef struct MeshOptimizeParams {
+	/// Tipsify triangle reordering for a FIFO post-transform cache.
+	bool reorderTriangles;
+	/// Draw outward facing triangle clusters first to reduce overdraw, needs `reorderTriangles`.
+	bool sortClusters;
+	/// One of `VertexOrder`.
+	u32 vertexOrder;
+	/// Cache size targeted by triangle reordering, 0 selects the default of 16.
+	u32 cacheSize;
+} MeshOptimizeParams;
+
+#define MESH_OPTIMIZE_DEFAULTS (MeshOptimizeParams) { \
+	.reorderTriangles = true,                      \
+	.sortClusters = true,                          \
+	.vertexOrder = VertexOrderFirstUse,            \
+	.cacheSize = 0,                                \
+}
+
+typedef struct MeshOptimizeReport {
+	MeshStats before;
+	MeshStats after;
+	u32 nClusters;
+	u64 optimizeNs;
+} MeshOptimizeReport;
+
+/// Options of `GenerateLODs`.
+typedef struct LodParams {
+	/// Number of simplified levels generated at most.
+	u32 maxLevels;
+	/// Triangle count of every level relative to the previous one.
+	f32 reduction;
+	/// Largest error of any level relative to the largest extent of the mesh bounds.
+	f32 maxError;
+} LodParams;
+
+#define LOD_DEFAULTS (LodParams) { \
+	.maxLevels = 4,               \
+	.reduction = 0.5f,            \
+	.maxError = 0.05f,            \
+}
+
+/// Simplified index buffer of an `Obj`, indexing its vertex buffer.
+typedef struct ObjLod {
+	usize nIndices;
+	u16* indices;
+	/// Largest distance the surface moved from the full resolution mesh, in mesh units.
+	f32 error;
+} ObjLod;
+
 void LoadOBJ(const char* path, Obj* obj);
 
+void LoadOBJTimed(const char* path, Obj* obj, ObjLoadTimings* timings);
+
+/// Like `LoadOBJTimed`, first merging positions closer than `epsilon` to close duplicated seams of scans.
+///
+/// `epsilon` of 0 only welds corners with identical indices, `timings` may be NULL.
+void LoadOBJWelded(const char* path, f32 epsilon, Obj* obj, ObjLoadTimings* timings);
+
 void FreeOBJ(Obj obj);
 
+/// Frees the vertex buffer of `obj` once nothing reads it anymore, `vertices` becomes NULL and `FreeOBJ` skips it.
+void FreeOBJVertices(Obj* obj);
+
+/// Simulates a post-transform cache of `cacheSize` entries, 0 selects the default of 16, over the index buffer.
+void AnalyzeOBJ(const Obj* obj, u32 cacheSize, MeshStats* stats);
+
+/// Reorders triangles and vertices of `obj` in place, the mesh itself is unchanged.
+///
+/// `report` may be NULL, statistics are always taken with a 16 entry cache.
+void OptimizeOBJ(Obj* obj, MeshOptimizeParams params, MeshOptimizeReport* report);
+
+/// Builds a chain of quadric error edge collapse simplifications of `obj`, coarsest last.
+///
+/// Levels only reference existing vertices so they share the vertex buffer of `obj`. `lods` has to hold
+/// `params.maxLevels` entries, free each written level with `FreeLOD`.
+/// @returns the number of levels written, fewer than requested once a level no longer simplifies much.
+u32 GenerateLODs(const Obj* obj, LodParams params, ObjLod* lods);
+
+void FreeLOD(ObjLod lod);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <cmm/cmm.h>
+#include <embree3/rtcore.h>
+
+#include "renderer.h"
+#include "obj.h"
+
+/*
+ * Triangle meshes traced out of core, paged in cluster by cluster from a file.
+ *
+ * `WritePagedMesh` bakes instances of a mesh into world space and writes them as clusters of up to
+ * `PAGED_MESH_CLUSTER_TRIANGLES` triangles, consecutive along a Morton curve over the mesh so every cluster is
+ * compact. The file holds a header, the table of cluster bounds and then one `PAGED_MESH_PAGE_BYTES` page per
+ * cluster. Triangles are stored as three corners each, a cluster needs nothing but its own page.
+ *
+ * `OpenPagedMesh` reads the header and cluster table, the only parts kept resident, and maps the pages read only.
+ * Attached to a scene the mesh is an Embree user geometry with one primitive per cluster, so the BVH Embree builds
+ * over cluster bounds is the resident top level. Rays reaching a cluster intersect its triangles straight from the
+ * mapping, faulting its page in on first touch.
+ *
+ * Resident pages are capped by a budget. Clusters are tracked by CLOCK like tiles of the texture cache: touching a
+ * cluster sets its reference bit, and paging one in beyond the budget drops the first cluster the hand finds
+ * unreferenced with `MADV_DONTNEED`. Pages are only ever read, so a ray still inside an evicted cluster just faults
+ * it in again.
+ */
+
+#define PAGED_MESH_VERSION 1
+#define PAGED_MESH_PAGE_BYTES 4096
+/// Slot of a cluster not paged in.
+#define PAGED_MESH_NOT_RESIDENT UINT32_MAX
+/// Cluster of something other than the paged mesh.
+#define PAGED_MESH_NO_CLUSTER UINT32_MAX
+
+typedef struct {
+    Position corners[3];
+} PagedTriangle;
+
+#define PAGED_MESH_CLUSTER_TRIANGLES (PAGED_MESH_PAGE_BYTES / sizeof(PagedTriangle))
+
+typedef struct {
+    f32 lower[3];
+    u32 nTriangles;
+    f32 upper[3];
+    u32 reserved;
+} PagedCluster;
+
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 pageBytes;
+    u64 nClusters;
+    u64 nTriangles;
+    /// Offset of the first cluster page, the cluster table follows the header.
+    u64 firstPage;
+} PagedMeshHeader;
+
+typedef struct {
+    i32 fd;
+    /// Read only mapping of every cluster page.
+    const u8* pages;
+    usize pagesBytes;
+    PagedCluster* clusters;
+    usize nClusters;
+    u64 nTriangles;
+    /// Geometry id in the scenes the mesh is attached to, see `AttachPagedMesh`.
+    u32 geomId;
+
+    pthread_mutex_t lock;
+    /// Clusters resident at most.
+    usize nSlots;
+    /// Cluster held by every slot, slots `[0, nResident)` are in use.
+    u32* slotClusters;
+    usize nResident;
+    usize hand;
+    /// Slot of every cluster, `PAGED_MESH_NOT_RESIDENT` while it is not paged in.
+    _Atomic u32* clusterSlots;
+    /// CLOCK reference bit of every cluster, set on every touch.
+    _Atomic u8* referenced;
+    u64 nPageIns;
+    u64 nEvictions;
+    usize peakResident;
+} PagedMesh;
+
+typedef struct {
+    u64 nPageIns;
+    u64 nEvictions;
+    usize residentBytes;
+    usize peakResidentBytes;
+    usize budgetBytes;
+    /// Cluster table and CLOCK state, resident however small the budget.
+    usize tableBytes;
+} PagedMeshStats;
+
+/// Bakes one copy of `obj` per entry of `instances` into `path`.
+///
+/// Works through one instance at a time, so only `obj` and a single baked copy are ever in memory.
+void WritePagedMesh(const char* path, const Obj* obj, Instances instances);
+
+/// Opens a mesh written by `WritePagedMesh` with at most `budgetBytes` of cluster pages resident, 0 for no limit.
+void OpenPagedMesh(const char* path, usize budgetBytes, PagedMesh* mesh);
+
+void ClosePagedMesh(PagedMesh* mesh);
+
+/// Adds the mesh as one user geometry to each of `scenes`, commit them afterwards.
+///
+/// Attach it to empty scenes so its geometry id, recorded in `mesh->geomId`, agrees between all of them.
+void AttachPagedMesh(RTCDevice device, const RTCScene* scenes, usize nScenes, PagedMesh* mesh);
+
+/// Marks `cluster` referenced, paging it in first when it is not resident.
+///
+/// @returns the triangles of `cluster`, which stay readable even if another thread evicts it meanwhile.
+const PagedTriangle* TouchPagedCluster(PagedMesh* mesh, u32 cluster);
+
+/// Drops every resident page and resets the counters, for measurements starting cold.
+void EvictPagedMesh(PagedMesh* mesh);
+
+void GetPagedMeshStats(PagedMesh* mesh, PagedMeshStats* stats);
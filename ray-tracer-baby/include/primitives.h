@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "attributes.h"
+#include "arena.h"
+#include "obj.h"
+
+/*
+ * Analytic primitives traced without tessellation.
+ *
+ * Spheres and discs map onto embree's point geometries, quads are parallelograms traced as embree quads, all of
+ * them report exact geometric normals. Primitive arrays are laid out the way embree reads them and shared with it
+ * in place, so a sphere costs 16 bytes plus a 2 byte material index instead of a tessellated mesh and its BVH.
+ *
+ * The rasterizer draws every kind as instances of one low poly proxy mesh, see `PrimitiveProxy`.
+ */
+
+enum PrimitiveKind {
+    PrimitiveKindSphere,
+    PrimitiveKindDisc,
+    PrimitiveKindQuad,
+    PrimitiveKindCount,
+};
+
+/// `RTC_FORMAT_FLOAT4` point with its radius.
+typedef struct {
+    f32 x, y, z;
+    f32 radius;
+} SpherePrimitive;
+
+/// `RTC_FORMAT_FLOAT4` point with its radius followed by the `RTC_FORMAT_FLOAT3` disc normal.
+typedef struct {
+    f32 x, y, z;
+    f32 radius;
+    Normal normal;
+} DiscPrimitive;
+
+/// Parallelogram spanned by `edgeU` and `edgeV` from `origin`, facing `edgeU x edgeV`.
+typedef struct {
+    Position origin;
+    Position edgeU;
+    Position edgeV;
+} QuadPrimitive;
+
+typedef struct {
+    usize counts[PrimitiveKindCount];
+    SpherePrimitive* spheres;
+    DiscPrimitive* discs;
+    QuadPrimitive* quads;
+    /// Index into `RayTracer.primitiveMaterials` of every primitive of every kind.
+    u16* materials[PrimitiveKindCount];
+    /// Geometry id of every kind in the scenes it is attached to, see `AttachPrimitives`.
+    u32 geomIds[PrimitiveKindCount];
+} Primitives;
+
+/// @returns bytes `CreatePrimitives` takes from an arena, including alignment slack.
+usize PrimitivesArenaSize(usize nSpheres, usize nDiscs, usize nQuads);
+
+/// Allocates the primitive arrays from `arena`, filling them is up to the caller.
+Primitives CreatePrimitives(Arena* arena, usize nSpheres, usize nDiscs, usize nQuads);
+
+/// Model matrix mapping the proxy of `kind` onto primitive `i`.
+void PrimitiveTransform(const Primitives* primitives, enum PrimitiveKind kind, usize i, mat4 model);
+
+#define PRIMITIVE_PROXY_MAX_VERTICES 42
+#define PRIMITIVE_PROXY_MAX_INDICES 240
+
+/// Low poly mesh of the unit primitive of `kind`: an 80 triangle sphere of radius 1, a 16 sided disc of radius 1
+/// in the xy plane or the square [0, 1]^2, both facing +z.
+///
+/// @returns an `Obj` viewing `vertices` and `indices`, which hold `PRIMITIVE_PROXY_MAX_*` entries.
+Obj PrimitiveProxy(enum PrimitiveKind kind, Vertex* vertices, u16* indices);
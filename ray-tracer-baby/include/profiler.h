@@ -0,0 +1,114 @@
+#pragma once
+
+#include <time.h>
+
+#include <cmm/cmm.h>
+
+/*
+ * Per thread counters and timed events.
+ *
+ * Each thread writes only to its own `ProfilerThread`, so recording needs neither locks nor atomics.
+ * Events go to a fixed size ring buffer which overwrites the oldest entries when full.
+ * Threads register lazily on first use; registration is the only synchronized operation.
+ *
+ * The slot of a thread that exited is taken over by the next thread registering, preferably one of the same name,
+ * which keeps adding to its counters and ring. Threads started per frame thus show up as one track each instead of
+ * using up slots. Beyond `PROFILE_MAX_THREADS` threads alive at once the rest go unrecorded, with a warning.
+ *
+ * Enabled with `-D_PROFILING`, otherwise every macro compiles to nothing.
+ */
+
+/// Monotonic wall clock in seconds, for timings that are reported whether or not profiling is enabled.
+static inline f64 NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+#define PROFILE_RING_CAPACITY ((usize)1 << 16)
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_MAX_THREADS 256
+#define PROFILE_UNLISTED SIZE_MAX
+
+enum ProfileCounter {
+    ProfileCounterRays,
+    ProfileCounterPrimaryRays,
+    ProfileCounterRngDraws,
+    ProfileCounterIntersectTicks,
+    ProfileCounterTraceTicks,
+    ProfileCounterTiles,
+    ProfileCounterPagedClusters,
+    ProfileCounterCount,
+};
+
+typedef struct {
+    const char* name;
+    u64 start;
+    u64 end;
+} ProfileEvent;
+
+typedef struct {
+    /// Slot in the profiler, `PROFILE_UNLISTED` for threads beyond `PROFILE_MAX_THREADS`.
+    usize id;
+    const char* name;
+    /// The thread owning the slot exited, the next thread registering may take it over.
+    bool exited;
+    u64 counters[ProfileCounterCount];
+    u64 raysPerDepth[PROFILE_MAX_DEPTH];
+    usize head;
+    ProfileEvent events[PROFILE_RING_CAPACITY];
+} ProfilerThread;
+
+#ifdef _PROFILING
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TICKS() __rdtsc()
+#else
+#define PROFILE_TICKS() ProfileNow()
+#endif
+
+extern _Thread_local ProfilerThread* ProfilerCurrent;
+
+ProfilerThread* ProfilerRegisterThread(const char* name);
+
+/// @returns monotonic time in nanoseconds.
+u64 ProfileNow(void);
+
+static inline ProfilerThread* ProfilerLocal(void) {
+    return ProfilerCurrent != NULL ? ProfilerCurrent : ProfilerRegisterThread(NULL);
+}
+
+static inline void ProfileRecord(const char* const name, const u64 start, const u64 end) {
+    ProfilerThread* const thread = ProfilerLocal();
+    thread->events[thread->head & (PROFILE_RING_CAPACITY - 1)] = (ProfileEvent) { name, start, end };
+    thread->head += 1;
+}
+
+#define PROFILE_THREAD(name) ProfilerRegisterThread(name)
+#define PROFILE_COUNT(counter, n) (ProfilerLocal()->counters[counter] += (n))
+#define PROFILE_RAY(depth) (ProfilerLocal()->raysPerDepth[(depth) < PROFILE_MAX_DEPTH ? (depth) : PROFILE_MAX_DEPTH - 1] += 1)
+/// Opens a timed event, must be closed with `PROFILE_END` in the same scope.
+#define PROFILE_BEGIN(var) const u64 var = (ProfilerLocal(), ProfileNow())
+#define PROFILE_END(name, var) ProfileRecord(name, var, ProfileNow())
+/// Cheap cycle based timers for the per-ray hot path, accumulated into a counter instead of events.
+#define PROFILE_TICKS_BEGIN(var) const u64 var = PROFILE_TICKS()
+#define PROFILE_TICKS_END(counter, var) PROFILE_COUNT(counter, PROFILE_TICKS() - (var))
+
+#else
+
+#define PROFILE_THREAD(name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_RAY(depth) ((void)0)
+#define PROFILE_BEGIN(var) ((void)0)
+#define PROFILE_END(name, var) ((void)0)
+#define PROFILE_TICKS_BEGIN(var) ((void)0)
+#define PROFILE_TICKS_END(counter, var) ((void)0)
+
+#endif
+
+/// Prints counters summed over all registered threads.
+void ProfilerReport(void);
+
+/// Writes all recorded events as Chrome / Perfetto trace JSON (`chrome://tracing`, ui.perfetto.dev).
+void ProfilerWriteChromeTrace(const char* path);
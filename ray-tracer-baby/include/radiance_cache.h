@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+/*
+ * World space cache of the light arriving at diffuse surfaces, so paths can end early instead of bouncing on.
+ *
+ * Records live in a hash grid keyed by the cell of side `cellSize` a hit falls into and one of
+ * `RADIANCE_CACHE_NORMAL_BINS`^2 octahedral bins of its normal, so the two sides of a thin wall or surfaces facing
+ * apart never share a record. A record holds the mean, over every path that passed through it, of the light gathered
+ * along cosine distributed directions. That is irradiance / pi: a diffuse surface of albedo `a` reflects `a` times it,
+ * which keeps records valid under any texture.
+ *
+ * Records fill progressively. Paths reaching a record with fewer than `RADIANCE_CACHE_MIN_SAMPLES` continue as usual
+ * and feed everything they gather further down back into it, paths reaching a converged one end there. Until
+ * `RADIANCE_CACHE_MAX_SAMPLES` one path in `RADIANCE_CACHE_TRAIN_RATIO` keeps training it anyway, so records kept
+ * across frames keep getting less noisy.
+ *
+ * All render threads share one cache without locks. Slots are claimed by a compare and swap of their key and sums
+ * are added by compare and swap loops, so concurrent updates are never lost. A reader may see a sum and a count from
+ * slightly different moments, which only adds a little noise.
+ */
+
+#define RADIANCE_CACHE_NORMAL_BINS 4
+/// Slots probed linearly from the hashed one before a hit goes without a record.
+#define RADIANCE_CACHE_PROBES 16
+#define RADIANCE_CACHE_MIN_SAMPLES 32
+#define RADIANCE_CACHE_MAX_SAMPLES 1024
+#define RADIANCE_CACHE_TRAIN_RATIO 8
+/// Returned instead of a record when none could be placed.
+#define RADIANCE_CACHE_NONE UINT32_MAX
+
+typedef struct {
+    /// Packed cell and normal bin with the top bit set, 0 for a free slot.
+    _Atomic u64 key;
+    /// Bits of the f32 sums of red, green and blue.
+    _Atomic u32 sum[3];
+    /// Paths that finished after passing through the record.
+    _Atomic u32 nSamples;
+} RadianceRecord;
+
+typedef struct {
+    RadianceRecord* records;
+    /// Power of two.
+    usize capacity;
+    f32 cellSize;
+    /// Paths look the cache up at the hit after this many bounces, 1 after the first diffuse bounce.
+    u32 depth;
+} RadianceCache;
+
+void CreateRadianceCache(RadianceCache* cache, usize capacity, f32 cellSize, u32 depth);
+
+void DestroyRadianceCache(RadianceCache* cache);
+
+/// Forgets every record, for when the scene changed. Not safe while rendering.
+void ResetRadianceCache(RadianceCache* cache);
+
+/// Finds the record of a hit at `position` facing `normal`, claiming a free slot for it when there is none yet.
+///
+/// @returns `RADIANCE_CACHE_NONE` when every probed slot belongs to other records.
+u32 FindRadianceRecord(RadianceCache* cache, const vec3 position, const vec3 normal);
+
+u32 RadianceRecordSamples(const RadianceCache* cache, u32 record);
+
+/// Mean of `record`, zero while it has no samples.
+void RadianceRecordMean(const RadianceCache* cache, u32 record, vec3 radiance);
+
+/// Adds light a path gathered after passing through `record`, divided by the throughput it had there.
+void AddRecordRadiance(RadianceCache* cache, u32 record, const vec3 radiance);
+
+/// Counts one finished path towards the mean of `record`.
+void CountRecordSample(RadianceCache* cache, u32 record);
+
+/// @returns the number of claimed slots, not exact while rendering.
+usize RadianceCacheRecords(const RadianceCache* cache);
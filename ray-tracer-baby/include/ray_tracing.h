@@ -6,6 +6,39 @@
 
 #include "renderer.h"
 #include "attributes.h"
+#include "arena.h"
+#include "vertex_format.h"
+#include "texture.h"
+#include "primitives.h"
+#include "lights.h"
+#include "environment.h"
+#include "radiance_cache.h"
+#include "paged_mesh.h"
+#include "accel_scene.h"
+
+/// How direct lighting picks the light it samples.
+enum LightSelection {
+    /// By importance, see `SampleLightTree`.
+    LightSelectionTree,
+    /// Every light equally likely, the baseline the tree is measured against.
+    LightSelectionUniform,
+};
+
+/// What `RenderRange` computes per pixel, every mode but `IntegratorPath` shades the first hit only.
+enum Integrator {
+    /// Diffuse paths of up to `nMaxReflections` bounces, see `TraceRays`.
+    IntegratorPath,
+    /// Albedo of the first hit.
+    IntegratorAlbedo,
+    /// Shading normal of the first hit mapped from [-1, 1] to [0, 1].
+    IntegratorNormal,
+    /// `1 / (1 + t)` of the first hit, near is bright.
+    IntegratorDepth,
+    /// Fraction of `nAoSamples` cosine distributed shadow rays unoccluded within `aoDistance`.
+    IntegratorAmbientOcclusion,
+    /// Albedo times one sample of the lights and one of the sky, without reflections.
+    IntegratorDirect,
+};
 
 enum MaterialType {
     MaterialTypeLambertian,
@@ -23,6 +56,8 @@ typedef struct {
 typedef struct {
     enum MaterialType type;
     vec3 albedo;
+    /// Multiplies `albedo` at the hit's texture coordinates, NULL for a flat color.
+    const Texture* albedoTexture;
     union {
         LambertianMaterial lambertian;
         MetallicMaterial metallic;
@@ -40,16 +75,216 @@ typedef struct {
     Rgb256 *buffer;
 } Buffer2d;
 
+/*
+ * Linear per pixel outputs of the integrator (arbitrary output variables).
+ *
+ * `color` holds the mean radiance before tonemapping. Albedo, normal and depth describe the first hit of the
+ * camera ray and guide the denoiser, escaped rays record the sky color as albedo with zero normal and depth.
+ *
+ * For progressive rendering `sum` and `nSamples` keep the running radiance sum and sample count per pixel,
+ * `color` is then the mean over every sample so far. Both are NULL unless set up by `CreateAccumulation`.
+ */
+typedef struct {
+    usize width;
+    usize height;
+    vec3* color;
+    vec3* albedo;
+    vec3* normal;
+    f32* depth;
+    vec3* sum;
+    u32* nSamples;
+} Aovs;
+
+/// Intersection result of a single ray, only what shading reads back.
+typedef struct {
+    f32 t;
+    /// Barycentrics of the hit within the triangle.
+    f32 u;
+    f32 v;
+    u32 primID;
+    u32 geomID;
+    u32 instID;
+    /// Geometric normal, see `EncodeOctahedral`.
+    u32 normal;
+    /// Level of detail the ray was traced against, 0 is full resolution.
+    u32 lod;
+} HitRecord;
+
+_Static_assert(sizeof(HitRecord) == 32, "HitRecord should fit two per cache line");
+
 typedef struct {
     RTCScene rtcScene;
     Array(Material) materials;
     usize nRaysPerSample;
     vec3 skyColor;
     usize nMaxReflections;
+    /// Samples are drawn from streams derived from this seed, the pixel and its sample count.
+    u64 seed;
+    /// Vertex normals and indices of the instanced mesh for smooth shading, NULL shades with geometric normals.
+    const CompactMesh* mesh;
+    const u16* indices;
+    /// Coarser copies of `rtcScene`, `lodScenes[l]` instances level `l + 1` of every mesh, see `IntersectRays`.
+    const RTCScene* lodScenes;
+    /// Largest world space error of every scene of `lodScenes`, increasing.
+    const f32* lodErrors;
+    /// Indices of `mesh` at every level of `lodScenes`.
+    const u16* const* lodIndices;
+    usize nLods;
+    /// Error allowed per unit of ray cone width, the counterpart of `RendererConfig.lodErrorPixels`.
+    f32 lodBudget;
+    /// Positions and texture coordinates of the instanced mesh for textured materials, NULL ignores
+    /// `Material.albedoTexture`. Positions are decoded from `mesh` instead when it is set.
+    const Vertex* vertices;
+    const TexCoord* texCoords;
+    /// Pages in the tiles of every `Material.albedoTexture`.
+    TextureCache* textureCache;
+    /// Scale of the (uniformly scaled) instances, converts mesh space areas to world space for mip selection.
+    f32 meshScale;
+    /// Analytic primitives attached to `rtcScene` and every scene of `lodScenes`, NULL without any.
+    const Primitives* primitives;
+    /// Materials indexed by `Primitives.materials`.
+    const Material* primitiveMaterials;
+    /// First hit of the camera ray of every pixel of the rendered buffers, row major, see `RasterizeVisibility`.
+    /// Primary rays are traced when NULL.
+    const HitRecord* primaryHits;
+    /// Lights sampled at every diffuse bounce, NULL leaves the sky as the only light.
+    const LightTree* lights;
+    enum LightSelection lightSelection;
+    /// Lights escaped paths and is sampled at every diffuse bounce, NULL shows a gradient up to `skyColor`.
+    const Environment* environment;
+    /// Shared by every worker and filled while rendering, paths end in its converged records at `depth`. NULL traces
+    /// every path to the end.
+    RadianceCache* radianceCache;
+    /// Out of core mesh attached to `rtcScene` and every scene of `lodScenes`, NULL without one. Its hits are shaded
+    /// with `pagedMaterial` and geometric normals.
+    const PagedMesh* pagedMesh;
+    const Material* pagedMaterial;
+    /// Traces the paths of a queue grouped by the cluster of `pagedMesh` they leave, see `IntersectRays`.
+    bool sortByCluster;
+    /// Traces rays through our own BVH instead of `rtcScene` when not NULL. It only holds the instanced mesh, so
+    /// levels of detail, primitives and the paged mesh need Embree.
+    const AccelScene* accelScene;
+    enum Integrator integrator;
+    /// Shadow rays per pixel sample and their length for `IntegratorAmbientOcclusion`.
+    u32 nAoSamples;
+    f32 aoDistance;
 } RayTracer;
 
+/// Per worker ray counters, accumulated without synchronization.
+typedef struct {
+    usize nPrimaryRays;
+    usize nRays;
+    /// Rays of `nRays` which selected a simplified level, full resolution ones are not counted. Shadow rays are
+    /// not part of either count.
+    usize nLodRays;
+    /// Wall time spent in `IntersectRays`, without generating or shading the rays.
+    f64 intersectSec;
+} RayStats;
+
+/*
+ * Paths in flight, stored as structure of arrays.
+ *
+ * Each component lives in its own cache line aligned array so shading loops over a single attribute can be
+ * vectorized. `pixel` indexes the radiance buffer the path contributes to and `depth` counts its bounces.
+ *
+ * `coneWidth` is the width of the ray cone through the path's pixel at the current origin. It grows by
+ * `pixelSpread` per unit of distance travelled, bounces are assumed not to widen it further, which keeps level
+ * of detail selection conservative.
+ */
+typedef struct {
+    usize len;
+    usize capacity;
+    f32* orgX;
+    f32* orgY;
+    f32* orgZ;
+    f32* dirX;
+    f32* dirY;
+    f32* dirZ;
+    f32* throughputR;
+    f32* throughputG;
+    f32* throughputB;
+    u32* pixel;
+    u32* depth;
+    f32* coneWidth;
+    /// Solid angle density the last bounce was sampled with, 0 for camera rays and mirrors, see `PowerHeuristic`.
+    f32* bsdfPdf;
+    /// Radiance cache record the path trains, `RADIANCE_CACHE_NONE` for none, and its throughput since the record.
+    u32* cacheRecord;
+    f32* cacheThroughputR;
+    f32* cacheThroughputG;
+    f32* cacheThroughputB;
+    /// Cluster of `RayTracer.pagedMesh` the path leaves, `PAGED_MESH_NO_CLUSTER` when it leaves anything else.
+    u32* cluster;
+    /// Scratch of `IntersectRays` ordering paths by `cluster`.
+    u64* traceOrder;
+    /// Angle between neighbouring primary rays.
+    f32 pixelSpread;
+} RayQueue;
+
 void CreateLambertian(Material* material, const vec3 albedo, f32 matte);
 
 void CreateMetallic(Material* material, const vec3 albedo, f32 roughness);
 
-void TraceRay(const RayTracer* rayTracer, struct RTCRayHit* ray, usize nReflections, vec3 outColor);
+/// @returns bytes `CreateRayQueue` takes from an arena.
+usize RayQueueArenaSize(usize capacity);
+
+/// Allocates storage for `capacity` paths from `arena`.
+RayQueue CreateRayQueue(Arena* arena, usize capacity);
+
+/// Appends a primary path with unit throughput.
+void PushRay(RayQueue* queue, const vec3 origin, const vec3 direction, u32 pixel);
+
+/// Intersects every path of `queue` with the scene, `hits` has to hold `queue->len` records.
+///
+/// With `sortByCluster` paths are traced in order of the cluster they leave instead of queue order. Paths leaving one
+/// cluster mostly reach the same few next, so each page in is shared by a run of rays rather than repeated whenever
+/// the budget evicted the page between two of them. Hits are stored at queue order either way.
+///
+/// With an `accelScene` the queue is traced through it in batches instead, reporting the ids Embree would.
+void IntersectRays(const RayTracer* rayTracer, const RayQueue* queue, HitRecord* hits, RayStats* stats);
+
+/// Per pixel sums paths of a queue contribute to, indexed by `RayQueue.pixel`.
+typedef struct {
+    vec3* radiance;
+    /// First hit attributes, see `Aovs`.
+    vec3* albedo;
+    vec3* normal;
+    f32* depth;
+} PathOutputs;
+
+/// Adds the contribution of escaped paths and of one light per hit to `outputs` and scatters the rest.
+///
+/// With an importance sampled environment its light reaches diffuse hits along two strategies, sampled directly and
+/// through escaping reflections, both weighted by the power heuristic.
+///
+/// With a radiance cache diffuse paths end in its record at `RadianceCache.depth` once the record converged, until then
+/// they train it with everything they gather further on.
+///
+/// Terminated paths are removed and survivors compacted to the front of the queue.
+void ShadeRays(const RayTracer* rayTracer, RayQueue* queue, const HitRecord* hits, const PathOutputs* outputs);
+
+/// Bounces all paths of `queue` until they escape or reach `nMaxReflections`, leaves the queue empty.
+void TraceRays(const RayTracer* rayTracer, RayQueue* queue, HitRecord* hits, const PathOutputs* outputs, RayStats* stats);
+
+/// Shades the first hit of every path of `queue` with one of the preview integrators, see `Integrator`.
+///
+/// Fills `outputs` like the first bounce of `ShadeRays` would and leaves the queue empty. Ambient occlusion traces its
+/// shadow rays in packets of eight with `rtcOccluded8`, one at a time through a paged mesh.
+void ShadePreview(const RayTracer* rayTracer, RayQueue* queue, const HitRecord* hits, const PathOutputs* outputs);
+
+/// @returns bytes `CreateAovs` takes from an arena.
+usize AovsArenaSize(usize width, usize height);
+
+Aovs CreateAovs(Arena* arena, usize width, usize height);
+
+/// @returns bytes `CreateAccumulation` takes from an arena.
+usize AccumulationArenaSize(usize width, usize height);
+
+/// Allocates zeroed running sums for progressive rendering into `aovs`.
+void CreateAccumulation(Arena* arena, Aovs* aovs);
+
+/// Discards every accumulated sample, for when the scene changed under a progressive render.
+void ResetAccumulation(Aovs* aovs);
+
+/// Clamps linear `color` to [0, 1] and quantizes it into `framebuffer`.
+void Tonemap(const vec3* color, Buffer2d framebuffer);
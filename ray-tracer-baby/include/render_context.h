@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <embree3/rtcore.h>
+
+#include "renderer.h"
+#include "ray_tracing.h"
+#include "progress_bar.h"
+#include "worker_pool.h"
+#include "topology.h"
+#include "obj.h"
+#include "arena.h"
+
+/*
+ * Self contained renderers for embedding the tracer.
+ *
+ * The interactive application keeps its state in process globals (`Renderer`, `AppState`, `Config` and the instance
+ * store of the rasterizer), so there is one scene per process. A `RenderContext` owns everything one scene needs
+ * instead: its top level scene, instances, materials, tracer settings and frame buffers. Any number of contexts can
+ * live in one process and render concurrently from different threads.
+ *
+ * Contexts are the interface for embedding and offline rendering (`bench --context-report`), the application is not
+ * built on them. They trace fully loaded meshes at full resolution into a fresh frame; progressive loading, levels
+ * of detail, the rasterizer, paged meshes and checkpoints remain the application's. The application shares only the
+ * `RenderShared` part: its device and worker pool.
+ *
+ * What contexts share lives in `RenderShared`: the Embree device, a `WorkerPool` running the frames of every
+ * context, and `SharedMesh`es, meshes parsed and built into a BVH once and only read after that. Contexts instance
+ * shared meshes into their own scene. Frames are cut into bands of `TILE_SIZE` rows queued on the pool, so bands of
+ * concurrent frames interleave on the workers instead of every context starting threads of its own.
+ *
+ * The device leaves BVH builds to the pool. It starts no build threads of its own and `CommitSharedScene` has every
+ * worker join the build with `rtcJoinCommitScene`, so building and tracing share the same threads instead of
+ * oversubscribing the cores. Scenes committed with plain `rtcCommitScene` build on the calling thread alone.
+ *
+ * On machines with several NUMA nodes workers can be pinned, spread round robin over the nodes, and read only data
+ * replicated per node: every shared mesh and context scene then exists once per node the pool runs on, built by
+ * workers of that node so its geometry and BVH are placed in local memory, and every band traces the copy of the
+ * node it runs on. Materials and frame buffers are not replicated.
+ *
+ * Usage: `CreateRenderShared`, `LoadSharedMesh` per mesh, then per scene `CreateRenderContext`,
+ * `AddContextInstances` and `RenderContextToBuffer` as often as needed. Destroy contexts before the meshes they
+ * instance and those before `RenderShared`.
+ */
+
+/// Copies of read only scene data at most, one per NUMA node.
+#define MAX_REPLICAS TOPOLOGY_MAX_NODES
+
+typedef struct {
+    /// Pins every worker to a CPU, dealt round robin over the NUMA nodes, see `CreatePinnedWorkerPool`.
+    bool pinWorkers;
+    /// Keeps a copy of meshes and context scenes per NUMA node the workers run on, implies `pinWorkers`.
+    bool replicatePerNode;
+} RenderSharedConfig;
+
+#define RENDER_SHARED_DEFAULTS ((RenderSharedConfig) { .pinWorkers = false, .replicatePerNode = false })
+
+typedef struct {
+    RTCDevice device;
+    WorkerPool pool;
+    CpuTopology topology;
+    /// Copies of every mesh and context scene, 1 unless replicating on a machine with several nodes. Replica `r`
+    /// is read by the workers of node `r` of the pool.
+    usize nReplicas;
+} RenderShared;
+
+typedef struct {
+    Obj obj;
+    /// One BLAS per replica, each built by workers of its node.
+    RTCScene scenes[MAX_REPLICAS];
+    /// Backs the geometry buffers of `scenes`.
+    Arena geometryArenas[MAX_REPLICAS];
+    usize nReplicas;
+} SharedMesh;
+
+typedef struct {
+    RenderShared* shared;
+    /// One TLAS per replica, holding the same instances of the replicas of the meshes.
+    RTCScene scenes[MAX_REPLICAS];
+    /// Instances were added since `scenes` were last committed.
+    bool dirty;
+    /// Settings of every frame, `rt.materials` is indexed by the geometry ids of instances. Bands trace the scene of
+    /// their replica whatever `rt.rtcScene` says.
+    RayTracer rt;
+    usize nInstances;
+    Arena frameArena;
+    Aovs aovs;
+    /// Progress of every band of a frame.
+    Array(PTask) tasks;
+} RenderContext;
+
+void CreateRenderShared(RenderShared* shared, usize nWorkers, RenderSharedConfig config);
+
+void DestroyRenderShared(RenderShared* shared);
+
+/// @returns the replica worker `worker` of the pool reads.
+usize WorkerReplica(const RenderShared* shared, usize worker);
+
+/// Builds the BVH of `scene` with every worker of the pool joining in and waits for it.
+///
+/// Call it from outside the pool, a worker would wait for items queued behind its own.
+void CommitSharedScene(RenderShared* shared, RTCScene scene);
+
+/// Builds the BVHs of `replicas`, one scene per replica, each with the workers of its node joining in, and waits.
+///
+/// Replicas are committed one after another, joined commits of the device never overlap. Like `CommitSharedScene`
+/// it may be called from outside the pool while the workers trace, each joins once done with its current item.
+void CommitReplicatedScenes(RenderShared* shared, const RTCScene* replicas);
+
+/// Parses the OBJ file at `path` and builds a BVH per replica on the device of `shared`.
+void LoadSharedMesh(RenderShared* shared, const char* path, SharedMesh* mesh);
+
+void DestroySharedMesh(SharedMesh* mesh);
+
+/// Creates an empty scene rendered at `width` x `height` with room for `maxInstances` instances.
+///
+/// The camera is the fixed one of `RenderRange`, sky and bounce limit start out as in the application. Adjust them
+/// and anything else the tracer offers through `context->rt`.
+void CreateRenderContext(RenderContext* context, RenderShared* shared, usize width, usize height, usize maxInstances);
+
+void DestroyRenderContext(RenderContext* context);
+
+/// Adds one instance of `mesh` per entry of `instances`, all of them shaded with `material`.
+///
+/// Panics, before touching the scene, when the context would exceed the `maxInstances` it was created with.
+void AddContextInstances(RenderContext* context, const SharedMesh* mesh, Instances instances, const Material* material);
+
+/// Renders a frame of `nSamples` samples per pixel on the shared pool and waits for it, one frame at a time per
+/// context.
+///
+/// The linear result stays in `context->aovs.color`, `buffer` receives it tonemapped, `width * height` pixels in
+/// rows from the top.
+///
+/// @returns the rays traced for the frame.
+RayStats RenderContextToBuffer(RenderContext* context, usize nSamples, Rgb256* buffer);
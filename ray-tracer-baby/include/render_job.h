@@ -0,0 +1,105 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+
+#include "ray_tracing.h"
+#include "progress_bar.h"
+#include "arena.h"
+#include "worker_pool.h"
+
+/// Placement of the buffers a job renders into within a `frameWidth` x `frameHeight` image.
+typedef struct {
+    usize x;
+    usize y;
+    usize frameWidth;
+    usize frameHeight;
+} FrameRegion;
+
+#define FULL_FRAME(buffer) ((FrameRegion) { .x = 0, .y = 0, .frameWidth = (buffer).width, .frameHeight = (buffer).height })
+
+typedef struct {
+    RayTracer* rt;
+    FrameRegion region;
+    Buffer2d framebuffer;
+    Aovs aovs;
+    usize tid;
+    usize nWorkers;
+    PTask* task;
+    Display* display;
+    /// Scratch memory owned by this worker, reset at the start of every frame.
+    Arena* arena;
+    RayStats stats;
+    /// Set for jobs run by `StartPoolRenderJobs`, `rt` then points at `nReplicas` tracers, one per node of `pool`.
+    WorkerPool* pool;
+    usize nReplicas;
+} RenderJobParams;
+
+/// Camera rays start at (0, 0, `CAMERA_ORIGIN_Z`) and pass through an image plane at unit distance down -z.
+#define CAMERA_ORIGIN_Z 1.0f
+
+/// Side of the square pixel blocks a worker traces between progress updates.
+#define TILE_SIZE 16
+
+DeclareArray(RenderJobParams);
+
+typedef struct {
+    Array(RenderJobParams) params;
+    Array(pthread_t) tids;
+    /// Pool and items of jobs run by `StartPoolRenderJobs`, `NULL` for jobs on threads of their own.
+    WorkerPool* pool;
+    WorkBatch* batch;
+} RenderJobs;
+
+/// Traces rows `[initialRow, initialRow + nRows)` tile by tile, path state is allocated from `arena`.
+///
+/// Writes the mean radiance and first hit attributes into `aovs` and a tonemapped preview into `framebuffer`.
+void RenderRange(
+    const RayTracer* rt,
+    FrameRegion region,
+    Buffer2d framebuffer,
+    usize initialRow,
+    usize nRows,
+    Aovs aovs,
+    PTask* task,
+    Arena* arena,
+    RayStats* stats
+);
+
+/// Per worker scratch arena capacity, only address space is reserved up front.
+#define WORKER_ARENA_SIZE ((usize)64 << 20)
+
+/// Creates one scratch arena per worker, reuse them across frames.
+Array(Arena) CreateWorkerArenas(usize nWorkers);
+
+void DropWorkerArenas(Array(Arena) arenas);
+
+/// Starts one worker per parallel task of `display`, each tracing a contiguous band of framebuffer rows.
+RenderJobs StartRenderJobs(RayTracer* rt, Buffer2d framebuffer, Aovs aovs, Display* display, Array(Arena) arenas);
+
+/// Like `StartRenderJobs` for buffers covering only part of the image, as placed by `region`.
+RenderJobs StartRegionRenderJobs(
+    RayTracer* rt,
+    FrameRegion region,
+    Buffer2d framebuffer,
+    Aovs aovs,
+    Display* display,
+    Array(Arena) arenas
+);
+
+/// Like `StartRegionRenderJobs` as items on the workers of `pool` instead of threads of their own, one item per
+/// parallel task of `display`. Items trace with `replicas[node]`, the tracer for the NUMA node of the worker running
+/// them, `nReplicas` is either 1 or `pool->nNodes`. Scratch memory comes from the arenas of the pool.
+RenderJobs StartPoolRenderJobs(
+    WorkerPool* pool,
+    RayTracer* replicas,
+    usize nReplicas,
+    FrameRegion region,
+    Buffer2d framebuffer,
+    Aovs aovs,
+    Display* display
+);
+
+/// Waits for all workers and returns the sum of their ray counters.
+RayStats JoinRenderJobs(RenderJobs jobs);
@@ -4,6 +4,10 @@
 #include <cglm/cglm.h>
 
 #include "obj.h"
+#include "arena.h"
+#include "vertex_format.h"
+#include "texture.h"
+#include "primitives.h"
 
 #define GL_ASSERT_NO_ERROR glCheckError_(__FILE__, __func__, __LINE__)
 
@@ -24,9 +28,32 @@ typedef struct {
 
 DeclareArray(PointLight);
 
+/// Simplified levels kept per mesh on top of the full resolution one.
+#define MAX_LODS 4
+
 typedef struct {
     Obj obj;
+    /// Coarser index buffers of `obj`, see `GenerateLODs`.
+    ObjLod lods[MAX_LODS];
+    u32 nLods;
+    /// Bounding sphere in mesh space.
+    vec3 center;
+    f32 radius;
+    /// Quantized copy of `obj`'s vertices, only with `RendererConfig.compactVertices`, `obj.vertices` is NULL then.
+    CompactMesh compact;
+    /// Backs `compact`.
+    Arena arena;
+    /// Tiled copy of `obj.albedoTexture`, only with `MeshLoaderConfig.textures`.
+    Texture albedoTexture;
+    bool hasAlbedoTexture;
     usize id;
+    /// Vertex array with the mesh and instance attributes, 0 until `UploadMesh`.
+    u32 vao;
+    u32 vbo;
+    u32 ebo;
+    /// `obj.texCoords` and the mipmapped `albedoTexture`, 0 without them.
+    u32 texCoordVbo;
+    u32 albedoMap;
 } Mesh;
 
 /// Data for mesh instancing
@@ -38,9 +65,14 @@ typedef struct {
 typedef struct {
     usize nMeshes;
     bool useGl;
-    const char* const * const objPaths;
     const char* vs;
     const char* fs;
+    /// Uploads `CompactVertex` instead of `Vertex`, see `vertex_format.h`.
+    bool compactVertices;
+    /// Screen space error in pixels up to which instances are drawn with a coarser level of detail, 0 always
+    /// draws full resolution.
+    f32 lodErrorPixels;
+    usize viewportHeight;
 } RendererConfig;
 
 
@@ -53,15 +85,33 @@ typedef Array(Instance) Instances;
 typedef void(*RendererInitializer)(RendererConfig);
 typedef void(*RendererDropper)(void);
 
-typedef struct {
-    usize vertex;
-    usize index;
-} Offsets;
-
 void RendererInitialize(RendererConfig config);
+/// Frees every mesh, stop the `MeshLoader` filling them first.
 void RendererDrop(void);
 void Render(void);
 
+/// Triangles drawn by the last `Render` and how many full resolution meshes would have taken.
+typedef struct {
+    usize nTriangles;
+    usize nFullTriangles;
+} LodStats;
+
+/// Uploads a loaded mesh to the GPU, `Render` draws it from then on. Call it on the GL thread.
+void UploadMesh(usize meshId);
+
+/// One instanced draw of a low poly proxy per primitive kind.
+typedef struct {
+    u32 vao;
+    u32 vbo;
+    u32 ebo;
+    u32 instanceVbo;
+    usize nIndices;
+    usize nInstances;
+} PrimitiveProxyBatch;
+
+/// Uploads a proxy instance for every primitive, `materials` are indexed by `Primitives.materials`.
+void UploadPrimitives(const Primitives* primitives, const MaterialRaster* materials);
+
 void ToggleWireFrame(void);
 
 void MoveCamera(vec3 direction, bool relative);
@@ -76,6 +126,9 @@ void glCheckError_(const char* file, const char* func, int line);
 /// Registers new instances of mesh for rendering.
 void AddInstances(usize meshId, Array(Instance) instances);
 
+/// @returns the largest axis scale of the instance transform.
+f32 InstanceScale(const Instance* instance);
+
 /// @returns pointer to instance data for given instance id
 Instance* GetInstance(usize meshId, usize instanceId);
 
@@ -94,8 +147,8 @@ typedef struct {
 
 extern struct Renderer {
     u32 program;
+    /// Filled in by a `MeshLoader`, only uploaded meshes are drawn.
     Array(Mesh) meshes;
-    Offsets* byteOffsets;
 
     Camera3D camera;
     mat4 view;
@@ -104,10 +157,15 @@ extern struct Renderer {
     vec3 lightPosition;
     vec3 lightColor;
 
-    u32 meshVbo;
     u32 instanceVbo;
-    u32 vao;
-    u32 ebo;
+    /// Analytic primitives, see `UploadPrimitives`.
+    PrimitiveProxyBatch primitiveProxies[PrimitiveKindCount];
+
+    bool compactVertices;
+
+    f32 lodErrorPixels;
+    usize viewportHeight;
+    LodStats lodStats;
 
     bool addWireFrame;
 
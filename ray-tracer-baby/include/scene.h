@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <embree3/rtcore.h>
+
+#include "renderer.h"
+#include "obj.h"
+#include "arena.h"
+#include "vertex_format.h"
+#include "primitives.h"
+
+/// Lays out `n * n` instances in a grid in front of the camera.
+void SceneNxN(Instances instances, usize n);
+
+/// Builds an embree scene (BLAS) holding a single triangle mesh.
+///
+/// With an `arena` the geometry buffers are shared with embree instead of being allocated by it,
+/// the arena has to outlive the scene.
+RTCScene CreateMeshScene(RTCDevice device, const Obj* obj, Arena* arena);
+
+/// Same as `CreateMeshScene` with the quantized positions of `compact`, so rays see what the rasterizer draws.
+///
+/// Indices are still read from `obj`. Takes `MeshSceneArenaSize(obj)` bytes from `arena`.
+RTCScene CreateCompactMeshScene(RTCDevice device, const Obj* obj, const CompactMesh* compact, Arena* arena);
+
+/// Same as `CreateMeshScene`, or `CreateCompactMeshScene` with a `compact` mesh, without building the BVH.
+///
+/// Commit the scene afterwards, e.g. with `CommitSharedScene` so the build runs on the workers of a pool.
+RTCScene CreateUncommittedMeshScene(RTCDevice device, const Obj* obj, const CompactMesh* compact, Arena* arena);
+
+/// @returns bytes `CreateMeshScene` takes from an arena for `obj`, including alignment slack.
+usize MeshSceneArenaSize(const Obj* obj);
+
+/// Builds an embree scene (TLAS) with one instance of `meshScene` per entry of `instances`.
+RTCScene CreateInstanceScene(RTCDevice device, RTCScene meshScene, Instances instances);
+
+/// Adds one instance of `meshScene` per entry of `instances` to `scene`, commit `scene` afterwards.
+///
+/// @returns the geometry id of the first instance, the rest follow consecutively.
+u32 AttachInstances(RTCDevice device, RTCScene scene, RTCScene meshScene, Instances instances);
+
+/// Overwrites the transforms of the instances `AttachInstances` added to `scene` from geometry id `firstId` on with
+/// those of `instances`, commit `scene` afterwards.
+void UpdateInstances(RTCScene scene, u32 firstId, Instances instances);
+
+/// @returns bytes `AttachPrimitives` takes from an arena for the quads of `primitives`.
+usize PrimitiveSceneArenaSize(const Primitives* primitives);
+
+/// Adds one geometry per non-empty kind of `primitives` to each of `scenes`, commit them afterwards.
+///
+/// Spheres and discs are read in place from `primitives`, quads are expanded into `arena`. Attach primitives to
+/// empty scenes so their geometry ids, recorded in `primitives->geomIds`, agree between all of them.
+void AttachPrimitives(RTCDevice device, const RTCScene* scenes, usize nScenes, Primitives* primitives, Arena* arena);
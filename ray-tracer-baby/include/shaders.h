@@ -5,6 +5,11 @@
 #define VIEW_POSITION_LOCATION 2
 #define LIGHT_POSITION_LOCATION 3
 #define LIGHT_COLOR_LOCATION 4
+#define MESH_ORIGIN_LOCATION 5
+#define MESH_EXTENT_LOCATION 6
+#define COMPACT_VERTICES_LOCATION 7
+#define USE_ALBEDO_MAP_LOCATION 8
+#define ALBEDO_MAP_BINDING 0
 
 #define POSITION_LOCATION 0
 #define NORMAL_INDEX 1
@@ -13,6 +18,7 @@
 #define ROUGHNESS_LOCATION 7
 #define FRESNEL_FACTOR__LOCATION 8
 #define TRANSPOSE_INVERSE_MODEL_LOCATION 9
+#define TEXCOORD_LOCATION 13
 
 #define SHADER(...) "#version 420 core\n#extension GL_ARB_explicit_uniform_location : require\n" STRINGIFY(__VA_ARGS__)
 
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+/*
+ * Tiled, mipmapped textures paged in on demand through a fixed size cache.
+ *
+ * `ConvertTexture` decodes an image once into a tiled file: a header with the level table, then every level of the
+ * box filtered mip chain cut into `TEXTURE_TILE_SIZE`^2 RGBA8 tiles, row major within a level and sRGB encoded.
+ * Edge tiles repeat the last texel. Sampling reads only the tiles around its footprint, the rest of the chain stays
+ * on disk.
+ *
+ * `TextureCache` holds a fixed number of tiles split into shards by tile key. Every shard has its own lock, chained
+ * hash table and CLOCK eviction, so render threads missing on different tiles rarely contend. Misses read the tile
+ * with `pread` while holding the lock of its shard.
+ */
+
+#define TEXTURE_VERSION 1
+#define TEXTURE_TILE_SIZE 32
+#define TEXTURE_TILE_BYTES (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4)
+#define TEXTURE_MAX_LEVELS 16
+#define TEXTURE_CACHE_SHARDS 16
+
+typedef struct {
+    u32 width;
+    u32 height;
+    u32 tilesX;
+    u32 tilesY;
+    /// Index of the first tile of the level in the file.
+    u64 firstTile;
+} TextureLevel;
+
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 nLevels;
+    TextureLevel levels[TEXTURE_MAX_LEVELS];
+} TextureHeader;
+
+typedef struct {
+    i32 fd;
+    /// Unique per opened texture, part of every tile key.
+    u32 id;
+    u32 nLevels;
+    TextureLevel levels[TEXTURE_MAX_LEVELS];
+} Texture;
+
+typedef struct {
+    pthread_mutex_t lock;
+    usize nSlots;
+    /// Tile key held by every slot.
+    u64* keys;
+    /// Next slot in the same bucket, `nSlots` ends a chain.
+    u32* next;
+    /// First slot of every bucket, `nBuckets` is a power of two.
+    u32* buckets;
+    usize nBuckets;
+    /// CLOCK reference bits, set on every hit.
+    u8* referenced;
+    u8* texels;
+    /// Slots `[0, nResident)` hold tiles.
+    usize nResident;
+    usize hand;
+    u64 hits;
+    u64 misses;
+} TextureCacheShard;
+
+typedef struct {
+    TextureCacheShard shards[TEXTURE_CACHE_SHARDS];
+    f32 srgbToLinear[256];
+} TextureCache;
+
+typedef struct {
+    u64 hits;
+    u64 misses;
+    usize residentBytes;
+    usize capacityBytes;
+} TextureCacheStats;
+
+/// Decodes `imagePath` and writes its tiled mip chain to `tiledPath`, unless `tiledPath` is newer than the image.
+///
+/// @returns false when the existing tiled file was kept.
+bool ConvertTexture(const char* imagePath, const char* tiledPath);
+
+void OpenTexture(const char* tiledPath, Texture* texture);
+
+void CloseTexture(Texture* texture);
+
+/// Reads a whole level into `rgba`, `width * height * 4` bytes in sRGB, bypassing the cache.
+void ReadTextureLevel(const Texture* texture, u32 level, u8* rgba);
+
+/// Rounds `capacityBytes` down to whole tiles, at least one per shard.
+void CreateTextureCache(TextureCache* cache, usize capacityBytes);
+
+void DestroyTextureCache(TextureCache* cache);
+
+/// Trilinearly filtered linear RGB at `u`, `v` (v pointing up the image, repeating), `lod` is the log2 of the footprint
+/// in texels of the full resolution level.
+void SampleTexture(TextureCache* cache, const Texture* texture, f32 u, f32 v, f32 lod, vec3 rgb);
+
+void GetTextureCacheStats(TextureCache* cache, TextureCacheStats* stats);
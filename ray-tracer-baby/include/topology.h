@@ -0,0 +1,45 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+
+/*
+ * CPUs this process may run on, grouped by NUMA node, and pinning threads to them.
+ *
+ * Nodes and their CPUs are read from `/sys/devices/system/node`, limited to the affinity mask the process started
+ * with so `taskset` and cgroup cpusets are respected. Nodes without any usable CPU are skipped and the remaining ones
+ * numbered densely from 0 in order of their kernel ids. Machines without NUMA support, or where sysfs is not
+ * readable, show up as a single node holding every usable CPU.
+ */
+
+#define TOPOLOGY_MAX_CPUS 1024
+#define TOPOLOGY_MAX_NODES 8
+
+typedef struct {
+    /// Usable CPUs, those of node 0 first, then those of node 1...
+    u32 cpus[TOPOLOGY_MAX_CPUS];
+    usize nCpus;
+    /// CPUs of node n are `cpus[nodeFirstCpu[n], nodeFirstCpu[n] + nodeCpus[n])`.
+    usize nodeFirstCpu[TOPOLOGY_MAX_NODES];
+    usize nodeCpus[TOPOLOGY_MAX_NODES];
+    /// Kernel id of every node.
+    u32 nodeIds[TOPOLOGY_MAX_NODES];
+    usize nNodes;
+} CpuTopology;
+
+void DetectCpuTopology(CpuTopology* topology);
+
+/// CPU for worker `worker` of a pool, workers are dealt round robin to the first `nNodes` nodes and within a node
+/// to its CPUs in order, wrapping around once every CPU has a worker.
+///
+/// @returns the CPU, `node` receives its node.
+u32 TopologyWorkerCpu(const CpuTopology* topology, usize nNodes, usize worker, usize* node);
+
+/// Restricts `thread` to `cpu`.
+///
+/// @returns false when the kernel refused, the thread then keeps running wherever it did.
+bool PinThreadToCpu(pthread_t thread, u32 cpu);
+
+/// Restricts `thread` to the CPUs of `node`, see `PinThreadToCpu`.
+bool PinThreadToNode(pthread_t thread, const CpuTopology* topology, usize node);
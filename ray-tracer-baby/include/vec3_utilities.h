@@ -1,5 +1,20 @@
+#pragma once
+
+#include <cmm/types.h>
 #include <cglm/cglm.h>
 
+/// Seeds the calling thread's generator (PCG32), draws after a given seed and sequence are reproducible.
+void SeedRandom(u64 seed, u64 sequence);
+/// Skips the next `delta` draws of the calling thread's generator in O(log delta).
+void AdvanceRandom(u64 delta);
+/// @returns uniform float in [0, 1) from the calling thread's generator.
+f32 RandomF32(void);
+
 void RandomVec3(vec3 result);
+/// Uniform on the unit sphere, which makes `normal + RandomUnitVec3` cosine distributed around `normal`.
 void RandomUnitVec3(vec3 result);
 bool IsNonZeroVec3(vec3 result);
+
+/// Packs unit vector into 32 bits (2 x 16 bit snorm) using octahedral mapping.
+u32 EncodeOctahedral(const vec3 normal);
+void DecodeOctahedral(u32 encoded, vec3 result);
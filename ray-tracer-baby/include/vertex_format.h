@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "obj.h"
+#include "arena.h"
+
+/*
+ * Compact vertex format shared by the raster and ray tracing paths.
+ *
+ * Positions are quantized to 16 bits per axis relative to the mesh bounds, normals are octahedral encoded into
+ * two snorm16 values (see `EncodeOctahedral`). A vertex takes 12 bytes instead of the 24 of `Vertex`.
+ *
+ * The layout maps directly onto GL vertex attributes: positions as 3 normalized `GL_UNSIGNED_SHORT`, scaled by
+ * the `meshOrigin` and `meshExtent` uniforms, normals as 2 normalized `GL_SHORT`. Embree only reads float
+ * positions, so `CreateCompactMeshScene` decodes those once, normals are only decoded when a ray hits. Once a mesh
+ * is quantized its full precision `Vertex` buffer is not needed anymore and the mesh loader frees it.
+ */
+
+typedef struct {
+    u16 position[3];
+    u16 _padding;
+    /// See `EncodeOctahedral`.
+    u32 normal;
+} CompactVertex;
+
+_Static_assert(sizeof(CompactVertex) == 12, "CompactVertex should be half the size of Vertex");
+
+typedef struct {
+    usize nVertices;
+    CompactVertex* vertices;
+    /// Lower corner of the mesh bounds.
+    vec3 origin;
+    /// Size of the mesh bounds, a quantized coordinate of 65535 lies on the upper corner.
+    vec3 extent;
+} CompactMesh;
+
+/// Error introduced by `CompressMesh`.
+typedef struct {
+    /// Largest and mean distance of a decoded position from the original, in mesh units.
+    f32 maxPositionError;
+    f32 meanPositionError;
+    /// Largest and mean angle between a decoded normal and the original, in degrees.
+    f32 maxNormalErrorDeg;
+    f32 meanNormalErrorDeg;
+} VertexPrecision;
+
+/// @returns bytes `CompressMesh` takes from an arena for `obj`, including alignment slack.
+usize CompactMeshArenaSize(const Obj* obj);
+
+/// Quantizes the vertices of `obj`, `precision` may be NULL.
+CompactMesh CompressMesh(const Obj* obj, Arena* arena, VertexPrecision* precision);
+
+void DecodePosition(const CompactMesh* mesh, usize vertex, vec3 result);
+
+/// Position of `vertex`, decoded from `compact` when given, read from `obj` otherwise.
+///
+/// With a compact mesh `obj` may already have freed its vertices, see `FreeOBJVertices`.
+void MeshPosition(const Obj* obj, const CompactMesh* compact, usize vertex, vec3 result);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cmm/cmm.h>
+
+#include "renderer.h"
+#include "ray_tracing.h"
+#include "render_job.h"
+#include "vertex_format.h"
+#include "primitives.h"
+#include "arena.h"
+#include "worker_pool.h"
+
+/*
+ * Visibility buffer of the camera rays, rasterized on the CPU instead of traced.
+ *
+ * Every sample of a pixel starts with the same pinhole ray (see `GeneratePrimaryRays`), so the first hit is the same
+ * for all of them and only changes with the scene. `RasterizeVisibility` finds it once for every pixel and stores it
+ * as the `HitRecord` `IntersectRays` would have produced: instance and primitive ids, embree style barycentrics, the
+ * ray distance and the geometric normal in object space.
+ *
+ * Rasterization runs in two parallel phases on the shared `WorkerPool`, each a batch of `nThreads` work items. First
+ * every item transforms a contiguous range of triangles with the `Instance.model` of their instance, clips them
+ * against the near plane and bins them into the `VISIBILITY_BIN_SIZE`^2 pixel bins their bounds overlap. Then items
+ * take whole bins, walking the lists of all ranges in triangle order and depth testing the ray distance where the ray
+ * of every pixel passes. Bins cover disjoint pixels, so the second phase needs no synchronization beyond handing out
+ * bins, and the result depends neither on `nThreads` nor on the pool's worker count.
+ *
+ * Spheres and discs are intersected exactly per pixel of their screen bounds, quads are rasterized as two triangles.
+ */
+
+#define VISIBILITY_BIN_SIZE 32
+/// Per range scratch arena capacity, only address space is reserved up front.
+#define VISIBILITY_ARENA_SIZE ((usize)1 << 30)
+
+/// A mesh as the rasterizer sees it, its instances take consecutive instance ids.
+typedef struct {
+    /// Full resolution indices, positions are decoded from `compact` when given so both paths agree on them.
+    const Obj* obj;
+    const CompactMesh* compact;
+    Instances instances;
+    /// TLAS geometry id of the first instance, see `AttachInstances`.
+    u32 firstInstanceId;
+} VisibilityMesh;
+
+DeclareArray(VisibilityMesh);
+
+typedef struct {
+    const VisibilityMesh* meshes;
+    usize nMeshes;
+    /// NULL without analytic primitives.
+    const Primitives* primitives;
+} VisibilityScene;
+
+typedef struct {
+    usize width;
+    usize height;
+    /// Ranges the triangles are split into, best the worker count of the pool rasterizing.
+    usize nThreads;
+    /// First hit of every pixel, row major, `width * height` records.
+    HitRecord* hits;
+    /// Set up triangles and bin lists of every range, reset every frame.
+    Arena* arenas;
+    /// Triangles of the last frame, and those left after clipping and culling.
+    usize nTriangles;
+    usize nBinnedTriangles;
+} VisibilityBuffer;
+
+void CreateVisibilityBuffer(VisibilityBuffer* visibility, usize width, usize height, usize nThreads);
+
+void DestroyVisibilityBuffer(VisibilityBuffer* visibility);
+
+/// Rasterizes the first hit of the camera ray of every pixel of `region`, which has to match the buffer's size, on
+/// the workers of `pool`.
+void RasterizeVisibility(VisibilityBuffer* visibility, const VisibilityScene* scene, FrameRegion region, WorkerPool* pool);
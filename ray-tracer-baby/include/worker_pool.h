@@ -0,0 +1,96 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+
+#include "arena.h"
+#include "topology.h"
+
+/*
+ * Long lived worker threads running work items from a shared first in, first out queue.
+ *
+ * Any number of threads may submit concurrently. Items are grouped into `WorkBatch`es, so each submitter waits for
+ * its own items only while the workers interleave the items of every batch in flight. Every worker owns a scratch
+ * arena of `WORKER_ARENA_SIZE`, reset before each item it runs.
+ *
+ * `SubmitWorkTo` queues an item for one worker only, on a small ring of its own that it drains before the shared
+ * queue. This is how Embree build tasks are joined on chosen workers, see `CommitSharedScene`.
+ *
+ * Workers of a pool made by `CreatePinnedWorkerPool` are each pinned to one CPU, dealt round robin over the NUMA nodes
+ * by `TopologyWorkerCpu`, and pin themselves before touching their arena so its pages end up on their own node.
+ */
+
+/// Items queued beyond this block `SubmitWork` until workers catch up.
+#define WORKER_POOL_QUEUE_CAPACITY 4096
+
+/// Items queued for a single worker beyond this block `SubmitWorkTo` until it catches up.
+#define WORKER_QUEUE_CAPACITY 64
+
+/// Runs on worker `worker` with its scratch `arena`.
+typedef void (*WorkFunction)(void* argument, usize worker, Arena* arena);
+
+/// Items submitted together, guarded by the lock of the pool they were submitted to.
+typedef struct {
+    usize nPending;
+} WorkBatch;
+
+typedef struct {
+    WorkFunction function;
+    void* argument;
+    WorkBatch* batch;
+} WorkItem;
+
+DeclareArray(WorkItem);
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct {
+    WorkerPool* pool;
+    usize index;
+    /// CPU the worker is pinned to, -1 when it is not.
+    i32 cpu;
+    /// NUMA node of `cpu`, dense below `pool->nNodes`, 0 when not pinned.
+    usize node;
+    /// Ring buffer of `WORKER_QUEUE_CAPACITY` items for this worker only, guarded by the lock of the pool.
+    Array(WorkItem) items;
+    usize head;
+    usize len;
+} WorkerThread;
+
+DeclareArray(WorkerThread);
+DeclareArray(pthread_t);
+
+struct WorkerPool {
+    Array(pthread_t) threads;
+    Array(WorkerThread) workers;
+    Array(Arena) arenas;
+    /// Ring buffer of `WORKER_POOL_QUEUE_CAPACITY` items, `len` of them from `head` on are queued.
+    Array(WorkItem) items;
+    usize head;
+    usize len;
+    pthread_mutex_t lock;
+    /// Signalled when items are queued or taken and when batches finish.
+    pthread_cond_t changed;
+    bool stop;
+    /// Nodes the workers are spread over, 1 when they are not pinned.
+    usize nNodes;
+};
+
+void CreateWorkerPool(WorkerPool* pool, usize nWorkers);
+
+/// Like `CreateWorkerPool` with every worker pinned to a CPU of `topology`, spread over as many of its nodes as
+/// there are workers for.
+void CreatePinnedWorkerPool(WorkerPool* pool, usize nWorkers, const CpuTopology* topology);
+
+/// Runs what is still queued and joins the workers.
+void DestroyWorkerPool(WorkerPool* pool);
+
+/// Queues `function(argument)` as part of `batch`, which has to be zeroed before its first item.
+void SubmitWork(WorkerPool* pool, WorkBatch* batch, WorkFunction function, void* argument);
+
+/// Queues `function(argument)` as part of `batch` to run on worker `worker` and no other.
+void SubmitWorkTo(WorkerPool* pool, WorkBatch* batch, usize worker, WorkFunction function, void* argument);
+
+/// Sleeps until every item of `batch` ran.
+void WaitWorkBatch(WorkerPool* pool, const WorkBatch* batch);
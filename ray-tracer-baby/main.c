@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <stdbool.h>
 #include <limits.h>
@@ -20,24 +22,127 @@
 #include "shaders.h"
 #include "ray_tracing.h"
 #include "progress_bar.h"
+#include "render_job.h"
+#include "render_context.h"
+#include "scene.h"
+#include "profiler.h"
+#include "arena.h"
+#include "denoise.h"
+#include "checkpoint.h"
+#include "mesh_loader.h"
+#include "texture.h"
+#include "vec3_utilities.h"
+#include "visibility.h"
+#include "lights.h"
+#include "environment.h"
+#include "radiance_cache.h"
+#include "paged_mesh.h"
 
 
 #define RNG_SEED 42
 
 #define N_INSTANCES 50
-#define X 0
-#define Y 1
-#define Z 2
 
 internal struct Config {
     int glVersionMajor;
     int glVersionMinor;
     usize nWorkers;
+    bool denoise;
+    /// Total samples per pixel, rendered in passes of `nSamplesPerPass`.
+    usize nSamples;
+    usize nSamplesPerPass;
+    const char* checkpointPath;
+    f64 checkpointIntervalSec;
+    bool resume;
+    /// Reorders the loaded meshes for vertex cache efficiency, see `OptimizeOBJ`.
+    bool optimizeMeshes;
+    MeshOptimizeParams meshOptimizeParams;
+    /// Quantized positions and octahedral normals for both the rasterizer and the ray tracer.
+    bool compactVertices;
+    /// Meshes are parsed in parallel and appear in the scene as they finish.
+    usize nLoaderThreads;
+    /// Closes duplicated seams by merging positions closer than `weldEpsilon` while loading.
+    bool weld;
+    f32 weldEpsilon;
+    /// Simplified levels of detail for distant instances and wide secondary rays.
+    bool lods;
+    LodParams lodParams;
+    /// Error budget of level of detail selection in pixels.
+    f32 lodErrorPixels;
+    /// Diffuse maps of the meshes' material libraries, paged in through a cache of `textureCacheBytes`.
+    bool textures;
+    usize textureCacheBytes;
+    /// Analytic spheres scattered behind the meshes, traced without tessellation. Any adds a backdrop and a few discs.
+    usize nSpheres;
+    /// Finds the first hits of camera rays with `RasterizeVisibility` instead of tracing them.
+    bool visibilityBuffer;
+    /// Lights scattered around the meshes, sampled at every bounce through a light tree unless `uniformLights`.
+    usize nLights;
+    bool uniformLights;
+    /// Equirectangular PFM or HDR image lighting the scene in place of the sky gradient, NULL for none.
+    const char* environmentPath;
+    /// Paths end in a radiance cache of `radianceCacheCell` sized cells after this many bounces, 0 disables it.
+    u32 radianceCacheDepth;
+    f32 radianceCacheCell;
+    /// Keeps the radiance cache from pass to pass until the scene changes instead of starting every pass empty.
+    bool persistentRadianceCache;
+    /// Mesh traced out of core from a file of `WritePagedMesh` alongside the scene, NULL for none.
+    const char* pagedMeshPath;
+    /// Cluster pages of `pagedMeshPath` resident at most, 0 for no limit.
+    usize pageBudgetBytes;
+    /// Traces ray queues grouped by the cluster of the paged mesh their paths leave.
+    bool sortByCluster;
+    /// Bakes the first mesh as a `writePagedGrid` square grid of instances into this file and exits.
+    const char* writePagedPath;
+    usize writePagedGrid;
+    /// Traces the first mesh through `Accel` instead of Embree, see `accel_scene.h`.
+    bool accelBackend;
+    /// Preview integrators shade the first hit only, see `Integrator`.
+    enum Integrator integrator;
+    u32 nAoSamples;
+    f32 aoDistance;
+    /// Pins the workers of the pool, tracing and building BVHs, to one CPU each, spread over the NUMA nodes.
+    bool pinThreads;
     const char* const title;
 } Config = {
     .glVersionMajor = 4,
     .glVersionMinor = 2,
     .nWorkers = 8,
+    .denoise = true,
+    .nSamples = 30,
+    .nSamplesPerPass = 2,
+    .checkpointPath = "./render.checkpoint",
+    .checkpointIntervalSec = 30.0,
+    .resume = false,
+    .optimizeMeshes = false,
+    .meshOptimizeParams = MESH_OPTIMIZE_DEFAULTS,
+    .compactVertices = false,
+    .nLoaderThreads = 4,
+    .weld = false,
+    .weldEpsilon = 0.f,
+    .lods = false,
+    .lodParams = LOD_DEFAULTS,
+    .lodErrorPixels = 1.f,
+    .textures = false,
+    .textureCacheBytes = (usize)64 << 20,
+    .nSpheres = 0,
+    .visibilityBuffer = false,
+    .nLights = 0,
+    .uniformLights = false,
+    .environmentPath = NULL,
+    .radianceCacheDepth = 0,
+    .radianceCacheCell = 0.05f,
+    .persistentRadianceCache = false,
+    .pagedMeshPath = NULL,
+    .pageBudgetBytes = (usize)256 << 20,
+    .sortByCluster = true,
+    .writePagedPath = NULL,
+    .writePagedGrid = 0,
+    .accelBackend = false,
+    .integrator = IntegratorPath,
+    .nAoSamples = 16,
+    .aoDistance = 1.f,
+    .pinThreads = false,
     .title = "ray-tracer-baby",
 };
 
@@ -52,10 +157,6 @@ internal void ErrorCallback(int _, const char* const description) {
 RTC_NAMESPACE_USE
 #endif
 
-void EmbreeErrorCallback(void* const _, enum RTCError error, const char* const str) {
-    PANIC("embree error ::" FS(i32) ":: %s", error, str);
-}
-
 internal struct AppState {
     const usize width;
     const usize height;
@@ -200,6 +301,7 @@ internal void ProcessInput(void) {
 #undef PROCESS_INPUT
 
 DeclareArray(RTCGeometry);
+DeclareArray(RTCScene);
 
 u32 createGroundPlane (RTCDevice device, RTCScene scene) {
     /* create a triangulated plane with 2 triangles and 4 vertices */
@@ -223,92 +325,264 @@ u32 createGroundPlane (RTCDevice device, RTCScene scene) {
     return geomID;
 }
 
+/// Ray tracing side of the scene, populated as meshes finish loading.
 typedef struct {
-    RayTracer* rt;
-    Buffer2d framebuffer;
-    usize tid;
-    PTask* task;
-} RenderJobParams;
-
-DeclareArray(RenderJobParams);
-
-void RenderRange(const RayTracer* const rt, Buffer2d framebuffer, usize initialRow, usize nRows, PTask* task) {
-    for (usize y = initialRow; y < initialRow + nRows; y++) {
-        task->progress += 1;
-        for (usize x = 0; x < framebuffer.width; x++) {
-            struct RTCRayHit rayhit;
-            f32 accumulator[3] = { 0.f };
-            vec3 color;
-
-            for (usize ri = 0; ri < rt->nRaysPerSample; ri++) {
-                rayhit.ray.org_x = 0.0f;
-                rayhit.ray.org_y = 0.0f;
-                rayhit.ray.org_z = 1.0f;
-
-                rayhit.ray.dir_x = (2.0f * ((f32)x / AppState.width)) - 1.0f;
-                rayhit.ray.dir_y = 1.0f - (2.0f * ((f32)y / AppState.height));
-                rayhit.ray.dir_z = -1.0f;
-                rayhit.ray.tnear = 0.001f;
-                rayhit.ray.tfar = INFINITY;
-                rayhit.ray.mask = 0xFFFFFFFF;
-                rayhit.ray.flags = 0;
-                rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-                
-                glm_vec3_one(color);
-                TraceRay(rt, &rayhit, 0, color);
-                
-                accumulator[X] += color[X];
-                accumulator[Y] += color[Y];
-                accumulator[Z] += color[Z];
-            }
-            glm_vec3_scale(accumulator, 1.f / rt->nRaysPerSample, accumulator);
-            framebuffer.buffer[y * framebuffer.width + x][X] = (u8)(accumulator[X] * 255.999f);
-            framebuffer.buffer[y * framebuffer.width + x][Y] = (u8)(accumulator[Y] * 255.999f);
-            framebuffer.buffer[y * framebuffer.width + x][Z] = (u8)(accumulator[Z] * 255.999f);
-        }
+    /// Device and pool, BVHs are built by the workers that trace them.
+    RenderShared* shared;
+    RTCDevice device;
+    /// TLAS, starts out empty.
+    RTCScene scene;
+    /// One TLAS per simplified level, instancing every mesh at that level or the coarsest one it has.
+    RTCScene lodScenes[MAX_LODS];
+    usize nLods;
+    /// See `RayTracer`.
+    f32 lodErrors[MAX_LODS];
+    const u16* lodIndices[MAX_LODS];
+    /// BLAS of every level of every mesh, `MAX_LODS + 1` per mesh, and the arenas backing their geometry.
+    Array(RTCScene) meshScenes;
+    Array(Arena) geometryArenas;
+    /// Instances added for every mesh.
+    Instances instances;
+    /// Largest scale of any instance, converts mesh space errors to world space.
+    f32 instanceScale;
+    /// Published meshes in publish order, as `RasterizeVisibility` sees them.
+    Array(VisibilityMesh) visibleMeshes;
+    usize nVisibleMeshes;
+    /// Instances of the first mesh with `--backend accel`.
+    AccelScene accelScene;
+} ProgressiveScene;
+
+/// @returns `mesh` with the indices of `level`, sharing its vertices.
+internal Obj LodObj(const Mesh* const mesh, const u32 level) {
+    Obj obj = mesh->obj;
+    if (level > 0) {
+        obj.nIndices = mesh->lods[level - 1].nIndices;
+        obj.indices = mesh->lods[level - 1].indices;
     }
+    return obj;
 }
 
-internal void* RenderJob(void* args) {
-    RenderJobParams* const params = args;
+/// Makes a loaded mesh visible: GL upload on this (the GL) thread, BLAS build, then instance attach.
+internal void PublishMesh(ProgressiveScene* const scene, RayTracer* const rt, const usize meshId) {
+    const Mesh* const mesh = &Renderer.meshes.data[meshId];
+    if (AppState.windowedMode) {
+        UploadMesh(meshId);
+        AddInstances(meshId, scene->instances);
+    }
 
-    ASSERT_EQ(params->framebuffer.height % Config.nWorkers, 0);
-    const usize offset = params->framebuffer.height / Config.nWorkers;
+    Arena* const geometryArena = &scene->geometryArenas.data[meshId];
+    usize arenaSize = 0;
+    for (u32 level = 0; level <= mesh->nLods; level++) {
+        const Obj lod = LodObj(mesh, level);
+        arenaSize += MeshSceneArenaSize(&lod);
+    }
+    *geometryArena = CreateArena(arenaSize);
+    RTCScene* const levelScenes = &scene->meshScenes.data[meshId * (MAX_LODS + 1)];
+    for (u32 level = 0; level <= mesh->nLods; level++) {
+        const Obj lod = LodObj(mesh, level);
+        levelScenes[level] = CreateUncommittedMeshScene(scene->device, &lod, Config.compactVertices ? &mesh->compact : NULL, geometryArena);
+        CommitSharedScene(scene->shared, levelScenes[level]);
+    }
 
-    const usize initialRow = params->tid * offset;
-    params->task->end = offset;
-    params->task->progress = 0;
-    RenderRange(params->rt, params->framebuffer, initialRow, offset, params->task);
-    return NULL;
+    // Instance ids follow attach order, which is load order rather than mesh order. Every TLAS attaches in the
+    // same order so ids, and with them materials, agree between levels.
+    const u32 firstId = AttachInstances(scene->device, scene->scene, levelScenes[0], scene->instances);
+    scene->visibleMeshes.data[scene->nVisibleMeshes++] = (VisibilityMesh) {
+        .obj = &mesh->obj,
+        .compact = Config.compactVertices ? &mesh->compact : NULL,
+        .instances = scene->instances,
+        .firstInstanceId = firstId,
+    };
+    for (usize i = 0; i < scene->instances.len; i++) {
+        CreateLambertian(&rt->materials.data[firstId + i], Palette1[i % ARRAY_LENGTH(Palette1)], 0.8f);
+        // Texture coordinates are only looked up for mesh 0, like vertex normals.
+        if (meshId == 0 && mesh->hasAlbedoTexture) rt->materials.data[firstId + i].albedoTexture = &mesh->albedoTexture;
+    }
+    for (usize l = 0; l < scene->nLods; l++) {
+        const u32 level = l + 1 < mesh->nLods ? (u32)l + 1 : mesh->nLods;
+        AttachInstances(scene->device, scene->lodScenes[l], levelScenes[level], scene->instances);
+        const f32 error = level == 0 ? 0.f : mesh->lods[level - 1].error * scene->instanceScale;
+        scene->lodErrors[l] = glm_max(scene->lodErrors[l], error);
+        if (meshId == 0) scene->lodIndices[l] = LodObj(mesh, level).indices;
+    }
+    if (meshId == 0 && Config.accelBackend) {
+        CreateAccelScene(&mesh->obj, Config.compactVertices ? &mesh->compact : NULL, scene->instances, firstId, &scene->accelScene);
+        rt->accelScene = &scene->accelScene;
+    }
+    if (meshId == 0) {
+        rt->mesh = Config.compactVertices ? &mesh->compact : NULL;
+        rt->indices = mesh->obj.indices;
+        rt->vertices = mesh->obj.vertices;
+        rt->texCoords = mesh->obj.texCoords;
+    }
 }
 
-DeclareArray(pthread_t);
-
-void SceneNxN(Instances instances, usize n) {
-    const isize h = n / 2;
-    Material _;
-    Transform transform;
-    for (usize i = 0; i < n * n; i++) {
-        const f32 norm = (f32)i / (f32)(n * n);
-        const isize xi = i % n - h;
-        const isize yi = (i / n) % n - h;
-        const isize zi = -1;
-
-        glm_vec3_copy((vec3) { (f32)xi, (f32)yi, (f32)zi + 0.3 }, transform.translation);
-        glm_vec3_copy((vec3) { 0.f, norm * M_PI, 0.f }, transform.rotation);
-        glm_vec3_copy((vec3) { 0.3f, 0.3f, 0.3f }, transform.scale);
-        CreateInstance(
-            &transform,
-            &_,
-            &instances.data[i]
-        );
+/// Publishes every mesh the loader finished since the last call and commits the TLAS once for all of them.
+///
+/// With `wait` blocks until at least one mesh is ready, unless every mesh has already been published.
+/// @returns the number of published meshes.
+internal usize PublishLoadedMeshes(MeshLoader* const loader, ProgressiveScene* const scene, RayTracer* const rt, const bool wait) {
+    usize nPublished = 0;
+    usize meshId;
+    if (wait && WaitLoadedMesh(loader, &meshId)) {
+        PublishMesh(scene, rt, meshId);
+        nPublished += 1;
+    }
+    while (PollLoadedMesh(loader, &meshId)) {
+        PublishMesh(scene, rt, meshId);
+        nPublished += 1;
+    }
+    if (nPublished > 0) {
+        PROFILE_BEGIN(commitStart);
+        CommitSharedScene(scene->shared, scene->scene);
+        for (usize l = 0; l < scene->nLods; l++) CommitSharedScene(scene->shared, scene->lodScenes[l]);
+        PROFILE_END("commit TLAS", commitStart);
+    }
+    return nPublished;
+}
+
+#define PRIMITIVE_DISCS 3
+/// Shared by all `--lights`, so their number does not change how bright the scene is.
+#define LIGHTS_TOTAL_POWER 40.f
+/// Records of `--radiance-cache`, 24 MiB.
+#define RADIANCE_CACHE_CAPACITY ((usize)1 << 20)
+
+/// `nSpheres` small spheres in a slab behind the mesh grid, discs below it and a backdrop quad closing the scene.
+internal Primitives ScatterPrimitives(Arena* const arena, const usize nSpheres) {
+    Primitives primitives = CreatePrimitives(arena, nSpheres, PRIMITIVE_DISCS, 1);
+    SeedRandom(RNG_SEED, 7);
+    for (usize i = 0; i < nSpheres; i++) {
+        primitives.spheres[i] = (SpherePrimitive) {
+            .x = 4.f * RandomF32() - 2.f,
+            .y = 4.f * RandomF32() - 2.f,
+            .z = -1.5f - RandomF32(),
+            .radius = 0.05f + 0.1f * RandomF32(),
+        };
+        primitives.materials[PrimitiveKindSphere][i] = (u16)(i % ARRAY_LENGTH(Palette1));
+    }
+    for (usize i = 0; i < PRIMITIVE_DISCS; i++) {
+        primitives.discs[i] = (DiscPrimitive) {
+            .x = (f32)i - 1.f, .y = -1.6f, .z = -0.7f,
+            .radius = 0.35f,
+            .normal = { 0.f, 1.f, 0.f },
+        };
+        primitives.materials[PrimitiveKindDisc][i] = (u16)(ARRAY_LENGTH(Palette1) - 1 - i);
+    }
+    primitives.quads[0] = (QuadPrimitive) {
+        .origin = { -4.f, -4.f, -3.f },
+        .edgeU = { 8.f, 0.f, 0.f },
+        .edgeV = { 0.f, 8.f, 0.f },
+    };
+    primitives.materials[PrimitiveKindQuad][0] = 7;
+    return primitives;
+}
+
+/// usage: ray-tracer-baby [--spp N] [--pass-spp N] [--checkpoint FILE] [--checkpoint-interval SEC] [--resume]
+///                        [--optimize-mesh first-use|morton] [--compact-vertices] [--loader-threads N] [--weld EPSILON]
+///                        [--lod ERROR_PIXELS] [--textures] [--texture-cache MB] [--spheres N]
+///                        [--visibility-buffer] [--lights N] [--uniform-lights] [--environment FILE]
+///                        [--radiance-cache 1|2] [--radiance-cache-cell SIZE] [--persistent-radiance-cache]
+///                        [--paged-mesh FILE] [--page-budget MB] [--unsorted-rays] [--write-paged-mesh FILE GRID]
+///                        [--backend embree|accel] [--integrator path|albedo|normal|depth|ao|direct]
+///                        [--ao-samples N] [--ao-distance D] [--pin-threads]
+internal void ParseArgs(const i32 argc, char** const argv) {
+    for (i32 i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--spp") == 0 && hasValue) Config.nSamples = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--pass-spp") == 0 && hasValue) Config.nSamplesPerPass = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--checkpoint") == 0 && hasValue) Config.checkpointPath = argv[++i];
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0 && hasValue) Config.checkpointIntervalSec = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--resume") == 0) Config.resume = true;
+        else if (strcmp(argv[i], "--optimize-mesh") == 0 && hasValue) {
+            const char* const order = argv[++i];
+            Config.optimizeMeshes = true;
+            if (strcmp(order, "first-use") == 0) Config.meshOptimizeParams.vertexOrder = VertexOrderFirstUse;
+            else if (strcmp(order, "morton") == 0) Config.meshOptimizeParams.vertexOrder = VertexOrderMorton;
+            else PANIC("Unknown vertex order: %s", order);
+        }
+        else if (strcmp(argv[i], "--compact-vertices") == 0) Config.compactVertices = true;
+        else if (strcmp(argv[i], "--loader-threads") == 0 && hasValue) Config.nLoaderThreads = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--weld") == 0 && hasValue) {
+            Config.weld = true;
+            Config.weldEpsilon = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--lod") == 0 && hasValue) {
+            Config.lods = true;
+            Config.lodErrorPixels = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--textures") == 0) Config.textures = true;
+        else if (strcmp(argv[i], "--texture-cache") == 0 && hasValue) Config.textureCacheBytes = strtoul(argv[++i], NULL, 10) << 20;
+        else if (strcmp(argv[i], "--spheres") == 0 && hasValue) Config.nSpheres = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--visibility-buffer") == 0) Config.visibilityBuffer = true;
+        else if (strcmp(argv[i], "--lights") == 0 && hasValue) Config.nLights = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--uniform-lights") == 0) Config.uniformLights = true;
+        else if (strcmp(argv[i], "--environment") == 0 && hasValue) Config.environmentPath = argv[++i];
+        else if (strcmp(argv[i], "--radiance-cache") == 0 && hasValue) Config.radianceCacheDepth = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--radiance-cache-cell") == 0 && hasValue) Config.radianceCacheCell = strtof(argv[++i], NULL);
+        else if (strcmp(argv[i], "--persistent-radiance-cache") == 0) Config.persistentRadianceCache = true;
+        else if (strcmp(argv[i], "--paged-mesh") == 0 && hasValue) Config.pagedMeshPath = argv[++i];
+        else if (strcmp(argv[i], "--page-budget") == 0 && hasValue) Config.pageBudgetBytes = strtoul(argv[++i], NULL, 10) << 20;
+        else if (strcmp(argv[i], "--unsorted-rays") == 0) Config.sortByCluster = false;
+        else if (strcmp(argv[i], "--write-paged-mesh") == 0 && i + 2 < argc) {
+            Config.writePagedPath = argv[++i];
+            Config.writePagedGrid = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && hasValue) {
+            const char* const backend = argv[++i];
+            if (strcmp(backend, "embree") == 0) Config.accelBackend = false;
+            else if (strcmp(backend, "accel") == 0) Config.accelBackend = true;
+            else PANIC("Unknown backend: %s", backend);
+        }
+        else if (strcmp(argv[i], "--integrator") == 0 && hasValue) {
+            const char* const integrator = argv[++i];
+            if (strcmp(integrator, "path") == 0) Config.integrator = IntegratorPath;
+            else if (strcmp(integrator, "albedo") == 0) Config.integrator = IntegratorAlbedo;
+            else if (strcmp(integrator, "normal") == 0) Config.integrator = IntegratorNormal;
+            else if (strcmp(integrator, "depth") == 0) Config.integrator = IntegratorDepth;
+            else if (strcmp(integrator, "ao") == 0) Config.integrator = IntegratorAmbientOcclusion;
+            else if (strcmp(integrator, "direct") == 0) Config.integrator = IntegratorDirect;
+            else PANIC("Unknown integrator: %s", integrator);
+        }
+        else if (strcmp(argv[i], "--ao-samples") == 0 && hasValue) Config.nAoSamples = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ao-distance") == 0 && hasValue) Config.aoDistance = strtof(argv[++i], NULL);
+        else if (strcmp(argv[i], "--pin-threads") == 0) Config.pinThreads = true;
+        else PANIC("Unknown argument: %s", argv[i]);
+    }
+    if (Config.nSamplesPerPass == 0) PANICM("--pass-spp has to be positive");
+    if (Config.nLoaderThreads == 0) PANICM("--loader-threads has to be positive");
+    if (Config.radianceCacheDepth > 2) PANICM("--radiance-cache has to be 1 or 2");
+    if (Config.radianceCacheCell <= 0.f) PANICM("--radiance-cache-cell has to be positive");
+    if (Config.aoDistance <= 0.f) PANICM("--ao-distance has to be positive");
+    // Previews are for checking the scene quickly, the denoiser would only blur them.
+    if (Config.integrator != IntegratorPath) Config.denoise = false;
+    if (Config.writePagedPath != NULL && Config.writePagedGrid == 0) PANICM("--write-paged-mesh needs a positive grid size");
+    // The rasterizer only sees resident meshes.
+    if (Config.pagedMeshPath != NULL && Config.visibilityBuffer) PANICM("--paged-mesh does not work with --visibility-buffer");
+    // Only the instanced mesh is built into the accel, everything else exists in the Embree scenes alone.
+    if (Config.accelBackend && (Config.lods || Config.nSpheres > 0 || Config.pagedMeshPath != NULL)) {
+        PANICM("--backend accel does not work with --lod, --spheres or --paged-mesh");
     }
 }
 
-i32 main(void) {
+i32 main(const i32 argc, char** const argv) {
+    const f64 startTime = NowSeconds();
+    ParseArgs(argc, argv);
     PRINTLN(FS(usize), __STDC_VERSION__);
     const char* const objPaths[] = { "../scenes/backpack.obj" };
 
+    if (Config.writePagedPath != NULL) {
+        Obj obj;
+        LoadOBJ(objPaths[0], &obj);
+        Instances grid = AllocateArray(Instance, Config.writePagedGrid * Config.writePagedGrid);
+        SceneNxN(grid, Config.writePagedGrid);
+        const f64 writeStart = NowSeconds();
+        WritePagedMesh(Config.writePagedPath, &obj, grid);
+        LOGLN("Wrote %s in %.3f s", Config.writePagedPath, NowSeconds() - writeStart);
+        FreeArray(grid);
+        FreeOBJ(obj);
+        exit(EXIT_SUCCESS);
+    }
+
     if (AppState.windowedMode) {
         LOGLNM("Running in windowed mode");
 
@@ -356,13 +630,26 @@ i32 main(void) {
 
     const RendererConfig config = {
         .nMeshes = ARRAY_LENGTH(objPaths),
-        .objPaths = objPaths,
         .vs = vs,
         .fs = fs,
         .useGl = AppState.windowedMode,
+        .compactVertices = Config.compactVertices,
+        .lodErrorPixels = Config.lods ? Config.lodErrorPixels : 0.f,
+        .viewportHeight = AppState.height,
     };
     Renderer.initialize(config);
 
+    MeshLoader loader;
+    StartMeshLoader(&loader, Renderer.meshes, (MeshLoaderConfig) {
+        .paths = objPaths,
+        .nThreads = Config.nLoaderThreads,
+        .weldEpsilon = Config.weld ? &Config.weldEpsilon : NULL,
+        .optimize = Config.optimizeMeshes ? &Config.meshOptimizeParams : NULL,
+        .compactVertices = Config.compactVertices,
+        .lods = Config.lods ? &Config.lodParams : NULL,
+        .textures = Config.textures,
+    });
+
     usize frameCount = 0;
     f64 lastUpdate = 0.0;
 
@@ -376,146 +663,279 @@ i32 main(void) {
     Instances instances = AllocateArray(Instance, nInstances);
     SceneNxN(instances, nInstancesInRow);
 
-    if (AppState.windowedMode) AddInstances(0, instances);
-
-    const RTCDevice device = rtcNewDevice(NULL);
-    if (!device) PANIC("error %d: cannot create device", rtcGetDeviceError(NULL));
-    rtcSetDeviceErrorFunction(device, EmbreeErrorCallback, NULL);
+    // One pool traces every pass and joins every BVH build, Embree starts no threads of its own.
+    RenderShared shared;
+    RenderSharedConfig sharedConfig = RENDER_SHARED_DEFAULTS;
+    sharedConfig.pinWorkers = Config.pinThreads;
+    CreateRenderShared(&shared, Config.nWorkers, sharedConfig);
+    const RTCDevice device = shared.device;
 
     if (rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_RAY_MASK_SUPPORTED)) 
         LOGLNM("RTC_DEVICE_PROPERTY_RAY_MASK_SUPPORTED is on");
 
-    RTCScene scene = rtcNewScene(device);
-
-    RTCScene meshScene = rtcNewScene(device);
-    RTCGeometry mesh = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
-
-    LOGLNM("Allocating embree positions");
-    Position* const positions = (Position*)rtcSetNewGeometryBuffer(
-        mesh,
-        RTC_BUFFER_TYPE_VERTEX, 
-        0,
-        RTC_FORMAT_FLOAT3, 
-        sizeof(Position), 
-        Renderer.meshes.data[0].obj.nVertices
-    );
-    
-    ASSERT_EQ(Renderer.meshes.data[0].obj.nIndices % 3, 0);
-
-    LOGLNM("Allocating embree indices");
-    u32(*indices)[3] = (u32(*)[3])rtcSetNewGeometryBuffer(
-        mesh,
-        RTC_BUFFER_TYPE_INDEX,
-        0,
-        RTC_FORMAT_UINT3,
-        3 * sizeof(u32),
-        Renderer.meshes.data[0].obj.nIndices / 3
-    );
-
-    for (usize i = 0; i < Renderer.meshes.data[0].obj.nVertices; i++) {
-        positions[i] = Renderer.meshes.data[0].obj.vertices[i].position;
+    ProgressiveScene scene = {
+        .shared = &shared,
+        .device = device,
+        .scene = rtcNewScene(device),
+        .nLods = Config.lods ? Config.lodParams.maxLevels : 0,
+        .meshScenes = AllocateArray(RTCScene, Renderer.meshes.len * (MAX_LODS + 1)),
+        .geometryArenas = AllocateArray(Arena, Renderer.meshes.len),
+        .instances = instances,
+        .instanceScale = 0.f,
+        .visibleMeshes = AllocateArray(VisibilityMesh, Renderer.meshes.len),
+        .nVisibleMeshes = 0,
+    };
+    CommitSharedScene(&shared, scene.scene);
+    for (usize l = 0; l < scene.nLods; l++) {
+        scene.lodScenes[l] = rtcNewScene(device);
+        CommitSharedScene(&shared, scene.lodScenes[l]);
+        scene.lodErrors[l] = 0.f;
     }
-
-    for (usize i = 0; i < Renderer.meshes.data[0].obj.nIndices / 3; i++) {
-        indices[i][0] = Renderer.meshes.data[0].obj.indices[3 * i + 0];
-        indices[i][1] = Renderer.meshes.data[0].obj.indices[3 * i + 1];
-        indices[i][2] = Renderer.meshes.data[0].obj.indices[3 * i + 2];
+    for (usize i = 0; i < scene.meshScenes.len; i++) scene.meshScenes.data[i] = NULL;
+    for (usize i = 0; i < instances.len; i++) scene.instanceScale = glm_max(scene.instanceScale, InstanceScale(&instances.data[i]));
+
+    COMMENT(--------========[ Primitives ]========--------)
+
+    // Attached before any mesh is published, so primitives take the first geometry ids of every TLAS.
+    Arena primitiveArena = { 0 };
+    Arena primitiveSceneArena = { 0 };
+    Primitives primitives = { 0 };
+    Material primitiveMaterials[ARRAY_LENGTH(Palette1)];
+    if (Config.nSpheres > 0) {
+        primitiveArena = CreateArena(PrimitivesArenaSize(Config.nSpheres, PRIMITIVE_DISCS, 1));
+        primitives = ScatterPrimitives(&primitiveArena, Config.nSpheres);
+        primitiveSceneArena = CreateArena(PrimitiveSceneArenaSize(&primitives));
+        RTCScene tlases[MAX_LODS + 1] = { scene.scene };
+        for (usize l = 0; l < scene.nLods; l++) tlases[l + 1] = scene.lodScenes[l];
+        AttachPrimitives(device, tlases, scene.nLods + 1, &primitives, &primitiveSceneArena);
+        for (usize s = 0; s <= scene.nLods; s++) CommitSharedScene(&shared, tlases[s]);
+
+        MaterialRaster rasterMaterials[ARRAY_LENGTH(Palette1)];
+        for (usize i = 0; i < ARRAY_LENGTH(Palette1); i++) {
+            CreateLambertian(&primitiveMaterials[i], Palette1[i], 0.8f);
+            glm_vec3_copy(Palette1[i], rasterMaterials[i].albedo);
+            rasterMaterials[i].matte = 0.8f;
+        }
+        if (AppState.windowedMode) UploadPrimitives(&primitives, rasterMaterials);
     }
 
-    rtcCommitGeometry(mesh);
+    COMMENT(--------========[ Paged Mesh ]========--------)
+
+    // Attached after the primitives and before any mesh is published, for the same reason.
+    PagedMesh pagedMesh;
+    Material pagedMaterial;
+    if (Config.pagedMeshPath != NULL) {
+        OpenPagedMesh(Config.pagedMeshPath, Config.pageBudgetBytes, &pagedMesh);
+        RTCScene tlases[MAX_LODS + 1] = { scene.scene };
+        for (usize l = 0; l < scene.nLods; l++) tlases[l + 1] = scene.lodScenes[l];
+        const f64 buildStart = NowSeconds();
+        AttachPagedMesh(device, tlases, scene.nLods + 1, &pagedMesh);
+        for (usize s = 0; s <= scene.nLods; s++) CommitSharedScene(&shared, tlases[s]);
+        LOGLN("Built the BVH over" FS(usize) "clusters in %.3f ms", pagedMesh.nClusters, (NowSeconds() - buildStart) * 1e3);
+        CreateLambertian(&pagedMaterial, Palette1[5], 0.8f);
+    }
 
-    // Attach the geometry to the scene
-    rtcAttachGeometry(meshScene, mesh);
-    rtcReleaseGeometry(mesh);
-    rtcCommitScene(meshScene);
+    COMMENT(--------========[ Lights ]========--------)
+
+    Array(Light) lights = AllocateArray(Light, Config.nLights);
+    LightTree lightTree;
+    CreateLightTree(&lightTree, Config.nLights);
+    if (Config.nLights > 0) {
+        ScatterLights(lights.data, lights.len, RNG_SEED, LIGHTS_TOTAL_POWER);
+        const f64 buildStart = NowSeconds();
+        BuildLightTree(&lightTree, lights.data, lights.len);
+        LOGLN("Built light tree of" FS(usize) "nodes over" FS(usize) "lights in %.3f ms",
+            lightTree.nNodes, lightTree.nLights, (NowSeconds() - buildStart) * 1e3);
+    }
 
-    // Create Embree instnaces
-    for (usize i = 0; i < instances.len; i++) {
-        RTCGeometry geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE);
-        rtcSetGeometryInstancedScene(geometry, meshScene);
-        // glm_mat4_transpose(instances.data[i].model);
-        rtcSetGeometryTransform(
-            geometry,
-            0,
-            RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
-            instances.data[i].model
-        );
-        rtcCommitGeometry(geometry);
-        rtcAttachGeometry(scene, geometry);
-        rtcReleaseGeometry(geometry);
+    Environment environment;
+    if (Config.environmentPath != NULL) {
+        const f64 loadStart = NowSeconds();
+        LoadEnvironment(Config.environmentPath, &environment);
+        LOGLN("Loaded %ux%u environment %s in %.3f ms", environment.width, environment.height, Config.environmentPath, (NowSeconds() - loadStart) * 1e3);
     }
-    
-    // Commit the scene
-    rtcCommitScene(scene);
 
     COMMENT(---------===========[ Trace Rays ]===========---------)
 
+    TextureCache textureCache;
+    if (Config.textures) CreateTextureCache(&textureCache, Config.textureCacheBytes);
+    RadianceCache radianceCache;
+    if (Config.radianceCacheDepth > 0) CreateRadianceCache(&radianceCache, RADIANCE_CACHE_CAPACITY, Config.radianceCacheCell, Config.radianceCacheDepth);
+
     RayTracer rt = (RayTracer) {
-        .materials = AllocateArray(Material, instances.len),
+        // Instance ids start after the primitive geometries and the paged mesh.
+        .materials = AllocateArray(Material, Renderer.meshes.len * instances.len + PrimitiveKindCount + 1),
         // .nMaxReflections = 1,
         // .nRaysPerSample = 1,
         .nMaxReflections = 15,
-        .nRaysPerSample = 30,
-        .rtcScene = scene,
+        .nRaysPerSample = Config.nSamplesPerPass,
+        .rtcScene = scene.scene,
         .skyColor = { 0.5f, 0.7f, 1.0f },
+        .seed = RNG_SEED,
+        .mesh = NULL,
+        .indices = NULL,
+        .lodScenes = scene.lodScenes,
+        .lodErrors = scene.lodErrors,
+        .lodIndices = scene.lodIndices,
+        .nLods = scene.nLods,
+        .lodBudget = Config.lodErrorPixels,
+        .vertices = NULL,
+        .texCoords = NULL,
+        .textureCache = Config.textures ? &textureCache : NULL,
+        .meshScale = scene.instanceScale,
+        .primitives = Config.nSpheres > 0 ? &primitives : NULL,
+        .primitiveMaterials = primitiveMaterials,
+        .lights = Config.nLights > 0 ? &lightTree : NULL,
+        .lightSelection = Config.uniformLights ? LightSelectionUniform : LightSelectionTree,
+        .environment = Config.environmentPath != NULL ? &environment : NULL,
+        .radianceCache = Config.radianceCacheDepth > 0 ? &radianceCache : NULL,
+        .pagedMesh = Config.pagedMeshPath != NULL ? &pagedMesh : NULL,
+        .pagedMaterial = &pagedMaterial,
+        .sortByCluster = Config.sortByCluster,
+        .accelScene = NULL,
+        .integrator = Config.integrator,
+        .nAoSamples = Config.nAoSamples,
+        .aoDistance = Config.aoDistance,
     };
 
-    for (usize i = 0; i < instances.len; i++) {
-        CreateLambertian(&rt.materials.data[i], Palette1[i % ARRAY_LENGTH(Palette1)], 0.8f);
-    }
-
-    Array(Rgb256) buffer = AllocateArray(Rgb256, AppState.width * AppState.height);
+    // Framebuffer pages are first touched by the worker that traces them.
+    Arena frameArena = CreateArena(
+        AppState.width * AppState.height * sizeof(Rgb256)
+        + AovsArenaSize(AppState.width, AppState.height)
+        + AccumulationArenaSize(AppState.width, AppState.height)
+        + DenoiseArenaSize(AppState.width, AppState.height)
+    );
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, AppState.width * AppState.height);
     Buffer2d framebuffer = (Buffer2d) {
         .width = AppState.width,
         .height = AppState.height,
         .buffer = buffer.data
     };
+    Aovs aovs = CreateAovs(&frameArena, AppState.width, AppState.height);
+    CreateAccumulation(&frameArena, &aovs);
+
+    if (Config.resume) {
+        // The checkpoint was rendered with the whole scene.
+        while (!MeshLoaderDone(&loader)) PublishLoadedMeshes(&loader, &scene, &rt, true);
+        if (LoadCheckpoint(Config.checkpointPath, &aovs, &rt.seed)) {
+            LOGLN("Resuming from %s at" FS(u32) "samples per pixel", Config.checkpointPath, aovs.nSamples[0]);
+        } else {
+            LOGLN("No checkpoint at %s, starting from scratch", Config.checkpointPath);
+        }
+    }
 
     Tasks tasks = {
-        .pTasks = AllocateArray(PTask, Config.nWorkers),
+        .pTasks = AllocatePTasks(Config.nWorkers),
         .sTasks = (Array(STask)) { .len = 0 }
     };
 
-    Display display = {
-        .tasks = tasks,
-        .start = time(NULL)
-    };
+    VisibilityBuffer visibility;
+    if (Config.visibilityBuffer) CreateVisibilityBuffer(&visibility, AppState.width, AppState.height, Config.nWorkers);
 
     vec3 lookDir;
     glm_vec3_copy(Renderer.camera.direction, lookDir);
 
-    Array(RenderJobParams) params = AllocateArray(RenderJobParams, Config.nWorkers);
-    Array(pthread_t) tids = AllocateArray(pthread_t, Config.nWorkers);
-
-    LOGLN("Starting" FS(usize) "worker threads", Config.nWorkers);
-    for (usize tid = 0; tid < Config.nWorkers; tid++) {
-        params.data[tid].tid = tid;
-        params.data[tid].framebuffer = framebuffer;
-        params.data[tid].rt = &rt;
-        params.data[tid].task = &display.tasks.pTasks.data[tid];
-        LOGLN("  * starting worker:" FS(usize), tid);
-        const i32 result = pthread_create(
-            &tids.data[tid],
-            NULL,
-            RenderJob,
-            &params.data[tid]
-        );
-        if (0 != result) PANIC("Failed to create worker" FS(usize), tid);
+    CheckpointWriter checkpointWriter;
+    StartCheckpointWriter(&checkpointWriter, Config.checkpointPath, AppState.width, AppState.height, rt.seed);
+    f64 lastCheckpoint = NowSeconds();
+
+    // Every pass adds the same number of samples to every pixel, so any pixel tells how far the render got.
+    RayStats stats = { 0 };
+    f64 elapsed = 0.0;
+    bool firstPass = true;
+    while (!MeshLoaderDone(&loader) || aovs.nSamples[0] < Config.nSamples) {
+        // Samples of a partial scene are thrown away once the next mesh arrives, so there is no point in
+        // converging one, wait for the next mesh instead.
+        const bool converged = aovs.nSamples[0] >= Config.nSamples;
+        const bool sceneChanged = PublishLoadedMeshes(&loader, &scene, &rt, converged) > 0;
+        if (sceneChanged && aovs.nSamples[0] > 0) {
+            LOGLNM("Scene changed, restarting accumulation");
+            ResetAccumulation(&aovs);
+        }
+        if (Config.radianceCacheDepth > 0 && (sceneChanged || !Config.persistentRadianceCache)) ResetRadianceCache(&radianceCache);
+        // The camera does not move, camera rays only hit something else once the scene changes.
+        if (Config.visibilityBuffer && (sceneChanged || firstPass)) {
+            const VisibilityScene visibilityScene = {
+                .meshes = scene.visibleMeshes.data,
+                .nMeshes = scene.nVisibleMeshes,
+                .primitives = rt.primitives,
+            };
+            const f64 rasterStart = NowSeconds();
+            RasterizeVisibility(&visibility, &visibilityScene, FULL_FRAME(framebuffer), &shared.pool);
+            LOGLN("Rasterized" FS(usize) "of" FS(usize) "triangles into the visibility buffer in %.3f ms",
+                visibility.nBinnedTriangles, visibility.nTriangles, (NowSeconds() - rasterStart) * 1e3);
+            rt.primaryHits = visibility.hits;
+        }
+
+        const usize remaining = Config.nSamples - aovs.nSamples[0];
+        rt.nRaysPerSample = remaining < Config.nSamplesPerPass ? remaining : Config.nSamplesPerPass;
+        LOGLN("Pass at" FS(u32) "of" FS(usize) "samples per pixel", aovs.nSamples[0], Config.nSamples);
+
+        Display display;
+        InitializeDisplay(&display, tasks);
+        const RenderJobs jobs = StartPoolRenderJobs(&shared.pool, &rt, 1, FULL_FRAME(framebuffer), framebuffer, aovs, &display);
+        SetupDisplay(&display);
+        while(!FinishedDisplay(&display)) {
+            WaitDisplay(&display, DISPLAY_REFRESH_MS);
+            UpdateDisplay(&display);
+        }
+        const RayStats passStats = JoinRenderJobs(jobs);
+        stats.nRays += passStats.nRays;
+        stats.nPrimaryRays += passStats.nPrimaryRays;
+        stats.nLodRays += passStats.nLodRays;
+        stats.intersectSec += passStats.intersectSec;
+        elapsed += ElapsedDisplay(&display);
+        DropDisplay(&display);
+        if (firstPass) {
+            LOGLN("First pass done %.3f s after start", NowSeconds() - startTime);
+            firstPass = false;
+        }
+
+        // Workers are idle here, snapshot the sums for the writer thread. Partial scenes are not worth resuming.
+        const f64 now = NowSeconds();
+        if (MeshLoaderDone(&loader) && now - lastCheckpoint >= Config.checkpointIntervalSec && SubmitCheckpoint(&checkpointWriter, &aovs, false)) {
+            lastCheckpoint = now;
+        }
     }
-    LOGLNM("Waiting for worker threads to finish");
-    SetupDisplay(&display);
-    while(!FinishedDisplay(&display)) {
-        usleep(16 * 1000);
-        UpdateDisplay(&display);
+    // Always leave a final checkpoint behind so the render can be continued with more samples.
+    SubmitCheckpoint(&checkpointWriter, &aovs, true);
+    StopCheckpointWriter(&checkpointWriter);
+    StopMeshLoader(&loader);
+    LOGLN("Traced" FS(usize) "rays (" FS(usize) "primary) in %.3f s", stats.nRays, stats.nPrimaryRays, elapsed);
+    if (scene.nLods > 0) LOGLN("  " FS(usize) "rays traced against simplified levels", stats.nLodRays);
+    if (Config.radianceCacheDepth > 0) {
+        LOGLN("Radiance cache:" FS(usize) "of" FS(usize) "records in use", RadianceCacheRecords(&radianceCache), radianceCache.capacity);
     }
-
-    // TODO: implement concurrent prograss bars
-    for (usize tid = 0; tid < Config.nWorkers; tid++) {
-        pthread_join(tids.data[tid], NULL);
+    if (Config.pagedMeshPath != NULL) {
+        PagedMeshStats pagedStats;
+        GetPagedMeshStats(&pagedMesh, &pagedStats);
+        LOGLN("Paged mesh:" FS(u64) "page ins (%.3f per thousand rays)," FS(u64) "evictions, peak" FS(usize) "of" FS(usize)
+            "KiB resident plus" FS(usize) "KiB of cluster table",
+            pagedStats.nPageIns, stats.nRays > 0 ? 1e3 * (f64)pagedStats.nPageIns / (f64)stats.nRays : 0.0, pagedStats.nEvictions,
+            pagedStats.peakResidentBytes / 1024, pagedStats.budgetBytes / 1024, pagedStats.tableBytes / 1024);
+    }
+    if (Config.textures) {
+        TextureCacheStats textureStats;
+        GetTextureCacheStats(&textureCache, &textureStats);
+        const u64 nLookups = textureStats.hits + textureStats.misses;
+        LOGLN("Texture cache:" FS(u64) "hits," FS(u64) "misses (%.3f %% hit rate)," FS(usize) "of" FS(usize) "KiB resident",
+            textureStats.hits, textureStats.misses, nLookups > 0 ? 100.0 * (f64)textureStats.hits / (f64)nLookups : 0.0,
+            textureStats.residentBytes / 1024, textureStats.capacityBytes / 1024);
     }
-    
+
     LOGLNM("Tracing done");
 
+    if (Config.denoise) {
+        Denoise(&aovs, DENOISE_DEFAULTS, &shared.pool, &frameArena, aovs.color);
+        Tonemap(aovs.color, framebuffer);
+        LOGLNM("Denoising done");
+    }
+
+#ifdef _PROFILING
+    ProfilerReport();
+    ProfilerWriteChromeTrace("./trace.json");
+#endif
+
     i32 result = stbi_write_bmp("./test.bmp", framebuffer.width, framebuffer.height, 3, framebuffer.buffer);
     if (result == 0) PANICM("image failed");
     else LOGLNM("Image written to file");
@@ -579,10 +999,30 @@ i32 main(void) {
     }
 
     FreeArray(tasks.pTasks);
-    FreeArray(buffer);
-
-    rtcReleaseScene(scene);
-    rtcReleaseScene(meshScene);
-    rtcReleaseDevice(device);
+    DropArena(&frameArena);
+    if (Config.textures) DestroyTextureCache(&textureCache);
+    if (Config.visibilityBuffer) DestroyVisibilityBuffer(&visibility);
+    DestroyLightTree(&lightTree);
+    if (Config.environmentPath != NULL) DestroyEnvironment(&environment);
+    if (Config.radianceCacheDepth > 0) DestroyRadianceCache(&radianceCache);
+    FreeArray(lights);
+
+    rtcReleaseScene(scene.scene);
+    for (usize l = 0; l < scene.nLods; l++) rtcReleaseScene(scene.lodScenes[l]);
+    for (usize i = 0; i < scene.meshScenes.len; i++) {
+        if (scene.meshScenes.data[i] != NULL) rtcReleaseScene(scene.meshScenes.data[i]);
+    }
+    for (usize i = 0; i < Renderer.meshes.len; i++) DropArena(&scene.geometryArenas.data[i]);
+    FreeArray(scene.meshScenes);
+    FreeArray(scene.geometryArenas);
+    FreeArray(scene.visibleMeshes);
+    if (Config.nSpheres > 0) {
+        DropArena(&primitiveSceneArena);
+        DropArena(&primitiveArena);
+    }
+    // Scenes hold the paged mesh's geometry, release them first.
+    if (Config.pagedMeshPath != NULL) ClosePagedMesh(&pagedMesh);
+    if (rt.accelScene != NULL) DestroyAccelScene(&scene.accelScene);
+    DestroyRenderShared(&shared);
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <embree3/rtcore.h>
+#include <cglm/cglm.h>
+#include <cmm/cmm.h>
+
+#include "renderer.h"
+#include "ray_tracing.h"
+#include "render_job.h"
+#include "render_context.h"
+#include "scene.h"
+#include "obj.h"
+#include "arena.h"
+#include "denoise.h"
+#include "distributed.h"
+
+/*
+ * Distributed rendering entry point, runs either as the coordinator of a frame or as one of its workers.
+ *
+ * Workers load the scene once and render whatever tiles the coordinator sends them, see `distributed.h`.
+ * `--spawn N` starts N local workers from the coordinator process for testing on a single machine, more
+ * workers can be started separately with `--worker` at any time.
+ *
+ * Workers trace tiles and build their BVHs on the pool of a `RenderShared`. On multi-socket nodes `--pin-threads`
+ * pins its threads spread over the NUMA nodes and `--numa-replicas` additionally keeps the mesh and instance scene
+ * once per node, so every thread traces memory local to it.
+ *
+ * usage: ray-tracer-baby-node --coordinator ADDRESS [--spawn N] [--size N] [--spp N] [--tile N] [--out FILE]
+ *                             [--no-denoise] [--threads N] [--obj PATH] [--grid N] [--pin-threads] [--numa-replicas]
+ *        ray-tracer-baby-node --worker ADDRESS [--threads N] [--obj PATH] [--grid N] [--pin-threads] [--numa-replicas]
+ */
+
+#define MAX_SPAWNED_WORKERS 64
+
+internal struct {
+    const char* coordinatorAddress;
+    const char* workerAddress;
+    usize nSpawn;
+    usize size;
+    usize spp;
+    usize maxReflections;
+    usize tileSize;
+    f64 reissueFactor;
+    bool denoise;
+    const char* outPath;
+    usize nThreads;
+    const char* objPath;
+    usize gridSize;
+    bool pinThreads;
+    bool numaReplicas;
+} NodeConfig = {
+    .coordinatorAddress = NULL,
+    .workerAddress = NULL,
+    .nSpawn = 0,
+    .size = 800,
+    .spp = 30,
+    .maxReflections = 15,
+    .tileSize = 64,
+    .reissueFactor = 3.0,
+    .denoise = true,
+    .outPath = "./distributed.ppm",
+    .nThreads = 8,
+    .objPath = "../scenes/sphere.obj",
+    .gridSize = 3,
+    .pinThreads = false,
+    .numaReplicas = false,
+};
+
+internal f32 Palette[4][3] = {
+    { 0.82f, 0.51f, 0.35f },
+    { 1.00f, 0.67f, 0.37f },
+    { 0.55f, 0.41f, 0.48f },
+    { 1.00f, 0.83f, 0.64f },
+};
+
+#if defined(RTC_NAMESPACE_USE)
+RTC_NAMESPACE_USE
+#endif
+
+COMMENT(--------========[ Worker ]========--------)
+
+typedef struct {
+    RenderShared shared;
+    SharedMesh mesh;
+    Instances instances;
+    /// Instance scene and tracer per replica of `shared`, all tracers share their materials.
+    RTCScene instanceScenes[MAX_REPLICAS];
+    RayTracer rts[MAX_REPLICAS];
+    Array(Rgb256) preview;
+} WorkerState;
+
+internal void LoadWorkerScene(WorkerState* const state) {
+    const RenderSharedConfig config = {
+        .pinWorkers = NodeConfig.pinThreads,
+        .replicatePerNode = NodeConfig.numaReplicas,
+    };
+    CreateRenderShared(&state->shared, NodeConfig.nThreads, config);
+    LoadSharedMesh(&state->shared, NodeConfig.objPath, &state->mesh);
+    state->instances = AllocateArray(Instance, NodeConfig.gridSize * NodeConfig.gridSize);
+    SceneNxN(state->instances, NodeConfig.gridSize);
+
+    const RTCDevice device = state->shared.device;
+    const usize nReplicas = state->shared.nReplicas;
+    for (usize r = 0; r < nReplicas; r++) {
+        state->instanceScenes[r] = rtcNewScene(device);
+        AttachInstances(device, state->instanceScenes[r], state->mesh.scenes[r], state->instances);
+    }
+    CommitReplicatedScenes(&state->shared, state->instanceScenes);
+
+    const Array(Material) materials = AllocateArray(Material, state->instances.len);
+    for (usize i = 0; i < state->instances.len; i++) {
+        CreateLambertian(&materials.data[i], Palette[i % ARRAY_LENGTH(Palette)], 0.8f);
+    }
+    for (usize r = 0; r < nReplicas; r++) {
+        state->rts[r] = (RayTracer) {
+            .materials = materials,
+            .rtcScene = state->instanceScenes[r],
+            .skyColor = { 0.5f, 0.7f, 1.0f },
+        };
+    }
+    state->preview = (Array(Rgb256)) { .len = 0, .data = NULL };
+}
+
+internal void DropWorkerScene(WorkerState* const state) {
+    if (state->preview.data != NULL) FreeArray(state->preview);
+    FreeArray(state->rts[0].materials);
+    FreeArray(state->instances);
+    for (usize r = 0; r < state->shared.nReplicas; r++) rtcReleaseScene(state->instanceScenes[r]);
+    DestroySharedMesh(&state->mesh);
+    DestroyRenderShared(&state->shared);
+}
+
+internal void PrepareFrame(void* const context, const FrameDesc* const frame) {
+    WorkerState* const state = context;
+    for (usize r = 0; r < state->shared.nReplicas; r++) {
+        state->rts[r].nRaysPerSample = frame->nRaysPerSample;
+        state->rts[r].nMaxReflections = frame->nMaxReflections;
+    }
+    if (state->preview.data != NULL) FreeArray(state->preview);
+    state->preview = AllocateArray(Rgb256, (usize)frame->tileSize * frame->tileSize);
+}
+
+internal void RenderTile(void* const context, const FrameDesc* const frame, const TileDesc* const tile, const Aovs aovs) {
+    WorkerState* const state = context;
+    const usize nThreads = state->shared.pool.workers.len;
+    const FrameRegion region = {
+        .x = tile->x,
+        .y = tile->y,
+        .frameWidth = frame->width,
+        .frameHeight = frame->height,
+    };
+    const Buffer2d preview = { .width = tile->width, .height = tile->height, .buffer = state->preview.data };
+
+    const Tasks tasks = {
+        .pTasks = AllocatePTasks(nThreads),
+        .sTasks = (Array(STask)) { .len = 0 },
+    };
+    Display display;
+    InitializeDisplay(&display, tasks);
+    JoinRenderJobs(StartPoolRenderJobs(&state->shared.pool, state->rts, state->shared.nReplicas, region, preview, aovs, &display));
+    DropDisplay(&display);
+    FreeArray(tasks.pTasks);
+}
+
+internal void RunWorkerNode(void) {
+    WorkerState state;
+    LoadWorkerScene(&state);
+    RunWorker(NodeConfig.workerAddress, (TileRenderer) {
+        .context = &state,
+        .prepare = PrepareFrame,
+        .render = RenderTile,
+    });
+    DropWorkerScene(&state);
+}
+
+COMMENT(--------========[ Coordinator ]========--------)
+
+internal pid_t SpawnWorker(const char* const executable) {
+    char threads[32];
+    char grid[32];
+    snprintf(threads, sizeof threads, "%zu", NodeConfig.nThreads);
+    snprintf(grid, sizeof grid, "%zu", NodeConfig.gridSize);
+
+    const pid_t pid = fork();
+    if (pid < 0) PANICM("Failed to fork worker");
+    if (pid == 0) {
+        char* args[] = {
+            (char*)executable,
+            "--worker", (char*)NodeConfig.coordinatorAddress,
+            "--threads", threads,
+            "--obj", (char*)NodeConfig.objPath,
+            "--grid", grid,
+            NULL,
+            NULL,
+            NULL,
+        };
+        usize nArgs = 9;
+        if (NodeConfig.pinThreads) args[nArgs++] = "--pin-threads";
+        if (NodeConfig.numaReplicas) args[nArgs++] = "--numa-replicas";
+        execv(executable, args);
+        PANIC("Failed to start worker %s", executable);
+    }
+    return pid;
+}
+
+internal void WritePpm(const char* const path, const Buffer2d framebuffer) {
+    FILE* const file = fopen(path, "wb");
+    if (file == NULL) PANIC("Failed to open %s", path);
+    fprintf(file, "P6\n%zu %zu\n255\n", framebuffer.width, framebuffer.height);
+    fwrite(framebuffer.buffer, sizeof(Rgb256), framebuffer.width * framebuffer.height, file);
+    fclose(file);
+}
+
+internal void RunCoordinatorNode(const char* const executable) {
+    const usize size = NodeConfig.size;
+    Arena frameArena = CreateArena(size * size * sizeof(Rgb256) + AovsArenaSize(size, size) + DenoiseArenaSize(size, size));
+    Array(Rgb256) buffer = ArenaAllocateArray(&frameArena, Rgb256, size * size);
+    const Buffer2d framebuffer = { .width = size, .height = size, .buffer = buffer.data };
+    const Aovs aovs = CreateAovs(&frameArena, size, size);
+
+    const i32 listener = ListenCoordinator(NodeConfig.coordinatorAddress);
+    pid_t workers[MAX_SPAWNED_WORKERS];
+    const usize nSpawn = NodeConfig.nSpawn < MAX_SPAWNED_WORKERS ? NodeConfig.nSpawn : MAX_SPAWNED_WORKERS;
+    for (usize i = 0; i < nSpawn; i++) workers[i] = SpawnWorker(executable);
+
+    const CoordinatorConfig config = {
+        .frame = {
+            .id = 0,
+            .width = (u32)size,
+            .height = (u32)size,
+            .nRaysPerSample = (u32)NodeConfig.spp,
+            .nMaxReflections = (u32)NodeConfig.maxReflections,
+            .tileSize = (u32)NodeConfig.tileSize,
+        },
+        .reissueFactor = NodeConfig.reissueFactor,
+    };
+    RunCoordinator(listener, &config, aovs);
+    for (usize i = 0; i < nSpawn; i++) waitpid(workers[i], NULL, 0);
+
+    if (NodeConfig.denoise) {
+        // The coordinator traces nothing itself, its pool lives only as long as the filter runs.
+        WorkerPool pool;
+        CreateWorkerPool(&pool, NodeConfig.nThreads);
+        Denoise(&aovs, DENOISE_DEFAULTS, &pool, &frameArena, aovs.color);
+        DestroyWorkerPool(&pool);
+    }
+    Tonemap(aovs.color, framebuffer);
+    WritePpm(NodeConfig.outPath, framebuffer);
+    LOGLN("Image written to %s", NodeConfig.outPath);
+    DropArena(&frameArena);
+}
+
+internal void ParseArgs(const i32 argc, char** const argv) {
+    for (i32 i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--coordinator") == 0 && hasValue) NodeConfig.coordinatorAddress = argv[++i];
+        else if (strcmp(argv[i], "--worker") == 0 && hasValue) NodeConfig.workerAddress = argv[++i];
+        else if (strcmp(argv[i], "--spawn") == 0 && hasValue) NodeConfig.nSpawn = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--size") == 0 && hasValue) NodeConfig.size = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--spp") == 0 && hasValue) NodeConfig.spp = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--tile") == 0 && hasValue) NodeConfig.tileSize = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--out") == 0 && hasValue) NodeConfig.outPath = argv[++i];
+        else if (strcmp(argv[i], "--no-denoise") == 0) NodeConfig.denoise = false;
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue) NodeConfig.nThreads = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--obj") == 0 && hasValue) NodeConfig.objPath = argv[++i];
+        else if (strcmp(argv[i], "--grid") == 0 && hasValue) NodeConfig.gridSize = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--pin-threads") == 0) NodeConfig.pinThreads = true;
+        else if (strcmp(argv[i], "--numa-replicas") == 0) NodeConfig.numaReplicas = true;
+        else PANIC("Unknown argument: %s", argv[i]);
+    }
+    if ((NodeConfig.coordinatorAddress == NULL) == (NodeConfig.workerAddress == NULL)) {
+        PANICM("Expected exactly one of --coordinator ADDRESS or --worker ADDRESS");
+    }
+    if (NodeConfig.nThreads == 0 || NodeConfig.tileSize == 0) PANICM("--threads and --tile have to be positive");
+}
+
+i32 main(const i32 argc, char** const argv) {
+    ParseArgs(argc, argv);
+    if (NodeConfig.workerAddress != NULL) RunWorkerNode();
+    else RunCoordinatorNode(argv[0]);
+    exit(EXIT_SUCCESS);
+}
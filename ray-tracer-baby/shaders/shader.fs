@@ -2,6 +2,7 @@ STRINGIFY(
 
 in vec3 rPos;
 in vec3 rNormal;
+in vec2 rTexCoord;
 flat in vec3 rAlbedo;
 flat in float rRoughness;
 flat in float rMetallic;
@@ -11,6 +12,9 @@ out vec4 FragColor;
 layout(location = 2) uniform vec3 viewPos;
 layout(location = 3) uniform vec3 lightPos;
 layout(location = 4) uniform vec3 lightColor;
+// sRGB texture, sampled in linear space, v points up the image
+layout(location = 8) uniform bool useAlbedoMap;
+layout(binding = 0) uniform sampler2D albedoMap;
 
 const float PI = 3.14159265359f;
 
@@ -37,8 +41,9 @@ vec3 FresnelSchlick(float HdotV, vec3 baseReflectivity) {
 void main() {
     const vec3 N = normalize(rNormal);
     const vec3 V = normalize(viewPos - rPos);
+    const vec3 albedo = useAlbedoMap ? rAlbedo * texture(albedoMap, vec2(rTexCoord.x, 1.f - rTexCoord.y)).rgb : rAlbedo;
 
-    const vec3 baseReflectivity = mix(vec3(0.04f), rAlbedo, rMetallic);
+    const vec3 baseReflectivity = mix(vec3(0.04f), albedo, rMetallic);
 
     vec3 Lo = vec3(0.f);
     // repeat for all light sources
@@ -63,11 +68,11 @@ void main() {
 
         kD *= 1.f - rMetallic;
 
-        Lo += (kD * rAlbedo / PI + specular) * radiance * NdotL;
+        Lo += (kD * albedo / PI + specular) * radiance * NdotL;
         
     }
 
-    const vec3 ambient = vec3(0.03f) * rAlbedo;
+    const vec3 ambient = vec3(0.03f) * albedo;
 
     vec3 color = ambient + Lo;
 
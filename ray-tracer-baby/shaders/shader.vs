@@ -3,6 +3,7 @@ STRINGIFY(
 // Mesh parameters
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
+layout(location = 13) in vec2 aTexCoord;
 // Instance parameters
 layout(location = 2) in mat4 iModel;
 layout(location = 6) in vec3 iAlbedo;
@@ -12,24 +13,40 @@ layout(location = 8) in float iMetallic;
 
 out vec3 rPos;
 out vec3 rNormal;
+out vec2 rTexCoord;
 flat out vec3 rAlbedo;
 flat out float rRoughness;
 flat out float rMetallic;
 
 layout(location = 0) uniform mat4 view;
 layout(location = 1) uniform mat4 projection;
+// Compact vertices, see vertex_format.h
+layout(location = 5) uniform vec3 meshOrigin;
+layout(location = 6) uniform vec3 meshExtent;
+layout(location = 7) uniform bool compactVertices;
+
+vec3 DecodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main() {
+    // quantized positions arrive normalized to the mesh bounds, normals as two snorm components
+    const vec3 position = compactVertices ? meshOrigin + aPos * meshExtent : aPos;
+    const vec3 normal = compactVertices ? DecodeOctahedral(aNormal.xy) : aNormal;
+
     // pass parameters to fragment shader
     const mat4 view_model = view * iModel;
 
-    rNormal = transpose(inverse(mat3(view_model))) * aNormal;
+    rNormal = transpose(inverse(mat3(view_model))) * normal;
     rAlbedo = iAlbedo;
+    rTexCoord = aTexCoord;
     rRoughness = iRoughness;
     rMetallic = iMetallic;
     // transform vertex positions into world space
-    rPos = vec3(iModel * vec4(aPos, 1.0));
-    gl_Position = projection * view_model * vec4(aPos, 1.0);
+    rPos = vec3(iModel * vec4(position, 1.0));
+    gl_Position = projection * view_model * vec4(position, 1.0);
 }
 
 )
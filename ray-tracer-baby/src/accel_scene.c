@@ -0,0 +1,63 @@
+#include "accel_scene.h"
+
+#include <stdlib.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+void CreateAccelScene(const Obj* const obj, const CompactMesh* const compact, const Instances instances, const u32 firstInstanceId, AccelScene* const scene) {
+    ASSERT_EQ(obj->nIndices % 3, 0);
+    const usize nMeshTriangles = obj->nIndices / 3;
+    const usize nTriangles = nMeshTriangles * instances.len;
+    const usize nPositions = obj->nVertices * instances.len;
+    if (nTriangles > UINT32_MAX || nPositions > UINT32_MAX) PANIC("Cannot bake" FS(usize) "triangles, ids are 32 bit", nTriangles);
+
+    Position* const positions = malloc(nPositions * sizeof(Position));
+    u32 (*const indices)[3] = malloc(nTriangles * sizeof(*indices));
+    mat3* const normalToObject = malloc(instances.len * sizeof(mat3));
+    if (positions == NULL || indices == NULL || normalToObject == NULL) PANIC("Failed to allocate" FS(usize) "baked triangles", nTriangles);
+    for (usize i = 0; i < instances.len; i++) {
+        // Edges map by `A`, so their cross product by `det(A) * inverse(transpose(A))`.
+        const f32 (*const model)[4] = (const f32 (*)[4])instances.data[i].model;
+        vec3 axes[3], cofactor;
+        for (usize c = 0; c < 3; c++) glm_vec3_copy((vec3) { model[c][0], model[c][1], model[c][2] }, axes[c]);
+        glm_vec3_cross(axes[1], axes[2], cofactor);
+        const f32 determinant = glm_vec3_dot(axes[0], cofactor);
+        const f32 scale = determinant != 0.f ? 1.f / determinant : 1.f;
+        for (usize c = 0; c < 3; c++) {
+            for (usize r = 0; r < 3; r++) normalToObject[i][c][r] = model[r][c] * scale;
+        }
+
+        Position* const baked = &positions[i * obj->nVertices];
+        for (usize k = 0; k < obj->nVertices; k++) {
+            vec3 p, world;
+            MeshPosition(obj, compact, k, p);
+            glm_mat4_mulv3(instances.data[i].model, p, 1.f, world);
+            baked[k] = (Position) { world[0], world[1], world[2] };
+        }
+        const u32 firstVertex = (u32)(i * obj->nVertices);
+        for (usize t = 0; t < nMeshTriangles; t++) {
+            for (usize c = 0; c < 3; c++) indices[i * nMeshTriangles + t][c] = firstVertex + obj->indices[3 * t + c];
+        }
+    }
+
+    *scene = (AccelScene) {
+        .nMeshTriangles = (u32)nMeshTriangles,
+        .nInstances = instances.len,
+        .firstInstanceId = firstInstanceId,
+        .normalToObject = normalToObject,
+    };
+    const AccelStatus status = BuildAccel(positions, nPositions, indices, nTriangles, &scene->stats, &scene->accel);
+    if (status != AccelStatusOk) PANIC("Failed to build accel over" FS(usize) "triangles, status" FS(u32), nTriangles, (u32)status);
+    LOGLN("Built accel over" FS(usize) "triangles," FS(u32) "nodes, depth" FS(u32) "in %.3f ms",
+        nTriangles, scene->stats.nNodes, scene->stats.depth, (f64)scene->stats.buildNs * 1e-6);
+    free(indices);
+    free(positions);
+}
+
+void DestroyAccelScene(AccelScene* const scene) {
+    FreeAccel(scene->accel);
+    free(scene->normalToObject);
+    scene->accel = NULL;
+    scene->normalToObject = NULL;
+}
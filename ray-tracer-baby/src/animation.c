@@ -0,0 +1,179 @@
+#include "animation.h"
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "profiler.h"
+#include "scene.h"
+
+void InterpolateInstances(const InstanceKeyframes* const keyframes, const f32 time, const Instances instances) {
+    ASSERT_EQ(instances.len, keyframes->nInstances);
+    if (keyframes->nKeys == 0) PANICM("Keyframes without any key");
+
+    // Keys `key` and `key + 1` enclose `time`, clamped to the first and last one.
+    usize key = 0;
+    while (key + 2 < keyframes->nKeys && keyframes->times[key + 1] <= time) key++;
+    const usize next = keyframes->nKeys > 1 ? key + 1 : key;
+    const f32 span = keyframes->times[next] - keyframes->times[key];
+    const f32 blend = span > 0.f ? glm_clamp((time - keyframes->times[key]) / span, 0.f, 1.f) : 0.f;
+
+    const Transform* const from = &keyframes->transforms[key * keyframes->nInstances];
+    const Transform* const to = &keyframes->transforms[next * keyframes->nInstances];
+    const MaterialRaster material = { 0 };
+    for (usize i = 0; i < instances.len; i++) {
+        Transform transform;
+        glm_vec3_lerp((f32*)from[i].translation, (f32*)to[i].translation, blend, transform.translation);
+        glm_vec3_lerp((f32*)from[i].rotation, (f32*)to[i].rotation, blend, transform.rotation);
+        glm_vec3_lerp((f32*)from[i].scale, (f32*)to[i].scale, blend, transform.scale);
+        CreateInstance(&transform, &material, &instances.data[i]);
+    }
+}
+
+/// Moves the instances of `context` to `time` and commits the scene of every replica.
+internal void BuildFrame(AnimationRenderer* const renderer, RenderContext* const context, const f32 time) {
+    PROFILE_BEGIN(buildStart);
+    InterpolateInstances(renderer->keyframes, time, renderer->instances);
+    RenderShared* const shared = context->shared;
+    // Instances were attached to empty scenes, so their geometry ids start at 0.
+    for (usize r = 0; r < shared->nReplicas; r++) UpdateInstances(context->scenes[r], 0, renderer->instances);
+    // The device starts no build threads, a plain `rtcCommitScene` would build on this thread alone.
+    CommitReplicatedScenes(shared, context->scenes);
+    context->dirty = false;
+    PROFILE_END("commit animated TLAS", buildStart);
+}
+
+internal void* BuilderJob(void* args) {
+    AnimationRenderer* const renderer = args;
+    PROFILE_THREAD("animation builder");
+    pthread_mutex_lock(&renderer->lock);
+    while (true) {
+        while (!renderer->pending && !renderer->stop) pthread_cond_wait(&renderer->changed, &renderer->lock);
+        if (!renderer->pending) break;
+        renderer->pending = false;
+        renderer->busy = true;
+        RenderContext* const target = renderer->target;
+        const f32 time = renderer->targetTime;
+        pthread_mutex_unlock(&renderer->lock);
+
+        const f64 buildStart = NowSeconds();
+        BuildFrame(renderer, target, time);
+        const f64 buildMs = (NowSeconds() - buildStart) * 1e3;
+
+        pthread_mutex_lock(&renderer->lock);
+        renderer->buildMs = buildMs;
+        renderer->busy = false;
+        pthread_cond_broadcast(&renderer->changed);
+    }
+    pthread_mutex_unlock(&renderer->lock);
+    return NULL;
+}
+
+/// Hands the frame at `time` to the builder, which has to be idle.
+internal void SubmitFrame(AnimationRenderer* const renderer, RenderContext* const context, const f32 time) {
+    pthread_mutex_lock(&renderer->lock);
+    if (renderer->pending || renderer->busy) PANICM("Animation builder still busy with the previous frame");
+    renderer->target = context;
+    renderer->targetTime = time;
+    renderer->pending = true;
+    pthread_cond_broadcast(&renderer->changed);
+    pthread_mutex_unlock(&renderer->lock);
+}
+
+/// Sleeps until the builder finished the last frame submitted.
+///
+/// @returns the time the frame took to build.
+internal f64 WaitFrame(AnimationRenderer* const renderer) {
+    pthread_mutex_lock(&renderer->lock);
+    while (renderer->pending || renderer->busy) pthread_cond_wait(&renderer->changed, &renderer->lock);
+    const f64 buildMs = renderer->buildMs;
+    pthread_mutex_unlock(&renderer->lock);
+    return buildMs;
+}
+
+void CreateAnimationRenderer(
+    AnimationRenderer* const renderer,
+    RenderShared* const shared,
+    const SharedMesh* const mesh,
+    const InstanceKeyframes* const keyframes,
+    const Material* const material,
+    const usize width,
+    const usize height
+) {
+    *renderer = (AnimationRenderer) {
+        .keyframes = keyframes,
+        .instances = AllocateArray(Instance, keyframes->nInstances),
+        .buildMs = 0.0,
+        .pending = false,
+        .busy = false,
+        .stop = false,
+    };
+    InterpolateInstances(keyframes, keyframes->nKeys > 0 ? keyframes->times[0] : 0.f, renderer->instances);
+    for (usize k = 0; k < 2; k++) {
+        RenderContext* const context = &renderer->contexts[k];
+        CreateRenderContext(context, shared, width, height, keyframes->nInstances);
+        // Rebuilt every other frame, build speed matters more than trace speed of the top level.
+        for (usize r = 0; r < shared->nReplicas; r++) {
+            rtcSetSceneFlags(context->scenes[r], RTC_SCENE_FLAG_DYNAMIC);
+            rtcSetSceneBuildQuality(context->scenes[r], RTC_BUILD_QUALITY_LOW);
+        }
+        AddContextInstances(context, mesh, renderer->instances, material);
+    }
+    pthread_mutex_init(&renderer->lock, NULL);
+    pthread_cond_init(&renderer->changed, NULL);
+    if (0 != pthread_create(&renderer->thread, NULL, BuilderJob, renderer)) PANICM("Failed to create animation builder");
+}
+
+void DestroyAnimationRenderer(AnimationRenderer* const renderer) {
+    pthread_mutex_lock(&renderer->lock);
+    renderer->stop = true;
+    pthread_cond_broadcast(&renderer->changed);
+    pthread_mutex_unlock(&renderer->lock);
+    pthread_join(renderer->thread, NULL);
+
+    pthread_cond_destroy(&renderer->changed);
+    pthread_mutex_destroy(&renderer->lock);
+    for (usize k = 0; k < 2; k++) DestroyRenderContext(&renderer->contexts[k]);
+    FreeArray(renderer->instances);
+}
+
+void RenderAnimation(
+    AnimationRenderer* const renderer,
+    const usize nFrames,
+    const f32 firstTime,
+    const f32 frameTime,
+    const usize nSamples,
+    Rgb256* const buffer,
+    const AnimationFrameCallback callback,
+    void* const user
+) {
+    // Both contexts trace with the settings of the first, through their own scene and materials.
+    RenderContext* const second = &renderer->contexts[1];
+    RayTracer rt = renderer->contexts[0].rt;
+    rt.rtcScene = second->scenes[0];
+    rt.materials = second->rt.materials;
+    second->rt = rt;
+
+    if (nFrames == 0) return;
+    SubmitFrame(renderer, &renderer->contexts[0], firstTime);
+    for (usize i = 0; i < nFrames; i++) {
+        RenderContext* const context = &renderer->contexts[i % 2];
+        const f64 waitStart = NowSeconds();
+        const f64 buildMs = WaitFrame(renderer);
+        const f64 stallMs = (NowSeconds() - waitStart) * 1e3;
+
+        // The other context finished tracing the previous frame, so its scene is free to change.
+        if (i + 1 < nFrames) SubmitFrame(renderer, &renderer->contexts[(i + 1) % 2], firstTime + (f32)(i + 1) * frameTime);
+
+        const f64 traceStart = NowSeconds();
+        const RayStats stats = RenderContextToBuffer(context, nSamples, buffer);
+        const AnimationFrame frame = {
+            .index = i,
+            .time = firstTime + (f32)i * frameTime,
+            .stats = stats,
+            .traceMs = (NowSeconds() - traceStart) * 1e3,
+            .buildMs = buildMs,
+            .stallMs = stallMs,
+        };
+        if (callback != NULL) callback(user, &frame, context, buffer);
+    }
+}
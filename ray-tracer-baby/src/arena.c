@@ -0,0 +1,59 @@
+#include "arena.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cmm/cmm.h>
+
+internal usize RoundUp(const usize value, const usize multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+Arena CreateArena(const usize capacity) {
+    Arena arena = { .base = NULL, .capacity = 0, .offset = 0, .hugeTlb = false };
+
+#ifdef MAP_HUGETLB
+    if (capacity >= HUGE_PAGE_SIZE) {
+        arena.capacity = RoundUp(capacity, HUGE_PAGE_SIZE);
+        void* const base = mmap(NULL, arena.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            arena.base = base;
+            arena.hugeTlb = true;
+            LOGLN("Arena of" FS(usize) "bytes backed by hugetlbfs", arena.capacity);
+            return arena;
+        }
+    }
+#endif
+
+    // No reserved huge pages, fall back to regular pages
+    arena.capacity = RoundUp(capacity, (usize)sysconf(_SC_PAGESIZE));
+    void* const base = mmap(NULL, arena.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) PANIC("Failed to map arena of" FS(usize) "bytes", arena.capacity);
+    arena.base = base;
+
+#ifdef MADV_HUGEPAGE
+    // and ask for transparent huge pages instead.
+    if (arena.capacity >= HUGE_PAGE_SIZE) madvise(arena.base, arena.capacity, MADV_HUGEPAGE);
+#endif
+    return arena;
+}
+
+void DropArena(Arena* const arena) {
+    if (arena->base != NULL) munmap(arena->base, arena->capacity);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->offset = 0;
+}
+
+void* ArenaPush(Arena* const arena, const usize size, const usize alignment) {
+    const usize offset = RoundUp(arena->offset, alignment);
+    if (offset + size > arena->capacity) {
+        PANIC("Arena exhausted: requested" FS(usize) "bytes with" FS(usize) "of" FS(usize) "in use", size, arena->offset, arena->capacity);
+    }
+    arena->offset = offset + size;
+    return arena->base + offset;
+}
+
+void ResetArena(Arena* const arena) {
+    arena->offset = 0;
+}
@@ -0,0 +1,243 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <cmm/cmm.h>
+
+#include "profiler.h"
+
+#define CHECKPOINT_MAGIC "RTBCKPT"
+/// Fastest zlib level, checkpoints have to keep up with the render.
+#define CHECKPOINT_COMPRESSION_LEVEL 1
+#define CHECKPOINT_ELEMENT_SIZE 4
+#define CHECKPOINT_SECTIONS 5
+
+internal usize PayloadSize(const usize width, const usize height) {
+    return width * height * (3 * sizeof(vec3) + sizeof(u32) + sizeof(f32));
+}
+
+/// Buffers of `aovs` stored in a checkpoint, in file order.
+internal void PayloadSections(const Aovs* const aovs, void* sections[CHECKPOINT_SECTIONS], usize sizes[CHECKPOINT_SECTIONS]) {
+    const usize n = aovs->width * aovs->height;
+    sections[0] = aovs->sum;
+    sizes[0] = n * sizeof(vec3);
+    sections[1] = aovs->nSamples;
+    sizes[1] = n * sizeof(u32);
+    sections[2] = aovs->albedo;
+    sizes[2] = n * sizeof(vec3);
+    sections[3] = aovs->normal;
+    sizes[3] = n * sizeof(vec3);
+    sections[4] = aovs->depth;
+    sizes[4] = n * sizeof(f32);
+}
+
+/// Splits `nElements` 4 byte values of `source` into byte planes.
+internal void Shuffle(const u8* const source, u8* const destination, const usize nElements) {
+    for (usize byte = 0; byte < CHECKPOINT_ELEMENT_SIZE; byte++) {
+        u8* const plane = destination + byte * nElements;
+        for (usize i = 0; i < nElements; i++) plane[i] = source[i * CHECKPOINT_ELEMENT_SIZE + byte];
+    }
+}
+
+internal void Unshuffle(const u8* const source, u8* const destination, const usize nElements) {
+    for (usize byte = 0; byte < CHECKPOINT_ELEMENT_SIZE; byte++) {
+        const u8* const plane = source + byte * nElements;
+        for (usize i = 0; i < nElements; i++) destination[i * CHECKPOINT_ELEMENT_SIZE + byte] = plane[i];
+    }
+}
+
+internal void WriteCheckpoint(const CheckpointWriter* const writer) {
+    PROFILE_BEGIN(writeStart);
+    const usize rawSize = PayloadSize(writer->width, writer->height);
+
+    // Lay the sections out back to back, then shuffle the whole payload.
+    u8* const raw = malloc(rawSize);
+    u8* const shuffled = malloc(rawSize);
+    uLongf compressedSize = compressBound(rawSize);
+    u8* const compressed = malloc(compressedSize);
+    if (raw == NULL || shuffled == NULL || compressed == NULL) PANICM("Failed to allocate checkpoint buffers");
+    void* sections[CHECKPOINT_SECTIONS];
+    usize sizes[CHECKPOINT_SECTIONS];
+    PayloadSections(&writer->snapshot, sections, sizes);
+    for (usize i = 0, offset = 0; i < CHECKPOINT_SECTIONS; offset += sizes[i++]) memcpy(raw + offset, sections[i], sizes[i]);
+    Shuffle(raw, shuffled, rawSize / CHECKPOINT_ELEMENT_SIZE);
+    if (compress2(compressed, &compressedSize, shuffled, rawSize, CHECKPOINT_COMPRESSION_LEVEL) != Z_OK) {
+        PANICM("Failed to compress checkpoint");
+    }
+
+    CheckpointHeader header = {
+        .version = CHECKPOINT_VERSION,
+        .width = (u32)writer->width,
+        .height = (u32)writer->height,
+        .crc = (u32)crc32(crc32(0L, Z_NULL, 0), raw, rawSize),
+        .seed = writer->seed,
+        .rawSize = rawSize,
+        .compressedSize = compressedSize,
+    };
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof header.magic);
+
+    char temporaryPath[4096];
+    snprintf(temporaryPath, sizeof temporaryPath, "%s.tmp", writer->path);
+    FILE* const file = fopen(temporaryPath, "wb");
+    if (file == NULL) PANIC("Failed to open %s: %s", temporaryPath, strerror(errno));
+    const bool written = fwrite(&header, sizeof header, 1, file) == 1
+        && fwrite(compressed, 1, compressedSize, file) == compressedSize
+        && fflush(file) == 0
+        && fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!written) PANIC("Failed to write %s", temporaryPath);
+    if (rename(temporaryPath, writer->path) != 0) PANIC("Failed to replace %s: %s", writer->path, strerror(errno));
+
+    LOGLN("Checkpoint written to %s (" FS(usize) "->" FS(usize) "bytes)", writer->path, rawSize, (usize)compressedSize);
+    free(compressed);
+    free(shuffled);
+    free(raw);
+    PROFILE_END("checkpoint", writeStart);
+}
+
+internal void* CheckpointJob(void* args) {
+    CheckpointWriter* const writer = args;
+    PROFILE_THREAD("checkpoint writer");
+    pthread_mutex_lock(&writer->lock);
+    while (true) {
+        while (!writer->pending && !writer->stop) pthread_cond_wait(&writer->changed, &writer->lock);
+        if (!writer->pending) break;
+        writer->pending = false;
+        writer->busy = true;
+        pthread_mutex_unlock(&writer->lock);
+
+        WriteCheckpoint(writer);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->busy = false;
+        writer->nWritten += 1;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+void StartCheckpointWriter(
+    CheckpointWriter* const writer,
+    const char* const path,
+    const usize width,
+    const usize height,
+    const u64 seed
+) {
+    *writer = (CheckpointWriter) {
+        .path = path,
+        .width = width,
+        .height = height,
+        .seed = seed,
+        .snapshot = {
+            .width = width,
+            .height = height,
+            .color = NULL,
+            .albedo = malloc(width * height * sizeof(vec3)),
+            .normal = malloc(width * height * sizeof(vec3)),
+            .depth = malloc(width * height * sizeof(f32)),
+            .sum = malloc(width * height * sizeof(vec3)),
+            .nSamples = malloc(width * height * sizeof(u32)),
+        },
+        .pending = false,
+        .busy = false,
+        .stop = false,
+        .nWritten = 0,
+    };
+    const Aovs* const snapshot = &writer->snapshot;
+    if (snapshot->albedo == NULL || snapshot->normal == NULL || snapshot->depth == NULL || snapshot->sum == NULL || snapshot->nSamples == NULL) {
+        PANICM("Failed to allocate checkpoint snapshot");
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    if (0 != pthread_create(&writer->thread, NULL, CheckpointJob, writer)) PANICM("Failed to create checkpoint writer");
+}
+
+bool SubmitCheckpoint(CheckpointWriter* const writer, const Aovs* const aovs, const bool wait) {
+    ASSERT_EQ(aovs->width, writer->width);
+    ASSERT_EQ(aovs->height, writer->height);
+    pthread_mutex_lock(&writer->lock);
+    while (wait && writer->busy) pthread_cond_wait(&writer->changed, &writer->lock);
+    const bool accepted = !writer->busy;
+    if (accepted) {
+        void* sources[CHECKPOINT_SECTIONS];
+        void* destinations[CHECKPOINT_SECTIONS];
+        usize sizes[CHECKPOINT_SECTIONS];
+        PayloadSections(aovs, sources, sizes);
+        PayloadSections(&writer->snapshot, destinations, sizes);
+        for (usize i = 0; i < CHECKPOINT_SECTIONS; i++) memcpy(destinations[i], sources[i], sizes[i]);
+        writer->pending = true;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    if (!accepted) LOGLNM("Previous checkpoint still being written, skipping");
+    return accepted;
+}
+
+void StopCheckpointWriter(CheckpointWriter* const writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = true;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_cond_destroy(&writer->changed);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->snapshot.albedo);
+    free(writer->snapshot.normal);
+    free(writer->snapshot.depth);
+    free(writer->snapshot.sum);
+    free(writer->snapshot.nSamples);
+}
+
+bool LoadCheckpoint(const char* const path, Aovs* const aovs, u64* const seed) {
+    FILE* const file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    CheckpointHeader header;
+    if (fread(&header, sizeof header, 1, file) != 1) PANIC("Truncated checkpoint %s", path);
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof header.magic) != 0) PANIC("%s is not a checkpoint", path);
+    if (header.version != CHECKPOINT_VERSION) PANIC("Unsupported checkpoint version" FS(u32), header.version);
+    if (header.width != aovs->width || header.height != aovs->height) {
+        PANIC("Checkpoint is" FS(u32) "x" FS(u32) ", frame is" FS(usize) "x" FS(usize),
+            header.width, header.height, aovs->width, aovs->height);
+    }
+    const usize n = aovs->width * aovs->height;
+    const usize rawSize = PayloadSize(aovs->width, aovs->height);
+    if (header.rawSize != rawSize) PANIC("Corrupt checkpoint %s", path);
+
+    u8* const compressed = malloc(header.compressedSize);
+    u8* const shuffled = malloc(rawSize);
+    u8* const raw = malloc(rawSize);
+    if (compressed == NULL || shuffled == NULL || raw == NULL) PANICM("Failed to allocate checkpoint buffers");
+    if (fread(compressed, 1, header.compressedSize, file) != header.compressedSize) PANIC("Truncated checkpoint %s", path);
+    fclose(file);
+
+    uLongf uncompressedSize = rawSize;
+    if (uncompress(shuffled, &uncompressedSize, compressed, header.compressedSize) != Z_OK || uncompressedSize != rawSize) {
+        PANIC("Corrupt checkpoint %s", path);
+    }
+    Unshuffle(shuffled, raw, rawSize / CHECKPOINT_ELEMENT_SIZE);
+    if ((u32)crc32(crc32(0L, Z_NULL, 0), raw, rawSize) != header.crc) PANIC("Checksum mismatch in %s", path);
+
+    void* sections[CHECKPOINT_SECTIONS];
+    usize sizes[CHECKPOINT_SECTIONS];
+    PayloadSections(aovs, sections, sizes);
+    for (usize i = 0, offset = 0; i < CHECKPOINT_SECTIONS; offset += sizes[i++]) memcpy(sections[i], raw + offset, sizes[i]);
+    for (usize i = 0; i < n; i++) {
+        const f32 scale = aovs->nSamples[i] == 0 ? 0.f : 1.f / aovs->nSamples[i];
+        glm_vec3_scale(aovs->sum[i], scale, aovs->color[i]);
+    }
+    *seed = header.seed;
+
+    free(raw);
+    free(shuffled);
+    free(compressed);
+    return true;
+}
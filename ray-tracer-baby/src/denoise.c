@@ -0,0 +1,303 @@
+#include "denoise.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DENOISE_SIMD 1
+#endif
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "profiler.h"
+
+#define DENOISE_ALIGNMENT 64
+#define DENOISE_EPSILON 1e-4f
+/// Rows filtered per work item, small enough to balance the bands of a pass over the pool.
+#define DENOISE_BAND_ROWS 8
+/// Planes taken from the arena, three normal components and two ping pong buffers of three color channels.
+#define DENOISE_PLANES 9
+/// Weights of exponents below this are flushed to zero, they are far below the float precision of the center tap's
+/// weight and would otherwise turn the sums into slow subnormal arithmetic.
+#define DENOISE_MIN_EXPONENT -60.f
+
+/// B3 spline, separable weights of the 5x5 kernel.
+internal const f32 Kernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+/// Color of one iteration and the guides, each component in a plane of its own so four neighbouring pixels load as
+/// one vector.
+typedef struct {
+    usize width;
+    usize height;
+    const f32* normal[3];
+    const f32* depth;
+    const f32* source[3];
+    f32* destination[3];
+    usize step;
+    f32 colorScale;
+    f32 normalScale;
+    f32 sigmaDepth;
+} DenoisePass;
+
+typedef struct {
+    const DenoisePass* pass;
+    usize initialRow;
+    usize endRow;
+} DenoiseBand;
+
+DeclareArray(DenoiseBand);
+
+usize DenoiseArenaSize(const usize width, const usize height) {
+    return DENOISE_PLANES * (width * height * sizeof(f32) + DENOISE_ALIGNMENT);
+}
+
+/// `e^x` for `x <= 0` by range reduction to `2^n e^r` and a polynomial in r (Cephes `expf`), zero below
+/// `DENOISE_MIN_EXPONENT`. The vector version below computes the very same operations per lane.
+internal f32 ExpNegative(f32 x) {
+    if (x < DENOISE_MIN_EXPONENT) return 0.f;
+    const f32 fx = x * 1.44269504088896341f + 0.5f;
+    const f32 truncated = (f32)(i32)fx;
+    const f32 n = truncated > fx ? truncated - 1.f : truncated;
+    x = x - n * 0.693359375f;
+    x = x - n * -2.12194440e-4f;
+    f32 y = 1.9875691500e-4f;
+    y = y * x + 1.3981999507e-3f;
+    y = y * x + 8.3334519073e-3f;
+    y = y * x + 4.1665795894e-2f;
+    y = y * x + 1.6666665459e-1f;
+    y = y * x + 5.0000001201e-1f;
+    y = y * (x * x) + x + 1.f;
+    const u32 bits = (u32)((i32)n + 127) << 23;
+    f32 scale;
+    memcpy(&scale, &bits, sizeof scale);
+    return y * scale;
+}
+
+/// Filters pixel (x, y), taps beyond the border are left out.
+internal void FilterPixel(const DenoisePass* const pass, const isize x, const isize y) {
+    const isize width = (isize)pass->width;
+    const isize height = (isize)pass->height;
+    const isize step = (isize)pass->step;
+    const isize p = y * width + x;
+    const f32 color[3] = { pass->source[0][p], pass->source[1][p], pass->source[2][p] };
+    const f32 normal[3] = { pass->normal[0][p], pass->normal[1][p], pass->normal[2][p] };
+    const f32 depth = pass->depth[p];
+    const f32 depthScale = 1.f / (pass->sigmaDepth * depth + DENOISE_EPSILON);
+
+    f32 sum[3] = { 0.f, 0.f, 0.f };
+    f32 weightSum = 0.f;
+    for (isize ky = 0; ky < 5; ky++) {
+        const isize qy = y + (ky - 2) * step;
+        if (qy < 0 || qy >= height) continue;
+        for (isize kx = 0; kx < 5; kx++) {
+            const isize qx = x + (kx - 2) * step;
+            if (qx < 0 || qx >= width) continue;
+            const isize q = qy * width + qx;
+
+            f32 colorDistance = 0.f, normalDistance = 0.f;
+            for (usize c = 0; c < 3; c++) {
+                const f32 dc = pass->source[c][q] - color[c];
+                const f32 dn = pass->normal[c][q] - normal[c];
+                colorDistance += dc * dc;
+                normalDistance += dn * dn;
+            }
+            const f32 dd = fabsf(pass->depth[q] - depth);
+            const f32 weight = Kernel[kx] * Kernel[ky] * ExpNegative(
+                - colorDistance * pass->colorScale - normalDistance * pass->normalScale - dd * depthScale
+            );
+            for (usize c = 0; c < 3; c++) sum[c] += weight * pass->source[c][q];
+            weightSum += weight;
+        }
+    }
+    // The center tap is never stopped, so the weight sum is never zero.
+    for (usize c = 0; c < 3; c++) pass->destination[c][p] = sum[c] / weightSum;
+}
+
+#ifdef DENOISE_SIMD
+
+internal __m128 ExpNegative4(__m128 x) {
+    const __m128 inRange = _mm_cmpge_ps(x, _mm_set1_ps(DENOISE_MIN_EXPONENT));
+    x = _mm_max_ps(x, _mm_set1_ps(DENOISE_MIN_EXPONENT));
+    // Floor by truncation, corrected for negative arguments since SSE2 lacks a rounding instruction.
+    const __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    const __m128 n = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), _mm_set1_ps(1.f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+    __m128 y = _mm_set1_ps(1.9875691500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+    y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), x), _mm_set1_ps(1.f));
+    // 2^n assembled in the exponent bits, n stays within the normal range thanks to the clamp above.
+    const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_and_ps(_mm_mul_ps(y, _mm_castsi128_ps(exponent)), inRange);
+}
+
+/// `FilterPixel` of pixels (x, y) to (x + 3, y), every horizontal tap of which lies inside the frame.
+internal void FilterPixels4(const DenoisePass* const pass, const isize x, const isize y) {
+    const isize width = (isize)pass->width;
+    const isize height = (isize)pass->height;
+    const isize step = (isize)pass->step;
+    const isize p = y * width + x;
+    __m128 color[3], normal[3];
+    for (usize c = 0; c < 3; c++) {
+        color[c] = _mm_loadu_ps(&pass->source[c][p]);
+        normal[c] = _mm_loadu_ps(&pass->normal[c][p]);
+    }
+    const __m128 depth = _mm_loadu_ps(&pass->depth[p]);
+    const __m128 depthScale = _mm_div_ps(
+        _mm_set1_ps(1.f),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pass->sigmaDepth), depth), _mm_set1_ps(DENOISE_EPSILON))
+    );
+    const __m128 colorScale = _mm_set1_ps(pass->colorScale);
+    const __m128 normalScale = _mm_set1_ps(pass->normalScale);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+    __m128 sum[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+    __m128 weightSum = _mm_setzero_ps();
+    for (isize ky = 0; ky < 5; ky++) {
+        const isize qy = y + (ky - 2) * step;
+        if (qy < 0 || qy >= height) continue;
+        for (isize kx = 0; kx < 5; kx++) {
+            const isize q = qy * width + x + (kx - 2) * step;
+
+            __m128 tap[3];
+            __m128 colorDistance = _mm_setzero_ps(), normalDistance = _mm_setzero_ps();
+            for (usize c = 0; c < 3; c++) {
+                tap[c] = _mm_loadu_ps(&pass->source[c][q]);
+                const __m128 dc = _mm_sub_ps(tap[c], color[c]);
+                const __m128 dn = _mm_sub_ps(_mm_loadu_ps(&pass->normal[c][q]), normal[c]);
+                colorDistance = _mm_add_ps(colorDistance, _mm_mul_ps(dc, dc));
+                normalDistance = _mm_add_ps(normalDistance, _mm_mul_ps(dn, dn));
+            }
+            const __m128 dd = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&pass->depth[q]), depth), absMask);
+            const __m128 exponent = _mm_sub_ps(
+                _mm_sub_ps(
+                    _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(colorDistance, colorScale)),
+                    _mm_mul_ps(normalDistance, normalScale)
+                ),
+                _mm_mul_ps(dd, depthScale)
+            );
+            const __m128 weight = _mm_mul_ps(_mm_set1_ps(Kernel[kx] * Kernel[ky]), ExpNegative4(exponent));
+            for (usize c = 0; c < 3; c++) sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(weight, tap[c]));
+            weightSum = _mm_add_ps(weightSum, weight);
+        }
+    }
+    for (usize c = 0; c < 3; c++) _mm_storeu_ps(&pass->destination[c][p], _mm_div_ps(sum[c], weightSum));
+}
+
+#endif
+
+internal void FilterRows(const DenoisePass* const pass, const usize initialRow, const usize endRow) {
+    const isize width = (isize)pass->width;
+    // Columns whose horizontal taps all lie inside the frame, filtered four at a time where SIMD is available.
+    const isize reach = 2 * (isize)pass->step;
+    const isize interiorEnd = width - reach;
+    for (isize y = (isize)initialRow; y < (isize)endRow; y++) {
+        isize x = 0;
+#ifdef DENOISE_SIMD
+        for (; x < reach && x < width; x++) FilterPixel(pass, x, y);
+        for (; x + 4 <= interiorEnd; x += 4) FilterPixels4(pass, x, y);
+#endif
+        for (; x < width; x++) FilterPixel(pass, x, y);
+    }
+}
+
+internal void DenoiseJob(void* const argument, const usize worker, Arena* const arena) {
+    (void)worker;
+    (void)arena;
+    const DenoiseBand* const band = argument;
+    PROFILE_BEGIN(bandStart);
+    FilterRows(band->pass, band->initialRow, band->endRow);
+    PROFILE_END("denoise rows", bandStart);
+}
+
+internal f32 Demodulate(const f32 color, const f32 albedo) {
+    return albedo > DENOISE_EPSILON ? color / albedo : color;
+}
+
+internal f32 Remodulate(const f32 irradiance, const f32 albedo) {
+    return albedo > DENOISE_EPSILON ? irradiance * albedo : irradiance;
+}
+
+void Denoise(
+    const Aovs* const aovs,
+    const DenoiseParams params,
+    WorkerPool* const pool,
+    Arena* const arena,
+    out vec3* const result
+) {
+    const usize n = aovs->width * aovs->height;
+    f32* planes[DENOISE_PLANES];
+    for (usize i = 0; i < DENOISE_PLANES; i++) planes[i] = ArenaPush(arena, n * sizeof(f32), DENOISE_ALIGNMENT);
+    f32* const normal[3] = { planes[0], planes[1], planes[2] };
+    f32* const buffers[2][3] = { { planes[3], planes[4], planes[5] }, { planes[6], planes[7], planes[8] } };
+
+    for (usize i = 0; i < n; i++) {
+        for (usize c = 0; c < 3; c++) {
+            normal[c][i] = aovs->normal[i][c];
+            buffers[0][c][i] = Demodulate(aovs->color[i][c], aovs->albedo[i][c]);
+        }
+    }
+
+    DenoisePass pass = {
+        .width = aovs->width,
+        .height = aovs->height,
+        .normal = { normal[0], normal[1], normal[2] },
+        .depth = aovs->depth,
+        .normalScale = 1.f / (params.sigmaNormal * params.sigmaNormal),
+        .sigmaDepth = params.sigmaDepth,
+    };
+    const usize nBands = (aovs->height + DENOISE_BAND_ROWS - 1) / DENOISE_BAND_ROWS;
+    const Array(DenoiseBand) bands = AllocateArray(DenoiseBand, nBands);
+    for (usize i = 0; i < nBands; i++) {
+        bands.data[i] = (DenoiseBand) {
+            .pass = &pass,
+            .initialRow = i * DENOISE_BAND_ROWS,
+            .endRow = (i + 1) * DENOISE_BAND_ROWS < aovs->height ? (i + 1) * DENOISE_BAND_ROWS : aovs->height,
+        };
+    }
+
+    f32 sigmaColor = params.sigmaColor;
+    for (usize iteration = 0; iteration < params.nIterations; iteration++) {
+        for (usize c = 0; c < 3; c++) {
+            pass.source[c] = buffers[iteration % 2][c];
+            pass.destination[c] = buffers[(iteration + 1) % 2][c];
+        }
+        pass.step = (usize)1 << iteration;
+        pass.colorScale = 1.f / (sigmaColor * sigmaColor);
+
+        // Each iteration reads the whole result of the previous one, so passes are joined one by one.
+        WorkBatch batch = { 0 };
+        for (usize i = 0; i < nBands; i++) SubmitWork(pool, &batch, DenoiseJob, &bands.data[i]);
+        WaitWorkBatch(pool, &batch);
+        sigmaColor *= 0.5f;
+    }
+    FreeArray(bands);
+
+    f32* const* const filtered = buffers[params.nIterations % 2];
+    for (usize i = 0; i < n; i++) {
+        for (usize c = 0; c < 3; c++) result[i][c] = Remodulate(filtered[c][i], aovs->albedo[i][c]);
+    }
+}
+
+internal f64 Clamp01(const f32 value) {
+    return value < 0.f ? 0.0 : value > 1.f ? 1.0 : (f64)value;
+}
+
+f64 Psnr(const vec3* const image, const vec3* const reference, const usize nPixels) {
+    f64 squaredError = 0.0;
+    for (usize i = 0; i < nPixels; i++) {
+        for (usize c = 0; c < 3; c++) {
+            const f64 difference = Clamp01(image[i][c]) - Clamp01(reference[i][c]);
+            squaredError += difference * difference;
+        }
+    }
+    const f64 mse = squaredError / (f64)(3 * nPixels);
+    return mse == 0.0 ? INFINITY : 10.0 * log10(1.0 / mse);
+}
@@ -0,0 +1,475 @@
+#include "distributed.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <cmm/cmm.h>
+
+#include "arena.h"
+#include "profiler.h"
+
+#define UNIX_ADDRESS_PREFIX "unix:"
+#define MAX_WORKERS 256
+#define POLL_TIMEOUT_MS 100
+#define CONNECT_ATTEMPTS 50
+#define CONNECT_RETRY_MS 100
+/// Never reissue tiles younger than this, average tile times of a cold frame are unreliable.
+#define REISSUE_MIN_SEC 0.5
+/// Workers that do not complete their hello within this are rejected, so a stalled one can not hang the coordinator.
+#define HANDSHAKE_TIMEOUT_MS 2000
+/// The coordinator gives up on a frame once it went this long without any worker connected.
+#define NO_WORKERS_TIMEOUT_SEC 30.0
+
+COMMENT(--------========[ Sockets ]========--------)
+
+internal bool SendAll(const i32 fd, const void* const data, const usize size) {
+    const u8* bytes = data;
+    usize sent = 0;
+    while (sent < size) {
+        const isize result = send(fd, bytes + sent, size - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+        sent += (usize)result;
+    }
+    return true;
+}
+
+internal bool RecvAll(const i32 fd, void* const data, const usize size) {
+    u8* bytes = data;
+    usize received = 0;
+    while (received < size) {
+        const isize result = recv(fd, bytes + received, size - received, 0);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+        received += (usize)result;
+    }
+    return true;
+}
+
+internal bool SendMessage(const i32 fd, const enum MessageType type, const void* const payload, const u32 size) {
+    const MessageHeader header = { .type = type, .size = size };
+    return SendAll(fd, &header, sizeof header) && SendAll(fd, payload, size);
+}
+
+/// Opens a listening (`listening`) or connected stream socket, @returns -1 on failure.
+internal i32 OpenSocket(const char* const address, const bool listening) {
+    const usize prefixLength = strlen(UNIX_ADDRESS_PREFIX);
+    if (strncmp(address, UNIX_ADDRESS_PREFIX, prefixLength) == 0) {
+        const char* const path = address + prefixLength;
+        struct sockaddr_un unixAddress = { .sun_family = AF_UNIX };
+        if (strlen(path) >= sizeof unixAddress.sun_path) PANIC("Socket path too long: %s", path);
+        strcpy(unixAddress.sun_path, path);
+
+        const i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (listening) {
+            unlink(path);
+            if (bind(fd, (struct sockaddr*)&unixAddress, sizeof unixAddress) == 0 && listen(fd, SOMAXCONN) == 0) return fd;
+        } else if (connect(fd, (struct sockaddr*)&unixAddress, sizeof unixAddress) == 0) {
+            return fd;
+        }
+        close(fd);
+        return -1;
+    }
+
+    const char* const separator = strrchr(address, ':');
+    if (separator == NULL) PANIC("Expected unix:PATH or HOST:PORT, got %s", address);
+    char host[256];
+    const usize hostLength = (usize)(separator - address);
+    if (hostLength >= sizeof host) PANIC("Host name too long: %s", address);
+    memcpy(host, address, hostLength);
+    host[hostLength] = '\0';
+
+    const struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = listening ? AI_PASSIVE : 0,
+    };
+    struct addrinfo* candidates;
+    if (getaddrinfo(hostLength == 0 ? NULL : host, separator + 1, &hints, &candidates) != 0) return -1;
+
+    i32 fd = -1;
+    for (struct addrinfo* candidate = candidates; candidate != NULL && fd < 0; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd < 0) continue;
+        const i32 enable = 1;
+        bool ok;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof enable);
+            ok = bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0;
+        } else {
+            ok = connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0;
+            // Tile requests are tiny and latency bound.
+            if (ok) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof enable);
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(candidates);
+    return fd;
+}
+
+i32 ListenCoordinator(const char* const address) {
+    const i32 fd = OpenSocket(address, true);
+    if (fd < 0) PANIC("Failed to listen on %s: %s", address, strerror(errno));
+    LOGLN("Coordinator listening on %s", address);
+    return fd;
+}
+
+COMMENT(--------========[ Coordinator ]========--------)
+
+typedef enum {
+    TileStatePending,
+    TileStateIssued,
+    TileStateDone,
+} TileState;
+
+typedef struct {
+    TileDesc desc;
+    TileState state;
+    /// Workers currently rendering this tile, more than one once it has been reissued.
+    u32 nOutstanding;
+    f64 issuedAt;
+} TileSlot;
+
+DeclareArray(TileSlot);
+
+typedef struct {
+    i32 fd;
+    usize id;
+    u32 inFlight[WORKER_PIPELINE_DEPTH];
+    usize nInFlight;
+    usize nCompleted;
+} WorkerConnection;
+
+typedef struct {
+    const CoordinatorConfig* config;
+    Aovs aovs;
+    Array(TileSlot) tiles;
+    usize nDone;
+    usize nextPending;
+    usize nReissued;
+    f64 totalTileSec;
+    WorkerConnection workers[MAX_WORKERS];
+    usize nWorkers;
+    usize nextWorkerId;
+    /// Receive buffer for a single tile result.
+    f32* scratch;
+} Coordinator;
+
+internal Array(TileSlot) SplitTiles(const FrameDesc* const frame) {
+    const u32 size = frame->tileSize;
+    const u32 nTilesX = (frame->width + size - 1) / size;
+    const u32 nTilesY = (frame->height + size - 1) / size;
+    Array(TileSlot) tiles = AllocateArray(TileSlot, (usize)nTilesX * nTilesY);
+    for (u32 ty = 0; ty < nTilesY; ty++) {
+        for (u32 tx = 0; tx < nTilesX; tx++) {
+            const u32 id = ty * nTilesX + tx;
+            const u32 x = tx * size;
+            const u32 y = ty * size;
+            tiles.data[id] = (TileSlot) {
+                .desc = {
+                    .id = id,
+                    .x = x,
+                    .y = y,
+                    .width = x + size < frame->width ? size : frame->width - x,
+                    .height = y + size < frame->height ? size : frame->height - y,
+                },
+                .state = TileStatePending,
+                .nOutstanding = 0,
+                .issuedAt = 0.0,
+            };
+        }
+    }
+    return tiles;
+}
+
+/// Limits how long blocking receives on `fd` wait, 0 waits forever.
+internal void SetReceiveTimeout(const i32 fd, const u32 timeoutMs) {
+    const struct timeval timeout = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+}
+
+internal void AcceptWorker(Coordinator* const coordinator, const i32 listener) {
+    const i32 fd = accept(listener, NULL, NULL);
+    if (fd < 0) return;
+
+    // Results are only read once poll reported them, the handshake is read right away.
+    SetReceiveTimeout(fd, HANDSHAKE_TIMEOUT_MS);
+    MessageHeader header;
+    u32 version = 0;
+    const bool ok = RecvAll(fd, &header, sizeof header)
+        && header.type == MessageTypeHello
+        && header.size == sizeof version
+        && RecvAll(fd, &version, sizeof version)
+        && version == DISTRIBUTED_PROTOCOL_VERSION
+        && coordinator->nWorkers < MAX_WORKERS
+        && SendMessage(fd, MessageTypeFrame, &coordinator->config->frame, sizeof(FrameDesc));
+    if (!ok) {
+        LOGLN("Rejected worker (protocol version" FS(u32) ")", version);
+        close(fd);
+        return;
+    }
+    SetReceiveTimeout(fd, 0);
+
+    WorkerConnection* const worker = &coordinator->workers[coordinator->nWorkers++];
+    *worker = (WorkerConnection) { .fd = fd, .id = coordinator->nextWorkerId++, .nInFlight = 0, .nCompleted = 0 };
+    LOGLN("Worker" FS(usize) "joined," FS(usize) "of" FS(usize) "tiles done", worker->id, coordinator->nDone, coordinator->tiles.len);
+}
+
+/// Closes the connection and puts tiles nobody else is rendering back into the pending set.
+internal void DropWorker(Coordinator* const coordinator, const usize index) {
+    WorkerConnection* const worker = &coordinator->workers[index];
+    for (usize i = 0; i < worker->nInFlight; i++) {
+        TileSlot* const tile = &coordinator->tiles.data[worker->inFlight[i]];
+        tile->nOutstanding -= 1;
+        if (tile->state == TileStateIssued && tile->nOutstanding == 0) {
+            tile->state = TileStatePending;
+            if (tile->desc.id < coordinator->nextPending) coordinator->nextPending = tile->desc.id;
+        }
+    }
+    LOGLN("Worker" FS(usize) "left after" FS(usize) "tiles", worker->id, worker->nCompleted);
+    close(worker->fd);
+    coordinator->workers[index] = coordinator->workers[--coordinator->nWorkers];
+}
+
+internal void MergeTile(const Aovs aovs, const TileDesc* const tile, const f32* const payload) {
+    const usize n = (usize)tile->width * tile->height;
+    const vec3* const color = (const vec3*)payload;
+    const vec3* const albedo = color + n;
+    const vec3* const normal = albedo + n;
+    const f32* const depth = (const f32*)(normal + n);
+    for (usize row = 0; row < tile->height; row++) {
+        const usize source = row * tile->width;
+        const usize destination = (tile->y + row) * aovs.width + tile->x;
+        memcpy(aovs.color[destination], color[source], tile->width * sizeof(vec3));
+        memcpy(aovs.albedo[destination], albedo[source], tile->width * sizeof(vec3));
+        memcpy(aovs.normal[destination], normal[source], tile->width * sizeof(vec3));
+        memcpy(&aovs.depth[destination], &depth[source], tile->width * sizeof(f32));
+    }
+}
+
+/// @returns false when the connection has to be dropped.
+internal bool ReceiveResult(Coordinator* const coordinator, WorkerConnection* const worker) {
+    MessageHeader header;
+    TileDesc desc;
+    if (!RecvAll(worker->fd, &header, sizeof header) || header.type != MessageTypeResult) return false;
+    if (header.size < sizeof desc || !RecvAll(worker->fd, &desc, sizeof desc)) return false;
+    if (desc.id >= coordinator->tiles.len) return false;
+
+    TileSlot* const tile = &coordinator->tiles.data[desc.id];
+    const usize nPixels = (usize)tile->desc.width * tile->desc.height;
+    const usize payloadSize = nPixels * (3 * sizeof(vec3) + sizeof(f32));
+    if (header.size != sizeof desc + payloadSize) return false;
+    if (!RecvAll(worker->fd, coordinator->scratch, payloadSize)) return false;
+
+    // Only tiles issued to this very connection are taken, anything else could overwrite a tile rendered since.
+    usize slot = 0;
+    while (slot < worker->nInFlight && worker->inFlight[slot] != desc.id) slot++;
+    if (slot == worker->nInFlight) {
+        LOGLN("Worker" FS(usize) "returned tile" FS(u32) "it was not issued", worker->id, desc.id);
+        return false;
+    }
+    worker->inFlight[slot] = worker->inFlight[--worker->nInFlight];
+    tile->nOutstanding -= 1;
+    worker->nCompleted += 1;
+
+    // Reissued tiles come back twice, keep whichever arrived first.
+    if (tile->state == TileStateDone) return true;
+    MergeTile(coordinator->aovs, &tile->desc, coordinator->scratch);
+    tile->state = TileStateDone;
+    coordinator->nDone += 1;
+    coordinator->totalTileSec += NowSeconds() - tile->issuedAt;
+    return true;
+}
+
+internal bool IsInFlight(const WorkerConnection* const worker, const u32 tileId) {
+    for (usize i = 0; i < worker->nInFlight; i++) {
+        if (worker->inFlight[i] == tileId) return true;
+    }
+    return false;
+}
+
+/// @returns tile to issue to `worker` next or NULL when there is nothing worth sending.
+internal TileSlot* NextTile(Coordinator* const coordinator, const WorkerConnection* const worker, const f64 now) {
+    Array(TileSlot) tiles = coordinator->tiles;
+    while (coordinator->nextPending < tiles.len && tiles.data[coordinator->nextPending].state != TileStatePending) {
+        coordinator->nextPending += 1;
+    }
+    if (coordinator->nextPending < tiles.len) return &tiles.data[coordinator->nextPending];
+
+    // Nothing left to hand out, back up the slowest tiles with otherwise idle workers.
+    if (worker->nInFlight > 0 || coordinator->nDone == 0) return NULL;
+    const f64 averageSec = coordinator->totalTileSec / (f64)coordinator->nDone;
+    const f64 threshold = coordinator->config->reissueFactor * averageSec;
+    const f64 cutoff = now - (threshold > REISSUE_MIN_SEC ? threshold : REISSUE_MIN_SEC);
+    TileSlot* oldest = NULL;
+    for (usize i = 0; i < tiles.len; i++) {
+        TileSlot* const tile = &tiles.data[i];
+        if (tile->state != TileStateIssued || tile->nOutstanding != 1 || tile->issuedAt > cutoff) continue;
+        if (IsInFlight(worker, tile->desc.id)) continue;
+        if (oldest == NULL || tile->issuedAt < oldest->issuedAt) oldest = tile;
+    }
+    if (oldest != NULL) coordinator->nReissued += 1;
+    return oldest;
+}
+
+/// @returns false when the connection has to be dropped.
+internal bool FeedWorker(Coordinator* const coordinator, WorkerConnection* const worker) {
+    const f64 now = NowSeconds();
+    while (worker->nInFlight < WORKER_PIPELINE_DEPTH) {
+        TileSlot* const tile = NextTile(coordinator, worker, now);
+        if (tile == NULL) break;
+        if (!SendMessage(worker->fd, MessageTypeTile, &tile->desc, sizeof(TileDesc))) return false;
+        if (tile->state == TileStatePending) tile->issuedAt = now;
+        tile->state = TileStateIssued;
+        tile->nOutstanding += 1;
+        worker->inFlight[worker->nInFlight++] = tile->desc.id;
+    }
+    return true;
+}
+
+void RunCoordinator(const i32 listener, const CoordinatorConfig* const config, const Aovs aovs) {
+    ASSERT_EQ(aovs.width, config->frame.width);
+    ASSERT_EQ(aovs.height, config->frame.height);
+
+    Coordinator* const coordinator = calloc(1, sizeof(Coordinator));
+    if (coordinator == NULL) PANICM("Failed to allocate coordinator");
+    coordinator->config = config;
+    coordinator->aovs = aovs;
+    coordinator->tiles = SplitTiles(&config->frame);
+    const usize tileSize = config->frame.tileSize;
+    coordinator->scratch = malloc(tileSize * tileSize * (3 * sizeof(vec3) + sizeof(f32)));
+    if (coordinator->scratch == NULL) PANICM("Failed to allocate tile buffer");
+
+    const f64 start = NowSeconds();
+    f64 lastWorkerSeen = start;
+    struct pollfd fds[MAX_WORKERS + 1];
+    while (coordinator->nDone < coordinator->tiles.len) {
+        // Workers may still be starting up or join later, but without any for this long nothing will finish the frame.
+        if (coordinator->nWorkers > 0) {
+            lastWorkerSeen = NowSeconds();
+        } else if (NowSeconds() - lastWorkerSeen > NO_WORKERS_TIMEOUT_SEC) {
+            PANIC("No workers connected for %.0f s," FS(usize) "of" FS(usize) "tiles left undone",
+                NO_WORKERS_TIMEOUT_SEC, coordinator->tiles.len - coordinator->nDone, coordinator->tiles.len);
+        }
+
+        fds[0] = (struct pollfd) { .fd = listener, .events = POLLIN };
+        for (usize i = 0; i < coordinator->nWorkers; i++) {
+            fds[i + 1] = (struct pollfd) { .fd = coordinator->workers[i].fd, .events = POLLIN };
+        }
+        const usize nPolled = coordinator->nWorkers;
+        const i32 nReady = poll(fds, nPolled + 1, POLL_TIMEOUT_MS);
+        if (nReady < 0 && errno != EINTR) PANIC("poll failed: %s", strerror(errno));
+
+        // Walk backwards, dropping a worker moves the last one into its slot.
+        for (usize i = nPolled; i-- > 0;) {
+            if (nReady <= 0 || fds[i + 1].revents == 0) continue;
+            if (!ReceiveResult(coordinator, &coordinator->workers[i])) DropWorker(coordinator, i);
+        }
+        if (nReady > 0 && (fds[0].revents & POLLIN)) AcceptWorker(coordinator, listener);
+
+        for (usize i = coordinator->nWorkers; i-- > 0;) {
+            if (!FeedWorker(coordinator, &coordinator->workers[i])) DropWorker(coordinator, i);
+        }
+    }
+
+    LOGLN(
+        "Frame of" FS(usize) "tiles done in %.3f s," FS(usize) "reissued",
+        coordinator->tiles.len, NowSeconds() - start, coordinator->nReissued
+    );
+    for (usize i = 0; i < coordinator->nWorkers; i++) {
+        const WorkerConnection* const worker = &coordinator->workers[i];
+        LOGLN("  * worker" FS(usize) ":" FS(usize) "tiles", worker->id, worker->nCompleted);
+        SendMessage(worker->fd, MessageTypeShutdown, NULL, 0);
+        close(worker->fd);
+    }
+    close(listener);
+    free(coordinator->scratch);
+    FreeArray(coordinator->tiles);
+    free(coordinator);
+}
+
+COMMENT(--------========[ Worker ]========--------)
+
+internal i32 ConnectWorker(const char* const address) {
+    for (usize attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++) {
+        const i32 fd = OpenSocket(address, false);
+        if (fd >= 0) return fd;
+        usleep(CONNECT_RETRY_MS * 1000);
+    }
+    PANIC("Failed to connect to coordinator at %s: %s", address, strerror(errno));
+}
+
+internal bool SendResult(const i32 fd, const TileDesc* const tile, const Aovs aovs) {
+    const usize n = (usize)tile->width * tile->height;
+    const MessageHeader header = {
+        .type = MessageTypeResult,
+        .size = (u32)(sizeof(TileDesc) + n * (3 * sizeof(vec3) + sizeof(f32))),
+    };
+    return SendAll(fd, &header, sizeof header)
+        && SendAll(fd, tile, sizeof(TileDesc))
+        && SendAll(fd, aovs.color, n * sizeof(vec3))
+        && SendAll(fd, aovs.albedo, n * sizeof(vec3))
+        && SendAll(fd, aovs.normal, n * sizeof(vec3))
+        && SendAll(fd, aovs.depth, n * sizeof(f32));
+}
+
+void RunWorker(const char* const address, const TileRenderer renderer) {
+    const i32 fd = ConnectWorker(address);
+    const u32 version = DISTRIBUTED_PROTOCOL_VERSION;
+    if (!SendMessage(fd, MessageTypeHello, &version, sizeof version)) PANIC("Failed to greet coordinator at %s", address);
+
+    FrameDesc frame;
+    bool hasFrame = false;
+    Arena tileArena = { .base = NULL };
+    usize nTiles = 0;
+
+    MessageHeader header;
+    bool running = true;
+    while (running && RecvAll(fd, &header, sizeof header)) {
+        switch (header.type) {
+            case MessageTypeShutdown: {
+                running = false;
+            } break;
+            case MessageTypeFrame: {
+                if (header.size != sizeof frame || !RecvAll(fd, &frame, sizeof frame)) PANICM("Malformed frame message");
+                DropArena(&tileArena);
+                tileArena = CreateArena(AovsArenaSize(frame.tileSize, frame.tileSize));
+                hasFrame = true;
+                renderer.prepare(renderer.context, &frame);
+                LOGLN("Rendering frame" FS(u32) "(" FS(u32) "x" FS(u32) ")", frame.id, frame.width, frame.height);
+            } break;
+            case MessageTypeTile: {
+                TileDesc tile;
+                if (header.size != sizeof tile || !RecvAll(fd, &tile, sizeof tile)) PANICM("Malformed tile message");
+                if (!hasFrame) PANICM("Received tile before frame");
+                ResetArena(&tileArena);
+                const Aovs aovs = CreateAovs(&tileArena, tile.width, tile.height);
+                renderer.render(renderer.context, &frame, &tile, aovs);
+                // The coordinator went away, there is nobody left to render for.
+                if (!SendResult(fd, &tile, aovs)) {
+                    running = false;
+                    break;
+                }
+                nTiles += 1;
+            } break;
+            default: PANIC("Unexpected message type" FS(u32), header.type);
+        }
+    }
+    LOGLN("Worker done after" FS(usize) "tiles", nTiles);
+    DropArena(&tileArena);
+    close(fd);
+}
@@ -0,0 +1,223 @@
+#include "environment.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stb/stb_image.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#define CGLM_CONST_FIX (f32*)
+
+internal f32 Luminance(const f32* const rgb) {
+    return 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+}
+
+internal u32 MinU32(const u32 a, const u32 b) {
+    return a < b ? a : b;
+}
+
+COMMENT(--------========[ Loading ]========--------)
+
+internal u32 ByteSwap32(const u32 value) {
+    return (value >> 24) | ((value >> 8) & 0xFF00u) | ((value << 8) & 0xFF0000u) | (value << 24);
+}
+
+/// Portable float map, `PF` for RGB or `Pf` for grayscale, rows stored bottom up.
+///
+/// @returns RGB texels in rows from the top, to be freed by the caller.
+internal f32* ReadPfm(const char* const path, u32* const width, u32* const height) {
+    FILE* const file = fopen(path, "rb");
+    if (file == NULL) PANIC("Failed to open %s", path);
+    char kind[3] = { 0 };
+    i32 w, h;
+    f64 scale;
+    if (fscanf(file, "%2s %d %d %lf", kind, &w, &h, &scale) != 4 || w <= 0 || h <= 0) PANIC("Malformed PFM header in %s", path);
+    // Exactly one whitespace character separates the header from the raster.
+    fgetc(file);
+    const usize nChannels = strcmp(kind, "PF") == 0 ? 3 : strcmp(kind, "Pf") == 0 ? 1 : 0;
+    if (nChannels == 0) PANIC("Unsupported PFM type %s in %s", kind, path);
+
+    const usize nTexels = (usize)w * (usize)h;
+    f32* const raster = malloc(nTexels * nChannels * sizeof(f32));
+    f32* const rgb = malloc(nTexels * 3 * sizeof(f32));
+    if (raster == NULL || rgb == NULL) PANIC("Failed to allocate %s", path);
+    if (fread(raster, sizeof(f32) * nChannels, nTexels, file) != nTexels) PANIC("Truncated PFM raster in %s", path);
+    fclose(file);
+
+    // A positive scale marks big endian data.
+    if (scale > 0.0) {
+        u32* const words = (u32*)raster;
+        for (usize i = 0; i < nTexels * nChannels; i++) words[i] = ByteSwap32(words[i]);
+    }
+    for (usize y = 0; y < (usize)h; y++) {
+        const f32* const row = &raster[((usize)h - 1 - y) * (usize)w * nChannels];
+        for (usize x = 0; x < (usize)w; x++) {
+            for (usize c = 0; c < 3; c++) rgb[(y * (usize)w + x) * 3 + c] = row[x * nChannels + (nChannels == 3 ? c : 0)];
+        }
+    }
+    free(raster);
+    *width = (u32)w;
+    *height = (u32)h;
+    return rgb;
+}
+
+void LoadEnvironment(const char* const path, Environment* const environment) {
+    const usize length = strlen(path);
+    u32 width, height;
+    f32* rgb;
+    if (length >= 4 && strcmp(path + length - 4, ".pfm") == 0) {
+        rgb = ReadPfm(path, &width, &height);
+    } else {
+        i32 w, h, nChannels;
+        rgb = stbi_loadf(path, &w, &h, &nChannels, 3);
+        if (rgb == NULL) PANIC("Failed to load %s: %s", path, stbi_failure_reason());
+        width = (u32)w;
+        height = (u32)h;
+    }
+    CreateEnvironment(environment, rgb, width, height);
+    free(rgb);
+}
+
+COMMENT(--------========[ Alias table ]========--------)
+
+/// Vose's method: texels below the mean weight are topped up from one above it until every entry holds the mean.
+internal void BuildAliasTable(AliasEntry* const alias, f64* const scaled, const usize n) {
+    // Below the mean from the front, above it from the back, together they never hold more than `n` texels.
+    u32* const worklist = malloc(n * sizeof(u32));
+    if (worklist == NULL) PANICM("Failed to allocate alias table worklist");
+    usize nSmall = 0, firstLarge = n;
+    for (usize i = 0; i < n; i++) {
+        if (scaled[i] < 1.0) worklist[nSmall++] = (u32)i;
+        else worklist[--firstLarge] = (u32)i;
+    }
+    while (nSmall > 0 && firstLarge < n) {
+        const u32 small = worklist[--nSmall];
+        const u32 large = worklist[firstLarge];
+        alias[small] = (AliasEntry) { .threshold = (f32)scaled[small], .alias = large };
+        scaled[large] -= 1.0 - scaled[small];
+        if (scaled[large] < 1.0) {
+            firstLarge++;
+            worklist[nSmall++] = large;
+        }
+    }
+    // Whatever is left holds the mean up to rounding.
+    while (nSmall > 0) {
+        const u32 i = worklist[--nSmall];
+        alias[i] = (AliasEntry) { .threshold = 1.f, .alias = i };
+    }
+    for (usize k = firstLarge; k < n; k++) alias[worklist[k]] = (AliasEntry) { .threshold = 1.f, .alias = worklist[k] };
+    free(worklist);
+}
+
+COMMENT(--------========[ Lookup ]========--------)
+
+internal const f32* Texel(const Environment* const environment, const u32 x, const u32 y) {
+    const usize tile = (usize)(y / ENVIRONMENT_TILE_SIZE) * environment->tilesX + x / ENVIRONMENT_TILE_SIZE;
+    const usize inTile = (y % ENVIRONMENT_TILE_SIZE) * ENVIRONMENT_TILE_SIZE + x % ENVIRONMENT_TILE_SIZE;
+    return &environment->texels[(tile * ENVIRONMENT_TILE_SIZE * ENVIRONMENT_TILE_SIZE + inTile) * 3];
+}
+
+/// Sampling weight of a texel, its luminance times the sine of the polar angle of its row's center.
+internal f64 TexelWeight(const Environment* const environment, const u32 x, const u32 y) {
+    const f32 luminance = Luminance(Texel(environment, x, y));
+    const f64 sinTheta = sin(M_PI * ((f64)y + 0.5) / (f64)environment->height);
+    return luminance > 0.f ? (f64)luminance * sinTheta : 0.0;
+}
+
+void CreateEnvironment(Environment* const environment, const f32* const rgb, const u32 width, const u32 height) {
+    const u32 tilesX = (width + ENVIRONMENT_TILE_SIZE - 1) / ENVIRONMENT_TILE_SIZE;
+    const u32 tilesY = (height + ENVIRONMENT_TILE_SIZE - 1) / ENVIRONMENT_TILE_SIZE;
+    *environment = (Environment) {
+        .width = width,
+        .height = height,
+        .tilesX = tilesX,
+        .texels = calloc((usize)tilesX * tilesY * ENVIRONMENT_TILE_SIZE * ENVIRONMENT_TILE_SIZE * 3, sizeof(f32)),
+        .alias = NULL,
+        .totalWeight = 0.0,
+    };
+    if (environment->texels == NULL) PANICM("Failed to allocate environment texels");
+    for (u32 y = 0; y < height; y++) {
+        for (u32 x = 0; x < width; x++) {
+            memcpy((f32*)Texel(environment, x, y), &rgb[((usize)y * width + x) * 3], 3 * sizeof(f32));
+        }
+    }
+
+    const usize n = (usize)width * height;
+    f64* const scaled = malloc(n * sizeof(f64));
+    if (scaled == NULL) PANICM("Failed to allocate environment weights");
+    for (u32 y = 0; y < height; y++) {
+        for (u32 x = 0; x < width; x++) {
+            scaled[(usize)y * width + x] = TexelWeight(environment, x, y);
+            environment->totalWeight += scaled[(usize)y * width + x];
+        }
+    }
+    if (environment->totalWeight > 0.0) {
+        for (usize i = 0; i < n; i++) scaled[i] *= (f64)n / environment->totalWeight;
+        environment->alias = malloc(n * sizeof(AliasEntry));
+        if (environment->alias == NULL) PANICM("Failed to allocate environment alias table");
+        BuildAliasTable(environment->alias, scaled, n);
+    }
+    free(scaled);
+}
+
+void DestroyEnvironment(Environment* const environment) {
+    free(environment->texels);
+    free(environment->alias);
+}
+
+/// Texel seen in `direction`, `sinTheta` is the sine of the polar angle of the direction.
+internal void DirectionToTexel(const Environment* const environment, const vec3 direction, u32* const x, u32* const y, f32* const sinTheta) {
+    const f32 length = glm_vec3_norm(CGLM_CONST_FIX direction);
+    const f32 cosTheta = glm_clamp(direction[1] / length, -1.f, 1.f);
+    const f32 u = 0.5f + atan2f(direction[0], -direction[2]) * (f32)(0.5 / M_PI);
+    const f32 v = acosf(cosTheta) * (f32)M_1_PI;
+    *x = MinU32((u32)(u * (f32)environment->width), environment->width - 1);
+    *y = MinU32((u32)(v * (f32)environment->height), environment->height - 1);
+    // Not from `cosTheta`, which has no precision left for the sine near the poles.
+    *sinTheta = glm_min(1.f, sqrtf(direction[0] * direction[0] + direction[2] * direction[2]) / length);
+}
+
+void EnvironmentRadiance(const Environment* const environment, const vec3 direction, out vec3 radiance) {
+    u32 x, y;
+    f32 sinTheta;
+    DirectionToTexel(environment, direction, &x, &y, &sinTheta);
+    glm_vec3_copy(CGLM_CONST_FIX Texel(environment, x, y), radiance);
+}
+
+/// Converts the probability of a texel to a density over the solid angle it covers at `sinTheta`.
+internal f32 SolidAngleDensity(const Environment* const environment, const f64 probability, const f32 sinTheta) {
+    if (sinTheta <= 0.f) return 0.f;
+    const f64 texels = (f64)environment->width * environment->height;
+    return (f32)(probability * texels / (2.0 * M_PI * M_PI * sinTheta));
+}
+
+f32 EnvironmentPdf(const Environment* const environment, const vec3 direction) {
+    if (environment->alias == NULL) return 0.f;
+    u32 x, y;
+    f32 sinTheta;
+    DirectionToTexel(environment, direction, &x, &y, &sinTheta);
+    return SolidAngleDensity(environment, TexelWeight(environment, x, y) / environment->totalWeight, sinTheta);
+}
+
+f32 SampleEnvironment(const Environment* const environment, const f32 random[4], out vec3 direction, out vec3 radiance) {
+    if (environment->alias == NULL) return 0.f;
+    const usize n = (usize)environment->width * environment->height;
+    // Two draws make a 48 bit number, enough for both the texel and the coin of any realistic resolution.
+    const f64 scaled = ((f64)random[0] + (f64)random[1] * 0x1p-24) * (f64)n;
+    usize i = (usize)scaled;
+    if (i >= n) i = n - 1;
+    const AliasEntry entry = environment->alias[i];
+    if ((f32)(scaled - (f64)i) >= entry.threshold) i = entry.alias;
+
+    const u32 x = (u32)(i % environment->width), y = (u32)(i / environment->width);
+    const f32 phi = (((f32)x + random[2]) / (f32)environment->width - 0.5f) * 2.f * (f32)M_PI;
+    const f32 theta = ((f32)y + random[3]) / (f32)environment->height * (f32)M_PI;
+    const f32 sinTheta = sinf(theta);
+    glm_vec3_copy((vec3) { sinTheta * sinf(phi), cosf(theta), -sinTheta * cosf(phi) }, direction);
+    glm_vec3_copy(CGLM_CONST_FIX Texel(environment, x, y), radiance);
+    return SolidAngleDensity(environment, TexelWeight(environment, x, y) / environment->totalWeight, sinTheta);
+}
@@ -0,0 +1,503 @@
+#include "lights.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "vec3_utilities.h"
+
+#define LIGHT_TREE_BINS 12
+
+#define CGLM_CONST_FIX (f32*)
+
+internal f32 Luminance(const vec3 color) {
+    return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+}
+
+void CreatePointLight(Light* const light, const vec3 position, const vec3 intensity) {
+    light->kind = LightKindPoint;
+    glm_vec3_copy(CGLM_CONST_FIX position, light->position);
+    glm_vec3_copy((vec3) { 0.f, 0.f, 1.f }, light->normal);
+    light->radius = 0.f;
+    glm_vec3_copy(CGLM_CONST_FIX intensity, light->color);
+}
+
+void CreateDiscLight(Light* const light, const vec3 position, const vec3 normal, const f32 radius, const vec3 radiance) {
+    light->kind = LightKindDisc;
+    glm_vec3_copy(CGLM_CONST_FIX position, light->position);
+    glm_vec3_normalize_to(CGLM_CONST_FIX normal, light->normal);
+    light->radius = radius;
+    glm_vec3_copy(CGLM_CONST_FIX radiance, light->color);
+}
+
+void CreateSphereLight(Light* const light, const vec3 position, const f32 radius, const vec3 radiance) {
+    light->kind = LightKindSphere;
+    glm_vec3_copy(CGLM_CONST_FIX position, light->position);
+    glm_vec3_copy((vec3) { 0.f, 0.f, 1.f }, light->normal);
+    light->radius = radius;
+    glm_vec3_copy(CGLM_CONST_FIX radiance, light->color);
+}
+
+/// Orthonormal tangent and bitangent completing the unit `normal`.
+internal void TangentFrame(const vec3 normal, out vec3 tangent, out vec3 bitangent) {
+    vec3 helper = { 1.f, 0.f, 0.f };
+    if (fabsf(normal[0]) > 0.9f) glm_vec3_copy((vec3) { 0.f, 1.f, 0.f }, helper);
+    glm_vec3_cross(helper, CGLM_CONST_FIX normal, tangent);
+    glm_vec3_normalize(tangent);
+    glm_vec3_cross(CGLM_CONST_FIX normal, tangent, bitangent);
+}
+
+internal f32 SafeAcos(const f32 cosine) {
+    return acosf(cosine < -1.f ? -1.f : cosine > 1.f ? 1.f : cosine);
+}
+
+COMMENT(--------========[ Bounds ]========--------)
+
+/// Identity of `UnionLightBounds`.
+internal LightBounds EmptyLightBounds(void) {
+    return (LightBounds) {
+        .min = { INFINITY, INFINITY, INFINITY },
+        .max = { -INFINITY, -INFINITY, -INFINITY },
+        .axis = { 0.f, 0.f, 1.f },
+        .thetaO = -1.f,
+        .thetaE = 0.f,
+        .power = 0.f,
+    };
+}
+
+internal LightBounds LightBoundsOf(const Light* const light) {
+    LightBounds bounds = {
+        .axis = { 0.f, 0.f, 1.f },
+        .thetaO = (f32)M_PI,
+        .thetaE = (f32)M_PI_2,
+    };
+    vec3 extent = { light->radius, light->radius, light->radius };
+    switch (light->kind) {
+        case LightKindPoint:
+            bounds.power = 4.f * (f32)M_PI * Luminance(light->color);
+            break;
+        case LightKindDisc:
+            // A disc spans less along the axes its normal leans towards.
+            for (usize k = 0; k < 3; k++) extent[k] *= sqrtf(glm_max(0.f, 1.f - light->normal[k] * light->normal[k]));
+            glm_vec3_copy(CGLM_CONST_FIX light->normal, bounds.axis);
+            bounds.thetaO = 0.f;
+            bounds.power = (f32)M_PI * (f32)M_PI * light->radius * light->radius * Luminance(light->color);
+            break;
+        case LightKindSphere:
+            bounds.power = 4.f * (f32)M_PI * (f32)M_PI * light->radius * light->radius * Luminance(light->color);
+            break;
+        default: PANIC("Unknown light kind" FS(u32), (u32)light->kind);
+    }
+    glm_vec3_sub(CGLM_CONST_FIX light->position, extent, bounds.min);
+    glm_vec3_add(CGLM_CONST_FIX light->position, extent, bounds.max);
+    return bounds;
+}
+
+/// Smallest cone around both `a` and `b`, widening the wider one towards the other.
+internal void UnionCones(const LightBounds* a, const LightBounds* b, out LightBounds* const result) {
+    if (b->thetaO > a->thetaO) {
+        const LightBounds* const swap = a;
+        a = b;
+        b = swap;
+    }
+    result->thetaE = glm_max(a->thetaE, b->thetaE);
+    const f32 thetaD = SafeAcos(glm_vec3_dot(CGLM_CONST_FIX a->axis, CGLM_CONST_FIX b->axis));
+    if (glm_min(thetaD + b->thetaO, (f32)M_PI) <= a->thetaO) {
+        glm_vec3_copy(CGLM_CONST_FIX a->axis, result->axis);
+        result->thetaO = a->thetaO;
+        return;
+    }
+    const f32 thetaO = 0.5f * (a->thetaO + thetaD + b->thetaO);
+    if (thetaO >= (f32)M_PI) {
+        glm_vec3_copy(CGLM_CONST_FIX a->axis, result->axis);
+        result->thetaO = (f32)M_PI;
+        return;
+    }
+    // Rotate `a`'s axis by the extra spread in the plane of both axes.
+    const f32 rotation = thetaO - a->thetaO;
+    vec3 towards;
+    glm_vec3_scale(CGLM_CONST_FIX a->axis, cosf(thetaD), towards);
+    glm_vec3_sub(CGLM_CONST_FIX b->axis, towards, towards);
+    if (glm_vec3_norm(towards) < 1e-6f) {
+        // Opposite axes, any perpendicular direction will do.
+        vec3 bitangent;
+        TangentFrame(a->axis, towards, bitangent);
+    }
+    glm_vec3_normalize(towards);
+    glm_vec3_scale(CGLM_CONST_FIX a->axis, cosf(rotation), result->axis);
+    glm_vec3_muladds(towards, sinf(rotation), result->axis);
+    glm_vec3_normalize(result->axis);
+    result->thetaO = thetaO;
+}
+
+internal LightBounds UnionLightBounds(const LightBounds* const a, const LightBounds* const b) {
+    if (a->thetaO < 0.f) return *b;
+    if (b->thetaO < 0.f) return *a;
+    LightBounds result;
+    glm_vec3_minv(CGLM_CONST_FIX a->min, CGLM_CONST_FIX b->min, result.min);
+    glm_vec3_maxv(CGLM_CONST_FIX a->max, CGLM_CONST_FIX b->max, result.max);
+    result.power = a->power + b->power;
+    UnionCones(a, b, &result);
+    return result;
+}
+
+/// Solid angle measure of the directions a cone reaches, including the falloff up to `thetaE`.
+internal f32 OrientationMeasure(const LightBounds* const bounds) {
+    const f32 thetaO = bounds->thetaO;
+    const f32 thetaW = glm_min(thetaO + bounds->thetaE, (f32)M_PI);
+    const f32 sinO = sinf(thetaO), cosO = cosf(thetaO);
+    return 2.f * (f32)M_PI * (1.f - cosO)
+        + (f32)M_PI_2 * (2.f * thetaW * sinO - cosf(thetaO - 2.f * thetaW) - 2.f * thetaO * sinO + cosO);
+}
+
+internal f32 SurfaceArea(const LightBounds* const bounds) {
+    vec3 d;
+    glm_vec3_sub(CGLM_CONST_FIX bounds->max, CGLM_CONST_FIX bounds->min, d);
+    return 2.f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+/// Surface area orientation heuristic of one node.
+internal f32 SaohCost(const LightBounds* const bounds) {
+    if (bounds->thetaO < 0.f) return 0.f;
+    return bounds->power * SurfaceArea(bounds) * OrientationMeasure(bounds);
+}
+
+COMMENT(--------========[ Build ]========--------)
+
+void CreateLightTree(LightTree* const tree, const usize capacity) {
+    *tree = (LightTree) {
+        .lights = NULL,
+        .nLights = 0,
+        .nodes = AllocateArray(LightNode, capacity > 0 ? 2 * capacity - 1 : 0),
+        .nNodes = 0,
+        .order = malloc(capacity * sizeof(u32)),
+        .lightBounds = malloc(capacity * sizeof(LightBounds)),
+        .lightLeaves = malloc(capacity * sizeof(u32)),
+        .builtCost = 0.f,
+    };
+    if (capacity > 0 && (tree->nodes.data == NULL || tree->order == NULL || tree->lightBounds == NULL || tree->lightLeaves == NULL)) {
+        PANICM("Failed to allocate light tree");
+    }
+}
+
+void DestroyLightTree(LightTree* const tree) {
+    FreeArray(tree->nodes);
+    free(tree->order);
+    free(tree->lightBounds);
+    free(tree->lightLeaves);
+}
+
+internal void Centroid(const LightBounds* const bounds, out vec3 centroid) {
+    glm_vec3_add(CGLM_CONST_FIX bounds->min, CGLM_CONST_FIX bounds->max, centroid);
+    glm_vec3_scale(centroid, 0.5f, centroid);
+}
+
+internal usize Bin(const LightBounds* const bounds, const usize axis, const f32 min, const f32 extent) {
+    const f32 centroid = 0.5f * (bounds->min[axis] + bounds->max[axis]);
+    const usize bin = (usize)((centroid - min) / extent * LIGHT_TREE_BINS);
+    return bin < LIGHT_TREE_BINS ? bin : LIGHT_TREE_BINS - 1;
+}
+
+internal void SetNode(LightNode* const node, const LightBounds bounds, const u32 index, const u32 leaf) {
+    *node = (LightNode) {
+        .bounds = bounds,
+        .cosThetaO = cosf(bounds.thetaO),
+        .cosThetaE = cosf(bounds.thetaE),
+        .index = index,
+        .leaf = leaf,
+    };
+}
+
+/// Builds the subtree over `order[begin, end)` and returns its root.
+internal u32 BuildNode(LightTree* const tree, const usize begin, const usize end) {
+    const LightBounds* const lightBounds = tree->lightBounds;
+    u32* const order = tree->order;
+    const u32 node = (u32)tree->nNodes++;
+    if (end - begin == 1) {
+        SetNode(&tree->nodes.data[node], lightBounds[order[begin]], order[begin], 1);
+        tree->lightLeaves[order[begin]] = node;
+        return node;
+    }
+
+    LightBounds total = EmptyLightBounds();
+    vec3 centroidMin = { INFINITY, INFINITY, INFINITY };
+    vec3 centroidMax = { -INFINITY, -INFINITY, -INFINITY };
+    for (usize i = begin; i < end; i++) {
+        total = UnionLightBounds(&total, &lightBounds[order[i]]);
+        vec3 centroid;
+        Centroid(&lightBounds[order[i]], centroid);
+        glm_vec3_minv(centroidMin, centroid, centroidMin);
+        glm_vec3_maxv(centroidMax, centroid, centroidMax);
+    }
+
+    vec3 extent;
+    glm_vec3_sub(total.max, total.min, extent);
+    const f32 maxExtent = glm_max(extent[0], glm_max(extent[1], extent[2]));
+
+    f32 bestCost = INFINITY;
+    usize bestAxis = 0, bestSplit = 0;
+    for (usize axis = 0; axis < 3; axis++) {
+        const f32 centroidExtent = centroidMax[axis] - centroidMin[axis];
+        if (centroidExtent <= 0.f) continue;
+        LightBounds bins[LIGHT_TREE_BINS];
+        for (usize b = 0; b < LIGHT_TREE_BINS; b++) bins[b] = EmptyLightBounds();
+        for (usize i = begin; i < end; i++) {
+            const usize b = Bin(&lightBounds[order[i]], axis, centroidMin[axis], centroidExtent);
+            bins[b] = UnionLightBounds(&bins[b], &lightBounds[order[i]]);
+        }
+        // Costs of every split from a sweep in each direction, `below[s]` bounds the bins before `s`.
+        f32 below[LIGHT_TREE_BINS];
+        LightBounds sweep = EmptyLightBounds();
+        for (usize split = 1; split < LIGHT_TREE_BINS; split++) {
+            sweep = UnionLightBounds(&sweep, &bins[split - 1]);
+            below[split] = sweep.thetaO < 0.f ? INFINITY : SaohCost(&sweep);
+        }
+        // Thin axes make for poor splits, regularized as in the paper.
+        const f32 regularization = extent[axis] > 0.f ? maxExtent / extent[axis] : 1.f;
+        sweep = EmptyLightBounds();
+        for (usize split = LIGHT_TREE_BINS - 1; split > 0; split--) {
+            sweep = UnionLightBounds(&sweep, &bins[split]);
+            if (sweep.thetaO < 0.f) continue;
+            const f32 cost = regularization * (below[split] + SaohCost(&sweep));
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    // All centroids coincide without a split, any halves do then.
+    usize mid = begin + (end - begin) / 2;
+    if (bestSplit > 0) {
+        const f32 centroidExtent = centroidMax[bestAxis] - centroidMin[bestAxis];
+        usize i = begin, j = end;
+        while (i < j) {
+            if (Bin(&lightBounds[order[i]], bestAxis, centroidMin[bestAxis], centroidExtent) < bestSplit) {
+                i++;
+            } else {
+                const u32 swap = order[i];
+                order[i] = order[--j];
+                order[j] = swap;
+            }
+        }
+        if (i > begin && i < end) mid = i;
+    }
+
+    BuildNode(tree, begin, mid);
+    const u32 right = BuildNode(tree, mid, end);
+    SetNode(&tree->nodes.data[node], total, right, 0);
+    return node;
+}
+
+internal f32 TreeCost(const LightTree* const tree) {
+    f32 cost = 0.f;
+    for (usize i = 0; i < tree->nNodes; i++) {
+        if (!tree->nodes.data[i].leaf) cost += SaohCost(&tree->nodes.data[i].bounds);
+    }
+    return cost;
+}
+
+void BuildLightTree(LightTree* const tree, const Light* const lights, const usize nLights) {
+    if (nLights > 0 && 2 * nLights - 1 > tree->nodes.len) PANIC("Light tree holds at most" FS(usize) "lights", (tree->nodes.len + 1) / 2);
+    tree->lights = lights;
+    tree->nLights = nLights;
+    tree->nNodes = 0;
+    for (usize i = 0; i < nLights; i++) {
+        tree->order[i] = (u32)i;
+        tree->lightBounds[i] = LightBoundsOf(&lights[i]);
+    }
+    if (nLights > 0) BuildNode(tree, 0, nLights);
+    tree->builtCost = TreeCost(tree);
+}
+
+bool UpdateLightTree(LightTree* const tree) {
+    // Children follow their parents, so a reverse sweep sees both children of a node before the node.
+    for (usize i = tree->nNodes; i-- > 0;) {
+        LightNode* const node = &tree->nodes.data[i];
+        const LightBounds bounds = node->leaf
+            ? LightBoundsOf(&tree->lights[node->index])
+            : UnionLightBounds(&tree->nodes.data[i + 1].bounds, &tree->nodes.data[node->index].bounds);
+        SetNode(node, bounds, node->index, node->leaf);
+    }
+    if (TreeCost(tree) <= LIGHT_TREE_REBUILD_RATIO * tree->builtCost) return false;
+    BuildLightTree(tree, tree->lights, tree->nLights);
+    return true;
+}
+
+COMMENT(--------========[ Sampling ]========--------)
+
+/// cos(max(0, a - b)) from the sines and cosines of both angles.
+internal f32 CosSubClamped(const f32 sinA, const f32 cosA, const f32 sinB, const f32 cosB) {
+    return cosA > cosB ? 1.f : cosA * cosB + sinA * sinB;
+}
+
+/// sin(max(0, a - b)) from the sines and cosines of both angles.
+internal f32 SinSubClamped(const f32 sinA, const f32 cosA, const f32 sinB, const f32 cosB) {
+    return cosA > cosB ? 0.f : sinA * cosB - cosA * sinB;
+}
+
+internal f32 SinFromCos(const f32 cosine) {
+    return sqrtf(glm_max(0.f, 1.f - cosine * cosine));
+}
+
+/// Upper bound of the light a node sends to a surface at `position` facing `normal`.
+///
+/// Angles at the light and at the surface are narrowed by the angle the node's bounds span from `position`, so no
+/// light below the node gets more than this. Works on cosines throughout, traversal is dominated by this function.
+internal f32 Importance(const LightNode* const node, const vec3 position, const vec3 normal) {
+    const LightBounds* const bounds = &node->bounds;
+    vec3 center, toPosition, diagonal;
+    Centroid(bounds, center);
+    glm_vec3_sub(CGLM_CONST_FIX position, center, toPosition);
+    glm_vec3_sub(CGLM_CONST_FIX bounds->max, CGLM_CONST_FIX bounds->min, diagonal);
+    const f32 radius2 = 0.25f * glm_vec3_dot(diagonal, diagonal);
+    const f32 distance2 = glm_vec3_dot(toPosition, toPosition);
+    if (distance2 <= radius2) return bounds->power / glm_max(radius2, 1e-6f);
+
+    glm_vec3_scale(toPosition, 1.f / sqrtf(distance2), toPosition);
+    const f32 sinU = sqrtf(radius2 / distance2);
+    const f32 cosU = SinFromCos(sinU);
+
+    const f32 cosTheta = glm_vec3_dot(CGLM_CONST_FIX bounds->axis, toPosition);
+    const f32 sinTheta = SinFromCos(cosTheta);
+    const f32 sinO = SinFromCos(node->cosThetaO);
+    const f32 cosOutside = CosSubClamped(sinTheta, cosTheta, sinO, node->cosThetaO);
+    const f32 sinOutside = SinSubClamped(sinTheta, cosTheta, sinO, node->cosThetaO);
+    const f32 cosEmit = CosSubClamped(sinOutside, cosOutside, sinU, cosU);
+    if (cosEmit <= node->cosThetaE) return 0.f;
+
+    const f32 cosI = -glm_vec3_dot(CGLM_CONST_FIX normal, toPosition);
+    const f32 cosReceive = CosSubClamped(SinFromCos(cosI), cosI, sinU, cosU);
+    if (cosReceive <= 0.f) return 0.f;
+
+    return bounds->power * cosEmit * cosReceive / distance2;
+}
+
+/// Probability of descending into the left child of the inner node `node`.
+internal f32 LeftProbability(const LightNode* const nodes, const u32 node, const vec3 position, const vec3 normal) {
+    const LightNode* const left = &nodes[node + 1];
+    const LightNode* const right = &nodes[nodes[node].index];
+    const f32 importanceLeft = Importance(left, position, normal);
+    const f32 importanceRight = Importance(right, position, normal);
+    if (importanceLeft + importanceRight > 0.f) return importanceLeft / (importanceLeft + importanceRight);
+    // The tighter bounds of both children can rule out what those of their parent let through. Choosing by power
+    // keeps the probabilities of all lights summing to one, lights picked this way just contribute nothing.
+    const f32 powerLeft = left->bounds.power, powerRight = right->bounds.power;
+    return powerLeft + powerRight > 0.f ? powerLeft / (powerLeft + powerRight) : 0.5f;
+}
+
+f32 SampleLightTree(const LightTree* const tree, const vec3 position, const vec3 normal, f32 u, out u32* const light) {
+    if (tree->nNodes == 0) return 0.f;
+    const LightNode* const nodes = tree->nodes.data;
+    if (Importance(&nodes[0], position, normal) <= 0.f) return 0.f;
+    u32 node = 0;
+    f32 probability = 1.f;
+    while (!nodes[node].leaf) {
+        const u32 left = node + 1, right = nodes[node].index;
+        // Reuse `u` for the next choice by stretching the part of it that picked the child.
+        const f32 pLeft = LeftProbability(nodes, node, position, normal);
+        if (u < pLeft) {
+            node = left;
+            u /= pLeft;
+            probability *= pLeft;
+        } else {
+            node = right;
+            u = (u - pLeft) / (1.f - pLeft);
+            probability *= 1.f - pLeft;
+        }
+        u = glm_min(u, 0x1.fffffep-1f);
+    }
+    *light = nodes[node].index;
+    return probability;
+}
+
+f32 LightTreePdf(const LightTree* const tree, const vec3 position, const vec3 normal, const u32 light) {
+    if (tree->nNodes == 0) return 0.f;
+    const LightNode* const nodes = tree->nodes.data;
+    if (Importance(&nodes[0], position, normal) <= 0.f) return 0.f;
+    const u32 leaf = tree->lightLeaves[light];
+    u32 node = 0;
+    f32 probability = 1.f;
+    while (!nodes[node].leaf) {
+        const u32 left = node + 1, right = nodes[node].index;
+        // Subtrees are stored depth first, the left one holds the nodes before `right`.
+        const f32 pLeft = LeftProbability(nodes, node, position, normal);
+        if (leaf < right) {
+            node = left;
+            probability *= pLeft;
+        } else {
+            node = right;
+            probability *= 1.f - pLeft;
+        }
+    }
+    return probability;
+}
+
+bool SampleLight(const Light* const light, const vec3 position, const f32 u, const f32 v, out vec3 direction, out f32* const distance, out vec3 radiance) {
+    vec3 target;
+    glm_vec3_copy(CGLM_CONST_FIX light->position, target);
+    if (light->kind == LightKindDisc) {
+        vec3 tangent, bitangent;
+        TangentFrame(light->normal, tangent, bitangent);
+        const f32 r = light->radius * sqrtf(u);
+        const f32 phi = 2.f * (f32)M_PI * v;
+        glm_vec3_muladds(tangent, r * cosf(phi), target);
+        glm_vec3_muladds(bitangent, r * sinf(phi), target);
+    }
+    glm_vec3_sub(target, CGLM_CONST_FIX position, direction);
+    const f32 distance2 = glm_vec3_dot(direction, direction);
+    const f32 length = sqrtf(distance2);
+    if (length == 0.f || (light->kind == LightKindSphere && length <= light->radius)) return false;
+    glm_vec3_scale(direction, 1.f / length, direction);
+    *distance = length;
+
+    switch (light->kind) {
+        case LightKindPoint:
+            glm_vec3_scale(CGLM_CONST_FIX light->color, 1.f / distance2, radiance);
+            return true;
+        case LightKindDisc: {
+            // Uniform over the disc, the density converts to solid angle with the cosine at the light.
+            const f32 cosine = -glm_vec3_dot(CGLM_CONST_FIX light->normal, direction);
+            if (cosine <= 0.f) return false;
+            const f32 area = (f32)M_PI * light->radius * light->radius;
+            glm_vec3_scale(CGLM_CONST_FIX light->color, cosine * area / distance2, radiance);
+            return true;
+        }
+        case LightKindSphere:
+            // Shadow rays stop at the surface rather than at the center inside whatever emits.
+            glm_vec3_scale(CGLM_CONST_FIX light->color, (f32)M_PI * light->radius * light->radius / distance2, radiance);
+            *distance = length - light->radius;
+            return true;
+        default: PANIC("Unknown light kind" FS(u32), (u32)light->kind);
+    }
+}
+
+void ScatterLights(Light* const lights, const usize nLights, const u64 seed, const f32 totalPower) {
+    SeedRandom(seed, 11);
+    const f32 share = totalPower / (f32)(nLights > 0 ? nLights : 1);
+    for (usize i = 0; i < nLights; i++) {
+        const vec3 position = { 6.f * RandomF32() - 3.f, 6.f * RandomF32() - 3.f, -3.f + 3.5f * RandomF32() };
+        const vec3 tint = { 0.6f + 0.4f * RandomF32(), 0.5f + 0.4f * RandomF32(), 0.3f + 0.4f * RandomF32() };
+        vec3 color;
+        switch (i % 3) {
+            case 0:
+                glm_vec3_scale((f32*)tint, share / (4.f * (f32)M_PI), color);
+                CreatePointLight(&lights[i], position, color);
+                break;
+            case 1: {
+                // Lamps looking down.
+                const f32 radius = 0.05f + 0.05f * RandomF32();
+                glm_vec3_scale((f32*)tint, share / ((f32)M_PI * (f32)M_PI * radius * radius), color);
+                CreateDiscLight(&lights[i], position, (vec3) { 0.f, -1.f, 0.f }, radius, color);
+            } break;
+            default: {
+                const f32 radius = 0.02f + 0.03f * RandomF32();
+                glm_vec3_scale((f32*)tint, share / (4.f * (f32)M_PI * (f32)M_PI * radius * radius), color);
+                CreateSphereLight(&lights[i], position, radius, color);
+            } break;
+        }
+    }
+}
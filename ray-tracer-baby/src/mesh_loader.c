@@ -0,0 +1,165 @@
+#include "mesh_loader.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "obj.h"
+#include "profiler.h"
+#include "texture.h"
+#include "vertex_format.h"
+
+internal void BoundingSphere(const Obj* const obj, vec3 center, f32* const radius) {
+    vec3 lower = { INFINITY, INFINITY, INFINITY };
+    vec3 upper = { -INFINITY, -INFINITY, -INFINITY };
+    for (usize i = 0; i < obj->nVertices; i++) {
+        vec3 p = { obj->vertices[i].position.x, obj->vertices[i].position.y, obj->vertices[i].position.z };
+        glm_vec3_minv(lower, p, lower);
+        glm_vec3_maxv(upper, p, upper);
+    }
+    glm_vec3_center(lower, upper, center);
+    *radius = 0.f;
+    for (usize i = 0; i < obj->nVertices; i++) {
+        vec3 p = { obj->vertices[i].position.x, obj->vertices[i].position.y, obj->vertices[i].position.z };
+        *radius = glm_max(*radius, glm_vec3_distance(center, p));
+    }
+}
+
+/// Tiles are written next to the image and reused while they are newer than it.
+internal void LoadAlbedoTexture(const char* const path, Mesh* const mesh) {
+    const Obj* const obj = &mesh->obj;
+    if (obj->albedoTexture == NULL) return;
+    if (obj->texCoords == NULL) {
+        LOGLN("Ignoring the diffuse map of %s, it has no texture coordinates", path);
+        return;
+    }
+    char tiledPath[4096];
+    snprintf(tiledPath, sizeof tiledPath, "%s.tiles", obj->albedoTexture);
+    ConvertTexture(obj->albedoTexture, tiledPath);
+    OpenTexture(tiledPath, &mesh->albedoTexture);
+    mesh->hasAlbedoTexture = true;
+    LOGLN("Textured %s with %s," FS(u32) "x" FS(u32) "," FS(u32) "levels", path, obj->albedoTexture,
+        mesh->albedoTexture.levels[0].width, mesh->albedoTexture.levels[0].height, mesh->albedoTexture.nLevels);
+}
+
+internal void LoadMesh(const char* const path, Mesh* const mesh, const MeshLoaderConfig* const config) {
+    Obj* const obj = &mesh->obj;
+#ifdef _PROFILING
+    ObjLoadTimings timings;
+    PROFILE_BEGIN(loadStart);
+    if (config->weldEpsilon != NULL) LoadOBJWelded(path, *config->weldEpsilon, obj, &timings);
+    else LoadOBJTimed(path, obj, &timings);
+    ProfileRecord("obj parse", loadStart, loadStart + timings.parseNs);
+    ProfileRecord("obj weld", loadStart + timings.parseNs, loadStart + timings.parseNs + timings.processNs);
+    PROFILE_END("obj load", loadStart);
+#else
+    if (config->weldEpsilon != NULL) LoadOBJWelded(path, *config->weldEpsilon, obj, NULL);
+    else LoadOBJ(path, obj);
+#endif
+    if (config->optimize != NULL) {
+        MeshOptimizeReport report;
+        OptimizeOBJ(obj, *config->optimize, &report);
+        LOGLN("Optimized %s in %.3f ms," FS(u32) "clusters", path, report.optimizeNs * 1e-6, report.nClusters);
+        LOGLN("  ACMR      : %.3f -> %.3f", report.before.acmr, report.after.acmr);
+        LOGLN("  ATVR      : %.3f -> %.3f", report.before.atvr, report.after.atvr);
+        LOGLN("  Overfetch : %.3f -> %.3f", report.before.overfetch, report.after.overfetch);
+    }
+    BoundingSphere(obj, mesh->center, &mesh->radius);
+    if (config->lods != NULL) {
+        if (config->lods->maxLevels > MAX_LODS) PANIC("At most" FS(usize) "levels of detail are supported", (usize)MAX_LODS);
+        mesh->nLods = GenerateLODs(obj, *config->lods, mesh->lods);
+        LOGLN("Simplified %s into" FS(u32) "levels", path, mesh->nLods);
+        for (u32 level = 0; level < mesh->nLods; level++) {
+            LOGLN("  LOD" FS(u32) "--" FS(usize) "triangles, error %.3e", level + 1, mesh->lods[level].nIndices / 3, mesh->lods[level].error);
+        }
+    }
+    if (config->compactVertices) {
+        mesh->arena = CreateArena(CompactMeshArenaSize(obj));
+        VertexPrecision precision;
+        mesh->compact = CompressMesh(obj, &mesh->arena, &precision);
+        LOGLN("Quantized %s -- position error max %.3e mean %.3e, normal error max %.3f mean %.3f deg",
+            path, precision.maxPositionError, precision.meanPositionError, precision.maxNormalErrorDeg, precision.meanNormalErrorDeg);
+        // Raster, Embree and shading all read the quantized vertices from here on, bounds and LODs are done.
+        FreeOBJVertices(obj);
+    }
+    if (config->textures) LoadAlbedoTexture(path, mesh);
+}
+
+internal void* MeshLoaderJob(void* args) {
+    MeshLoader* const loader = args;
+    PROFILE_THREAD("mesh loader");
+    pthread_mutex_lock(&loader->lock);
+    while (loader->nextPath < loader->meshes.len) {
+        const usize meshId = loader->nextPath++;
+        pthread_mutex_unlock(&loader->lock);
+
+        Mesh* const mesh = &loader->meshes.data[meshId];
+        mesh->id = meshId;
+        LoadMesh(loader->config.paths[meshId], mesh, &loader->config);
+
+        pthread_mutex_lock(&loader->lock);
+        loader->ready[loader->nReady++] = meshId;
+        pthread_cond_broadcast(&loader->loaded);
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+void StartMeshLoader(MeshLoader* const loader, const Meshes meshes, const MeshLoaderConfig config) {
+    const usize nThreads = config.nThreads < meshes.len ? config.nThreads : meshes.len;
+    *loader = (MeshLoader) {
+        .config = config,
+        .meshes = meshes,
+        .threads = malloc(nThreads * sizeof(pthread_t)),
+        .nThreads = nThreads,
+        .nextPath = 0,
+        .ready = malloc(meshes.len * sizeof(usize)),
+        .nReady = 0,
+        .nTaken = 0,
+    };
+    if (loader->threads == NULL || loader->ready == NULL) PANICM("Failed to allocate mesh loader");
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->loaded, NULL);
+    LOGLN("Loading" FS(usize) ".obj models on" FS(usize) "threads", meshes.len, nThreads);
+    for (usize tid = 0; tid < nThreads; tid++) {
+        if (0 != pthread_create(&loader->threads[tid], NULL, MeshLoaderJob, loader)) {
+            PANIC("Failed to create mesh loader" FS(usize), tid);
+        }
+    }
+}
+
+bool PollLoadedMesh(MeshLoader* const loader, usize* const meshId) {
+    pthread_mutex_lock(&loader->lock);
+    const bool available = loader->nTaken < loader->nReady;
+    if (available) *meshId = loader->ready[loader->nTaken++];
+    pthread_mutex_unlock(&loader->lock);
+    return available;
+}
+
+bool WaitLoadedMesh(MeshLoader* const loader, usize* const meshId) {
+    pthread_mutex_lock(&loader->lock);
+    while (loader->nTaken == loader->nReady && loader->nReady < loader->meshes.len) {
+        pthread_cond_wait(&loader->loaded, &loader->lock);
+    }
+    const bool available = loader->nTaken < loader->nReady;
+    if (available) *meshId = loader->ready[loader->nTaken++];
+    pthread_mutex_unlock(&loader->lock);
+    return available;
+}
+
+bool MeshLoaderDone(const MeshLoader* const loader) {
+    // Only the caller advances `nTaken`.
+    return loader->nTaken == loader->meshes.len;
+}
+
+void StopMeshLoader(MeshLoader* const loader) {
+    for (usize tid = 0; tid < loader->nThreads; tid++) pthread_join(loader->threads[tid], NULL);
+    pthread_cond_destroy(&loader->loaded);
+    pthread_mutex_destroy(&loader->lock);
+    free(loader->threads);
+    free(loader->ready);
+}
@@ -0,0 +1,400 @@
+#include "paged_mesh.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "profiler.h"
+
+#define PAGED_MESH_MAGIC "RTBPAGE"
+/// Bits per axis of the Morton codes ordering triangles into clusters.
+#define MORTON_BITS 10
+
+#if defined(RTC_NAMESPACE_USE)
+RTC_NAMESPACE_USE
+#endif
+
+internal usize RoundUp(const usize value, const usize multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+COMMENT(--------========[ Writing ]========--------)
+
+/// Spreads the low `MORTON_BITS` bits of `value` to every third bit.
+internal u32 SpreadBits(u32 value) {
+    value &= (1u << MORTON_BITS) - 1;
+    value = (value | (value << 16)) & 0x030000FF;
+    value = (value | (value << 8)) & 0x0300F00F;
+    value = (value | (value << 4)) & 0x030C30C3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+}
+
+internal int CompareU64(const void* const a, const void* const b) {
+    const u64 x = *(const u64*)a, y = *(const u64*)b;
+    return (x > y) - (x < y);
+}
+
+/// @returns the triangles of `obj` sorted along a Morton curve over their centroids, `nIndices / 3` of them.
+internal u32* MortonTriangleOrder(const Obj* const obj) {
+    const usize nTriangles = obj->nIndices / 3;
+    vec3 lower = { INFINITY, INFINITY, INFINITY }, upper = { -INFINITY, -INFINITY, -INFINITY };
+    for (usize i = 0; i < obj->nVertices; i++) {
+        const Position* const p = &obj->vertices[i].position;
+        glm_vec3_minv(lower, (vec3) { p->x, p->y, p->z }, lower);
+        glm_vec3_maxv(upper, (vec3) { p->x, p->y, p->z }, upper);
+    }
+
+    // Code in the high half, triangle in the low one, so sorting keeps triangles of equal codes in file order.
+    u64* const keys = malloc(nTriangles * sizeof(u64));
+    u32* const order = malloc(nTriangles * sizeof(u32));
+    if (keys == NULL || order == NULL) PANICM("Failed to allocate triangle order");
+    const f32 cells = (f32)((1u << MORTON_BITS) - 1);
+    for (usize t = 0; t < nTriangles; t++) {
+        vec3 centroid = { 0.f, 0.f, 0.f };
+        for (usize k = 0; k < 3; k++) {
+            const Position* const p = &obj->vertices[obj->indices[3 * t + k]].position;
+            glm_vec3_add(centroid, (vec3) { p->x, p->y, p->z }, centroid);
+        }
+        u32 code = 0;
+        for (usize axis = 0; axis < 3; axis++) {
+            const f32 extent = upper[axis] - lower[axis];
+            const f32 unit = extent > 0.f ? (centroid[axis] / 3.f - lower[axis]) / extent : 0.f;
+            code |= SpreadBits((u32)(glm_clamp(unit, 0.f, 1.f) * cells)) << axis;
+        }
+        keys[t] = (u64)code << 32 | t;
+    }
+    qsort(keys, nTriangles, sizeof(u64), CompareU64);
+    for (usize t = 0; t < nTriangles; t++) order[t] = (u32)keys[t];
+    free(keys);
+    return order;
+}
+
+void WritePagedMesh(const char* const path, const Obj* const obj, const Instances instances) {
+    PROFILE_BEGIN(writeStart);
+    ASSERT_EQ(obj->nIndices % 3, 0);
+    const usize nTriangles = obj->nIndices / 3;
+    const usize clustersPerInstance = (nTriangles + PAGED_MESH_CLUSTER_TRIANGLES - 1) / PAGED_MESH_CLUSTER_TRIANGLES;
+    const usize nClusters = clustersPerInstance * instances.len;
+
+    PagedMeshHeader header = {
+        .version = PAGED_MESH_VERSION,
+        .pageBytes = PAGED_MESH_PAGE_BYTES,
+        .nClusters = nClusters,
+        .nTriangles = (u64)nTriangles * instances.len,
+        .firstPage = RoundUp(sizeof(PagedMeshHeader) + nClusters * sizeof(PagedCluster), PAGED_MESH_PAGE_BYTES),
+    };
+    memcpy(header.magic, PAGED_MESH_MAGIC, sizeof header.magic);
+
+    u32* const order = MortonTriangleOrder(obj);
+    PagedCluster* const clusters = calloc(nClusters > 0 ? nClusters : 1, sizeof(PagedCluster));
+    Position* const baked = malloc(obj->nVertices * sizeof(Position));
+    if (clusters == NULL || baked == NULL) PANIC("Failed to allocate clusters of %s", path);
+
+    char temporaryPath[4096];
+    snprintf(temporaryPath, sizeof temporaryPath, "%s.%d.tmp", path, (i32)getpid());
+    FILE* const file = fopen(temporaryPath, "wb");
+    if (file == NULL) PANIC("Failed to open %s: %s", temporaryPath, strerror(errno));
+    // The cluster table is only known once every page is written, pages start past the space it takes.
+    bool written = fseek(file, (long)header.firstPage, SEEK_SET) == 0;
+
+    u8 page[PAGED_MESH_PAGE_BYTES];
+    for (usize i = 0; i < instances.len && written; i++) {
+        for (usize v = 0; v < obj->nVertices; v++) {
+            const Position* const p = &obj->vertices[v].position;
+            vec3 world;
+            glm_mat4_mulv3(instances.data[i].model, (vec3) { p->x, p->y, p->z }, 1.f, world);
+            baked[v] = (Position) { world[0], world[1], world[2] };
+        }
+        for (usize c = 0; c < clustersPerInstance && written; c++) {
+            PagedCluster* const cluster = &clusters[i * clustersPerInstance + c];
+            PagedTriangle* const triangles = (PagedTriangle*)page;
+            const usize first = c * PAGED_MESH_CLUSTER_TRIANGLES;
+            cluster->nTriangles = (u32)(nTriangles - first < PAGED_MESH_CLUSTER_TRIANGLES ? nTriangles - first : PAGED_MESH_CLUSTER_TRIANGLES);
+            vec3 lower = { INFINITY, INFINITY, INFINITY }, upper = { -INFINITY, -INFINITY, -INFINITY };
+            memset(page, 0, sizeof page);
+            for (usize t = 0; t < cluster->nTriangles; t++) {
+                const u32 triangle = order[first + t];
+                for (usize k = 0; k < 3; k++) {
+                    const Position corner = baked[obj->indices[3 * triangle + k]];
+                    triangles[t].corners[k] = corner;
+                    glm_vec3_minv(lower, (vec3) { corner.x, corner.y, corner.z }, lower);
+                    glm_vec3_maxv(upper, (vec3) { corner.x, corner.y, corner.z }, upper);
+                }
+            }
+            glm_vec3_copy(lower, cluster->lower);
+            glm_vec3_copy(upper, cluster->upper);
+            written = fwrite(page, sizeof page, 1, file) == 1;
+        }
+    }
+    written = written
+        && fseek(file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof header, 1, file) == 1
+        && fwrite(clusters, sizeof(PagedCluster), nClusters, file) == nClusters
+        && fflush(file) == 0;
+    fclose(file);
+    free(baked);
+    free(clusters);
+    free(order);
+    if (!written) PANIC("Failed to write %s", temporaryPath);
+    if (rename(temporaryPath, path) != 0) PANIC("Failed to replace %s: %s", path, strerror(errno));
+
+    PROFILE_END("paged mesh write", writeStart);
+    LOGLN("Paged" FS(u64) "triangles into" FS(usize) "clusters of %s", header.nTriangles, nClusters, path);
+}
+
+COMMENT(--------========[ Paging ]========--------)
+
+void OpenPagedMesh(const char* const path, const usize budgetBytes, PagedMesh* const mesh) {
+    const long systemPage = sysconf(_SC_PAGESIZE);
+    if (PAGED_MESH_PAGE_BYTES % systemPage != 0) PANIC("Clusters of" FS(u32) "bytes do not fill whole pages of %ld bytes", PAGED_MESH_PAGE_BYTES, systemPage);
+
+    const i32 fd = open(path, O_RDONLY);
+    if (fd < 0) PANIC("Failed to open %s: %s", path, strerror(errno));
+    PagedMeshHeader header;
+    if (pread(fd, &header, sizeof header, 0) != sizeof header) PANIC("Truncated paged mesh %s", path);
+    if (memcmp(header.magic, PAGED_MESH_MAGIC, sizeof header.magic) != 0) PANIC("%s is not a paged mesh", path);
+    if (header.version != PAGED_MESH_VERSION) PANIC("Unsupported paged mesh version" FS(u32), header.version);
+    if (header.pageBytes != PAGED_MESH_PAGE_BYTES) PANIC("Paged mesh %s has pages of" FS(u32) "bytes", path, header.pageBytes);
+    if (header.nClusters == 0 || header.nClusters >= PAGED_MESH_NOT_RESIDENT) PANIC("Paged mesh %s has" FS(u64) "clusters", path, header.nClusters);
+
+    const usize nClusters = header.nClusters;
+    const usize tableBytes = nClusters * sizeof(PagedCluster);
+    usize nSlots = budgetBytes == 0 ? nClusters : budgetBytes / PAGED_MESH_PAGE_BYTES;
+    nSlots = nSlots == 0 ? 1 : nSlots < nClusters ? nSlots : nClusters;
+    *mesh = (PagedMesh) {
+        .fd = fd,
+        .pagesBytes = nClusters * PAGED_MESH_PAGE_BYTES,
+        .clusters = malloc(tableBytes),
+        .nClusters = nClusters,
+        .nTriangles = header.nTriangles,
+        .geomId = RTC_INVALID_GEOMETRY_ID,
+        .nSlots = nSlots,
+        .slotClusters = malloc(nSlots * sizeof(u32)),
+        .clusterSlots = malloc(nClusters * sizeof(_Atomic u32)),
+        .referenced = calloc(nClusters, sizeof(_Atomic u8)),
+    };
+    if (mesh->clusters == NULL || mesh->slotClusters == NULL || mesh->clusterSlots == NULL || mesh->referenced == NULL) {
+        PANIC("Failed to allocate cluster table of %s", path);
+    }
+    if (pread(fd, mesh->clusters, tableBytes, sizeof header) != (ssize_t)tableBytes) PANIC("Truncated cluster table in %s", path);
+    for (usize c = 0; c < nClusters; c++) atomic_init(&mesh->clusterSlots[c], PAGED_MESH_NOT_RESIDENT);
+
+    void* const pages = mmap(NULL, mesh->pagesBytes, PROT_READ, MAP_PRIVATE, fd, (off_t)header.firstPage);
+    if (pages == MAP_FAILED) PANIC("Failed to map clusters of %s: %s", path, strerror(errno));
+    // Rays visit clusters in no particular file order, read ahead would only fill the budget with pages nobody asked for.
+    madvise(pages, mesh->pagesBytes, MADV_RANDOM);
+    mesh->pages = pages;
+    pthread_mutex_init(&mesh->lock, NULL);
+    LOGLN("Opened %s:" FS(u64) "triangles in" FS(usize) "clusters," FS(usize) "resident at most",
+        path, mesh->nTriangles, nClusters, nSlots);
+}
+
+void ClosePagedMesh(PagedMesh* const mesh) {
+    pthread_mutex_destroy(&mesh->lock);
+    munmap((void*)mesh->pages, mesh->pagesBytes);
+    close(mesh->fd);
+    free((void*)mesh->referenced);
+    free((void*)mesh->clusterSlots);
+    free(mesh->slotClusters);
+    free(mesh->clusters);
+    mesh->fd = -1;
+}
+
+internal const u8* ClusterPage(const PagedMesh* const mesh, const u32 cluster) {
+    return mesh->pages + (usize)cluster * PAGED_MESH_PAGE_BYTES;
+}
+
+/// Gives `cluster` a slot, evicting the first cluster the CLOCK hand finds unreferenced once all are taken.
+internal void PageIn(PagedMesh* const mesh, const u32 cluster) {
+    pthread_mutex_lock(&mesh->lock);
+    if (atomic_load_explicit(&mesh->clusterSlots[cluster], memory_order_relaxed) == PAGED_MESH_NOT_RESIDENT) {
+        u32 slot;
+        if (mesh->nResident < mesh->nSlots) {
+            slot = (u32)mesh->nResident++;
+            if (mesh->nResident > mesh->peakResident) mesh->peakResident = mesh->nResident;
+        } else {
+            while (atomic_load_explicit(&mesh->referenced[mesh->slotClusters[mesh->hand]], memory_order_relaxed)) {
+                atomic_store_explicit(&mesh->referenced[mesh->slotClusters[mesh->hand]], 0, memory_order_relaxed);
+                mesh->hand = (mesh->hand + 1) % mesh->nSlots;
+            }
+            slot = (u32)mesh->hand;
+            mesh->hand = (mesh->hand + 1) % mesh->nSlots;
+            const u32 evicted = mesh->slotClusters[slot];
+            atomic_store_explicit(&mesh->clusterSlots[evicted], PAGED_MESH_NOT_RESIDENT, memory_order_relaxed);
+            madvise((void*)ClusterPage(mesh, evicted), PAGED_MESH_PAGE_BYTES, MADV_DONTNEED);
+            mesh->nEvictions += 1;
+        }
+        mesh->slotClusters[slot] = cluster;
+        atomic_store_explicit(&mesh->clusterSlots[cluster], slot, memory_order_relaxed);
+        mesh->nPageIns += 1;
+    }
+    atomic_store_explicit(&mesh->referenced[cluster], 1, memory_order_relaxed);
+    pthread_mutex_unlock(&mesh->lock);
+}
+
+const PagedTriangle* TouchPagedCluster(PagedMesh* const mesh, const u32 cluster) {
+    if (atomic_load_explicit(&mesh->clusterSlots[cluster], memory_order_relaxed) == PAGED_MESH_NOT_RESIDENT) {
+        PageIn(mesh, cluster);
+    } else if (!atomic_load_explicit(&mesh->referenced[cluster], memory_order_relaxed)) {
+        // Only written when clear, so hot clusters do not bounce their cache line between threads.
+        atomic_store_explicit(&mesh->referenced[cluster], 1, memory_order_relaxed);
+    }
+    PROFILE_COUNT(ProfileCounterPagedClusters, 1);
+    return (const PagedTriangle*)ClusterPage(mesh, cluster);
+}
+
+void EvictPagedMesh(PagedMesh* const mesh) {
+    pthread_mutex_lock(&mesh->lock);
+    for (usize s = 0; s < mesh->nResident; s++) {
+        atomic_store_explicit(&mesh->clusterSlots[mesh->slotClusters[s]], PAGED_MESH_NOT_RESIDENT, memory_order_relaxed);
+    }
+    for (usize c = 0; c < mesh->nClusters; c++) atomic_store_explicit(&mesh->referenced[c], 0, memory_order_relaxed);
+    madvise((void*)mesh->pages, mesh->pagesBytes, MADV_DONTNEED);
+    // Drops the file from the page cache too, so the next touches go to disk.
+    posix_fadvise(mesh->fd, 0, 0, POSIX_FADV_DONTNEED);
+    mesh->nResident = 0;
+    mesh->hand = 0;
+    mesh->nPageIns = 0;
+    mesh->nEvictions = 0;
+    mesh->peakResident = 0;
+    pthread_mutex_unlock(&mesh->lock);
+}
+
+void GetPagedMeshStats(PagedMesh* const mesh, PagedMeshStats* const stats) {
+    pthread_mutex_lock(&mesh->lock);
+    *stats = (PagedMeshStats) {
+        .nPageIns = mesh->nPageIns,
+        .nEvictions = mesh->nEvictions,
+        .residentBytes = mesh->nResident * PAGED_MESH_PAGE_BYTES,
+        .peakResidentBytes = mesh->peakResident * PAGED_MESH_PAGE_BYTES,
+        .budgetBytes = mesh->nSlots * PAGED_MESH_PAGE_BYTES,
+        .tableBytes = mesh->nClusters * (sizeof(PagedCluster) + sizeof(u32) + sizeof(u8)) + mesh->nSlots * sizeof(u32),
+    };
+    pthread_mutex_unlock(&mesh->lock);
+}
+
+COMMENT(--------========[ Embree geometry ]========--------)
+
+/// Moller-Trumbore, @returns true with the distance and barycentrics of a hit within (`tNear`, `tFar`).
+internal bool IntersectTriangle(
+    const PagedTriangle* const triangle,
+    const vec3 origin,
+    const vec3 direction,
+    const f32 tNear,
+    const f32 tFar,
+    out f32* const t,
+    out f32* const u,
+    out f32* const v
+) {
+    const Position* const p = triangle->corners;
+    vec3 e1 = { p[1].x - p[0].x, p[1].y - p[0].y, p[1].z - p[0].z };
+    vec3 e2 = { p[2].x - p[0].x, p[2].y - p[0].y, p[2].z - p[0].z };
+    vec3 pv;
+    glm_vec3_cross((f32*)direction, e2, pv);
+    const f32 determinant = glm_vec3_dot(e1, pv);
+    if (fabsf(determinant) < 1e-12f) return false;
+    const f32 inverse = 1.f / determinant;
+    vec3 tv = { origin[0] - p[0].x, origin[1] - p[0].y, origin[2] - p[0].z };
+    *u = glm_vec3_dot(tv, pv) * inverse;
+    if (*u < 0.f || *u > 1.f) return false;
+    vec3 qv;
+    glm_vec3_cross(tv, e1, qv);
+    *v = glm_vec3_dot((f32*)direction, qv) * inverse;
+    if (*v < 0.f || *u + *v > 1.f) return false;
+    *t = glm_vec3_dot(e2, qv) * inverse;
+    return *t > tNear && *t < tFar;
+}
+
+internal void ClusterBounds(const struct RTCBoundsFunctionArguments* const args) {
+    const PagedMesh* const mesh = args->geometryUserPtr;
+    const PagedCluster* const cluster = &mesh->clusters[args->primID];
+    *args->bounds_o = (struct RTCBounds) {
+        .lower_x = cluster->lower[0], .lower_y = cluster->lower[1], .lower_z = cluster->lower[2],
+        .upper_x = cluster->upper[0], .upper_y = cluster->upper[1], .upper_z = cluster->upper[2],
+    };
+}
+
+/// Closest hit among the triangles of one cluster, the primitive id of the hit is the cluster.
+internal void IntersectCluster(const struct RTCIntersectFunctionNArguments* const args) {
+    // Rays are traced one at a time with `rtcIntersect1`.
+    if (!args->valid[0]) return;
+    PagedMesh* const mesh = args->geometryUserPtr;
+    struct RTCRayHit* const rayHit = (struct RTCRayHit*)args->rayhit;
+    const vec3 origin = { rayHit->ray.org_x, rayHit->ray.org_y, rayHit->ray.org_z };
+    const vec3 direction = { rayHit->ray.dir_x, rayHit->ray.dir_y, rayHit->ray.dir_z };
+
+    const PagedTriangle* const triangles = TouchPagedCluster(mesh, args->primID);
+    const u32 nTriangles = mesh->clusters[args->primID].nTriangles;
+    u32 closest = nTriangles;
+    f32 tFar = rayHit->ray.tfar, hitU = 0.f, hitV = 0.f;
+    for (u32 i = 0; i < nTriangles; i++) {
+        f32 t, u, v;
+        if (IntersectTriangle(&triangles[i], origin, direction, rayHit->ray.tnear, tFar, &t, &u, &v)) {
+            closest = i;
+            tFar = t;
+            hitU = u;
+            hitV = v;
+        }
+    }
+    if (closest == nTriangles) return;
+
+    const Position* const p = triangles[closest].corners;
+    vec3 e1 = { p[1].x - p[0].x, p[1].y - p[0].y, p[1].z - p[0].z };
+    vec3 e2 = { p[2].x - p[0].x, p[2].y - p[0].y, p[2].z - p[0].z };
+    vec3 normal;
+    glm_vec3_cross(e1, e2, normal);
+    rayHit->ray.tfar = tFar;
+    rayHit->hit.u = hitU;
+    rayHit->hit.v = hitV;
+    rayHit->hit.Ng_x = normal[0];
+    rayHit->hit.Ng_y = normal[1];
+    rayHit->hit.Ng_z = normal[2];
+    rayHit->hit.primID = args->primID;
+    rayHit->hit.geomID = args->geomID;
+    rayHit->hit.instID[0] = args->context->instID[0];
+}
+
+internal void OccludedCluster(const struct RTCOccludedFunctionNArguments* const args) {
+    if (!args->valid[0]) return;
+    PagedMesh* const mesh = args->geometryUserPtr;
+    struct RTCRay* const ray = (struct RTCRay*)args->ray;
+    const vec3 origin = { ray->org_x, ray->org_y, ray->org_z };
+    const vec3 direction = { ray->dir_x, ray->dir_y, ray->dir_z };
+
+    const PagedTriangle* const triangles = TouchPagedCluster(mesh, args->primID);
+    const u32 nTriangles = mesh->clusters[args->primID].nTriangles;
+    for (u32 i = 0; i < nTriangles; i++) {
+        f32 t, u, v;
+        if (IntersectTriangle(&triangles[i], origin, direction, ray->tnear, ray->tfar, &t, &u, &v)) {
+            // Embree marks occluded rays with a negative `tfar`.
+            ray->tfar = -INFINITY;
+            return;
+        }
+    }
+}
+
+void AttachPagedMesh(const RTCDevice device, const RTCScene* const scenes, const usize nScenes, PagedMesh* const mesh) {
+    const RTCGeometry geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+    rtcSetGeometryUserPrimitiveCount(geometry, (u32)mesh->nClusters);
+    rtcSetGeometryUserData(geometry, mesh);
+    rtcSetGeometryBoundsFunction(geometry, ClusterBounds, NULL);
+    rtcSetGeometryIntersectFunction(geometry, IntersectCluster);
+    rtcSetGeometryOccludedFunction(geometry, OccludedCluster);
+    rtcCommitGeometry(geometry);
+    for (usize s = 0; s < nScenes; s++) {
+        const u32 geomId = rtcAttachGeometry(scenes[s], geometry);
+        if (s == 0) mesh->geomId = geomId;
+        else if (geomId != mesh->geomId) PANIC("Paged mesh geometry id" FS(u32) "differs between scenes", geomId);
+    }
+    rtcReleaseGeometry(geometry);
+    LOGLN("Attached" FS(usize) "clusters as geometry" FS(u32), mesh->nClusters, mesh->geomId);
+}
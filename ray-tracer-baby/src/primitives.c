@@ -0,0 +1,177 @@
+#include "primitives.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+/// Embree reads point and normal buffers with 16 byte loads.
+#define PRIMITIVE_BUFFER_PADDING 16
+
+usize PrimitivesArenaSize(const usize nSpheres, const usize nDiscs, const usize nQuads) {
+    return nSpheres * sizeof(SpherePrimitive)
+        + nDiscs * sizeof(DiscPrimitive) + PRIMITIVE_BUFFER_PADDING
+        + nQuads * sizeof(QuadPrimitive)
+        + (nSpheres + nDiscs + nQuads) * sizeof(u16)
+        + 6 * 16;
+}
+
+Primitives CreatePrimitives(Arena* const arena, const usize nSpheres, const usize nDiscs, const usize nQuads) {
+    Primitives primitives = {
+        .counts = { [PrimitiveKindSphere] = nSpheres, [PrimitiveKindDisc] = nDiscs, [PrimitiveKindQuad] = nQuads },
+        .spheres = ArenaPush(arena, nSpheres * sizeof(SpherePrimitive), 16),
+        .discs = ArenaPush(arena, nDiscs * sizeof(DiscPrimitive) + PRIMITIVE_BUFFER_PADDING, 16),
+        .quads = ArenaPush(arena, nQuads * sizeof(QuadPrimitive), 16),
+    };
+    for (usize kind = 0; kind < PrimitiveKindCount; kind++) {
+        primitives.materials[kind] = ArenaPush(arena, primitives.counts[kind] * sizeof(u16), 16);
+        primitives.geomIds[kind] = ~0u;
+    }
+    return primitives;
+}
+
+/// Orthonormal tangent and bitangent completing the unit `normal`.
+internal void TangentFrame(const vec3 normal, vec3 tangent, vec3 bitangent) {
+    vec3 helper = { 1.f, 0.f, 0.f };
+    if (fabsf(normal[0]) > 0.9f) glm_vec3_copy((vec3) { 0.f, 1.f, 0.f }, helper);
+    glm_vec3_cross(helper, (f32*)normal, tangent);
+    glm_vec3_normalize(tangent);
+    glm_vec3_cross((f32*)normal, tangent, bitangent);
+}
+
+void PrimitiveTransform(const Primitives* const primitives, const enum PrimitiveKind kind, const usize i, mat4 model) {
+    glm_mat4_identity(model);
+    switch (kind) {
+        case PrimitiveKindSphere: {
+            const SpherePrimitive* const sphere = &primitives->spheres[i];
+            model[0][0] = model[1][1] = model[2][2] = sphere->radius;
+            glm_vec3_copy((vec3) { sphere->x, sphere->y, sphere->z }, model[3]);
+        } break;
+        case PrimitiveKindDisc: {
+            const DiscPrimitive* const disc = &primitives->discs[i];
+            vec3 normal = { disc->normal.nx, disc->normal.ny, disc->normal.nz };
+            glm_vec3_normalize(normal);
+            TangentFrame(normal, model[0], model[1]);
+            glm_vec3_scale(model[0], disc->radius, model[0]);
+            glm_vec3_scale(model[1], disc->radius, model[1]);
+            glm_vec3_copy(normal, model[2]);
+            glm_vec3_copy((vec3) { disc->x, disc->y, disc->z }, model[3]);
+        } break;
+        case PrimitiveKindQuad: {
+            const QuadPrimitive* const quad = &primitives->quads[i];
+            glm_vec3_copy((vec3) { quad->edgeU.x, quad->edgeU.y, quad->edgeU.z }, model[0]);
+            glm_vec3_copy((vec3) { quad->edgeV.x, quad->edgeV.y, quad->edgeV.z }, model[1]);
+            glm_vec3_cross(model[0], model[1], model[2]);
+            glm_vec3_normalize(model[2]);
+            glm_vec3_copy((vec3) { quad->origin.x, quad->origin.y, quad->origin.z }, model[3]);
+        } break;
+        default: PANIC("Unknown primitive kind" FS(u32), (u32)kind);
+    }
+}
+
+COMMENT(--------========[ Proxies ]========--------)
+
+internal u16 IcosphereMidpoint(Vertex* const vertices, usize* const nVertices, const u16 a, const u16 b) {
+    vec3 midpoint = {
+        vertices[a].position.x + vertices[b].position.x,
+        vertices[a].position.y + vertices[b].position.y,
+        vertices[a].position.z + vertices[b].position.z,
+    };
+    glm_vec3_normalize(midpoint);
+    for (usize i = 0; i < *nVertices; i++) {
+        const Position* const p = &vertices[i].position;
+        if (fabsf(p->x - midpoint[0]) + fabsf(p->y - midpoint[1]) + fabsf(p->z - midpoint[2]) < 1e-5f) return (u16)i;
+    }
+    vertices[*nVertices] = (Vertex) {
+        .position = { midpoint[0], midpoint[1], midpoint[2] },
+        .normal = { midpoint[0], midpoint[1], midpoint[2] },
+    };
+    return (u16)(*nVertices)++;
+}
+
+/// Icosahedron with every face split into four.
+internal void Icosphere(Vertex* const vertices, usize* const nVertices, u16* const indices, usize* const nIndices) {
+    const f32 t = (1.f + sqrtf(5.f)) / 2.f;
+    const f32 corners[12][3] = {
+        { -1.f, t, 0.f }, { 1.f, t, 0.f }, { -1.f, -t, 0.f }, { 1.f, -t, 0.f },
+        { 0.f, -1.f, t }, { 0.f, 1.f, t }, { 0.f, -1.f, -t }, { 0.f, 1.f, -t },
+        { t, 0.f, -1.f }, { t, 0.f, 1.f }, { -t, 0.f, -1.f }, { -t, 0.f, 1.f },
+    };
+    const u16 faces[20][3] = {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 },
+    };
+    *nVertices = 0;
+    for (usize i = 0; i < 12; i++) {
+        vec3 p = { corners[i][0], corners[i][1], corners[i][2] };
+        glm_vec3_normalize(p);
+        vertices[(*nVertices)++] = (Vertex) { .position = { p[0], p[1], p[2] }, .normal = { p[0], p[1], p[2] } };
+    }
+    *nIndices = 0;
+    for (usize f = 0; f < 20; f++) {
+        const u16 a = faces[f][0], b = faces[f][1], c = faces[f][2];
+        const u16 ab = IcosphereMidpoint(vertices, nVertices, a, b);
+        const u16 bc = IcosphereMidpoint(vertices, nVertices, b, c);
+        const u16 ca = IcosphereMidpoint(vertices, nVertices, c, a);
+        const u16 triangles[4][3] = { { a, ab, ca }, { b, bc, ab }, { c, ca, bc }, { ab, bc, ca } };
+        memcpy(&indices[*nIndices], triangles, sizeof triangles);
+        *nIndices += 12;
+    }
+}
+
+/// Front and back side of a flat proxy, back vertices follow the front ones with flipped normals and winding.
+internal void TwoSided(Vertex* const vertices, const usize nFront, u16* const indices, const usize nFrontIndices) {
+    for (usize i = 0; i < nFront; i++) {
+        vertices[nFront + i] = vertices[i];
+        vertices[nFront + i].normal.nz = -vertices[i].normal.nz;
+    }
+    for (usize i = 0; i < nFrontIndices; i += 3) {
+        indices[nFrontIndices + i + 0] = (u16)(indices[i + 0] + nFront);
+        indices[nFrontIndices + i + 1] = (u16)(indices[i + 2] + nFront);
+        indices[nFrontIndices + i + 2] = (u16)(indices[i + 1] + nFront);
+    }
+}
+
+Obj PrimitiveProxy(const enum PrimitiveKind kind, Vertex* const vertices, u16* const indices) {
+    usize nVertices = 0, nIndices = 0;
+    switch (kind) {
+        case PrimitiveKindSphere: Icosphere(vertices, &nVertices, indices, &nIndices); break;
+        case PrimitiveKindDisc: {
+            const usize nSides = 16;
+            vertices[0] = (Vertex) { .position = { 0.f, 0.f, 0.f }, .normal = { 0.f, 0.f, 1.f } };
+            for (usize i = 0; i < nSides; i++) {
+                const f32 angle = 2.f * (f32)M_PI * (f32)i / (f32)nSides;
+                vertices[1 + i] = (Vertex) { .position = { cosf(angle), sinf(angle), 0.f }, .normal = { 0.f, 0.f, 1.f } };
+                indices[3 * i + 0] = 0;
+                indices[3 * i + 1] = (u16)(1 + i);
+                indices[3 * i + 2] = (u16)(1 + (i + 1) % nSides);
+            }
+            TwoSided(vertices, nSides + 1, indices, 3 * nSides);
+            nVertices = 2 * (nSides + 1);
+            nIndices = 6 * nSides;
+        } break;
+        case PrimitiveKindQuad: {
+            const f32 corners[4][2] = { { 0.f, 0.f }, { 1.f, 0.f }, { 1.f, 1.f }, { 0.f, 1.f } };
+            for (usize i = 0; i < 4; i++) {
+                vertices[i] = (Vertex) { .position = { corners[i][0], corners[i][1], 0.f }, .normal = { 0.f, 0.f, 1.f } };
+            }
+            const u16 front[6] = { 0, 1, 2, 0, 2, 3 };
+            memcpy(indices, front, sizeof front);
+            TwoSided(vertices, 4, indices, 6);
+            nVertices = 8;
+            nIndices = 12;
+        } break;
+        default: PANIC("Unknown primitive kind" FS(u32), (u32)kind);
+    }
+    return (Obj) {
+        .nVertices = nVertices,
+        .nIndices = nIndices,
+        .vertices = vertices,
+        .indices = indices,
+        .texCoords = NULL,
+        .albedoTexture = NULL,
+    };
+}
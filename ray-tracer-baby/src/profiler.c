@@ -0,0 +1,195 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <cmm/cmm.h>
+
+#ifdef _PROFILING
+
+internal const char* const CounterNames[ProfileCounterCount] = {
+    [ProfileCounterRays] = "rays",
+    [ProfileCounterPrimaryRays] = "primaryRays",
+    [ProfileCounterRngDraws] = "rngDraws",
+    [ProfileCounterIntersectTicks] = "intersectTicks",
+    [ProfileCounterTraceTicks] = "traceTicks",
+    [ProfileCounterTiles] = "tiles",
+    [ProfileCounterPagedClusters] = "pagedClusters",
+};
+
+internal struct {
+    pthread_mutex_t lock;
+    ProfilerThread* threads[PROFILE_MAX_THREADS];
+    usize nThreads;
+    u64 originNs;
+    u64 originTicks;
+    /// Holds the `ProfilerThread` of every registered thread, released by `ReleaseThread` when it exits.
+    pthread_key_t key;
+    pthread_once_t keyOnce;
+    bool warnedFull;
+} Profiler = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .nThreads = 0,
+    .keyOnce = PTHREAD_ONCE_INIT,
+    .warnedFull = false,
+};
+
+_Thread_local ProfilerThread* ProfilerCurrent = NULL;
+
+u64 ProfileNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+/// Hands the slot of an exiting thread to the next one registering, its events and counters stay for the reports.
+internal void ReleaseThread(void* const value) {
+    ProfilerThread* const thread = value;
+    pthread_mutex_lock(&Profiler.lock);
+    if (thread->id == PROFILE_UNLISTED) free(thread);
+    else thread->exited = true;
+    pthread_mutex_unlock(&Profiler.lock);
+}
+
+internal void CreateThreadKey(void) {
+    if (0 != pthread_key_create(&Profiler.key, ReleaseThread)) PANICM("Failed to create profiler thread key");
+}
+
+/// @returns the slot of an exited thread, one named `name` if there is any, NULL when none exited.
+internal ProfilerThread* ExitedThread(const char* const name) {
+    ProfilerThread* found = NULL;
+    for (usize t = 0; t < Profiler.nThreads; t++) {
+        ProfilerThread* const thread = Profiler.threads[t];
+        if (!thread->exited) continue;
+        if (strcmp(thread->name, name) == 0) return thread;
+        if (found == NULL) found = thread;
+    }
+    return found;
+}
+
+ProfilerThread* ProfilerRegisterThread(const char* const name) {
+    if (ProfilerCurrent != NULL) {
+        if (name != NULL) ProfilerCurrent->name = name;
+        return ProfilerCurrent;
+    }
+    pthread_once(&Profiler.keyOnce, CreateThreadKey);
+    const char* const threadName = name != NULL ? name : "thread";
+
+    pthread_mutex_lock(&Profiler.lock);
+    if (Profiler.nThreads == 0) {
+        Profiler.originNs = ProfileNow();
+        Profiler.originTicks = PROFILE_TICKS();
+    }
+    ProfilerThread* thread = ExitedThread(threadName);
+    if (thread != NULL) {
+        thread->exited = false;
+    } else {
+        thread = calloc(1, sizeof(ProfilerThread));
+        if (thread == NULL) PANICM("Failed to allocate profiler thread state");
+        if (Profiler.nThreads < PROFILE_MAX_THREADS) {
+            thread->id = Profiler.nThreads;
+            Profiler.threads[Profiler.nThreads++] = thread;
+        } else {
+            // Recorded into a slot of its own that no report reads, freed again when the thread exits.
+            thread->id = PROFILE_UNLISTED;
+            if (!Profiler.warnedFull) LOGLN("Profiler full with" FS(usize) "threads alive, not recording further threads", Profiler.nThreads);
+            Profiler.warnedFull = true;
+        }
+    }
+    thread->name = threadName;
+    pthread_mutex_unlock(&Profiler.lock);
+
+    pthread_setspecific(Profiler.key, thread);
+    ProfilerCurrent = thread;
+    return thread;
+}
+
+/// Nanoseconds per tick of `PROFILE_TICKS`, measured against the monotonic clock since the first registration.
+internal f64 NsPerTick(void) {
+    const u64 ticks = PROFILE_TICKS() - Profiler.originTicks;
+    const u64 ns = ProfileNow() - Profiler.originNs;
+    return ticks == 0 ? 1.0 : (f64)ns / (f64)ticks;
+}
+
+void ProfilerReport(void) {
+    pthread_mutex_lock(&Profiler.lock);
+    u64 counters[ProfileCounterCount] = { 0 };
+    u64 raysPerDepth[PROFILE_MAX_DEPTH] = { 0 };
+    usize nDropped = 0;
+    for (usize t = 0; t < Profiler.nThreads; t++) {
+        const ProfilerThread* const thread = Profiler.threads[t];
+        for (usize c = 0; c < ProfileCounterCount; c++) counters[c] += thread->counters[c];
+        for (usize d = 0; d < PROFILE_MAX_DEPTH; d++) raysPerDepth[d] += thread->raysPerDepth[d];
+        if (thread->head > PROFILE_RING_CAPACITY) nDropped += thread->head - PROFILE_RING_CAPACITY;
+    }
+    const f64 nsPerTick = NsPerTick();
+    pthread_mutex_unlock(&Profiler.lock);
+
+    const f64 intersectMs = (f64)counters[ProfileCounterIntersectTicks] * nsPerTick * 1e-6;
+    const f64 traceMs = (f64)counters[ProfileCounterTraceTicks] * nsPerTick * 1e-6;
+
+    PRINTLN("Profile (" FS(usize) "threads )", Profiler.nThreads);
+    for (usize c = 0; c < ProfileCounterCount; c++) {
+        PRINTLN("  %-16s" FS(u64), CounterNames[c], counters[c]);
+    }
+    PRINTLN("  intersect        %.3f ms (summed over threads)", intersectMs);
+    PRINTLN("  shade            %.3f ms (summed over threads)", traceMs - intersectMs);
+    for (usize d = 0; d < PROFILE_MAX_DEPTH; d++) {
+        if (raysPerDepth[d] != 0) PRINTLN("  rays at depth %2zu" FS(u64), d, raysPerDepth[d]);
+    }
+    if (nDropped != 0) PRINTLN("  dropped" FS(usize) "events (ring buffer overflow)", nDropped);
+}
+
+void ProfilerWriteChromeTrace(const char* const path) {
+    FILE* const file = fopen(path, "w");
+    if (file == NULL) PANIC("Failed to open %s", path);
+
+    pthread_mutex_lock(&Profiler.lock);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (usize t = 0; t < Profiler.nThreads; t++) {
+        const ProfilerThread* const thread = Profiler.threads[t];
+        fprintf(
+            file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", thread->id, thread->name
+        );
+        first = false;
+
+        // Oldest surviving event first.
+        const usize nEvents = thread->head < PROFILE_RING_CAPACITY ? thread->head : PROFILE_RING_CAPACITY;
+        for (usize i = thread->head - nEvents; i < thread->head; i++) {
+            const ProfileEvent* const event = &thread->events[i & (PROFILE_RING_CAPACITY - 1)];
+            fprintf(
+                file,
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                event->name,
+                thread->id,
+                (f64)(event->start - Profiler.originNs) * 1e-3,
+                (f64)(event->end - event->start) * 1e-3
+            );
+        }
+
+        fprintf(file, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":%zu,\"ts\":0,\"args\":{", thread->id);
+        for (usize c = 0; c < ProfileCounterCount; c++) {
+            fprintf(file, "%s\"%s\":%lu", c == 0 ? "" : ",", CounterNames[c], (unsigned long)thread->counters[c]);
+        }
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n]}\n");
+    pthread_mutex_unlock(&Profiler.lock);
+
+    fclose(file);
+    LOGLN("Trace written to %s", path);
+}
+
+#else
+
+void ProfilerReport(void) {}
+
+void ProfilerWriteChromeTrace(const char* const _) {}
+
+#endif
@@ -0,0 +1,125 @@
+#include "progress_bar.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <cmm/cmm.h>
+
+#ifndef X_PRINT
+#define X_PRINT(fmt, ...) PRINTLN(fmt, __VA_ARGS__)
+#endif
+
+Array(PTask) AllocatePTasks(const usize n) {
+    Array(PTask) tasks = { .len = n, .data = aligned_alloc(CACHE_LINE_SIZE, n * sizeof(PTask)) };
+    if (tasks.data == NULL) PANIC("Failed to allocate" FS(usize) "tasks", n);
+    for (usize i = 0; i < n; i++) {
+        atomic_init(&tasks.data[i].progress, 0);
+        atomic_init(&tasks.data[i].nRays, 0);
+        tasks.data[i].end = 0;
+        tasks.data[i].id = i;
+    }
+    return tasks;
+}
+
+void InitializeDisplay(Display* const display, const Tasks tasks) {
+    display->tasks = tasks;
+    display->nFinished = 0;
+    clock_gettime(CLOCK_MONOTONIC, &display->start);
+
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&display->changed, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&display->lock, NULL);
+}
+
+void DropDisplay(Display* const display) {
+    pthread_cond_destroy(&display->changed);
+    pthread_mutex_destroy(&display->lock);
+}
+
+f64 ElapsedDisplay(const Display* const display) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (f64)(now.tv_sec - display->start.tv_sec) + (f64)(now.tv_nsec - display->start.tv_nsec) * 1e-9;
+}
+
+void SetupDisplay(const Display* const display) {
+    const usize nTasks = display->tasks.sTasks.len + display->tasks.pTasks.len;
+    for (usize i = 0; i < nTasks; i++) X_PRINT("%5d%%", 0);
+    X_PRINT("%s", "");
+}
+
+internal void PrintTask(const f32 completed, const f64 elapsed) {
+    // ETA extrapolates the average rate so far, unknown until something completes.
+    const f64 remaining = completed > 0.f ? elapsed / completed * (1.f - completed) : 0.0;
+    X_PRINT(
+        "%5lu%% | estim. %6.1f s left",
+        (usize)(completed * 100),
+        remaining
+    );
+}
+
+void UpdateDisplay(Display* const display) {
+    // TODO: move these ASCII escapes into macros
+    const usize nSTasks = display->tasks.sTasks.len;
+    const usize nPTasks = display->tasks.pTasks.len;
+    const usize nTasks = nPTasks + nSTasks;
+    const f64 elapsed = ElapsedDisplay(display);
+
+    printf("\033[%luF", nTasks + 1);
+    for (usize i = 0; i < nSTasks; i++) {
+        const STask* const task = &display->tasks.sTasks.data[i];
+        PrintTask((f32)task->progress / (f32)task->end, elapsed);
+    }
+    usize nRays = 0;
+    for (usize i = 0; i < nPTasks; i++) {
+        PTask* const task = &display->tasks.pTasks.data[i];
+        const usize progress = atomic_load_explicit(&task->progress, memory_order_relaxed);
+        nRays += atomic_load_explicit(&task->nRays, memory_order_relaxed);
+        PrintTask(task->end == 0 ? 0.f : (f32)progress / (f32)task->end, elapsed);
+    }
+    X_PRINT("%8.3f Mrays/s | %6.1f s elapsed", elapsed > 0.0 ? (f64)nRays / elapsed * 1e-6 : 0.0, elapsed);
+}
+
+bool FinishedDisplay(Display* const display) {
+    const usize nSTasks = display->tasks.sTasks.len;
+    bool done = true;
+    for (usize i = 0; i < nSTasks; i++) {
+        done &= display->tasks.sTasks.data[i].progress == display->tasks.sTasks.data[i].end;
+    }
+    pthread_mutex_lock(&display->lock);
+    done &= display->nFinished == display->tasks.pTasks.len;
+    pthread_mutex_unlock(&display->lock);
+    return done;
+}
+
+void WaitDisplay(Display* const display, const u32 timeoutMs) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&display->lock);
+    const usize nFinished = display->nFinished;
+    i32 result = 0;
+    while (display->nFinished == nFinished && result == 0) {
+        result = pthread_cond_timedwait(&display->changed, &display->lock, &deadline);
+    }
+    pthread_mutex_unlock(&display->lock);
+}
+
+void FinishTask(Display* const display, PTask* const task) {
+    atomic_store_explicit(&task->progress, task->end, memory_order_relaxed);
+    pthread_mutex_lock(&display->lock);
+    display->nFinished += 1;
+    pthread_cond_broadcast(&display->changed);
+    pthread_mutex_unlock(&display->lock);
+}
+
+#undef X_PRINT
@@ -0,0 +1,132 @@
+#include "radiance_cache.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+/// Bits per cell coordinate in a key, cells further apart than that wrap around and merely share hash slots.
+#define CELL_BITS 19
+#define CELL_MASK ((1ull << CELL_BITS) - 1)
+
+/// Finalizer of SplitMix64, spreads neighbouring cells over the whole table.
+internal u64 MixKey(u64 value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+internal f32 SignNotZero(const f32 value) {
+    return value >= 0.f ? 1.f : -1.f;
+}
+
+/// Octahedral bin of the unit `normal`, like `EncodeOctahedral` at `RADIANCE_CACHE_NORMAL_BINS` steps per axis.
+internal u32 NormalBin(const vec3 normal) {
+    const f32 l1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+    f32 u = normal[0] / l1, v = normal[1] / l1;
+    if (normal[2] < 0.f) {
+        const f32 folded = (1.f - fabsf(v)) * SignNotZero(u);
+        v = (1.f - fabsf(u)) * SignNotZero(v);
+        u = folded;
+    }
+    const u32 bu = (u32)glm_clamp((u * 0.5f + 0.5f) * RADIANCE_CACHE_NORMAL_BINS, 0.f, RADIANCE_CACHE_NORMAL_BINS - 1);
+    const u32 bv = (u32)glm_clamp((v * 0.5f + 0.5f) * RADIANCE_CACHE_NORMAL_BINS, 0.f, RADIANCE_CACHE_NORMAL_BINS - 1);
+    return bv * RADIANCE_CACHE_NORMAL_BINS + bu;
+}
+
+internal u64 RecordKey(const RadianceCache* const cache, const vec3 position, const vec3 normal) {
+    u64 key = 1ull << 63;
+    for (usize axis = 0; axis < 3; axis++) {
+        const i64 cell = (i64)floorf(position[axis] / cache->cellSize);
+        key |= ((u64)cell & CELL_MASK) << (axis * CELL_BITS);
+    }
+    return key | (u64)NormalBin(normal) << (3 * CELL_BITS);
+}
+
+internal void AtomicAddF32(_Atomic u32* const target, const f32 value) {
+    u32 expected = atomic_load_explicit(target, memory_order_relaxed);
+    while (true) {
+        f32 current;
+        memcpy(&current, &expected, sizeof current);
+        const f32 sum = current + value;
+        u32 desired;
+        memcpy(&desired, &sum, sizeof desired);
+        if (atomic_compare_exchange_weak_explicit(target, &expected, desired, memory_order_relaxed, memory_order_relaxed)) return;
+    }
+}
+
+void CreateRadianceCache(RadianceCache* const cache, const usize capacity, const f32 cellSize, const u32 depth) {
+    usize slots = 1;
+    while (slots < capacity) slots <<= 1;
+    *cache = (RadianceCache) {
+        .records = malloc(slots * sizeof(RadianceRecord)),
+        .capacity = slots,
+        .cellSize = cellSize,
+        .depth = depth,
+    };
+    if (cache->records == NULL) PANICM("Failed to allocate radiance cache");
+    ResetRadianceCache(cache);
+}
+
+void DestroyRadianceCache(RadianceCache* const cache) {
+    free(cache->records);
+}
+
+void ResetRadianceCache(RadianceCache* const cache) {
+    // All zero bits are a free slot with zero sums.
+    memset(cache->records, 0, cache->capacity * sizeof(RadianceRecord));
+}
+
+u32 FindRadianceRecord(RadianceCache* const cache, const vec3 position, const vec3 normal) {
+    const u64 key = RecordKey(cache, position, normal);
+    const usize mask = cache->capacity - 1;
+    const usize home = (usize)MixKey(key) & mask;
+    for (usize probe = 0; probe < RADIANCE_CACHE_PROBES; probe++) {
+        const usize slot = (home + probe) & mask;
+        u64 current = atomic_load_explicit(&cache->records[slot].key, memory_order_relaxed);
+        if (current == 0) {
+            if (atomic_compare_exchange_strong_explicit(&cache->records[slot].key, &current, key, memory_order_relaxed, memory_order_relaxed)) {
+                return (u32)slot;
+            }
+            // Another thread claimed the slot first, possibly for the same key.
+        }
+        if (current == key) return (u32)slot;
+    }
+    return RADIANCE_CACHE_NONE;
+}
+
+u32 RadianceRecordSamples(const RadianceCache* const cache, const u32 record) {
+    return atomic_load_explicit(&cache->records[record].nSamples, memory_order_relaxed);
+}
+
+void RadianceRecordMean(const RadianceCache* const cache, const u32 record, out vec3 radiance) {
+    RadianceRecord* const r = &cache->records[record];
+    const u32 nSamples = atomic_load_explicit(&r->nSamples, memory_order_relaxed);
+    for (usize c = 0; c < 3; c++) {
+        const u32 bits = atomic_load_explicit(&r->sum[c], memory_order_relaxed);
+        f32 sum;
+        memcpy(&sum, &bits, sizeof sum);
+        radiance[c] = nSamples > 0 ? sum / (f32)nSamples : 0.f;
+    }
+}
+
+void AddRecordRadiance(RadianceCache* const cache, const u32 record, const vec3 radiance) {
+    RadianceRecord* const r = &cache->records[record];
+    for (usize c = 0; c < 3; c++) {
+        if (radiance[c] != 0.f) AtomicAddF32(&r->sum[c], radiance[c]);
+    }
+}
+
+void CountRecordSample(RadianceCache* const cache, const u32 record) {
+    atomic_fetch_add_explicit(&cache->records[record].nSamples, 1, memory_order_relaxed);
+}
+
+usize RadianceCacheRecords(const RadianceCache* const cache) {
+    usize nRecords = 0;
+    for (usize slot = 0; slot < cache->capacity; slot++) {
+        nRecords += atomic_load_explicit(&cache->records[slot].key, memory_order_relaxed) != 0;
+    }
+    return nRecords;
+}
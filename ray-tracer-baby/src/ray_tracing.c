@@ -1,14 +1,19 @@
 #include "ray_tracing.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <cmm/cmm.h>
 #include <cglm/cglm.h>
 #include "vec3_utilities.h"
+#include "profiler.h"
+#include "environment.h"
+#include "radiance_cache.h"
 
 #define RNG_SEED 42
 #define REC(x) (1.f / x)
 
-typedef void (*Reflect)(vec3, const vec3);
-
 #define CGLM_CONST_FIX (f32*)
 
 // internal vec3 _Palette[8] = {
@@ -25,28 +30,17 @@ typedef void (*Reflect)(vec3, const vec3);
 void CreateLambertian(Material* const material, const vec3 albedo, const f32 matte) {
     material->type = MaterialTypeLambertian;
     glm_vec3_copy(albedo, material->albedo);
+    material->albedoTexture = NULL;
     material->params.lambertian.matte = matte;
 }
 
 void CreateMetallic(Material* const material, const vec3 albedo, const f32 roughness) {
     material->type = MaterialTypeMetallic;
     glm_vec3_copy(albedo, material->albedo);
+    material->albedoTexture = NULL;
     material->params.metallic.roughness = roughness;
 }
 
-internal void Scatter(in out struct RTCRayHit* const rayHit, const Reflect reflect) {
-    vec3 hit;
-
-    glm_vec3_scale(&rayHit->ray.dir_x, rayHit->ray.tfar, hit);
-    glm_vec3_add(hit, &rayHit->ray.org_x, hit);
-
-    // Calculate reflected direction
-    reflect(&rayHit->ray.dir_x, &rayHit->hit.Ng_x);
-
-    // Update ray origin
-    glm_vec3_copy(hit, &rayHit->ray.org_x);
-}
-
 /// Scatter incoming ray using lambertian distribution.
 internal void LambertianReflection(in out vec3 ray, const vec3 normal) {
     vec3 random;
@@ -73,59 +67,885 @@ internal const Material DefaultMaterial = (Material) {
     }
 };
 
-void TraceRay(
+#define RAY_QUEUE_ALIGNMENT 64
+
+/// 4 byte wide components of `RayQueue`, `traceOrder` is the only wider one. `CreateRayQueue` panics when this
+/// falls behind the components it pushes.
+#define RAY_QUEUE_COMPONENTS 18
+
+internal void* PushComponent(Arena* const arena, const usize capacity, const usize size) {
+    return ArenaPush(arena, capacity * size, RAY_QUEUE_ALIGNMENT);
+}
+
+usize RayQueueArenaSize(const usize capacity) {
+    return RAY_QUEUE_COMPONENTS * capacity * sizeof(f32) + sizeof(u64) * capacity + (RAY_QUEUE_COMPONENTS + 1) * RAY_QUEUE_ALIGNMENT;
+}
+
+RayQueue CreateRayQueue(Arena* const arena, const usize capacity) {
+    const usize start = arena->offset;
+    const RayQueue queue = {
+        .len = 0,
+        .capacity = capacity,
+        .orgX = PushComponent(arena, capacity, sizeof(f32)),
+        .orgY = PushComponent(arena, capacity, sizeof(f32)),
+        .orgZ = PushComponent(arena, capacity, sizeof(f32)),
+        .dirX = PushComponent(arena, capacity, sizeof(f32)),
+        .dirY = PushComponent(arena, capacity, sizeof(f32)),
+        .dirZ = PushComponent(arena, capacity, sizeof(f32)),
+        .throughputR = PushComponent(arena, capacity, sizeof(f32)),
+        .throughputG = PushComponent(arena, capacity, sizeof(f32)),
+        .throughputB = PushComponent(arena, capacity, sizeof(f32)),
+        .pixel = PushComponent(arena, capacity, sizeof(u32)),
+        .depth = PushComponent(arena, capacity, sizeof(u32)),
+        .coneWidth = PushComponent(arena, capacity, sizeof(f32)),
+        .bsdfPdf = PushComponent(arena, capacity, sizeof(f32)),
+        .cacheRecord = PushComponent(arena, capacity, sizeof(u32)),
+        .cacheThroughputR = PushComponent(arena, capacity, sizeof(f32)),
+        .cacheThroughputG = PushComponent(arena, capacity, sizeof(f32)),
+        .cacheThroughputB = PushComponent(arena, capacity, sizeof(f32)),
+        .cluster = PushComponent(arena, capacity, sizeof(u32)),
+        .traceOrder = PushComponent(arena, capacity, sizeof(u64)),
+        .pixelSpread = 0.f,
+    };
+    const usize used = arena->offset - start;
+    if (used > RayQueueArenaSize(capacity)) PANIC("Ray queue took" FS(usize) "bytes, more than its arena size", used);
+    return queue;
+}
+
+void PushRay(RayQueue* const queue, const vec3 origin, const vec3 direction, const u32 pixel) {
+    if (queue->len >= queue->capacity) PANIC("Ray queue full:" FS(usize) "paths", queue->capacity);
+    const usize i = queue->len++;
+    queue->orgX[i] = origin[0];
+    queue->orgY[i] = origin[1];
+    queue->orgZ[i] = origin[2];
+    queue->dirX[i] = direction[0];
+    queue->dirY[i] = direction[1];
+    queue->dirZ[i] = direction[2];
+    queue->throughputR[i] = 1.f;
+    queue->throughputG[i] = 1.f;
+    queue->throughputB[i] = 1.f;
+    queue->pixel[i] = pixel;
+    queue->depth[i] = 0;
+    queue->coneWidth[i] = 0.f;
+    queue->bsdfPdf[i] = 0.f;
+    queue->cacheRecord[i] = RADIANCE_CACHE_NONE;
+    queue->cacheThroughputR[i] = 1.f;
+    queue->cacheThroughputG[i] = 1.f;
+    queue->cacheThroughputB[i] = 1.f;
+    queue->cluster[i] = PAGED_MESH_NO_CLUSTER;
+}
+
+internal int CompareU64(const void* const a, const void* const b) {
+    const u64 x = *(const u64*)a, y = *(const u64*)b;
+    return (x > y) - (x < y);
+}
+
+/// @returns the coarsest level whose error stays within `lodBudget` cone widths, 0 for full resolution.
+internal u32 SelectLod(const RayTracer* const rayTracer, const f32 coneWidth) {
+    u32 level = 0;
+    while (level < rayTracer->nLods && rayTracer->lodErrors[level] <= rayTracer->lodBudget * coneWidth) level++;
+    return level;
+}
+
+/// Rays handed to `TraceAccel` at once, staged on the stack.
+#define ACCEL_BATCH 64
+
+internal void IntersectAccel(const AccelScene* const scene, const RayQueue* const queue, out HitRecord* const hits) {
+    AccelRay rays[ACCEL_BATCH];
+    AccelHit accelHits[ACCEL_BATCH];
+    for (usize first = 0; first < queue->len; first += ACCEL_BATCH) {
+        const usize n = queue->len - first < ACCEL_BATCH ? queue->len - first : ACCEL_BATCH;
+        for (usize k = 0; k < n; k++) {
+            const usize i = first + k;
+            rays[k] = (AccelRay) {
+                .origin = { queue->orgX[i], queue->orgY[i], queue->orgZ[i] },
+                .tNear = 0.001f,
+                .direction = { queue->dirX[i], queue->dirY[i], queue->dirZ[i] },
+                .tFar = INFINITY,
+            };
+        }
+
+        PROFILE_TICKS_BEGIN(intersectStart);
+        TraceAccel(scene->accel, rays, n, accelHits);
+        PROFILE_TICKS_END(ProfileCounterIntersectTicks, intersectStart);
+
+        // Triangles are baked instance after instance, see `CreateAccelScene`.
+        for (usize k = 0; k < n; k++) {
+            const usize i = first + k;
+            const AccelHit* const accelHit = &accelHits[k];
+            PROFILE_RAY(queue->depth[i]);
+            if (accelHit->primId == ACCEL_NO_HIT) {
+                hits[i] = (HitRecord) {
+                    .t = INFINITY,
+                    .primID = RTC_INVALID_GEOMETRY_ID,
+                    .geomID = RTC_INVALID_GEOMETRY_ID,
+                    .instID = RTC_INVALID_GEOMETRY_ID,
+                };
+                continue;
+            }
+            const u32 instance = accelHit->primId / scene->nMeshTriangles;
+            // Back to object space, where Embree reports the normal of instanced geometry.
+            const f32 (*const toObject)[3] = (const f32 (*)[3])scene->normalToObject[instance];
+            vec3 normal;
+            for (usize r = 0; r < 3; r++) {
+                normal[r] = toObject[0][r] * accelHit->normal[0] + toObject[1][r] * accelHit->normal[1] + toObject[2][r] * accelHit->normal[2];
+            }
+            hits[i] = (HitRecord) {
+                .t = accelHit->t,
+                .u = accelHit->u,
+                .v = accelHit->v,
+                .primID = accelHit->primId % scene->nMeshTriangles,
+                .geomID = 0,
+                .instID = scene->firstInstanceId + instance,
+                .normal = EncodeOctahedral(normal),
+                .lod = 0,
+            };
+        }
+    }
+}
+
+void IntersectRays(
     const RayTracer* const rayTracer,
-    struct RTCRayHit* const rayHit,
-    usize nReflections,
-    out vec3 color
+    const RayQueue* const queue,
+    out HitRecord* const hits,
+    in out RayStats* const stats
 ) {
-    if (nReflections >= rayTracer->nMaxReflections) {
-        glm_vec3_zero(color);
+    const f64 start = NowSeconds();
+    if (rayTracer->accelScene != NULL) {
+        IntersectAccel(rayTracer->accelScene, queue, hits);
+        PROFILE_COUNT(ProfileCounterRays, queue->len);
+        stats->nRays += queue->len;
+        stats->intersectSec += NowSeconds() - start;
         return;
     }
 
     struct RTCIntersectContext context;
     rtcInitIntersectContext(&context);
-    rtcIntersect1(rayTracer->rtcScene, &context, rayHit);
-
-    // Set color to ones and attenuate it later
-    if (nReflections == 0) glm_vec3_one(color);
-    if (rayHit->hit.geomID != RTC_INVALID_GEOMETRY_ID) {
-        const usize instanceId = rayHit->hit.instID[0];
-        const Material* const material = instanceId == RTC_INVALID_GEOMETRY_ID 
-        ? &DefaultMaterial
-        : &rayTracer->materials.data[instanceId]
-        ;
-
-        Reflect reflect;
-        switch (material->type) {
-            case MaterialTypeLambertian: reflect = LambertianReflection; break;
-            case MaterialTypeMetallic: PANICM("unimplemented"); reflect = MetallicReflection; break;
+
+    // Cluster in the high half, position in the queue in the low one, so paths of one cluster keep queue order.
+    const bool sorted = rayTracer->sortByCluster && rayTracer->pagedMesh != NULL;
+    if (sorted) {
+        for (usize i = 0; i < queue->len; i++) queue->traceOrder[i] = (u64)queue->cluster[i] << 32 | i;
+        qsort(queue->traceOrder, queue->len, sizeof(u64), CompareU64);
+    }
+
+    struct RTCRayHit rayHit;
+    for (usize k = 0; k < queue->len; k++) {
+        const usize i = sorted ? (u32)queue->traceOrder[k] : k;
+        rayHit.ray.org_x = queue->orgX[i];
+        rayHit.ray.org_y = queue->orgY[i];
+        rayHit.ray.org_z = queue->orgZ[i];
+        rayHit.ray.dir_x = queue->dirX[i];
+        rayHit.ray.dir_y = queue->dirY[i];
+        rayHit.ray.dir_z = queue->dirZ[i];
+        rayHit.ray.tnear = 0.001f;
+        rayHit.ray.tfar = INFINITY;
+        rayHit.ray.time = 0.f;
+        rayHit.ray.mask = 0xFFFFFFFF;
+        rayHit.ray.id = (u32)i;
+        rayHit.ray.flags = 0;
+        rayHit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        rayHit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+
+        // Primary rays start with a zero width cone and always see full resolution.
+        const u32 lod = SelectLod(rayTracer, queue->coneWidth[i]);
+        const RTCScene scene = lod == 0 ? rayTracer->rtcScene : rayTracer->lodScenes[lod - 1];
+        stats->nLodRays += lod > 0;
+
+        PROFILE_TICKS_BEGIN(intersectStart);
+        rtcIntersect1(scene, &context, &rayHit);
+        PROFILE_TICKS_END(ProfileCounterIntersectTicks, intersectStart);
+        PROFILE_RAY(queue->depth[i]);
+
+        HitRecord* const hit = &hits[i];
+        hit->t = rayHit.ray.tfar;
+        hit->u = rayHit.hit.u;
+        hit->v = rayHit.hit.v;
+        hit->primID = rayHit.hit.primID;
+        hit->geomID = rayHit.hit.geomID;
+        hit->instID = rayHit.hit.instID[0];
+        hit->normal = hit->geomID == RTC_INVALID_GEOMETRY_ID
+            ? 0
+            : EncodeOctahedral((vec3) { rayHit.hit.Ng_x, rayHit.hit.Ng_y, rayHit.hit.Ng_z });
+        hit->lod = lod;
+    }
+    PROFILE_COUNT(ProfileCounterRays, queue->len);
+    stats->nRays += queue->len;
+    stats->intersectSec += NowSeconds() - start;
+}
+
+/// Gradient from white at the nadir to `skyColor` at the zenith, for scenes without an environment map.
+internal void SkyColor(const RayTracer* const rayTracer, const vec3 direction, out vec3 color) {
+    vec3 unit;
+    glm_vec3_normalize_to(CGLM_CONST_FIX direction, unit);
+    const f32 blend = 0.5f * (unit[1] + 1.f);
+    vec3 white = { 1.f - blend, 1.f - blend, 1.f - blend };
+    vec3 sky;
+    glm_vec3_scale(CGLM_CONST_FIX rayTracer->skyColor, blend, sky);
+    glm_vec3_add(white, sky, color);
+}
+
+/// Power heuristic weight of a sample drawn with density `pdf` against another strategy with density `otherPdf`.
+internal f32 PowerHeuristic(const f32 pdf, const f32 otherPdf) {
+    const f32 a = pdf * pdf, b = otherPdf * otherPdf;
+    return a + b > 0.f ? a / (a + b) : 0.f;
+}
+
+/// @returns the vertex indices of the triangle hit, at the level of detail it was traced against.
+internal const u16* HitTriangle(const RayTracer* const rayTracer, const HitRecord* const hit) {
+    const u16* const indices = hit->lod == 0 ? rayTracer->indices : rayTracer->lodIndices[hit->lod - 1];
+    return &indices[3 * hit->primID];
+}
+
+/// Interpolates the vertex normals of `rayTracer->mesh` at the hit, or decodes the geometric normal without one.
+///
+/// The interpolated normal is flipped to the side of the geometric normal.
+internal void ShadingNormal(const RayTracer* const rayTracer, const HitRecord* const hit, out vec3 normal) {
+    DecodeOctahedral(hit->normal, normal);
+    if (rayTracer->mesh == NULL || hit->instID == RTC_INVALID_GEOMETRY_ID) return;
+
+    const u16* const triangle = HitTriangle(rayTracer, hit);
+    const f32 weights[3] = { 1.f - hit->u - hit->v, hit->u, hit->v };
+    vec3 interpolated = { 0.f, 0.f, 0.f };
+    for (usize k = 0; k < 3; k++) {
+        vec3 vertexNormal;
+        DecodeOctahedral(rayTracer->mesh->vertices[triangle[k]].normal, vertexNormal);
+        glm_vec3_muladds(vertexNormal, weights[k], interpolated);
+    }
+    glm_vec3_normalize(interpolated);
+    if (glm_vec3_dot(interpolated, normal) < 0.f) glm_vec3_negate(interpolated);
+    glm_vec3_copy(interpolated, normal);
+}
+
+/// @returns the kind of primitive hit, `PrimitiveKindCount` for meshes.
+internal enum PrimitiveKind HitPrimitive(const RayTracer* const rayTracer, const HitRecord* const hit) {
+    if (rayTracer->primitives == NULL || hit->instID != RTC_INVALID_GEOMETRY_ID) return PrimitiveKindCount;
+    for (usize kind = 0; kind < PrimitiveKindCount; kind++) {
+        if (rayTracer->primitives->geomIds[kind] == hit->geomID) return (enum PrimitiveKind)kind;
+    }
+    return PrimitiveKindCount;
+}
+
+internal bool HitPagedMesh(const RayTracer* const rayTracer, const HitRecord* const hit) {
+    return rayTracer->pagedMesh != NULL && hit->instID == RTC_INVALID_GEOMETRY_ID && hit->geomID == rayTracer->pagedMesh->geomId;
+}
+
+internal const Material* HitMaterial(const RayTracer* const rayTracer, const HitRecord* const hit) {
+    if (hit->instID != RTC_INVALID_GEOMETRY_ID) return &rayTracer->materials.data[hit->instID];
+    if (HitPagedMesh(rayTracer, hit)) return rayTracer->pagedMaterial;
+    const enum PrimitiveKind kind = HitPrimitive(rayTracer, hit);
+    if (kind == PrimitiveKindCount) return &DefaultMaterial;
+    return &rayTracer->primitiveMaterials[rayTracer->primitives->materials[kind][hit->primID]];
+}
+
+/// Exact normal of a primitive hit at `position`, flat primitives are two sided and face the incoming `direction`.
+///
+/// @returns false for mesh hits.
+internal bool PrimitiveNormal(const RayTracer* const rayTracer, const HitRecord* const hit, const vec3 position, const vec3 direction, out vec3 normal) {
+    const enum PrimitiveKind kind = HitPrimitive(rayTracer, hit);
+    if (kind == PrimitiveKindCount) return false;
+    if (kind == PrimitiveKindSphere) {
+        // Recomputed from the center rather than decoded from the quantized geometric normal.
+        const SpherePrimitive* const sphere = &rayTracer->primitives->spheres[hit->primID];
+        glm_vec3_sub((f32*)position, (vec3) { sphere->x, sphere->y, sphere->z }, normal);
+        glm_vec3_normalize(normal);
+        return true;
+    }
+    DecodeOctahedral(hit->normal, normal);
+    if (glm_vec3_dot(normal, (f32*)direction) > 0.f) glm_vec3_negate(normal);
+    return true;
+}
+
+/// Albedo of `material` at the hit, textures are filtered over the footprint of the ray cone.
+///
+/// The cone is `coneWidth` wide at the hit. Dividing by the cosine to the normal stretches it over the surface, the
+/// ratio of texture to world area of the triangle converts that width to texels (Akenine-Moller et al. 2019).
+internal void HitAlbedo(
+    const RayTracer* const rayTracer,
+    const Material* const material,
+    const HitRecord* const hit,
+    const vec3 direction,
+    const vec3 normal,
+    const f32 coneWidth,
+    out vec3 albedo
+) {
+    glm_vec3_copy(CGLM_CONST_FIX material->albedo, albedo);
+    if (material->albedoTexture == NULL || rayTracer->texCoords == NULL || hit->instID == RTC_INVALID_GEOMETRY_ID) return;
+
+    const u16* const triangle = HitTriangle(rayTracer, hit);
+    const TexCoord* const t[3] = { &rayTracer->texCoords[triangle[0]], &rayTracer->texCoords[triangle[1]], &rayTracer->texCoords[triangle[2]] };
+    vec3 p[3];
+    for (usize k = 0; k < 3; k++) {
+        if (rayTracer->mesh != NULL) {
+            DecodePosition(rayTracer->mesh, triangle[k], p[k]);
+        } else {
+            const Position* const position = &rayTracer->vertices[triangle[k]].position;
+            glm_vec3_copy((vec3) { position->x, position->y, position->z }, p[k]);
         }
+    }
+    const f32 w = 1.f - hit->u - hit->v;
+    const f32 u = w * t[0]->u + hit->u * t[1]->u + hit->v * t[2]->u;
+    const f32 v = w * t[0]->v + hit->u * t[1]->v + hit->v * t[2]->v;
+
+    const Texture* const texture = material->albedoTexture;
+    const f32 texelArea = fabsf((t[1]->u - t[0]->u) * (t[2]->v - t[0]->v) - (t[2]->u - t[0]->u) * (t[1]->v - t[0]->v))
+        * (f32)texture->levels[0].width * (f32)texture->levels[0].height;
+    vec3 e1, e2, cross;
+    glm_vec3_sub(p[1], p[0], e1);
+    glm_vec3_sub(p[2], p[0], e2);
+    glm_vec3_cross(e1, e2, cross);
+    const f32 worldArea = glm_vec3_norm(cross) * rayTracer->meshScale * rayTracer->meshScale;
+
+    f32 lod = 0.f;
+    if (texelArea > 0.f && worldArea > 0.f) {
+        const f32 cosine = fabsf(glm_vec3_dot(CGLM_CONST_FIX direction, CGLM_CONST_FIX normal)) / glm_vec3_norm(CGLM_CONST_FIX direction);
+        const f32 footprint = coneWidth / glm_max(cosine, 1e-2f) * sqrtf(texelArea / worldArea);
+        lod = footprint > 0.f ? log2f(footprint) : 0.f;
+    }
+    vec3 texel;
+    SampleTexture(rayTracer->textureCache, texture, u, v, lod, texel);
+    glm_vec3_mul(albedo, texel, albedo);
+}
 
-        Scatter(rayHit, reflect);
-        rayHit->ray.tnear = 0.001f;
-        rayHit->ray.tfar = INFINITY;
-        rayHit->ray.mask = 0xFFFFFFFF;
-        rayHit->ray.flags = 0;
-        rayHit->hit.geomID = RTC_INVALID_GEOMETRY_ID;
-        
-        switch (material-> type) {
+/// @returns true when anything lies within `distance` along the unit `direction` from `position`.
+internal bool Occluded(const RayTracer* const rayTracer, const vec3 position, const vec3 direction, const f32 distance, const f32 coneWidth) {
+    if (rayTracer->accelScene != NULL) {
+        const AccelRay ray = {
+            .origin = { position[0], position[1], position[2] },
+            .tNear = 0.001f,
+            .direction = { direction[0], direction[1], direction[2] },
+            .tFar = distance,
+        };
+        bool occluded;
+        PROFILE_TICKS_BEGIN(occludedStart);
+        OccludedAccel(rayTracer->accelScene->accel, &ray, 1, &occluded);
+        PROFILE_TICKS_END(ProfileCounterIntersectTicks, occludedStart);
+        return occluded;
+    }
+
+    struct RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    struct RTCRay shadow = {
+        .org_x = position[0], .org_y = position[1], .org_z = position[2],
+        .tnear = 0.001f,
+        .dir_x = direction[0], .dir_y = direction[1], .dir_z = direction[2],
+        .time = 0.f,
+        .tfar = distance,
+        .mask = 0xFFFFFFFF,
+        .id = 0,
+        .flags = 0,
+    };
+    const u32 lod = SelectLod(rayTracer, coneWidth);
+    const RTCScene scene = lod == 0 ? rayTracer->rtcScene : rayTracer->lodScenes[lod - 1];
+    PROFILE_TICKS_BEGIN(occludedStart);
+    rtcOccluded1(scene, &context, &shadow);
+    PROFILE_TICKS_END(ProfileCounterIntersectTicks, occludedStart);
+    // Embree marks occluded rays with a negative `tfar`.
+    return shadow.tfar < 0.f;
+}
+
+/// Light from one of `rayTracer->lights` reflected by a diffuse surface at `position`, zero when occluded.
+///
+/// The light is picked according to `lightSelection`, the returned radiance is divided by the probability of both the
+/// pick and the point sampled on it, so the estimate is unbiased either way.
+internal void DirectLight(
+    const RayTracer* const rayTracer,
+    const vec3 position,
+    const vec3 normal,
+    const f32 coneWidth,
+    out vec3 radiance
+) {
+    glm_vec3_zero(radiance);
+    const LightTree* const tree = rayTracer->lights;
+    if (tree->nLights == 0) return;
+
+    u32 light;
+    f32 probability;
+    const f32 u = RandomF32();
+    if (rayTracer->lightSelection == LightSelectionUniform) {
+        light = (u32)(u * (f32)tree->nLights);
+        if (light >= tree->nLights) light = (u32)tree->nLights - 1;
+        probability = 1.f / (f32)tree->nLights;
+    } else {
+        probability = SampleLightTree(tree, position, normal, u, &light);
+        if (probability == 0.f) return;
+    }
+
+    vec3 direction, incoming;
+    f32 distance;
+    const f32 uLight = RandomF32(), vLight = RandomF32();
+    if (!SampleLight(&tree->lights[light], position, uLight, vLight, direction, &distance, incoming)) return;
+    const f32 cosine = glm_vec3_dot(direction, CGLM_CONST_FIX normal);
+    if (cosine <= 0.f) return;
+
+    if (Occluded(rayTracer, position, direction, distance * (1.f - 1e-4f), coneWidth)) return;
+
+    // Lambertian BRDF albedo / pi, the albedo is applied by the caller.
+    glm_vec3_scale(incoming, cosine / ((f32)M_PI * probability), radiance);
+}
+
+/// Environment light reflected by a diffuse surface at `position`, sampled by importance and weighted against
+/// sampling the same direction by the BSDF, see `ShadeRays`.
+///
+/// `normal` faces the incoming path, `bsdfNormal` is the one `LambertianReflection` scatters around.
+internal void DirectEnvironment(
+    const RayTracer* const rayTracer,
+    const vec3 position,
+    const vec3 normal,
+    const vec3 bsdfNormal,
+    const f32 coneWidth,
+    out vec3 radiance
+) {
+    glm_vec3_zero(radiance);
+    const f32 random[4] = { RandomF32(), RandomF32(), RandomF32(), RandomF32() };
+    vec3 direction, incoming;
+    const f32 pdf = SampleEnvironment(rayTracer->environment, random, direction, incoming);
+    if (pdf <= 0.f) return;
+    const f32 cosine = glm_vec3_dot(direction, CGLM_CONST_FIX normal);
+    if (cosine <= 0.f) return;
+    if (Occluded(rayTracer, position, direction, INFINITY, coneWidth)) return;
+
+    const f32 bsdfPdf = glm_max(0.f, glm_vec3_dot(direction, CGLM_CONST_FIX bsdfNormal)) * (f32)M_1_PI;
+    glm_vec3_scale(incoming, cosine * (f32)M_1_PI / pdf * PowerHeuristic(pdf, bsdfPdf), radiance);
+}
+
+/// Feeds `radiance` times `weight` to `record` of the radiance cache, a path without one feeds nothing.
+internal void TrainRecord(const RayTracer* const rayTracer, const u32 record, const vec3 weight, const vec3 radiance) {
+    if (record == RADIANCE_CACHE_NONE) return;
+    vec3 relative;
+    glm_vec3_mul(CGLM_CONST_FIX weight, CGLM_CONST_FIX radiance, relative);
+    AddRecordRadiance(rayTracer->radianceCache, record, relative);
+}
+
+/// Counts the sample of an ending path towards the record it trained.
+internal void FinishRecord(const RayTracer* const rayTracer, const u32 record) {
+    if (record != RADIANCE_CACHE_NONE) CountRecordSample(rayTracer->radianceCache, record);
+}
+
+/// Looks up the record of a diffuse hit at `position` facing `normal`.
+///
+/// @returns true when the path ends in the record, with the light it reflects in `radiance`. Otherwise `record` is
+/// set to the record the path has to train, if any.
+internal bool LookupRadianceCache(
+    const RayTracer* const rayTracer,
+    const vec3 position,
+    const vec3 normal,
+    out vec3 radiance,
+    out u32* const record
+) {
+    RadianceCache* const cache = rayTracer->radianceCache;
+    // Jittering by up to half a cell blends neighbouring records instead of showing the grid.
+    const vec3 jittered = {
+        position[0] + (RandomF32() - 0.5f) * cache->cellSize,
+        position[1] + (RandomF32() - 0.5f) * cache->cellSize,
+        position[2] + (RandomF32() - 0.5f) * cache->cellSize,
+    };
+    const u32 found = FindRadianceRecord(cache, jittered, normal);
+    if (found == RADIANCE_CACHE_NONE) return false;
+    const u32 nSamples = RadianceRecordSamples(cache, found);
+    const bool train = nSamples < RADIANCE_CACHE_MIN_SAMPLES
+        || (nSamples < RADIANCE_CACHE_MAX_SAMPLES && RandomF32() * RADIANCE_CACHE_TRAIN_RATIO < 1.f);
+    if (train) {
+        *record = found;
+        return false;
+    }
+    RadianceRecordMean(cache, found, radiance);
+    return true;
+}
+
+void ShadeRays(
+    const RayTracer* const rayTracer,
+    in out RayQueue* const queue,
+    const HitRecord* const hits,
+    const PathOutputs* const outputs
+) {
+    const usize n = queue->len;
+
+    // Move origins to the hit points first, escaped paths are dropped below so their values do not matter.
+    f32* restrict const orgX = queue->orgX;
+    f32* restrict const orgY = queue->orgY;
+    f32* restrict const orgZ = queue->orgZ;
+    const f32* restrict const dirX = queue->dirX;
+    const f32* restrict const dirY = queue->dirY;
+    const f32* restrict const dirZ = queue->dirZ;
+    for (usize i = 0; i < n; i++) {
+        const f32 t = hits[i].t;
+        orgX[i] += dirX[i] * t;
+        orgY[i] += dirY[i] * t;
+        orgZ[i] += dirZ[i] * t;
+    }
+
+    usize survivors = 0;
+    for (usize i = 0; i < n; i++) {
+        const HitRecord* const hit = &hits[i];
+        const vec3 throughput = { queue->throughputR[i], queue->throughputG[i], queue->throughputB[i] };
+        vec3 direction = { queue->dirX[i], queue->dirY[i], queue->dirZ[i] };
+
+        const u32 pixel = queue->pixel[i];
+        const bool primary = queue->depth[i] == 0;
+        // Light the path gathers from here on, divided by its throughput at the record, trains the record.
+        u32 record = queue->cacheRecord[i];
+        vec3 recordWeight = { queue->cacheThroughputR[i], queue->cacheThroughputG[i], queue->cacheThroughputB[i] };
+
+        if (hit->geomID == RTC_INVALID_GEOMETRY_ID) {
+            vec3 sky;
+            if (rayTracer->environment != NULL) {
+                EnvironmentRadiance(rayTracer->environment, direction, sky);
+                if (rayTracer->environment->alias != NULL && queue->bsdfPdf[i] > 0.f) {
+                    // The other half of the estimate `DirectEnvironment` made at the last bounce.
+                    glm_vec3_normalize(direction);
+                    const f32 weight = PowerHeuristic(queue->bsdfPdf[i], EnvironmentPdf(rayTracer->environment, direction));
+                    glm_vec3_scale(sky, weight, sky);
+                }
+            } else {
+                SkyColor(rayTracer, direction, sky);
+            }
+            glm_vec3_muladd(CGLM_CONST_FIX throughput, sky, outputs->radiance[pixel]);
+            if (primary) glm_vec3_add(outputs->albedo[pixel], sky, outputs->albedo[pixel]);
+            TrainRecord(rayTracer, record, recordWeight, sky);
+            FinishRecord(rayTracer, record);
+            continue;
+        }
+
+        const Material* const material = HitMaterial(rayTracer, hit);
+
+        vec3 normal;
+        if (!PrimitiveNormal(rayTracer, hit, (vec3) { orgX[i], orgY[i], orgZ[i] }, direction, normal)) {
+            ShadingNormal(rayTracer, hit, normal);
+        }
+        const f32 coneWidth = queue->coneWidth[i] + queue->pixelSpread * hit->t;
+        vec3 albedo;
+        HitAlbedo(rayTracer, material, hit, direction, normal, coneWidth, albedo);
+        if (primary) {
+            glm_vec3_add(outputs->albedo[pixel], albedo, outputs->albedo[pixel]);
+            glm_vec3_add(outputs->normal[pixel], normal, outputs->normal[pixel]);
+            outputs->depth[pixel] += hit->t;
+        }
+
+        // Paths at the bounce limit contribute nothing.
+        const u32 depth = queue->depth[i] + 1;
+        if (depth >= rayTracer->nMaxReflections) {
+            FinishRecord(rayTracer, record);
+            continue;
+        }
+
+        const bool diffuse = material->type == MaterialTypeLambertian;
+        const vec3 position = { orgX[i], orgY[i], orgZ[i] };
+        vec3 facing;
+        glm_vec3_copy(normal, facing);
+        if (glm_vec3_dot(facing, direction) > 0.f) glm_vec3_negate(facing);
+
+        // Light reflected here reaches the record weighted by the albedo, unless the record is this hit.
+        glm_vec3_mul(recordWeight, albedo, recordWeight);
+        if (diffuse && rayTracer->radianceCache != NULL && queue->depth[i] == rayTracer->radianceCache->depth) {
+            vec3 cached;
+            if (LookupRadianceCache(rayTracer, position, facing, cached, &record)) {
+                glm_vec3_mul(cached, albedo, cached);
+                glm_vec3_muladd(CGLM_CONST_FIX throughput, cached, outputs->radiance[pixel]);
+                continue;
+            }
+            glm_vec3_one(recordWeight);
+        }
+
+        // Point, disc and sphere lights are not part of the scene, so reflected paths cannot hit them and sampling
+        // them here counts their light exactly once.
+        const bool sampleEnvironment = diffuse && rayTracer->environment != NULL && rayTracer->environment->alias != NULL;
+        if (diffuse && (rayTracer->lights != NULL || sampleEnvironment)) {
+            vec3 light;
+            if (rayTracer->lights != NULL) {
+                DirectLight(rayTracer, position, facing, coneWidth, light);
+                TrainRecord(rayTracer, record, recordWeight, light);
+                glm_vec3_mul(light, albedo, light);
+                glm_vec3_muladd(CGLM_CONST_FIX throughput, light, outputs->radiance[pixel]);
+            }
+            if (sampleEnvironment) {
+                DirectEnvironment(rayTracer, position, facing, normal, coneWidth, light);
+                TrainRecord(rayTracer, record, recordWeight, light);
+                glm_vec3_mul(light, albedo, light);
+                glm_vec3_muladd(CGLM_CONST_FIX throughput, light, outputs->radiance[pixel]);
+            }
+        }
+
+        // Cosine weighted around `normal`, mirrors are sampled by a delta and take no part in MIS.
+        f32 bsdfPdf = 0.f;
+        switch (material->type) {
             case MaterialTypeLambertian: {
-                glm_vec3_scale(color, material->params.lambertian.matte, color);
-                TraceRay(rayTracer, rayHit, nReflections + 1, color);
-                glm_vec3_mul(color, material->albedo, color);
+                LambertianReflection(direction, normal);
+                bsdfPdf = glm_max(0.f, glm_vec3_dot(direction, normal) / glm_vec3_norm(direction)) * (f32)M_1_PI;
             } break;
             default:
-            case MaterialTypeMetallic: {
-                PANICM("unimplemented");
-            } break;
+            case MaterialTypeMetallic: PANICM("unimplemented"); MetallicReflection(direction, normal); break;
+        }
+
+        queue->orgX[survivors] = queue->orgX[i];
+        queue->orgY[survivors] = queue->orgY[i];
+        queue->orgZ[survivors] = queue->orgZ[i];
+        queue->dirX[survivors] = direction[0];
+        queue->dirY[survivors] = direction[1];
+        queue->dirZ[survivors] = direction[2];
+        queue->throughputR[survivors] = throughput[0] * albedo[0];
+        queue->throughputG[survivors] = throughput[1] * albedo[1];
+        queue->throughputB[survivors] = throughput[2] * albedo[2];
+        queue->pixel[survivors] = pixel;
+        queue->depth[survivors] = depth;
+        queue->coneWidth[survivors] = coneWidth;
+        queue->bsdfPdf[survivors] = bsdfPdf;
+        queue->cacheRecord[survivors] = record;
+        queue->cacheThroughputR[survivors] = recordWeight[0];
+        queue->cacheThroughputG[survivors] = recordWeight[1];
+        queue->cacheThroughputB[survivors] = recordWeight[2];
+        // The paged mesh reports the cluster hit as the primitive.
+        queue->cluster[survivors] = HitPagedMesh(rayTracer, hit) ? hit->primID : PAGED_MESH_NO_CLUSTER;
+        survivors += 1;
+    }
+    queue->len = survivors;
+}
+
+void TraceRays(
+    const RayTracer* const rayTracer,
+    in out RayQueue* const queue,
+    HitRecord* const hits,
+    const PathOutputs* const outputs,
+    in out RayStats* const stats
+) {
+    if (rayTracer->nMaxReflections == 0) queue->len = 0;
+    while (queue->len > 0) {
+        IntersectRays(rayTracer, queue, hits, stats);
+        ShadeRays(rayTracer, queue, hits, outputs);
+    }
+}
+
+/// Shadow rays traced together by `OccludedPacket`, the width of `RTCRay8`.
+#define SHADOW_PACKET 8
+
+/// Tests up to `SHADOW_PACKET` shadow rays leaving `position` along the unit `directions`, `distance` long.
+///
+/// A paged mesh only intersects single rays, see `AttachPagedMesh`, so packets are split into single rays with one.
+internal void OccludedPacket(
+    const RayTracer* const rayTracer,
+    const vec3 position,
+    const vec3* const directions,
+    const usize n,
+    const f32 distance,
+    const f32 coneWidth,
+    out bool* const occluded
+) {
+    if (rayTracer->accelScene != NULL) {
+        AccelRay rays[SHADOW_PACKET];
+        for (usize k = 0; k < n; k++) {
+            rays[k] = (AccelRay) {
+                .origin = { position[0], position[1], position[2] },
+                .tNear = 0.001f,
+                .direction = { directions[k][0], directions[k][1], directions[k][2] },
+                .tFar = distance,
+            };
+        }
+        PROFILE_TICKS_BEGIN(occludedStart);
+        OccludedAccel(rayTracer->accelScene->accel, rays, n, occluded);
+        PROFILE_TICKS_END(ProfileCounterIntersectTicks, occludedStart);
+        return;
+    }
+    if (rayTracer->pagedMesh != NULL) {
+        for (usize k = 0; k < n; k++) occluded[k] = Occluded(rayTracer, position, directions[k], distance, coneWidth);
+        return;
+    }
+
+    struct RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    struct RTCRay8 packet;
+    // Embree loads the mask as one vector, `rtcOccluded8` requires it aligned to the packet width like `RTCRay8`.
+    _Alignas(4 * SHADOW_PACKET) i32 valid[SHADOW_PACKET];
+    for (usize k = 0; k < SHADOW_PACKET; k++) {
+        valid[k] = k < n ? -1 : 0;
+        packet.org_x[k] = position[0];
+        packet.org_y[k] = position[1];
+        packet.org_z[k] = position[2];
+        packet.tnear[k] = 0.001f;
+        packet.dir_x[k] = k < n ? directions[k][0] : 0.f;
+        packet.dir_y[k] = k < n ? directions[k][1] : 0.f;
+        packet.dir_z[k] = k < n ? directions[k][2] : 1.f;
+        packet.time[k] = 0.f;
+        packet.tfar[k] = distance;
+        packet.mask[k] = 0xFFFFFFFF;
+        packet.id[k] = (u32)k;
+        packet.flags[k] = 0;
+    }
+    // Every ray of the packet leaves the same point, so they share its level of detail.
+    const u32 lod = SelectLod(rayTracer, coneWidth);
+    const RTCScene scene = lod == 0 ? rayTracer->rtcScene : rayTracer->lodScenes[lod - 1];
+    PROFILE_TICKS_BEGIN(occludedStart);
+    rtcOccluded8(valid, scene, &context, &packet);
+    PROFILE_TICKS_END(ProfileCounterIntersectTicks, occludedStart);
+    for (usize k = 0; k < n; k++) occluded[k] = packet.tfar[k] < 0.f;
+}
+
+/// @returns the fraction of `nAoSamples` cosine distributed directions around `normal` free for `aoDistance`.
+internal f32 AmbientOcclusion(const RayTracer* const rayTracer, const vec3 position, const vec3 normal, const f32 coneWidth) {
+    if (rayTracer->nAoSamples == 0) return 1.f;
+    usize nVisible = 0;
+    for (usize first = 0; first < rayTracer->nAoSamples; first += SHADOW_PACKET) {
+        const usize n = rayTracer->nAoSamples - first < SHADOW_PACKET ? rayTracer->nAoSamples - first : SHADOW_PACKET;
+        vec3 directions[SHADOW_PACKET];
+        bool occluded[SHADOW_PACKET];
+        for (usize k = 0; k < n; k++) {
+            LambertianReflection(directions[k], normal);
+            glm_vec3_normalize(directions[k]);
         }
+        OccludedPacket(rayTracer, position, directions, n, rayTracer->aoDistance, coneWidth, occluded);
+        for (usize k = 0; k < n; k++) nVisible += !occluded[k];
+    }
+    return (f32)nVisible / (f32)rayTracer->nAoSamples;
+}
+
+/// Light of the sky or environment reflected by a diffuse surface at `position`, from a single unoccluded sample.
+///
+/// Importance sampled environments are sampled by their own density, anything else by the cosine around `normal`.
+internal void DirectSky(
+    const RayTracer* const rayTracer,
+    const vec3 position,
+    const vec3 normal,
+    const f32 coneWidth,
+    out vec3 radiance
+) {
+    glm_vec3_zero(radiance);
+    const Environment* const environment = rayTracer->environment;
+    vec3 direction, incoming;
+    f32 weight = 1.f;
+    if (environment != NULL && environment->alias != NULL) {
+        const f32 random[4] = { RandomF32(), RandomF32(), RandomF32(), RandomF32() };
+        const f32 pdf = SampleEnvironment(environment, random, direction, incoming);
+        if (pdf <= 0.f) return;
+        const f32 cosine = glm_vec3_dot(direction, CGLM_CONST_FIX normal);
+        if (cosine <= 0.f) return;
+        weight = cosine * (f32)M_1_PI / pdf;
     } else {
-        glm_vec3_norm(&rayHit->ray.dir_x);
-        f32 blend = 0.5f * (rayHit->ray.dir_y + 1.f);
-        vec3 white = { 1.f - blend, 1.f - blend, 1.f - blend };
-        vec3 blue = { 0.5f * blend, 0.7f * blend, 1.0f * blend };
-        glm_vec3_add(white, blue, color);
+        // Cosine over pi cancels against the density of the sample.
+        LambertianReflection(direction, normal);
+        glm_vec3_normalize(direction);
+        if (environment != NULL) EnvironmentRadiance(environment, direction, incoming);
+        else SkyColor(rayTracer, direction, incoming);
+    }
+    if (Occluded(rayTracer, position, direction, INFINITY, coneWidth)) return;
+    glm_vec3_scale(incoming, weight, radiance);
+}
+
+void ShadePreview(
+    const RayTracer* const rayTracer,
+    in out RayQueue* const queue,
+    const HitRecord* const hits,
+    const PathOutputs* const outputs
+) {
+    for (usize i = 0; i < queue->len; i++) {
+        const HitRecord* const hit = &hits[i];
+        const vec3 direction = { queue->dirX[i], queue->dirY[i], queue->dirZ[i] };
+        const u32 pixel = queue->pixel[i];
+
+        if (hit->geomID == RTC_INVALID_GEOMETRY_ID) {
+            vec3 sky;
+            if (rayTracer->environment != NULL) EnvironmentRadiance(rayTracer->environment, direction, sky);
+            else SkyColor(rayTracer, direction, sky);
+            glm_vec3_add(outputs->albedo[pixel], sky, outputs->albedo[pixel]);
+            switch (rayTracer->integrator) {
+                case IntegratorAlbedo:
+                case IntegratorDirect: glm_vec3_add(outputs->radiance[pixel], sky, outputs->radiance[pixel]); break;
+                // Nothing occludes the sky.
+                case IntegratorAmbientOcclusion: glm_vec3_adds(outputs->radiance[pixel], 1.f, outputs->radiance[pixel]); break;
+                default: break;
+            }
+            continue;
+        }
+
+        const vec3 position = {
+            queue->orgX[i] + direction[0] * hit->t,
+            queue->orgY[i] + direction[1] * hit->t,
+            queue->orgZ[i] + direction[2] * hit->t,
+        };
+        const Material* const material = HitMaterial(rayTracer, hit);
+        vec3 normal;
+        if (!PrimitiveNormal(rayTracer, hit, position, direction, normal)) ShadingNormal(rayTracer, hit, normal);
+        const f32 coneWidth = queue->coneWidth[i] + queue->pixelSpread * hit->t;
+        vec3 albedo;
+        HitAlbedo(rayTracer, material, hit, direction, normal, coneWidth, albedo);
+        glm_vec3_add(outputs->albedo[pixel], albedo, outputs->albedo[pixel]);
+        glm_vec3_add(outputs->normal[pixel], normal, outputs->normal[pixel]);
+        outputs->depth[pixel] += hit->t;
+
+        vec3 facing;
+        glm_vec3_copy(normal, facing);
+        if (glm_vec3_dot(facing, CGLM_CONST_FIX direction) > 0.f) glm_vec3_negate(facing);
+
+        vec3 color;
+        switch (rayTracer->integrator) {
+            case IntegratorAlbedo: glm_vec3_copy(albedo, color); break;
+            case IntegratorNormal: {
+                glm_vec3_adds(normal, 1.f, color);
+                glm_vec3_scale(color, 0.5f, color);
+            } break;
+            case IntegratorDepth: glm_vec3_broadcast(1.f / (1.f + hit->t), color); break;
+            case IntegratorAmbientOcclusion: glm_vec3_broadcast(AmbientOcclusion(rayTracer, position, facing, coneWidth), color); break;
+            case IntegratorDirect: {
+                DirectSky(rayTracer, position, facing, coneWidth, color);
+                if (rayTracer->lights != NULL) {
+                    vec3 light;
+                    DirectLight(rayTracer, position, facing, coneWidth, light);
+                    glm_vec3_add(color, light, color);
+                }
+                glm_vec3_mul(color, albedo, color);
+            } break;
+            default: PANIC("Not a preview integrator:" FS(i32), rayTracer->integrator);
+        }
+        glm_vec3_add(outputs->radiance[pixel], color, outputs->radiance[pixel]);
+    }
+    queue->len = 0;
+}
+
+#define AOVS_ALIGNMENT 64
+#define AOVS_PIXEL_SIZE (3 * sizeof(vec3) + sizeof(f32))
+
+usize AovsArenaSize(const usize width, const usize height) {
+    return width * height * AOVS_PIXEL_SIZE + 4 * AOVS_ALIGNMENT;
+}
+
+Aovs CreateAovs(Arena* const arena, const usize width, const usize height) {
+    const usize n = width * height;
+    return (Aovs) {
+        .width = width,
+        .height = height,
+        .color = ArenaPush(arena, n * sizeof(vec3), AOVS_ALIGNMENT),
+        .albedo = ArenaPush(arena, n * sizeof(vec3), AOVS_ALIGNMENT),
+        .normal = ArenaPush(arena, n * sizeof(vec3), AOVS_ALIGNMENT),
+        .depth = ArenaPush(arena, n * sizeof(f32), AOVS_ALIGNMENT),
+        .sum = NULL,
+        .nSamples = NULL,
+    };
+}
+
+usize AccumulationArenaSize(const usize width, const usize height) {
+    return width * height * (sizeof(vec3) + sizeof(u32)) + 2 * AOVS_ALIGNMENT;
+}
+
+void CreateAccumulation(Arena* const arena, Aovs* const aovs) {
+    const usize n = aovs->width * aovs->height;
+    aovs->sum = ArenaPush(arena, n * sizeof(vec3), AOVS_ALIGNMENT);
+    aovs->nSamples = ArenaPush(arena, n * sizeof(u32), AOVS_ALIGNMENT);
+    memset(aovs->sum, 0, n * sizeof(vec3));
+    memset(aovs->nSamples, 0, n * sizeof(u32));
+}
+
+void ResetAccumulation(Aovs* const aovs) {
+    const usize n = aovs->width * aovs->height;
+    memset(aovs->sum, 0, n * sizeof(vec3));
+    memset(aovs->nSamples, 0, n * sizeof(u32));
+}
+
+internal u8 Quantize(const f32 value) {
+    return (u8)((value < 0.f ? 0.f : value > 1.f ? 1.f : value) * 255.999f);
+}
+
+void Tonemap(const vec3* const color, const Buffer2d framebuffer) {
+    for (usize i = 0; i < framebuffer.width * framebuffer.height; i++) {
+        framebuffer.buffer[i][0] = Quantize(color[i][0]);
+        framebuffer.buffer[i][1] = Quantize(color[i][1]);
+        framebuffer.buffer[i][2] = Quantize(color[i][2]);
     }
 }
@@ -0,0 +1,237 @@
+#include "render_context.h"
+
+#include <stdio.h>
+
+#include <cmm/cmm.h>
+
+#include "profiler.h"
+#include "render_job.h"
+#include "scene.h"
+
+/// Rows of one work item, the granularity at which frames of different contexts interleave.
+#define BAND_ROWS TILE_SIZE
+
+typedef struct {
+    const RenderContext* context;
+    Buffer2d framebuffer;
+    usize initialRow;
+    usize nRows;
+    PTask* task;
+    RayStats stats;
+} ContextBand;
+
+DeclareArray(ContextBand);
+
+#if defined(RTC_NAMESPACE_USE)
+RTC_NAMESPACE_USE
+#endif
+
+internal void EmbreeErrorCallback(void* const _, enum RTCError error, const char* const str) {
+    PANIC("embree error ::" FS(i32) ":: %s", error, str);
+}
+
+void CreateRenderShared(RenderShared* const shared, const usize nWorkers, const RenderSharedConfig config) {
+    // No build threads besides the committing one, builds run on the pool through `rtcJoinCommitScene`.
+    char deviceConfig[64];
+    snprintf(deviceConfig, sizeof deviceConfig, "threads=1,user_threads=%zu", nWorkers);
+    shared->device = rtcNewDevice(deviceConfig);
+    if (!shared->device) PANIC("error %d: cannot create device", rtcGetDeviceError(NULL));
+    rtcSetDeviceErrorFunction(shared->device, EmbreeErrorCallback, NULL);
+
+    DetectCpuTopology(&shared->topology);
+    if (config.pinWorkers || config.replicatePerNode) CreatePinnedWorkerPool(&shared->pool, nWorkers, &shared->topology);
+    else CreateWorkerPool(&shared->pool, nWorkers);
+    shared->nReplicas = config.replicatePerNode ? shared->pool.nNodes : 1;
+    if (shared->nReplicas > 1) LOGLN("Replicating scenes on" FS(usize) "NUMA nodes", shared->nReplicas);
+}
+
+void DestroyRenderShared(RenderShared* const shared) {
+    DestroyWorkerPool(&shared->pool);
+    rtcReleaseDevice(shared->device);
+}
+
+usize WorkerReplica(const RenderShared* const shared, const usize worker) {
+    return shared->nReplicas > 1 ? shared->pool.workers.data[worker].node : 0;
+}
+
+internal void JoinCommit(void* const argument, const usize _, Arena* const __) {
+    rtcJoinCommitScene(argument);
+}
+
+/// Commits `nScenes` scenes one after another, scene `s` joined by the workers of replica `s`, or by every worker
+/// when there is a single scene.
+///
+/// The device has one task scheduler that every joined commit runs on, so two commits must never be joined at once.
+internal void JoinCommits(RenderShared* const shared, const RTCScene* const scenes, const usize nScenes) {
+    PROFILE_BEGIN(commitStart);
+    for (usize s = 0; s < nScenes; s++) {
+        WorkBatch batch = { 0 };
+        for (usize w = 0; w < shared->pool.workers.len; w++) {
+            if (nScenes == 1 || WorkerReplica(shared, w) == s) SubmitWorkTo(&shared->pool, &batch, w, JoinCommit, scenes[s]);
+        }
+        WaitWorkBatch(&shared->pool, &batch);
+    }
+    PROFILE_END("joined commit", commitStart);
+}
+
+void CommitSharedScene(RenderShared* const shared, const RTCScene scene) {
+    JoinCommits(shared, &scene, 1);
+}
+
+void CommitReplicatedScenes(RenderShared* const shared, const RTCScene* const replicas) {
+    JoinCommits(shared, replicas, shared->nReplicas);
+}
+
+typedef struct {
+    RenderShared* shared;
+    SharedMesh* mesh;
+    usize replica;
+} MeshReplica;
+
+internal void CreateMeshReplica(void* const argument, const usize _, Arena* const __) {
+    const MeshReplica* const replica = argument;
+    SharedMesh* const mesh = replica->mesh;
+    Arena* const geometryArena = &mesh->geometryArenas[replica->replica];
+    *geometryArena = CreateArena(MeshSceneArenaSize(&mesh->obj));
+    mesh->scenes[replica->replica] = CreateUncommittedMeshScene(replica->shared->device, &mesh->obj, NULL, geometryArena);
+}
+
+void LoadSharedMesh(RenderShared* const shared, const char* const path, SharedMesh* const mesh) {
+    LoadOBJ(path, &mesh->obj);
+    mesh->nReplicas = shared->nReplicas;
+
+    // Worker r runs on node r, so the geometry of every replica is first touched on the node reading it.
+    MeshReplica replicas[MAX_REPLICAS];
+    WorkBatch batch = { 0 };
+    for (usize r = 0; r < mesh->nReplicas; r++) {
+        replicas[r] = (MeshReplica) { .shared = shared, .mesh = mesh, .replica = r };
+        SubmitWorkTo(&shared->pool, &batch, r, CreateMeshReplica, &replicas[r]);
+    }
+    WaitWorkBatch(&shared->pool, &batch);
+    CommitReplicatedScenes(shared, mesh->scenes);
+}
+
+void DestroySharedMesh(SharedMesh* const mesh) {
+    for (usize r = 0; r < mesh->nReplicas; r++) {
+        rtcReleaseScene(mesh->scenes[r]);
+        DropArena(&mesh->geometryArenas[r]);
+    }
+    FreeOBJ(mesh->obj);
+}
+
+void CreateRenderContext(
+    RenderContext* const context,
+    RenderShared* const shared,
+    const usize width,
+    const usize height,
+    const usize maxInstances
+) {
+    *context = (RenderContext) {
+        .shared = shared,
+        .dirty = true,
+        .rt = (RayTracer) {
+            .materials = AllocateArray(Material, maxInstances),
+            .nMaxReflections = 15,
+            .nRaysPerSample = 1,
+            .skyColor = { 0.5f, 0.7f, 1.0f },
+            .seed = 42,
+        },
+        .nInstances = 0,
+        .frameArena = CreateArena(AovsArenaSize(width, height)),
+        .tasks = AllocatePTasks((height + BAND_ROWS - 1) / BAND_ROWS),
+    };
+    for (usize r = 0; r < shared->nReplicas; r++) context->scenes[r] = rtcNewScene(shared->device);
+    context->rt.rtcScene = context->scenes[0];
+    context->aovs = CreateAovs(&context->frameArena, width, height);
+}
+
+void DestroyRenderContext(RenderContext* const context) {
+    FreeArray(context->tasks);
+    DropArena(&context->frameArena);
+    FreeArray(context->rt.materials);
+    for (usize r = 0; r < context->shared->nReplicas; r++) rtcReleaseScene(context->scenes[r]);
+}
+
+void AddContextInstances(
+    RenderContext* const context,
+    const SharedMesh* const mesh,
+    const Instances instances,
+    const Material* const material
+) {
+    if (instances.len == 0) return;
+    // Checked before attaching, the scenes must not hold instances without a material.
+    if (context->nInstances + instances.len > context->rt.materials.len) {
+        PANIC("Context holds at most" FS(usize) "instances", context->rt.materials.len);
+    }
+    const RTCDevice device = context->shared->device;
+    const u32 firstId = AttachInstances(device, context->scenes[0], mesh->scenes[0], instances);
+    // Only this function attaches geometry, so ids count the instances added so far.
+    ASSERT_EQ((usize)firstId, context->nInstances);
+    // Replicas attach the same instances in the same order, so their ids agree.
+    for (usize r = 1; r < context->shared->nReplicas; r++) {
+        const u32 replicaId = AttachInstances(device, context->scenes[r], mesh->scenes[r], instances);
+        ASSERT_EQ(replicaId, firstId);
+    }
+    for (usize i = 0; i < instances.len; i++) context->rt.materials.data[firstId + i] = *material;
+    context->nInstances += instances.len;
+    context->dirty = true;
+}
+
+internal void RenderBand(void* const argument, const usize worker, Arena* const arena) {
+    ContextBand* const band = argument;
+    RayTracer rt = band->context->rt;
+    rt.rtcScene = band->context->scenes[WorkerReplica(band->context->shared, worker)];
+    RenderRange(
+        &rt,
+        FULL_FRAME(band->framebuffer),
+        band->framebuffer,
+        band->initialRow,
+        band->nRows,
+        band->context->aovs,
+        band->task,
+        arena,
+        &band->stats
+    );
+}
+
+RayStats RenderContextToBuffer(RenderContext* const context, const usize nSamples, Rgb256* const buffer) {
+    if (context->dirty) {
+        CommitReplicatedScenes(context->shared, context->scenes);
+        context->dirty = false;
+    }
+    context->rt.nRaysPerSample = nSamples;
+
+    const Buffer2d framebuffer = {
+        .width = context->aovs.width,
+        .height = context->aovs.height,
+        .buffer = buffer,
+    };
+    Array(ContextBand) bands = AllocateArray(ContextBand, context->tasks.len);
+    WorkBatch batch = { 0 };
+    for (usize i = 0; i < bands.len; i++) {
+        const usize initialRow = i * BAND_ROWS;
+        bands.data[i] = (ContextBand) {
+            .context = context,
+            .framebuffer = framebuffer,
+            .initialRow = initialRow,
+            .nRows = initialRow + BAND_ROWS < framebuffer.height ? BAND_ROWS : framebuffer.height - initialRow,
+            .task = &context->tasks.data[i],
+            .stats = { 0 },
+        };
+        context->tasks.data[i].end = bands.data[i].nRows * framebuffer.width;
+        atomic_store_explicit(&context->tasks.data[i].progress, 0, memory_order_relaxed);
+        atomic_store_explicit(&context->tasks.data[i].nRays, 0, memory_order_relaxed);
+        SubmitWork(&context->shared->pool, &batch, RenderBand, &bands.data[i]);
+    }
+    WaitWorkBatch(&context->shared->pool, &batch);
+
+    RayStats total = { 0 };
+    for (usize i = 0; i < bands.len; i++) {
+        total.nPrimaryRays += bands.data[i].stats.nPrimaryRays;
+        total.nRays += bands.data[i].stats.nRays;
+        total.nLodRays += bands.data[i].stats.nLodRays;
+        total.intersectSec += bands.data[i].stats.intersectSec;
+    }
+    FreeArray(bands);
+    return total;
+}
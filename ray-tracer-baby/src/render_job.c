@@ -0,0 +1,347 @@
+#include "render_job.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "profiler.h"
+#include "vec3_utilities.h"
+
+#define X 0
+#define Y 1
+#define Z 2
+
+/// Finalizer of SplitMix64, spreads neighbouring tile coordinates over unrelated seeds.
+internal u64 MixSeed(u64 value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+/// Every sample of a tile gets `2^RANDOM_SAMPLE_STRIDE_LOG2` draws of the tile's stream, far more than any path takes.
+#define RANDOM_SAMPLE_STRIDE_LOG2 32
+
+/// Upper bound of paths in flight per worker, tiles with more samples are traced in several batches.
+#define RAY_QUEUE_CAPACITY (TILE_SIZE * TILE_SIZE * 64)
+
+internal void GeneratePrimaryRays(
+    const FrameRegion region,
+    const usize tileX, const usize tileEndX,
+    const usize tileY, const usize tileEndY,
+    const usize nSamples,
+    out RayQueue* const queue
+) {
+    const vec3 origin = { 0.0f, 0.0f, CAMERA_ORIGIN_Z };
+    // Neighbouring rows are 2 / frameHeight apart on the image plane at unit distance.
+    queue->pixelSpread = 2.0f / (f32)region.frameHeight;
+    for (usize y = tileY; y < tileEndY; y++) {
+        for (usize x = tileX; x < tileEndX; x++) {
+            const vec3 direction = {
+                (2.0f * ((f32)(region.x + x) / region.frameWidth)) - 1.0f,
+                1.0f - (2.0f * ((f32)(region.y + y) / region.frameHeight)),
+                -1.0f,
+            };
+            const u32 pixel = (u32)((y - tileY) * TILE_SIZE + (x - tileX));
+            for (usize si = 0; si < nSamples; si++) PushRay(queue, origin, direction, pixel);
+        }
+    }
+}
+
+/// Looks up the first hits of the paths `GeneratePrimaryRays` queued for the tile instead of tracing them.
+internal void LookupPrimaryHits(
+    const RayTracer* const rt,
+    const usize width,
+    const usize tileX, const usize tileEndX,
+    const usize tileY, const usize tileEndY,
+    const usize nSamples,
+    out HitRecord* const hits
+) {
+    usize i = 0;
+    for (usize y = tileY; y < tileEndY; y++) {
+        for (usize x = tileX; x < tileEndX; x++) {
+            const HitRecord* const hit = &rt->primaryHits[y * width + x];
+            for (usize si = 0; si < nSamples; si++) hits[i++] = *hit;
+        }
+    }
+}
+
+void RenderRange(
+    const RayTracer* const rt,
+    const FrameRegion region,
+    const Buffer2d framebuffer,
+    const usize initialRow,
+    const usize nRows,
+    const Aovs aovs,
+    PTask* const task,
+    Arena* const arena,
+    out RayStats* const stats
+) {
+    const usize nTilePixels = TILE_SIZE * TILE_SIZE;
+    const usize nSamplesPerBatch = rt->nRaysPerSample < RAY_QUEUE_CAPACITY / nTilePixels
+        ? rt->nRaysPerSample
+        : RAY_QUEUE_CAPACITY / nTilePixels
+        ;
+    RayQueue queue = CreateRayQueue(arena, nTilePixels * nSamplesPerBatch);
+    HitRecord* const hits = ArenaPush(arena, queue.capacity * sizeof(HitRecord), 64);
+    const PathOutputs outputs = {
+        .radiance = ArenaPush(arena, nTilePixels * sizeof(vec3), 64),
+        .albedo = ArenaPush(arena, nTilePixels * sizeof(vec3), 64),
+        .normal = ArenaPush(arena, nTilePixels * sizeof(vec3), 64),
+        .depth = ArenaPush(arena, nTilePixels * sizeof(f32), 64),
+    };
+
+    const usize endRow = initialRow + nRows;
+    for (usize tileY = initialRow; tileY < endRow; tileY += TILE_SIZE) {
+        const usize tileEndY = tileY + TILE_SIZE < endRow ? tileY + TILE_SIZE : endRow;
+        for (usize tileX = 0; tileX < framebuffer.width; tileX += TILE_SIZE) {
+            const usize tileEndX = tileX + TILE_SIZE < framebuffer.width ? tileX + TILE_SIZE : framebuffer.width;
+            const usize nRaysBefore = stats->nRays;
+            PROFILE_BEGIN(tileStart);
+
+            memset(outputs.radiance, 0, nTilePixels * sizeof(vec3));
+            memset(outputs.albedo, 0, nTilePixels * sizeof(vec3));
+            memset(outputs.normal, 0, nTilePixels * sizeof(vec3));
+            memset(outputs.depth, 0, nTilePixels * sizeof(f32));
+
+            // Each tile draws from a stream of its own, positioned by the samples its pixels already have. A pass
+            // resumed from a checkpoint thus draws exactly what it would have drawn in an uninterrupted render.
+            const usize firstPixel = tileY * framebuffer.width + tileX;
+            const u64 sampleIndex = aovs.nSamples == NULL ? 0 : aovs.nSamples[firstPixel];
+            const u64 tileId = ((u64)(region.y + tileY) << 32) | (region.x + tileX);
+            SeedRandom(MixSeed(rt->seed), MixSeed(tileId));
+            AdvanceRandom(sampleIndex << RANDOM_SAMPLE_STRIDE_LOG2);
+
+            for (usize sample = 0; sample < rt->nRaysPerSample; sample += nSamplesPerBatch) {
+                const usize nSamples = sample + nSamplesPerBatch < rt->nRaysPerSample
+                    ? nSamplesPerBatch
+                    : rt->nRaysPerSample - sample
+                    ;
+                queue.len = 0;
+                GeneratePrimaryRays(region, tileX, tileEndX, tileY, tileEndY, nSamples, &queue);
+                PROFILE_COUNT(ProfileCounterPrimaryRays, queue.len);
+                stats->nPrimaryRays += queue.len;
+                if (rt->integrator != IntegratorPath) {
+                    PROFILE_TICKS_BEGIN(previewStart);
+                    if (rt->primaryHits != NULL) {
+                        LookupPrimaryHits(rt, framebuffer.width, tileX, tileEndX, tileY, tileEndY, nSamples, hits);
+                    } else {
+                        IntersectRays(rt, &queue, hits, stats);
+                    }
+                    ShadePreview(rt, &queue, hits, &outputs);
+                    PROFILE_TICKS_END(ProfileCounterTraceTicks, previewStart);
+                    continue;
+                }
+                if (rt->primaryHits != NULL && rt->nMaxReflections > 0) {
+                    LookupPrimaryHits(rt, framebuffer.width, tileX, tileEndX, tileY, tileEndY, nSamples, hits);
+                    ShadeRays(rt, &queue, hits, &outputs);
+                }
+
+                PROFILE_TICKS_BEGIN(traceStart);
+                TraceRays(rt, &queue, hits, &outputs, stats);
+                PROFILE_TICKS_END(ProfileCounterTraceTicks, traceStart);
+            }
+
+            const f32 scale = 1.f / rt->nRaysPerSample;
+            for (usize y = tileY; y < tileEndY; y++) {
+                for (usize x = tileX; x < tileEndX; x++) {
+                    const usize local = (y - tileY) * TILE_SIZE + (x - tileX);
+                    const usize global = y * framebuffer.width + x;
+                    if (aovs.sum == NULL) {
+                        glm_vec3_scale(outputs.radiance[local], scale, aovs.color[global]);
+                    } else {
+                        glm_vec3_add(aovs.sum[global], outputs.radiance[local], aovs.sum[global]);
+                        aovs.nSamples[global] += rt->nRaysPerSample;
+                        glm_vec3_scale(aovs.sum[global], 1.f / aovs.nSamples[global], aovs.color[global]);
+                    }
+                    glm_vec3_scale(outputs.albedo[local], scale, aovs.albedo[global]);
+                    glm_vec3_normalize_to(outputs.normal[local], aovs.normal[global]);
+                    aovs.depth[global] = outputs.depth[local] * scale;
+                }
+                // Noisy preview, replaced by the denoised frame when denoising is enabled.
+                Tonemap(
+                    &aovs.color[y * framebuffer.width + tileX],
+                    (Buffer2d) { .width = tileEndX - tileX, .height = 1, .buffer = &framebuffer.buffer[y * framebuffer.width + tileX] }
+                );
+            }
+
+            // Publish once per tile, the display only needs an approximate, eventually consistent view.
+            atomic_fetch_add_explicit(&task->progress, (tileEndY - tileY) * (tileEndX - tileX), memory_order_relaxed);
+            atomic_fetch_add_explicit(&task->nRays, stats->nRays - nRaysBefore, memory_order_relaxed);
+            PROFILE_COUNT(ProfileCounterTiles, 1);
+            PROFILE_END("tile", tileStart);
+        }
+    }
+}
+
+/// Band of rows of worker `params->tid`.
+internal void WorkerRows(const RenderJobParams* const params, usize* const initialRow, usize* const nRows) {
+    // Spread the remainder over the first workers so any worker count is valid.
+    const usize height = params->framebuffer.height;
+    const usize base = height / params->nWorkers;
+    const usize remainder = height % params->nWorkers;
+    *nRows = base + (params->tid < remainder ? 1 : 0);
+    *initialRow = params->tid * base + (params->tid < remainder ? params->tid : remainder);
+}
+
+/// Resets the progress of worker `params->tid`.
+///
+/// Called before the worker starts, `end` is not atomic and the display reads it while workers run.
+internal void ResetRenderTask(const RenderJobParams* const params) {
+    usize initialRow, nRows;
+    WorkerRows(params, &initialRow, &nRows);
+    params->task->end = nRows * params->framebuffer.width;
+    atomic_store_explicit(&params->task->progress, 0, memory_order_relaxed);
+    atomic_store_explicit(&params->task->nRays, 0, memory_order_relaxed);
+}
+
+/// Traces the band of rows of worker `params->tid` with `rt`.
+internal void RunRenderJob(RenderJobParams* const params, const RayTracer* const rt) {
+    usize initialRow, nRows;
+    WorkerRows(params, &initialRow, &nRows);
+
+    // Count into a local copy, params of neighbouring workers share cache lines.
+    RayStats stats = { 0 };
+    RenderRange(rt, params->region, params->framebuffer, initialRow, nRows, params->aovs, params->task, params->arena, &stats);
+    params->stats = stats;
+    FinishTask(params->display, params->task);
+}
+
+internal void* RenderJob(void* args) {
+    RenderJobParams* const params = args;
+    PROFILE_THREAD("render worker");
+    ResetArena(params->arena);
+    RunRenderJob(params, params->rt);
+    return NULL;
+}
+
+internal void PoolRenderJob(void* const argument, const usize worker, Arena* const arena) {
+    RenderJobParams* const params = argument;
+    params->arena = arena;
+    const usize replica = params->nReplicas > 1 ? params->pool->workers.data[worker].node : 0;
+    RunRenderJob(params, &params->rt[replica]);
+}
+
+Array(Arena) CreateWorkerArenas(const usize nWorkers) {
+    Array(Arena) arenas = AllocateArray(Arena, nWorkers);
+    for (usize i = 0; i < nWorkers; i++) arenas.data[i] = CreateArena(WORKER_ARENA_SIZE);
+    return arenas;
+}
+
+void DropWorkerArenas(const Array(Arena) arenas) {
+    for (usize i = 0; i < arenas.len; i++) DropArena(&arenas.data[i]);
+    FreeArray(arenas);
+}
+
+RenderJobs StartRenderJobs(
+    RayTracer* const rt,
+    const Buffer2d framebuffer,
+    const Aovs aovs,
+    Display* const display,
+    const Array(Arena) arenas
+) {
+    return StartRegionRenderJobs(rt, FULL_FRAME(framebuffer), framebuffer, aovs, display, arenas);
+}
+
+RenderJobs StartRegionRenderJobs(
+    RayTracer* const rt,
+    const FrameRegion region,
+    const Buffer2d framebuffer,
+    const Aovs aovs,
+    Display* const display,
+    const Array(Arena) arenas
+) {
+    const usize nWorkers = display->tasks.pTasks.len;
+    ASSERT_EQ(arenas.len, nWorkers);
+    RenderJobs jobs = {
+        .params = AllocateArray(RenderJobParams, nWorkers),
+        .tids = AllocateArray(pthread_t, nWorkers),
+        .pool = NULL,
+        .batch = NULL,
+    };
+
+    LOGLN("Starting" FS(usize) "worker threads", nWorkers);
+    for (usize tid = 0; tid < nWorkers; tid++) {
+        jobs.params.data[tid] = (RenderJobParams) {
+            .rt = rt,
+            .region = region,
+            .framebuffer = framebuffer,
+            .aovs = aovs,
+            .tid = tid,
+            .nWorkers = nWorkers,
+            .task = &display->tasks.pTasks.data[tid],
+            .display = display,
+            .arena = &arenas.data[tid],
+        };
+        ResetRenderTask(&jobs.params.data[tid]);
+        LOGLN("  * starting worker:" FS(usize), tid);
+        const i32 result = pthread_create(
+            &jobs.tids.data[tid],
+            NULL,
+            RenderJob,
+            &jobs.params.data[tid]
+        );
+        if (0 != result) PANIC("Failed to create worker" FS(usize), tid);
+    }
+    return jobs;
+}
+
+RenderJobs StartPoolRenderJobs(
+    WorkerPool* const pool,
+    RayTracer* const replicas,
+    const usize nReplicas,
+    const FrameRegion region,
+    const Buffer2d framebuffer,
+    const Aovs aovs,
+    Display* const display
+) {
+    if (nReplicas != 1 && nReplicas != pool->nNodes) PANIC("Expected 1 or" FS(usize) "replicas", pool->nNodes);
+    const usize nTasks = display->tasks.pTasks.len;
+    RenderJobs jobs = {
+        .params = AllocateArray(RenderJobParams, nTasks),
+        .tids = (Array(pthread_t)) { .len = 0, .data = NULL },
+        .pool = pool,
+        .batch = malloc(sizeof(WorkBatch)),
+    };
+    if (jobs.batch == NULL) PANICM("Failed to allocate render batch");
+    *jobs.batch = (WorkBatch) { 0 };
+
+    for (usize tid = 0; tid < nTasks; tid++) {
+        jobs.params.data[tid] = (RenderJobParams) {
+            .rt = replicas,
+            .region = region,
+            .framebuffer = framebuffer,
+            .aovs = aovs,
+            .tid = tid,
+            .nWorkers = nTasks,
+            .task = &display->tasks.pTasks.data[tid],
+            .display = display,
+            .arena = NULL,
+            .pool = pool,
+            .nReplicas = nReplicas,
+        };
+        ResetRenderTask(&jobs.params.data[tid]);
+        SubmitWork(pool, jobs.batch, PoolRenderJob, &jobs.params.data[tid]);
+    }
+    return jobs;
+}
+
+RayStats JoinRenderJobs(const RenderJobs jobs) {
+    if (jobs.pool != NULL) {
+        WaitWorkBatch(jobs.pool, jobs.batch);
+        free(jobs.batch);
+    }
+    RayStats total = { 0 };
+    for (usize tid = 0; tid < jobs.params.len; tid++) {
+        if (jobs.pool == NULL) pthread_join(jobs.tids.data[tid], NULL);
+        total.nPrimaryRays += jobs.params.data[tid].stats.nPrimaryRays;
+        total.nRays += jobs.params.data[tid].stats.nRays;
+        total.nLodRays += jobs.params.data[tid].stats.nLodRays;
+        total.intersectSec += jobs.params.data[tid].stats.intersectSec;
+    }
+    FreeArray(jobs.params);
+    if (jobs.pool == NULL) FreeArray(jobs.tids);
+    return total;
+}
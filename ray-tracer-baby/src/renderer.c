@@ -1,5 +1,10 @@
 #include "renderer.h"
 
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <GL/glew.h>
 #include <cglm/cglm.h>
 
@@ -9,6 +14,10 @@
 #include "attributes.h"
 #include "shaders.h"
 #include "obj.h"
+#include "primitives.h"
+#include "profiler.h"
+#include "texture.h"
+#include "vertex_format.h"
 
 #define MAX_INSTANCES (usize)10000
 #define MAX_MESHES (usize)100
@@ -38,20 +47,17 @@ internal Instance InstanceStore[MAX_MESHES][MAX_INSTANCES];
 internal usize InstanceStoreLen[MAX_MESHES];
 
 #define N_INSTANCES(meshId) InstanceStoreLen[meshId]
-#define INSTANCE_OFFSET(meshId) (N_INSTANCES(meshId) * sizeof* InstanceStore[meshId])
+#define INSTANCE_BASE(meshId) ((meshId) * MAX_INSTANCES * sizeof(Instance))
+#define INSTANCE_OFFSET(meshId) (INSTANCE_BASE(meshId) + N_INSTANCES(meshId) * sizeof* InstanceStore[meshId])
 
 struct Renderer Renderer = {
         .program = 0,
-        .byteOffsets = NULL,
         .camera = {
             .fov = 60.f,
             .nearPlane = 0.1f,
             .farPlane = 1000.f
         },
-        .meshVbo = 0,
         .instanceVbo = 0,
-        .vao = 0,
-        .ebo = 0,
         .initialize = RendererInitialize,
         .drop = RendererDrop,
 };
@@ -178,12 +184,100 @@ internal void InitializeLighting(void) {
     glm_vec3_copy((vec3) { 1.f, 1.f, 1.f }, Renderer.lightColor);
 }
 
-#define VERTEX_BYTE_OFFSET(i) Renderer.byteOffsets[i].vertex
-#define INDEX_BYTE_OFFSET(i) Renderer.byteOffsets[i].index
 #define OBJ(i) Renderer.meshes.data[i].obj
 
-#define VERTEX_BYTE_SIZE(i) (OBJ(i).nVertices * sizeof(Vertex))
+#define VERTEX_SIZE (Renderer.compactVertices ? sizeof(CompactVertex) : sizeof(Vertex))
+#define VERTEX_BYTE_SIZE(i) (OBJ(i).nVertices * VERTEX_SIZE)
 #define INDEX_BYTE_SIZE(i) (OBJ(i).nIndices * sizeof(u16))
+#define LOD_INDEX_COUNT(mesh, level) ((level) == 0 ? (mesh)->obj.nIndices : (mesh)->lods[(level) - 1].nIndices)
+
+internal void ConfigureMeshAttributes(const bool compactVertices) {
+    LOGLNM("Configuring mesh attributes");
+    if (compactVertices) {
+        glVertexAttribPointer(POSITION_LOCATION, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, position));  // NOLINT(performance-no-int-to-ptr)
+        glEnableVertexAttribArray(POSITION_LOCATION);
+        LOGLN ("  Vertex::Location   :" FS(u32), POSITION_LOCATION);
+        LOGLN ("  Vertex::Size       :" FS(i32), 3);
+        LOGLN ("  Vertex::Type       : %s" , STRINGIFY(GL_UNSIGNED_SHORT));
+        LOGLN ("  Vertex::Normalized : %s" , STRINGIFY(GL_TRUE));
+        LOGLN ("  Vertex::Stride     :" FS(usize), sizeof(CompactVertex));
+        LOGLN ("  Vertex::Offset     :" FS(usize), offsetof(CompactVertex, position));
+
+        glVertexAttribPointer(NORMAL_INDEX, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, normal));  // NOLINT(performance-no-int-to-ptr)
+        glEnableVertexAttribArray(NORMAL_INDEX);
+        LOGLN ("  Normal::Location   :" FS(u32), NORMAL_INDEX);
+        LOGLN ("  Normal::Size       :" FS(i32), 2);
+        LOGLN ("  Normal::Type       : %s" , STRINGIFY(GL_SHORT));
+        LOGLN ("  Normal::Normalized : %s" , STRINGIFY(GL_TRUE));
+        LOGLN ("  Normal::Stride     :" FS(usize), sizeof(CompactVertex));
+        LOGLN ("  Normal::Offset     :" FS(usize), offsetof(CompactVertex, normal));
+    } else {
+        glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        glEnableVertexAttribArray(POSITION_LOCATION);
+        LOGLN ("  Vertex::Location   :" FS(u32), POSITION_LOCATION);
+        LOGLN ("  Vertex::Size       :" FS(i32), 3);
+        LOGLN ("  Vertex::Type       : %s" , STRINGIFY(GL_FLOAT));
+        LOGLN ("  Vertex::Normalized : %s" , STRINGIFY(GL_FALSE));
+        LOGLN ("  Vertex::Stride     :" FS(usize), sizeof(Vertex));
+        LOGLN ("  Vertex::Offset     :" FS(u32), 0);
+
+        glVertexAttribPointer(NORMAL_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)sizeof(Position));  // NOLINT(performance-no-int-to-ptr)
+        glEnableVertexAttribArray(NORMAL_INDEX);
+        LOGLN ("  Normal::Location   :" FS(u32), NORMAL_INDEX);
+        LOGLN ("  Normal::Size       :" FS(i32), 3);
+        LOGLN ("  Normal::Type       : %s" , STRINGIFY(GL_FLOAT));
+        LOGLN ("  Normal::Normalized : %s" , STRINGIFY(GL_FALSE));
+        LOGLN ("  Normal::Stride     :" FS(usize), sizeof(Vertex));
+        LOGLN ("  Normal::Offset     :" FS(usize), sizeof(Position));
+    }
+}
+
+/// Points the per instance attributes of the bound vertex array at `Instance`s starting `base` bytes into `buffer`.
+internal void ConfigureInstanceBuffer(const u32 buffer, const usize base) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(MODEL_LOCATION + 0, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)base);
+    glVertexAttribPointer(MODEL_LOCATION + 1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + sizeof(f32) * 4));
+    glVertexAttribPointer(MODEL_LOCATION + 2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + sizeof(f32) * 8));
+    glVertexAttribPointer(MODEL_LOCATION + 3, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + sizeof(f32) * 12));
+    glVertexAttribPointer(ALBEDO_LOCATION   , 3, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + sizeof(f32) * 16));
+    glVertexAttribPointer( ROUGHNESS_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + sizeof(f32) * 19));
+    glVertexAttribPointer(FRESNEL_FACTOR__LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + sizeof(f32) * 20));
+    glEnableVertexAttribArray(MODEL_LOCATION + 0);
+    glEnableVertexAttribArray(MODEL_LOCATION + 1);
+    glEnableVertexAttribArray(MODEL_LOCATION + 2);
+    glEnableVertexAttribArray(MODEL_LOCATION + 3);
+    glEnableVertexAttribArray(ALBEDO_LOCATION);
+    glEnableVertexAttribArray( ROUGHNESS_LOCATION);
+    glEnableVertexAttribArray(FRESNEL_FACTOR__LOCATION);
+    glVertexAttribDivisor(MODEL_LOCATION + 0, 1);
+    glVertexAttribDivisor(MODEL_LOCATION + 1, 1);
+    glVertexAttribDivisor(MODEL_LOCATION + 2, 1);
+    glVertexAttribDivisor(MODEL_LOCATION + 3, 1);
+    glVertexAttribDivisor(MODEL_LOCATION + 0, 1);
+    glVertexAttribDivisor(ALBEDO_LOCATION, 1);
+    glVertexAttribDivisor(ROUGHNESS_LOCATION, 1);
+    glVertexAttribDivisor(FRESNEL_FACTOR__LOCATION, 1);
+
+#ifdef INVERTED_NORMALS
+    glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 0, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)base);
+    glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)(base + sizeof(float) * 4));
+    glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 2, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)(base + sizeof(float) * 8));
+    glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 3, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)(base + sizeof(float) * 12));
+    glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 0);
+    glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 1);
+    glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 2);
+    glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 3);
+    glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 0, 1);
+    glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 1, 1);
+    glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 2, 1);
+    glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 3, 1);
+#endif
+}
+
+/// Instances of every mesh live in their own `MAX_INSTANCES` sized slice of the instance buffer.
+internal void ConfigureInstanceAttributes(const usize meshId) {
+    ConfigureInstanceBuffer(Renderer.instanceVbo, INSTANCE_BASE(meshId));
+}
 
 void RendererInitialize(const RendererConfig config) {
     LOGLNM("Initializing renderer");
@@ -207,129 +301,22 @@ void RendererInitialize(const RendererConfig config) {
         InitializeLighting();
     }
 
+    Renderer.compactVertices = config.compactVertices;
+    Renderer.lodErrorPixels = config.lodErrorPixels;
+    Renderer.viewportHeight = config.viewportHeight;
     Renderer.meshes = AllocateArray(Mesh, config.nMeshes);
-    Renderer.byteOffsets = (Offsets*)malloc(Renderer.meshes.len * sizeof(Offsets));
-
-    usize totalIndexSize = 0;
-    usize totalVertexSize = 0;
-    VERTEX_BYTE_OFFSET(0) = 0;
-    INDEX_BYTE_OFFSET(0) = 0;
-    LOGLN("Loading" FS(usize) ".obj models", Renderer.meshes.len);
-    for (usize i = 0; i < Renderer.meshes.len; i++) {
-        Renderer.meshes.data[i].id = i;
-        LoadOBJ(config.objPaths[i], &OBJ(i));
-        totalIndexSize += OBJ(i).nIndices * sizeof(u16);
-        totalVertexSize += OBJ(i).nVertices * sizeof(Vertex);
-
-        LOGLN("Allocating" FS(usize) "MB for mesh vertices", MB(MAX_INSTANCES * MAX_MESHES * sizeof(Instance)));
-        LOGLN("Allocating" FS(usize) "bytes for mesh indexes", totalIndexSize);
-
-
-        if (i > 0) {
-            VERTEX_BYTE_OFFSET(i) =
-                VERTEX_BYTE_OFFSET(i - 1) // offset by however much the previous object was offset
-                + VERTEX_BYTE_SIZE(i - 1); // and offset by the previous' object data.
-            INDEX_BYTE_OFFSET(i) = INDEX_BYTE_OFFSET(i - 1) + INDEX_BYTE_SIZE(i - 1);
-        }
-    }
+    // Meshes arrive through `UploadMesh` as they finish loading.
+    memset(Renderer.meshes.data, 0, Renderer.meshes.len * sizeof(Mesh));
 
     if (config.useGl) {
-        glCreateBuffers(1, &Renderer.meshVbo);
         glCreateBuffers(1, &Renderer.instanceVbo);
-        glCreateBuffers(1, &Renderer.ebo);
-        glCreateVertexArrays(1, &Renderer.vao);
-
-        glBindVertexArray(Renderer.vao);
-
-        const usize last = Renderer.meshes.len - 1;
-
-        ASSERT_EQ(totalVertexSize, VERTEX_BYTE_OFFSET(last) + VERTEX_BYTE_SIZE(last));
-        ASSERT_EQ(totalIndexSize, INDEX_BYTE_OFFSET(last) + INDEX_BYTE_SIZE(last));
 
         // Allocate instance buffer
-        LOGLN("Allocating" FS(usize) "MB for mesh vertices", MB(MAX_INSTANCES * MAX_MESHES * sizeof(Instance)));
+        LOGLN("Allocating" FS(usize) "MB for mesh instances", MB(MAX_INSTANCES * MAX_MESHES * sizeof(Instance)));
         glBindBuffer(GL_ARRAY_BUFFER, Renderer.instanceVbo);
         glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * MAX_MESHES * sizeof(Instance), NULL, GL_DYNAMIC_DRAW);
 
-        // Allocate model vertex buffer
-        LOGLN("Allocating" FS(usize) "bytes for mesh vertices", totalVertexSize);
-        glBindBuffer(GL_ARRAY_BUFFER, Renderer.meshVbo);
-        glBufferData(GL_ARRAY_BUFFER, totalVertexSize, NULL, GL_STATIC_DRAW);
-        // Allocate model index buffer
-        LOGLN("Allocating" FS(usize) "bytes for mesh indexes", totalIndexSize);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Renderer.ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalIndexSize, NULL, GL_STATIC_DRAW);
-
-        LOGLNM("Uploading meshes to GPU");
-        for (usize i = 0; i < Renderer.meshes.len; i++) {
-            LOGLN("  Mesh" FS(usize) "--" FS(usize) "bytes", i, VERTEX_BYTE_SIZE(i));
-            glBufferSubData(GL_ARRAY_BUFFER, VERTEX_BYTE_OFFSET(i), VERTEX_BYTE_SIZE(i), OBJ(i).vertices);
-            GL_ASSERT_NO_ERROR;
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, INDEX_BYTE_OFFSET(i), INDEX_BYTE_SIZE(i), OBJ(i).indices);
-            GL_ASSERT_NO_ERROR;
-        }
-
-        // Configure vertex array pointers
-
-        // Configure meshes
-        LOGLNM("Configuring mesh attributes");
-        glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        glEnableVertexAttribArray(POSITION_LOCATION);
-        LOGLN ("  Vertex::Location   :" FS(u32), POSITION_LOCATION);
-        LOGLN ("  Vertex::Size       :" FS(i32), 3);
-        LOGLN ("  Vertex::Type       : %s" , STRINGIFY(GL_FLOAT));
-        LOGLN ("  Vertex::Normalized : %s" , STRINGIFY(GL_FALSE));
-        LOGLN ("  Vertex::Stride     :" FS(usize), sizeof(Vertex));
-        LOGLN ("  Vertex::Offset     :" FS(u32), 0);
-
-        glVertexAttribPointer(NORMAL_INDEX, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)sizeof(Position));  // NOLINT(performance-no-int-to-ptr)
-        glEnableVertexAttribArray(NORMAL_INDEX);
-        LOGLN ("  Normal::Location   :" FS(u32), NORMAL_INDEX);
-        LOGLN ("  Normal::Size       :" FS(i32), 3);
-        LOGLN ("  Normal::Type       : %s" , STRINGIFY(GL_FLOAT));
-        LOGLN ("  Normal::Normalized : %s" , STRINGIFY(GL_FALSE));
-        LOGLN ("  Normal::Stride     :" FS(usize), sizeof(Vertex));
-        LOGLN ("  Normal::Offset     :" FS(usize), sizeof(Position));
-
-        // Configure instance parameters
-        glBindBuffer(GL_ARRAY_BUFFER, Renderer.instanceVbo);
-        glVertexAttribPointer(MODEL_LOCATION + 0, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)0);
-        glVertexAttribPointer(MODEL_LOCATION + 1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(sizeof(f32) * 4));
-        glVertexAttribPointer(MODEL_LOCATION + 2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(sizeof(f32) * 8));
-        glVertexAttribPointer(MODEL_LOCATION + 3, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(sizeof(f32) * 12));
-        glVertexAttribPointer(ALBEDO_LOCATION   , 3, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(sizeof(f32) * 16));
-        glVertexAttribPointer( ROUGHNESS_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(sizeof(f32) * 19));
-        glVertexAttribPointer(FRESNEL_FACTOR__LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(sizeof(f32) * 20));
-        glEnableVertexAttribArray(MODEL_LOCATION + 0);
-        glEnableVertexAttribArray(MODEL_LOCATION + 1);
-        glEnableVertexAttribArray(MODEL_LOCATION + 2);
-        glEnableVertexAttribArray(MODEL_LOCATION + 3);
-        glEnableVertexAttribArray(ALBEDO_LOCATION);
-        glEnableVertexAttribArray( ROUGHNESS_LOCATION);
-        glEnableVertexAttribArray(FRESNEL_FACTOR__LOCATION);
-        glVertexAttribDivisor(MODEL_LOCATION + 0, 1);
-        glVertexAttribDivisor(MODEL_LOCATION + 1, 1);
-        glVertexAttribDivisor(MODEL_LOCATION + 2, 1);
-        glVertexAttribDivisor(MODEL_LOCATION + 3, 1);
-        glVertexAttribDivisor(MODEL_LOCATION + 0, 1);
-        glVertexAttribDivisor(ALBEDO_LOCATION, 1);
-        glVertexAttribDivisor(ROUGHNESS_LOCATION, 1);
-        glVertexAttribDivisor(FRESNEL_FACTOR__LOCATION, 1);
-
-    #ifdef INVERTED_NORMALS
-        glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 0, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)0);
-        glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 1, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)(sizeof(float) * 4));
-        glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 2, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)(sizeof(float) * 8));
-        glVertexAttribPointer(TRANSPOSE_INVERSE_MODEL_LOCATION + 3, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4 * 4, (void*)(sizeof(float) * 12));
-        glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 0);
-        glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 1);
-        glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 2);
-        glEnableVertexAttribArray(TRANSPOSE_INVERSE_MODEL_LOCATION + 3);
-        glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 0, 1);
-        glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 1, 1);
-        glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 2, 1);
-        glVertexAttribDivisor(TRANSPOSE_INVERSE_MODEL_LOCATION + 3, 1);
-    #endif
+        glUniform1i(COMPACT_VERTICES_LOCATION, Renderer.compactVertices);
 
         LOGLNM("Enabling depth test");
         glEnable(GL_DEPTH_TEST);
@@ -352,38 +339,237 @@ void RendererInitialize(const RendererConfig config) {
     }
 }
 
+
+/// Texture coordinates live in their own buffer so both vertex formats share them.
+internal void UploadTexCoords(Mesh* const mesh) {
+    glCreateBuffers(1, &mesh->texCoordVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->texCoordVbo);
+    glBufferData(GL_ARRAY_BUFFER, mesh->obj.nVertices * sizeof(TexCoord), mesh->obj.texCoords, GL_STATIC_DRAW);
+    glVertexAttribPointer(TEXCOORD_LOCATION, 2, GL_FLOAT, GL_FALSE, sizeof(TexCoord), (void*)0);
+    glEnableVertexAttribArray(TEXCOORD_LOCATION);
+    GL_ASSERT_NO_ERROR;
+}
+
+/// Uploads every level of the tiled mip chain as is, GL filters between them like `SampleTexture` does.
+internal void UploadAlbedoMap(Mesh* const mesh) {
+    const Texture* const texture = &mesh->albedoTexture;
+    glCreateTextures(GL_TEXTURE_2D, 1, &mesh->albedoMap);
+    glTextureStorage2D(mesh->albedoMap, (i32)texture->nLevels, GL_SRGB8_ALPHA8, (i32)texture->levels[0].width, (i32)texture->levels[0].height);
+    u8* const rgba = malloc((usize)texture->levels[0].width * texture->levels[0].height * 4);
+    if (rgba == NULL) PANIC("Failed to allocate albedo map of mesh" FS(usize), mesh->id);
+    for (u32 level = 0; level < texture->nLevels; level++) {
+        ReadTextureLevel(texture, level, rgba);
+        glTextureSubImage2D(mesh->albedoMap, (i32)level, 0, 0, (i32)texture->levels[level].width, (i32)texture->levels[level].height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    }
+    free(rgba);
+    glTextureParameteri(mesh->albedoMap, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(mesh->albedoMap, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(mesh->albedoMap, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(mesh->albedoMap, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    GL_ASSERT_NO_ERROR;
+}
+
+void UploadMesh(const usize meshId) {
+    Mesh* const mesh = &Renderer.meshes.data[meshId];
+    LOGLN("Uploading mesh" FS(usize) "--" FS(usize) "bytes", meshId, VERTEX_BYTE_SIZE(meshId));
+    const void* const vertices = Renderer.compactVertices
+        ? (const void*)mesh->compact.vertices
+        : (const void*)mesh->obj.vertices;
+
+    glCreateVertexArrays(1, &mesh->vao);
+    glCreateBuffers(1, &mesh->vbo);
+    glCreateBuffers(1, &mesh->ebo);
+    glBindVertexArray(mesh->vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+    glBufferData(GL_ARRAY_BUFFER, VERTEX_BYTE_SIZE(meshId), vertices, GL_STATIC_DRAW);
+    GL_ASSERT_NO_ERROR;
+    // Levels of detail follow the full resolution indices, see `Render`.
+    usize indexByteSize = INDEX_BYTE_SIZE(meshId);
+    for (u32 level = 0; level < mesh->nLods; level++) indexByteSize += mesh->lods[level].nIndices * sizeof(u16);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexByteSize, NULL, GL_STATIC_DRAW);
+    usize indexOffset = 0;
+    for (u32 level = 0; level <= mesh->nLods; level++) {
+        const u16* const indices = level == 0 ? mesh->obj.indices : mesh->lods[level - 1].indices;
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexOffset, LOD_INDEX_COUNT(mesh, level) * sizeof(u16), indices);
+        indexOffset += LOD_INDEX_COUNT(mesh, level) * sizeof(u16);
+    }
+    GL_ASSERT_NO_ERROR;
+
+    ConfigureMeshAttributes(Renderer.compactVertices);
+    if (mesh->obj.texCoords != NULL) UploadTexCoords(mesh);
+    if (mesh->hasAlbedoTexture) UploadAlbedoMap(mesh);
+    ConfigureInstanceAttributes(meshId);
+    GL_ASSERT_NO_ERROR;
+}
+
+void UploadPrimitives(const Primitives* const primitives, const MaterialRaster* const materials) {
+    Vertex vertices[PRIMITIVE_PROXY_MAX_VERTICES];
+    u16 indices[PRIMITIVE_PROXY_MAX_INDICES];
+    for (usize kind = 0; kind < PrimitiveKindCount; kind++) {
+        PrimitiveProxyBatch* const batch = &Renderer.primitiveProxies[kind];
+        const usize nInstances = primitives->counts[kind];
+        if (nInstances == 0) continue;
+        const Obj proxy = PrimitiveProxy((enum PrimitiveKind)kind, vertices, indices);
+        LOGLN("Uploading" FS(usize) "primitive proxies of kind" FS(usize) "--" FS(usize) "triangles each", nInstances, kind, proxy.nIndices / 3);
+
+        Instance* const instances = malloc(nInstances * sizeof(Instance));
+        if (instances == NULL) PANICM("Failed to allocate primitive proxy instances");
+        for (usize i = 0; i < nInstances; i++) {
+            PrimitiveTransform(primitives, (enum PrimitiveKind)kind, i, instances[i].model);
+            instances[i].material = materials[primitives->materials[kind][i]];
+        }
+
+        glCreateVertexArrays(1, &batch->vao);
+        glCreateBuffers(1, &batch->vbo);
+        glCreateBuffers(1, &batch->ebo);
+        glCreateBuffers(1, &batch->instanceVbo);
+        glBindVertexArray(batch->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+        glBufferData(GL_ARRAY_BUFFER, proxy.nVertices * sizeof(Vertex), proxy.vertices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, proxy.nIndices * sizeof(u16), proxy.indices, GL_STATIC_DRAW);
+        ConfigureMeshAttributes(false);
+        glBindBuffer(GL_ARRAY_BUFFER, batch->instanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, nInstances * sizeof(Instance), instances, GL_STATIC_DRAW);
+        ConfigureInstanceBuffer(batch->instanceVbo, 0);
+        free(instances);
+        GL_ASSERT_NO_ERROR;
+
+        batch->nIndices = proxy.nIndices;
+        batch->nInstances = nInstances;
+    }
+}
+
+/// @returns the coarsest level of `mesh` whose error projects to at most `Renderer.lodErrorPixels` for `instance`.
+internal u32 SelectLod(const Mesh* const mesh, const Instance* const instance) {
+    if (mesh->nLods == 0 || Renderer.lodErrorPixels <= 0.f) return 0;
+
+    vec3 center;
+    glm_mat4_mulv3((vec4*)instance->model, (f32*)mesh->center, 1.f, center);
+    const f32 scale = InstanceScale(instance);
+    // Distance to the closest point of the bounding sphere, inside of it only full resolution will do.
+    const f32 distance = glm_vec3_distance(center, Renderer.camera.position) - mesh->radius * scale;
+    if (distance <= 0.f) return 0;
+
+    const f32 pixelsPerUnit = Renderer.perspective[1][1] * 0.5f * (f32)Renderer.viewportHeight / distance;
+    u32 level = 0;
+    while (level < mesh->nLods && mesh->lods[level].error * scale * pixelsPerUnit <= Renderer.lodErrorPixels) level++;
+    return level;
+}
+
+internal u8 InstanceLods[MAX_INSTANCES];
+internal Instance LodOrderedInstances[MAX_INSTANCES];
+
+internal void DrawLevel(const usize nIndices, const usize indexByteOffset, const usize nInstances, const usize firstInstance) {
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, (i32)nIndices, GL_UNSIGNED_SHORT, (const void*)indexByteOffset, (i32)nInstances, (u32)firstInstance);
+    if (Renderer.addWireFrame) {
+        glPolygonMode(GL_FRONT_AND_BACK , GL_LINE); GL_ASSERT_NO_ERROR;
+        glDrawElementsInstancedBaseInstance(GL_TRIANGLES, (i32)nIndices, GL_UNSIGNED_SHORT, (const void*)indexByteOffset, (i32)nInstances, (u32)firstInstance);
+        glPolygonMode(GL_FRONT_AND_BACK , GL_FILL); GL_ASSERT_NO_ERROR;
+    }
+}
+
+/// Proxies always use full precision vertices.
+internal void RenderPrimitiveProxies(void) {
+    glUniform1i(COMPACT_VERTICES_LOCATION, false);
+    glUniform1i(USE_ALBEDO_MAP_LOCATION, false);
+    for (usize kind = 0; kind < PrimitiveKindCount; kind++) {
+        const PrimitiveProxyBatch* const batch = &Renderer.primitiveProxies[kind];
+        if (batch->vao == 0) continue;
+        glBindVertexArray(batch->vao);
+        DrawLevel(batch->nIndices, 0, batch->nInstances, 0);
+    }
+    glUniform1i(COMPACT_VERTICES_LOCATION, Renderer.compactVertices);
+    GL_ASSERT_NO_ERROR;
+}
+
 void Render(void) {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    Renderer.lodStats = (LodStats) { .nTriangles = 0, .nFullTriangles = 0 };
     for (usize meshId = 0; meshId < Renderer.meshes.len; meshId++) {
+        const Mesh* const mesh = &Renderer.meshes.data[meshId];
+        // Still loading.
+        if (mesh->vao == 0) continue;
         GL_ASSERT_NO_ERROR;
-        glDrawElementsInstanced(GL_TRIANGLES, (i32)OBJ(meshId).nIndices, GL_UNSIGNED_SHORT, (const void*)INDEX_BYTE_OFFSET(meshId), N_INSTANCES(meshId));
-        if (Renderer.addWireFrame) {
-            glPolygonMode(GL_FRONT_AND_BACK , GL_LINE); GL_ASSERT_NO_ERROR;
-            glDrawElementsInstanced(GL_TRIANGLES, (i32)OBJ(meshId).nIndices, GL_UNSIGNED_SHORT, (const void*)INDEX_BYTE_OFFSET(meshId), N_INSTANCES(meshId));
-            glPolygonMode(GL_FRONT_AND_BACK , GL_FILL); GL_ASSERT_NO_ERROR;
+        glBindVertexArray(mesh->vao);
+        if (Renderer.compactVertices) {
+            glUniform3fv(MESH_ORIGIN_LOCATION, 1, mesh->compact.origin);
+            glUniform3fv(MESH_EXTENT_LOCATION, 1, mesh->compact.extent);
+        }
+        glUniform1i(USE_ALBEDO_MAP_LOCATION, mesh->albedoMap != 0 && mesh->texCoordVbo != 0);
+        if (mesh->albedoMap != 0) glBindTextureUnit(ALBEDO_MAP_BINDING, mesh->albedoMap);
+
+        // Instances are grouped by level in the instance buffer so every level is a single instanced draw.
+        const usize nInstances = N_INSTANCES(meshId);
+        usize levelCounts[MAX_LODS + 1] = { 0 };
+        usize levelStarts[MAX_LODS + 1] = { 0 };
+        if (mesh->nLods > 0 && Renderer.lodErrorPixels > 0.f) {
+            for (usize i = 0; i < nInstances; i++) {
+                InstanceLods[i] = (u8)SelectLod(mesh, &InstanceStore[meshId][i]);
+                levelCounts[InstanceLods[i]] += 1;
+            }
+            for (u32 level = 1; level <= mesh->nLods; level++) levelStarts[level] = levelStarts[level - 1] + levelCounts[level - 1];
+            usize fill[MAX_LODS + 1];
+            memcpy(fill, levelStarts, sizeof fill);
+            for (usize i = 0; i < nInstances; i++) LodOrderedInstances[fill[InstanceLods[i]]++] = InstanceStore[meshId][i];
+            glBindBuffer(GL_ARRAY_BUFFER, Renderer.instanceVbo);
+            glBufferSubData(GL_ARRAY_BUFFER, INSTANCE_BASE(meshId), nInstances * sizeof(Instance), LodOrderedInstances);
+        } else {
+            levelCounts[0] = nInstances;
         }
+
+        usize indexByteOffset = 0;
+        for (u32 level = 0; level <= mesh->nLods; level++) {
+            const usize nIndices = LOD_INDEX_COUNT(mesh, level);
+            if (levelCounts[level] > 0) DrawLevel(nIndices, indexByteOffset, levelCounts[level], levelStarts[level]);
+            Renderer.lodStats.nTriangles += levelCounts[level] * nIndices / 3;
+            indexByteOffset += nIndices * sizeof(u16);
+        }
+        Renderer.lodStats.nFullTriangles += nInstances * OBJ(meshId).nIndices / 3;
         GL_ASSERT_NO_ERROR;
 	}
+    RenderPrimitiveProxies();
 }
 
 void ToggleWireFrame(void) {
     Renderer.addWireFrame = !Renderer.addWireFrame;
 }
 
-#undef VERTEX_BYTE_OFFSET
-#undef INDEX_BYTE_OFFSET
 #undef VERTEX_BYTE_SIZE
+#undef VERTEX_SIZE
 #undef INDEX_BYTE_SIZE
+#undef LOD_INDEX_COUNT
 
 void RendererDrop(void) {
     LOGLNM("Dropping renderer");
 
     LOGLN("Freeing" FS(usize) ".obj models", Renderer.meshes.len);
     for (usize i = 0; i < Renderer.meshes.len; i++) {
-        FreeOBJ(OBJ(i));
+        Mesh* const mesh = &Renderer.meshes.data[i];
+        if (mesh->vao != 0) {
+            glDeleteVertexArrays(1, &mesh->vao);
+            glDeleteBuffers(1, &mesh->vbo);
+            glDeleteBuffers(1, &mesh->ebo);
+            if (mesh->texCoordVbo != 0) glDeleteBuffers(1, &mesh->texCoordVbo);
+            if (mesh->albedoMap != 0) glDeleteTextures(1, &mesh->albedoMap);
+        }
+        if (mesh->hasAlbedoTexture) CloseTexture(&mesh->albedoTexture);
+        for (u32 level = 0; level < mesh->nLods; level++) FreeLOD(mesh->lods[level]);
+        FreeOBJ(mesh->obj);
+        if (Renderer.compactVertices) DropArena(&mesh->arena);
     }
     FreeArray(Renderer.meshes);
-    free(Renderer.byteOffsets);
+    for (usize kind = 0; kind < PrimitiveKindCount; kind++) {
+        PrimitiveProxyBatch* const batch = &Renderer.primitiveProxies[kind];
+        if (batch->vao == 0) continue;
+        glDeleteVertexArrays(1, &batch->vao);
+        glDeleteBuffers(1, &batch->vbo);
+        glDeleteBuffers(1, &batch->ebo);
+        glDeleteBuffers(1, &batch->instanceVbo);
+        *batch = (PrimitiveProxyBatch) { 0 };
+    }
 }
 
 void CreateInstance(Transform* const transform, const MaterialRaster* const material, Instance* const Instance) {
@@ -426,6 +612,12 @@ void AddInstances(const usize meshId, const Instances instances) {
     InstanceStoreLen[meshId] += instances.len;
 }
 
+f32 InstanceScale(const Instance* const instance) {
+    return sqrtf(glm_max(
+        glm_max(glm_vec3_norm2((f32*)instance->model[0]), glm_vec3_norm2((f32*)instance->model[1])),
+        glm_vec3_norm2((f32*)instance->model[2])));
+}
+
 Instance* GetInstance(const usize meshId, const usize instanceId) {
     return &InstanceStore[meshId][instanceId];
 }
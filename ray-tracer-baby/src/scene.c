@@ -0,0 +1,217 @@
+#include "scene.h"
+
+#include <stddef.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "attributes.h"
+#include "profiler.h"
+
+void SceneNxN(const Instances instances, const usize n) {
+    const isize h = n / 2;
+    MaterialRaster _;
+    Transform transform;
+    for (usize i = 0; i < n * n; i++) {
+        const f32 norm = (f32)i / (f32)(n * n);
+        const isize xi = i % n - h;
+        const isize yi = (i / n) % n - h;
+        const isize zi = -1;
+
+        glm_vec3_copy((vec3) { (f32)xi, (f32)yi, (f32)zi + 0.3 }, transform.translation);
+        glm_vec3_copy((vec3) { 0.f, norm * M_PI, 0.f }, transform.rotation);
+        glm_vec3_copy((vec3) { 0.3f, 0.3f, 0.3f }, transform.scale);
+        CreateInstance(
+            &transform,
+            &_,
+            &instances.data[i]
+        );
+    }
+}
+
+usize MeshSceneArenaSize(const Obj* const obj) {
+    return obj->nVertices * sizeof(Position) + sizeof(f32) + obj->nIndices * sizeof(u32) + 2 * 16;
+}
+
+/// Positions come from `compact` when given, otherwise from `obj`.
+internal RTCScene BuildMeshScene(
+    const RTCDevice device,
+    const Obj* const obj,
+    const CompactMesh* const compact,
+    Arena* const arena,
+    const bool commit
+) {
+    RTCScene meshScene = rtcNewScene(device);
+    RTCGeometry mesh = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+
+    ASSERT_EQ(obj->nIndices % 3, 0);
+
+    Position* positions;
+    u32(*indices)[3];
+    if (arena != NULL) {
+        LOGLNM("Sharing arena buffers with embree");
+        // Embree reads vertices with 16 byte loads, pad past the last one.
+        positions = ArenaPush(arena, obj->nVertices * sizeof(Position) + sizeof(f32), 16);
+        indices = ArenaPush(arena, obj->nIndices * sizeof(u32), 16);
+        rtcSetSharedGeometryBuffer(mesh, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, positions, 0, sizeof(Position), obj->nVertices);
+        rtcSetSharedGeometryBuffer(mesh, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, indices, 0, 3 * sizeof(u32), obj->nIndices / 3);
+    } else {
+        LOGLNM("Allocating embree positions");
+        positions = (Position*)rtcSetNewGeometryBuffer(
+            mesh,
+            RTC_BUFFER_TYPE_VERTEX,
+            0,
+            RTC_FORMAT_FLOAT3,
+            sizeof(Position),
+            obj->nVertices
+        );
+
+        LOGLNM("Allocating embree indices");
+        indices = (u32(*)[3])rtcSetNewGeometryBuffer(
+            mesh,
+            RTC_BUFFER_TYPE_INDEX,
+            0,
+            RTC_FORMAT_UINT3,
+            3 * sizeof(u32),
+            obj->nIndices / 3
+        );
+    }
+
+    if (compact != NULL) ASSERT_EQ(compact->nVertices, obj->nVertices);
+    for (usize i = 0; i < obj->nVertices; i++) {
+        vec3 position;
+        MeshPosition(obj, compact, i, position);
+        positions[i] = (Position) { position[0], position[1], position[2] };
+    }
+
+    for (usize i = 0; i < obj->nIndices / 3; i++) {
+        indices[i][0] = obj->indices[3 * i + 0];
+        indices[i][1] = obj->indices[3 * i + 1];
+        indices[i][2] = obj->indices[3 * i + 2];
+    }
+
+    rtcCommitGeometry(mesh);
+
+    // Attach the geometry to the scene
+    rtcAttachGeometry(meshScene, mesh);
+    rtcReleaseGeometry(mesh);
+    if (!commit) return meshScene;
+    PROFILE_BEGIN(commitStart);
+    rtcCommitScene(meshScene);
+    PROFILE_END("commit BLAS", commitStart);
+    return meshScene;
+}
+
+RTCScene CreateMeshScene(const RTCDevice device, const Obj* const obj, Arena* const arena) {
+    return BuildMeshScene(device, obj, NULL, arena, true);
+}
+
+RTCScene CreateCompactMeshScene(const RTCDevice device, const Obj* const obj, const CompactMesh* const compact, Arena* const arena) {
+    return BuildMeshScene(device, obj, compact, arena, true);
+}
+
+RTCScene CreateUncommittedMeshScene(const RTCDevice device, const Obj* const obj, const CompactMesh* const compact, Arena* const arena) {
+    return BuildMeshScene(device, obj, compact, arena, false);
+}
+
+u32 AttachInstances(const RTCDevice device, const RTCScene scene, const RTCScene meshScene, const Instances instances) {
+    u32 firstId = RTC_INVALID_GEOMETRY_ID;
+    for (usize i = 0; i < instances.len; i++) {
+        RTCGeometry geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE);
+        rtcSetGeometryInstancedScene(geometry, meshScene);
+        rtcSetGeometryTransform(
+            geometry,
+            0,
+            RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+            instances.data[i].model
+        );
+        rtcCommitGeometry(geometry);
+        const u32 geomId = rtcAttachGeometry(scene, geometry);
+        if (i == 0) firstId = geomId;
+        rtcReleaseGeometry(geometry);
+    }
+    return firstId;
+}
+
+void UpdateInstances(const RTCScene scene, const u32 firstId, const Instances instances) {
+    for (usize i = 0; i < instances.len; i++) {
+        RTCGeometry geometry = rtcGetGeometry(scene, firstId + (u32)i);
+        rtcSetGeometryTransform(
+            geometry,
+            0,
+            RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+            instances.data[i].model
+        );
+        rtcCommitGeometry(geometry);
+    }
+}
+
+RTCScene CreateInstanceScene(const RTCDevice device, const RTCScene meshScene, const Instances instances) {
+    RTCScene scene = rtcNewScene(device);
+
+    // Create Embree instnaces
+    AttachInstances(device, scene, meshScene, instances);
+
+    // Commit the scene
+    PROFILE_BEGIN(commitStart);
+    rtcCommitScene(scene);
+    PROFILE_END("commit TLAS", commitStart);
+    return scene;
+}
+
+usize PrimitiveSceneArenaSize(const Primitives* const primitives) {
+    const usize nQuads = primitives->counts[PrimitiveKindQuad];
+    return nQuads * 4 * sizeof(Position) + sizeof(f32) + nQuads * 4 * sizeof(u32) + 2 * 16;
+}
+
+internal RTCGeometry CreatePrimitiveGeometry(const RTCDevice device, const Primitives* const primitives, const enum PrimitiveKind kind, Arena* const arena) {
+    const usize n = primitives->counts[kind];
+    RTCGeometry geometry;
+    switch (kind) {
+        case PrimitiveKindSphere:
+            geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_SPHERE_POINT);
+            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, primitives->spheres, 0, sizeof(SpherePrimitive), n);
+            break;
+        case PrimitiveKindDisc:
+            geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_ORIENTED_DISC_POINT);
+            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT4, primitives->discs, 0, sizeof(DiscPrimitive), n);
+            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_NORMAL, 0, RTC_FORMAT_FLOAT3, primitives->discs, offsetof(DiscPrimitive, normal), sizeof(DiscPrimitive), n);
+            break;
+        case PrimitiveKindQuad: {
+            geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_QUAD);
+            // Embree reads vertices with 16 byte loads, pad past the last one.
+            Position* const corners = ArenaPush(arena, n * 4 * sizeof(Position) + sizeof(f32), 16);
+            u32(*const indices)[4] = ArenaPush(arena, n * 4 * sizeof(u32), 16);
+            for (usize i = 0; i < n; i++) {
+                const QuadPrimitive* const quad = &primitives->quads[i];
+                const Position o = quad->origin, u = quad->edgeU, v = quad->edgeV;
+                corners[4 * i + 0] = o;
+                corners[4 * i + 1] = (Position) { o.x + u.x, o.y + u.y, o.z + u.z };
+                corners[4 * i + 2] = (Position) { o.x + u.x + v.x, o.y + u.y + v.y, o.z + u.z + v.z };
+                corners[4 * i + 3] = (Position) { o.x + v.x, o.y + v.y, o.z + v.z };
+                for (u32 k = 0; k < 4; k++) indices[i][k] = (u32)(4 * i) + k;
+            }
+            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, corners, 0, sizeof(Position), 4 * n);
+            rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT4, indices, 0, 4 * sizeof(u32), n);
+        } break;
+        default: PANIC("Unknown primitive kind" FS(u32), (u32)kind);
+    }
+    rtcCommitGeometry(geometry);
+    return geometry;
+}
+
+void AttachPrimitives(const RTCDevice device, const RTCScene* const scenes, const usize nScenes, Primitives* const primitives, Arena* const arena) {
+    for (usize kind = 0; kind < PrimitiveKindCount; kind++) {
+        primitives->geomIds[kind] = RTC_INVALID_GEOMETRY_ID;
+        if (primitives->counts[kind] == 0) continue;
+
+        const RTCGeometry geometry = CreatePrimitiveGeometry(device, primitives, (enum PrimitiveKind)kind, arena);
+        for (usize s = 0; s < nScenes; s++) {
+            const u32 geomId = rtcAttachGeometry(scenes[s], geometry);
+            if (s == 0) primitives->geomIds[kind] = geomId;
+            else if (geomId != primitives->geomIds[kind]) PANIC("Primitive geometry id" FS(u32) "differs between scenes", geomId);
+        }
+        rtcReleaseGeometry(geometry);
+        LOGLN("Attached" FS(usize) "primitives of kind" FS(usize) "as geometry" FS(u32), primitives->counts[kind], kind, primitives->geomIds[kind]);
+    }
+}
@@ -0,0 +1,379 @@
+#include "texture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+#include <cmm/cmm.h>
+
+#include "profiler.h"
+
+#define TEXTURE_MAGIC "RTBTILE"
+#define TEXTURE_KEY_MULTIPLIER 0x9E3779B97F4A7C15ull
+
+internal atomic_uint NextTextureId = 1;
+
+COMMENT(--------========[ Conversion ]========--------)
+
+internal f32 SrgbToLinear(const f32 c) {
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+internal u8 LinearToSrgb(f32 c) {
+    c = glm_clamp(c, 0.f, 1.f);
+    const f32 encoded = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.f / 2.4f) - 0.055f;
+    return (u8)(encoded * 255.f + 0.5f);
+}
+
+internal u32 MinU32(const u32 a, const u32 b) {
+    return a < b ? a : b;
+}
+
+internal bool TiledTextureUpToDate(const char* const imagePath, const char* const tiledPath) {
+    struct stat image, tiled;
+    if (stat(tiledPath, &tiled) != 0 || stat(imagePath, &image) != 0) return false;
+    return tiled.st_mtime >= image.st_mtime;
+}
+
+internal u32 BuildLevelTable(const u32 width, const u32 height, TextureLevel* const levels) {
+    u32 nLevels = 0;
+    u64 nTiles = 0;
+    u32 w = width, h = height;
+    while (nLevels < TEXTURE_MAX_LEVELS) {
+        const u32 tilesX = (w + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        const u32 tilesY = (h + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        levels[nLevels++] = (TextureLevel) { .width = w, .height = h, .tilesX = tilesX, .tilesY = tilesY, .firstTile = nTiles };
+        nTiles += (u64)tilesX * tilesY;
+        if (w == 1 && h == 1) break;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return nLevels;
+}
+
+/// 2x2 box filter of linear RGBA `source` into the next level, odd edges drop their last row or column.
+internal void Downsample(const f32* const source, const TextureLevel* const from, f32* const destination, const TextureLevel* const to) {
+    for (u32 y = 0; y < to->height; y++) {
+        const u32 y0 = MinU32(2 * y, from->height - 1), y1 = MinU32(2 * y + 1, from->height - 1);
+        for (u32 x = 0; x < to->width; x++) {
+            const u32 x0 = MinU32(2 * x, from->width - 1), x1 = MinU32(2 * x + 1, from->width - 1);
+            for (u32 c = 0; c < 4; c++) {
+                destination[(y * to->width + x) * 4 + c] = 0.25f * (
+                    source[(y0 * from->width + x0) * 4 + c] + source[(y0 * from->width + x1) * 4 + c] +
+                    source[(y1 * from->width + x0) * 4 + c] + source[(y1 * from->width + x1) * 4 + c]);
+            }
+        }
+    }
+}
+
+internal void WriteTiles(const f32* const texels, const TextureLevel* const level, u8* const tiles) {
+    for (u32 tileY = 0; tileY < level->tilesY; tileY++) {
+        for (u32 tileX = 0; tileX < level->tilesX; tileX++) {
+            u8* const tile = tiles + (level->firstTile + tileY * level->tilesX + tileX) * TEXTURE_TILE_BYTES;
+            for (u32 y = 0; y < TEXTURE_TILE_SIZE; y++) {
+                const u32 sy = MinU32(tileY * TEXTURE_TILE_SIZE + y, level->height - 1);
+                for (u32 x = 0; x < TEXTURE_TILE_SIZE; x++) {
+                    const u32 sx = MinU32(tileX * TEXTURE_TILE_SIZE + x, level->width - 1);
+                    const f32* const texel = &texels[(sy * level->width + sx) * 4];
+                    u8* const destination = &tile[(y * TEXTURE_TILE_SIZE + x) * 4];
+                    destination[0] = LinearToSrgb(texel[0]);
+                    destination[1] = LinearToSrgb(texel[1]);
+                    destination[2] = LinearToSrgb(texel[2]);
+                    destination[3] = (u8)(glm_clamp(texel[3], 0.f, 1.f) * 255.f + 0.5f);
+                }
+            }
+        }
+    }
+}
+
+bool ConvertTexture(const char* const imagePath, const char* const tiledPath) {
+    if (TiledTextureUpToDate(imagePath, tiledPath)) return false;
+    PROFILE_BEGIN(convertStart);
+
+    i32 width, height, nChannels;
+    u8* const image = stbi_load(imagePath, &width, &height, &nChannels, 4);
+    if (image == NULL) PANIC("Failed to load %s: %s", imagePath, stbi_failure_reason());
+
+    TextureHeader header = { .version = TEXTURE_VERSION };
+    memcpy(header.magic, TEXTURE_MAGIC, sizeof header.magic);
+    header.nLevels = BuildLevelTable((u32)width, (u32)height, header.levels);
+    const TextureLevel* const last = &header.levels[header.nLevels - 1];
+    const u64 nTiles = last->firstTile + (u64)last->tilesX * last->tilesY;
+
+    // Filtering happens in linear space, only the stored tiles are sRGB.
+    f32 srgbToLinear[256];
+    for (usize i = 0; i < 256; i++) srgbToLinear[i] = SrgbToLinear((f32)i / 255.f);
+    // Levels are clamped to at least one texel, so a level 1 of an image one texel wide is more than a quarter of it.
+    const TextureLevel* const second = &header.levels[header.nLevels > 1 ? 1 : 0];
+    f32* level = malloc((usize)width * height * 4 * sizeof(f32));
+    f32* next = malloc((usize)second->width * second->height * 4 * sizeof(f32));
+    u8* const tiles = malloc(nTiles * TEXTURE_TILE_BYTES);
+    if (level == NULL || next == NULL || tiles == NULL) PANIC("Failed to allocate tiles of %s", imagePath);
+    for (usize i = 0; i < (usize)width * height; i++) {
+        for (usize c = 0; c < 3; c++) level[i * 4 + c] = srgbToLinear[image[i * 4 + c]];
+        level[i * 4 + 3] = (f32)image[i * 4 + 3] / 255.f;
+    }
+    stbi_image_free(image);
+
+    for (u32 l = 0; l < header.nLevels; l++) {
+        if (l > 0) {
+            Downsample(level, &header.levels[l - 1], next, &header.levels[l]);
+            f32* const swap = level;
+            level = next;
+            next = swap;
+        }
+        WriteTiles(level, &header.levels[l], tiles);
+    }
+    free(level);
+    free(next);
+
+    char temporaryPath[4096];
+    snprintf(temporaryPath, sizeof temporaryPath, "%s.%d.%lu.tmp", tiledPath, (i32)getpid(), (unsigned long)pthread_self());
+    FILE* const file = fopen(temporaryPath, "wb");
+    if (file == NULL) PANIC("Failed to open %s: %s", temporaryPath, strerror(errno));
+    const bool written = fwrite(&header, sizeof header, 1, file) == 1
+        && fwrite(tiles, TEXTURE_TILE_BYTES, nTiles, file) == nTiles
+        && fflush(file) == 0;
+    fclose(file);
+    free(tiles);
+    if (!written) PANIC("Failed to write %s", temporaryPath);
+    // Loader threads converting the same image race only on which identical file ends up in place.
+    if (rename(temporaryPath, tiledPath) != 0) PANIC("Failed to replace %s: %s", tiledPath, strerror(errno));
+
+    PROFILE_END("texture convert", convertStart);
+    LOGLN("Tiled %s into" FS(u32) "levels," FS(u64) "tiles", imagePath, header.nLevels, nTiles);
+    return true;
+}
+
+COMMENT(--------========[ Texture files ]========--------)
+
+internal off_t TileOffset(const u64 tile) {
+    return (off_t)(sizeof(TextureHeader) + tile * TEXTURE_TILE_BYTES);
+}
+
+internal void ReadTile(const Texture* const texture, const u64 tile, u8* const texels) {
+    if (pread(texture->fd, texels, TEXTURE_TILE_BYTES, TileOffset(tile)) != TEXTURE_TILE_BYTES) {
+        PANIC("Failed to read tile" FS(u64) "of texture" FS(u32) ": %s", tile, texture->id, strerror(errno));
+    }
+}
+
+void OpenTexture(const char* const tiledPath, Texture* const texture) {
+    const i32 fd = open(tiledPath, O_RDONLY);
+    if (fd < 0) PANIC("Failed to open %s: %s", tiledPath, strerror(errno));
+    TextureHeader header;
+    if (pread(fd, &header, sizeof header, 0) != sizeof header) PANIC("Truncated texture %s", tiledPath);
+    if (memcmp(header.magic, TEXTURE_MAGIC, sizeof header.magic) != 0) PANIC("%s is not a tiled texture", tiledPath);
+    if (header.version != TEXTURE_VERSION) PANIC("Unsupported texture version" FS(u32), header.version);
+
+    *texture = (Texture) {
+        .fd = fd,
+        .id = atomic_fetch_add_explicit(&NextTextureId, 1, memory_order_relaxed),
+        .nLevels = header.nLevels,
+    };
+    memcpy(texture->levels, header.levels, sizeof texture->levels);
+}
+
+void CloseTexture(Texture* const texture) {
+    close(texture->fd);
+    texture->fd = -1;
+}
+
+void ReadTextureLevel(const Texture* const texture, const u32 level, u8* const rgba) {
+    const TextureLevel* const l = &texture->levels[level];
+    u8 tile[TEXTURE_TILE_BYTES];
+    for (u32 tileY = 0; tileY < l->tilesY; tileY++) {
+        for (u32 tileX = 0; tileX < l->tilesX; tileX++) {
+            ReadTile(texture, l->firstTile + tileY * l->tilesX + tileX, tile);
+            const u32 width = MinU32(TEXTURE_TILE_SIZE, l->width - tileX * TEXTURE_TILE_SIZE);
+            const u32 height = MinU32(TEXTURE_TILE_SIZE, l->height - tileY * TEXTURE_TILE_SIZE);
+            for (u32 y = 0; y < height; y++) {
+                memcpy(&rgba[((usize)(tileY * TEXTURE_TILE_SIZE + y) * l->width + tileX * TEXTURE_TILE_SIZE) * 4],
+                    &tile[y * TEXTURE_TILE_SIZE * 4], width * 4);
+            }
+        }
+    }
+}
+
+COMMENT(--------========[ Cache ]========--------)
+
+void CreateTextureCache(TextureCache* const cache, const usize capacityBytes) {
+    usize nSlots = capacityBytes / TEXTURE_TILE_BYTES / TEXTURE_CACHE_SHARDS;
+    if (nSlots == 0) nSlots = 1;
+    usize nBuckets = 1;
+    while (nBuckets < nSlots) nBuckets *= 2;
+
+    for (usize s = 0; s < TEXTURE_CACHE_SHARDS; s++) {
+        TextureCacheShard* const shard = &cache->shards[s];
+        *shard = (TextureCacheShard) {
+            .nSlots = nSlots,
+            .keys = malloc(nSlots * sizeof(u64)),
+            .next = malloc(nSlots * sizeof(u32)),
+            .buckets = malloc(nBuckets * sizeof(u32)),
+            .nBuckets = nBuckets,
+            .referenced = calloc(nSlots, sizeof(u8)),
+            .texels = malloc(nSlots * TEXTURE_TILE_BYTES),
+        };
+        if (shard->keys == NULL || shard->next == NULL || shard->buckets == NULL || shard->referenced == NULL || shard->texels == NULL) {
+            PANICM("Failed to allocate texture cache");
+        }
+        for (usize b = 0; b < nBuckets; b++) shard->buckets[b] = (u32)nSlots;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    for (usize i = 0; i < 256; i++) cache->srgbToLinear[i] = SrgbToLinear((f32)i / 255.f);
+    LOGLN("Texture cache of" FS(usize) "tiles," FS(usize) "KiB", nSlots * TEXTURE_CACHE_SHARDS, nSlots * TEXTURE_CACHE_SHARDS * TEXTURE_TILE_BYTES / 1024);
+}
+
+void DestroyTextureCache(TextureCache* const cache) {
+    for (usize s = 0; s < TEXTURE_CACHE_SHARDS; s++) {
+        TextureCacheShard* const shard = &cache->shards[s];
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->keys);
+        free(shard->next);
+        free(shard->buckets);
+        free(shard->referenced);
+        free(shard->texels);
+    }
+}
+
+internal u64 TileKey(const Texture* const texture, const u32 level, const u32 tile) {
+    return ((u64)texture->id << 40) | ((u64)level << 32) | tile;
+}
+
+internal usize BucketOf(const TextureCacheShard* const shard, const u64 hash) {
+    return (usize)(hash >> 20) & (shard->nBuckets - 1);
+}
+
+internal void UnlinkSlot(TextureCacheShard* const shard, const u32 slot) {
+    u32* link = &shard->buckets[BucketOf(shard, shard->keys[slot] * TEXTURE_KEY_MULTIPLIER)];
+    while (*link != slot) link = &shard->next[*link];
+    *link = shard->next[slot];
+}
+
+/// Looks up or pages in a tile, the shard has to be locked. The texels stay valid until the shard is unlocked.
+internal const u8* ResidentTile(TextureCacheShard* const shard, const Texture* const texture, const u64 key, const u64 hash, const u64 tile) {
+    const usize bucket = BucketOf(shard, hash);
+    for (u32 slot = shard->buckets[bucket]; slot != shard->nSlots; slot = shard->next[slot]) {
+        if (shard->keys[slot] == key) {
+            shard->referenced[slot] = 1;
+            shard->hits++;
+            return &shard->texels[(usize)slot * TEXTURE_TILE_BYTES];
+        }
+    }
+
+    shard->misses++;
+    u32 slot;
+    if (shard->nResident < shard->nSlots) {
+        slot = (u32)shard->nResident++;
+    } else {
+        // CLOCK: the first tile not referenced since the hand last passed it.
+        while (shard->referenced[shard->hand]) {
+            shard->referenced[shard->hand] = 0;
+            shard->hand = (shard->hand + 1) % shard->nSlots;
+        }
+        slot = (u32)shard->hand;
+        shard->hand = (shard->hand + 1) % shard->nSlots;
+        UnlinkSlot(shard, slot);
+    }
+    u8* const texels = &shard->texels[(usize)slot * TEXTURE_TILE_BYTES];
+    ReadTile(texture, tile, texels);
+    shard->keys[slot] = key;
+    shard->next[slot] = shard->buckets[bucket];
+    shard->buckets[bucket] = slot;
+    shard->referenced[slot] = 1;
+    return texels;
+}
+
+/// Keeps the shard of the last fetched tile locked so neighbouring texels of a footprint share one lookup.
+typedef struct {
+    TextureCacheShard* shard;
+    u64 key;
+    const u8* texels;
+} TileCursor;
+
+internal void ReleaseTile(TileCursor* const cursor) {
+    if (cursor->shard != NULL) pthread_mutex_unlock(&cursor->shard->lock);
+    cursor->shard = NULL;
+}
+
+internal void FetchTexel(TextureCache* const cache, const Texture* const texture, const u32 level, const u32 x, const u32 y, TileCursor* const cursor, vec3 rgb) {
+    const TextureLevel* const l = &texture->levels[level];
+    const u32 tile = (y / TEXTURE_TILE_SIZE) * l->tilesX + x / TEXTURE_TILE_SIZE;
+    const u64 key = TileKey(texture, level, tile);
+    if (cursor->shard == NULL || cursor->key != key) {
+        ReleaseTile(cursor);
+        const u64 hash = key * TEXTURE_KEY_MULTIPLIER;
+        cursor->shard = &cache->shards[hash >> 60];
+        cursor->key = key;
+        pthread_mutex_lock(&cursor->shard->lock);
+        cursor->texels = ResidentTile(cursor->shard, texture, key, hash, l->firstTile + tile);
+    }
+    const u8* const texel = &cursor->texels[((y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE) * 4];
+    rgb[0] = cache->srgbToLinear[texel[0]];
+    rgb[1] = cache->srgbToLinear[texel[1]];
+    rgb[2] = cache->srgbToLinear[texel[2]];
+}
+
+internal u32 Wrap(const i64 i, const u32 n) {
+    const i64 wrapped = i % (i64)n;
+    return (u32)(wrapped < 0 ? wrapped + n : wrapped);
+}
+
+internal void SampleLevel(TextureCache* const cache, const Texture* const texture, const u32 level, const f32 u, const f32 v, TileCursor* const cursor, vec3 rgb) {
+    const TextureLevel* const l = &texture->levels[level];
+    const f32 x = u * (f32)l->width - 0.5f;
+    const f32 y = (1.f - v) * (f32)l->height - 0.5f;
+    const f32 fx = floorf(x), fy = floorf(y);
+    const f32 tx = x - fx, ty = y - fy;
+    const u32 x0 = Wrap((i64)fx, l->width), x1 = Wrap((i64)fx + 1, l->width);
+    const u32 y0 = Wrap((i64)fy, l->height), y1 = Wrap((i64)fy + 1, l->height);
+
+    vec3 c00, c10, c01, c11;
+    FetchTexel(cache, texture, level, x0, y0, cursor, c00);
+    FetchTexel(cache, texture, level, x1, y0, cursor, c10);
+    FetchTexel(cache, texture, level, x0, y1, cursor, c01);
+    FetchTexel(cache, texture, level, x1, y1, cursor, c11);
+    glm_vec3_lerp(c00, c10, tx, c00);
+    glm_vec3_lerp(c01, c11, tx, c01);
+    glm_vec3_lerp(c00, c01, ty, rgb);
+}
+
+void SampleTexture(TextureCache* const cache, const Texture* const texture, f32 u, f32 v, f32 lod, vec3 rgb) {
+    if (!isfinite(u) || !isfinite(v)) u = v = 0.f;
+    // Keeps the integer texel coordinates in range for any repetition count.
+    u -= floorf(u);
+    v -= floorf(v);
+    lod = glm_clamp(isfinite(lod) ? lod : 0.f, 0.f, (f32)(texture->nLevels - 1));
+    const u32 level = (u32)lod;
+    const f32 t = lod - (f32)level;
+
+    TileCursor cursor = { 0 };
+    SampleLevel(cache, texture, level, u, v, &cursor, rgb);
+    if (t > 0.f && level + 1 < texture->nLevels) {
+        vec3 coarser;
+        SampleLevel(cache, texture, level + 1, u, v, &cursor, coarser);
+        glm_vec3_lerp(rgb, coarser, t, rgb);
+    }
+    ReleaseTile(&cursor);
+}
+
+void GetTextureCacheStats(TextureCache* const cache, TextureCacheStats* const stats) {
+    *stats = (TextureCacheStats) { 0 };
+    for (usize s = 0; s < TEXTURE_CACHE_SHARDS; s++) {
+        TextureCacheShard* const shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->residentBytes += shard->nResident * TEXTURE_TILE_BYTES;
+        stats->capacityBytes += shard->nSlots * TEXTURE_TILE_BYTES;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,123 @@
+// CPU sets and `pthread_setaffinity_np` are GNU extensions.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "topology.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cmm/cmm.h>
+
+/// Calls `visit(user, id)` for every id of a kernel list like `0-3,8-11`, as found in `cpulist` files.
+///
+/// @returns false when `path` can not be read.
+internal bool ReadIdList(const char* const path, void (*const visit)(void* user, u32 id), void* const user) {
+    FILE* const file = fopen(path, "r");
+    if (file == NULL) return false;
+    char line[4096];
+    const bool read = fgets(line, sizeof line, file) != NULL;
+    fclose(file);
+    if (!read) return false;
+
+    const char* cursor = line;
+    while (*cursor != '\0' && *cursor != '\n') {
+        char* end;
+        const u32 first = (u32)strtoul(cursor, &end, 10);
+        if (end == cursor) break;
+        u32 last = first;
+        if (*end == '-') {
+            cursor = end + 1;
+            last = (u32)strtoul(cursor, &end, 10);
+        }
+        for (u32 id = first; id <= last; id++) visit(user, id);
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+typedef struct {
+    CpuTopology* topology;
+    const cpu_set_t* allowed;
+} CpuVisit;
+
+internal void AddCpu(void* const user, const u32 cpu) {
+    CpuVisit* const visit = user;
+    CpuTopology* const topology = visit->topology;
+    if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, visit->allowed) || topology->nCpus == TOPOLOGY_MAX_CPUS) return;
+    topology->cpus[topology->nCpus++] = cpu;
+}
+
+typedef struct {
+    u32 ids[TOPOLOGY_MAX_NODES];
+    usize nIds;
+} NodeIds;
+
+internal void AddNodeId(void* const user, const u32 id) {
+    NodeIds* const nodes = user;
+    if (nodes->nIds < TOPOLOGY_MAX_NODES) nodes->ids[nodes->nIds++] = id;
+}
+
+void DetectCpuTopology(CpuTopology* const topology) {
+    topology->nCpus = 0;
+    topology->nNodes = 0;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (0 != sched_getaffinity(0, sizeof allowed, &allowed)) {
+        const long nOnline = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < nOnline && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &allowed);
+    }
+    CpuVisit visit = { .topology = topology, .allowed = &allowed };
+
+    NodeIds nodes = { .nIds = 0 };
+    if (ReadIdList("/sys/devices/system/node/online", AddNodeId, &nodes)) {
+        for (usize i = 0; i < nodes.nIds; i++) {
+            char path[64];
+            snprintf(path, sizeof path, "/sys/devices/system/node/node%u/cpulist", nodes.ids[i]);
+            const usize firstCpu = topology->nCpus;
+            if (!ReadIdList(path, AddCpu, &visit) || topology->nCpus == firstCpu) continue;
+            // Memory only nodes are skipped, so node indices stay dense.
+            const usize node = topology->nNodes++;
+            topology->nodeIds[node] = nodes.ids[i];
+            topology->nodeFirstCpu[node] = firstCpu;
+            topology->nodeCpus[node] = topology->nCpus - firstCpu;
+        }
+    }
+
+    if (topology->nNodes == 0) {
+        topology->nCpus = 0;
+        for (u32 cpu = 0; cpu < CPU_SETSIZE; cpu++) AddCpu(&visit, cpu);
+        // Not even the affinity mask tells anything, run wherever the scheduler likes.
+        if (topology->nCpus == 0) topology->cpus[topology->nCpus++] = 0;
+        topology->nNodes = 1;
+        topology->nodeIds[0] = 0;
+        topology->nodeFirstCpu[0] = 0;
+        topology->nodeCpus[0] = topology->nCpus;
+    }
+}
+
+u32 TopologyWorkerCpu(const CpuTopology* const topology, const usize nNodes, const usize worker, usize* const node) {
+    if (nNodes == 0 || nNodes > topology->nNodes) PANIC("Expected between 1 and" FS(usize) "nodes", topology->nNodes);
+    *node = worker % nNodes;
+    const usize slot = worker / nNodes % topology->nodeCpus[*node];
+    return topology->cpus[topology->nodeFirstCpu[*node] + slot];
+}
+
+bool PinThreadToCpu(const pthread_t thread, const u32 cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return 0 == pthread_setaffinity_np(thread, sizeof set, &set);
+}
+
+bool PinThreadToNode(const pthread_t thread, const CpuTopology* const topology, const usize node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (usize i = 0; i < topology->nodeCpus[node]; i++) CPU_SET(topology->cpus[topology->nodeFirstCpu[node] + i], &set);
+    return 0 == pthread_setaffinity_np(thread, sizeof set, &set);
+}
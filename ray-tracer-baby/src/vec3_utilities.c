@@ -1,25 +1,117 @@
 #include "vec3_utilities.h"
 
 #include <stdbool.h>
-#include <cmm/random.h>
+#include <math.h>
 #include <cmm/types.h>
 
+#include "profiler.h"
+
+#define PCG_MULTIPLIER 6364136223846793005ULL
+
+// Each render thread draws from its own stream, no shared state between workers.
+internal _Thread_local u64 RngState = 0x853c49e6748fea9bULL;
+internal _Thread_local u64 RngIncrement = 0xda3e39cb94b95bdbULL;
+
+internal u32 NextRandom(void) {
+    const u64 state = RngState;
+    RngState = state * PCG_MULTIPLIER + RngIncrement;
+    const u32 xorShifted = (u32)(((state >> 18u) ^ state) >> 27u);
+    const u32 rotation = (u32)(state >> 59u);
+    return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31u));
+}
+
+void SeedRandom(const u64 seed, const u64 sequence) {
+    RngState = 0;
+    RngIncrement = (sequence << 1u) | 1u;
+    NextRandom();
+    RngState += seed;
+    NextRandom();
+}
+
+void AdvanceRandom(u64 delta) {
+    // Composes `delta` steps of the LCG by squaring (Brown, "Random Number Generation with Arbitrary Strides").
+    u64 multiplier = PCG_MULTIPLIER;
+    u64 increment = RngIncrement;
+    u64 totalMultiplier = 1;
+    u64 totalIncrement = 0;
+    while (delta > 0) {
+        if (delta & 1u) {
+            totalMultiplier *= multiplier;
+            totalIncrement = totalIncrement * multiplier + increment;
+        }
+        increment = (multiplier + 1) * increment;
+        multiplier *= multiplier;
+        delta >>= 1u;
+    }
+    RngState = totalMultiplier * RngState + totalIncrement;
+}
+
+f32 RandomF32(void) {
+    return (f32)(NextRandom() >> 8) * 0x1p-24f;
+}
+
 void RandomVec3(vec3 result) {
-    glm_vec3_copy((vec3){ RANDOM_UNIFORM(f32), RANDOM_UNIFORM(f32), RANDOM_UNIFORM(f32) }, result);
+    PROFILE_COUNT(ProfileCounterRngDraws, 3);
+    glm_vec3_copy((vec3){ RandomF32(), RandomF32(), RandomF32() }, result);
 }
 
 internal void RandomVec3InUnitSphere(vec3 result) {
     while (true) {
         RandomVec3(result);
-        if (glm_vec3_dot(result, result) < 1) return;
+        glm_vec3_scale(result, 2.f, result);
+        glm_vec3_subs(result, 1.f, result);
+        const f32 length2 = glm_vec3_dot(result, result);
+        if (length2 < 1 && length2 > 1e-8f) return;
     }
 }
 
 void RandomUnitVec3(vec3 result) {
     RandomVec3InUnitSphere(result);
-    glm_vec3_norm(result);
+    glm_vec3_normalize(result);
 }
 
 bool IsNonZeroVec3(vec3 result) {
     return glm_vec3_dot(result, result) < 0.001;
-}
\ No newline at end of file
+}
+
+internal f32 SignNotZero(const f32 value) {
+    return value >= 0.f ? 1.f : -1.f;
+}
+
+internal u32 PackSnorm16(const f32 value) {
+    const f32 clamped = value < -1.f ? -1.f : value > 1.f ? 1.f : value;
+    return (u32)(u16)(i16)roundf(clamped * 32767.f);
+}
+
+internal f32 UnpackSnorm16(const u32 value) {
+    const f32 unpacked = (f32)(i16)(u16)value / 32767.f;
+    return unpacked < -1.f ? -1.f : unpacked;
+}
+
+u32 EncodeOctahedral(const vec3 normal) {
+    const f32 l1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+    if (l1 == 0.f) return 0;
+    f32 x = normal[0] / l1;
+    f32 y = normal[1] / l1;
+    // Fold the lower hemisphere over the diagonals
+    if (normal[2] < 0.f) {
+        const f32 foldedX = (1.f - fabsf(y)) * SignNotZero(x);
+        const f32 foldedY = (1.f - fabsf(x)) * SignNotZero(y);
+        x = foldedX;
+        y = foldedY;
+    }
+    return PackSnorm16(x) | (PackSnorm16(y) << 16);
+}
+
+void DecodeOctahedral(const u32 encoded, vec3 result) {
+    const f32 x = UnpackSnorm16(encoded & 0xFFFF);
+    const f32 y = UnpackSnorm16(encoded >> 16);
+    result[0] = x;
+    result[1] = y;
+    result[2] = 1.f - fabsf(x) - fabsf(y);
+    if (result[2] < 0.f) {
+        result[0] = (1.f - fabsf(y)) * SignNotZero(x);
+        result[1] = (1.f - fabsf(x)) * SignNotZero(y);
+    }
+    glm_vec3_normalize(result);
+}
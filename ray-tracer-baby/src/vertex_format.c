@@ -0,0 +1,87 @@
+#include "vertex_format.h"
+
+#include <math.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "vec3_utilities.h"
+
+#define QUANTIZATION_LEVELS 65535.f
+
+usize CompactMeshArenaSize(const Obj* const obj) {
+    return obj->nVertices * sizeof(CompactVertex) + _Alignof(CompactVertex);
+}
+
+internal u16 Quantize(const f32 value, const f32 origin, const f32 extent) {
+    if (extent <= 0.f) return 0;
+    const f32 t = (value - origin) / extent;
+    const f32 clamped = t < 0.f ? 0.f : t > 1.f ? 1.f : t;
+    return (u16)roundf(clamped * QUANTIZATION_LEVELS);
+}
+
+void DecodePosition(const CompactMesh* const mesh, const usize vertex, vec3 result) {
+    const u16* const q = mesh->vertices[vertex].position;
+    for (usize axis = 0; axis < 3; axis++) {
+        result[axis] = mesh->origin[axis] + (f32)q[axis] / QUANTIZATION_LEVELS * mesh->extent[axis];
+    }
+}
+
+void MeshPosition(const Obj* const obj, const CompactMesh* const compact, const usize vertex, vec3 result) {
+    if (compact != NULL) {
+        DecodePosition(compact, vertex, result);
+    } else {
+        const Position* const p = &obj->vertices[vertex].position;
+        glm_vec3_copy((vec3) { p->x, p->y, p->z }, result);
+    }
+}
+
+CompactMesh CompressMesh(const Obj* const obj, Arena* const arena, VertexPrecision* const precision) {
+    CompactMesh mesh = {
+        .nVertices = obj->nVertices,
+        .vertices = ArenaPush(arena, obj->nVertices * sizeof(CompactVertex), _Alignof(CompactVertex)),
+    };
+
+    vec3 upper;
+    glm_vec3_broadcast(obj->nVertices > 0 ? INFINITY : 0.f, mesh.origin);
+    glm_vec3_broadcast(obj->nVertices > 0 ? -INFINITY : 0.f, upper);
+    for (usize i = 0; i < obj->nVertices; i++) {
+        const vec3 p = { obj->vertices[i].position.x, obj->vertices[i].position.y, obj->vertices[i].position.z };
+        glm_vec3_minv(mesh.origin, (f32*)p, mesh.origin);
+        glm_vec3_maxv(upper, (f32*)p, upper);
+    }
+    glm_vec3_sub(upper, mesh.origin, mesh.extent);
+
+    VertexPrecision error = { 0.f, 0.f, 0.f, 0.f };
+    for (usize i = 0; i < obj->nVertices; i++) {
+        const Vertex* const source = &obj->vertices[i];
+        vec3 position = { source->position.x, source->position.y, source->position.z };
+        vec3 normal = { source->normal.nx, source->normal.ny, source->normal.nz };
+
+        CompactVertex* const vertex = &mesh.vertices[i];
+        for (usize axis = 0; axis < 3; axis++) {
+            vertex->position[axis] = Quantize(position[axis], mesh.origin[axis], mesh.extent[axis]);
+        }
+        vertex->_padding = 0;
+        vertex->normal = EncodeOctahedral(normal);
+
+        vec3 decoded;
+        DecodePosition(&mesh, i, decoded);
+        const f32 positionError = glm_vec3_distance(position, decoded);
+        error.maxPositionError = glm_max(error.maxPositionError, positionError);
+        error.meanPositionError += positionError;
+
+        glm_vec3_normalize(normal);
+        DecodeOctahedral(vertex->normal, decoded);
+        const f32 cosine = glm_clamp(glm_vec3_dot(normal, decoded), -1.f, 1.f);
+        const f32 normalError = glm_deg(acosf(cosine));
+        error.maxNormalErrorDeg = glm_max(error.maxNormalErrorDeg, normalError);
+        error.meanNormalErrorDeg += normalError;
+    }
+    if (obj->nVertices > 0) {
+        error.meanPositionError /= (f32)obj->nVertices;
+        error.meanNormalErrorDeg /= (f32)obj->nVertices;
+    }
+    if (precision != NULL) *precision = error;
+    return mesh;
+}
@@ -0,0 +1,575 @@
+#include "visibility.h"
+
+#include <math.h>
+#include <stdatomic.h>
+
+#include <cmm/cmm.h>
+#include <cglm/cglm.h>
+
+#include "profiler.h"
+#include "vec3_utilities.h"
+
+#define VISIBILITY_ALIGNMENT 64
+/// Same as the `tnear` of `IntersectRays`.
+#define VISIBILITY_NEAR 0.001f
+
+/// Triangle in pixel coordinates of the buffer, counter-clockwise on screen.
+typedef struct {
+    f32 x[3];
+    f32 y[3];
+    f32 invDepth[3];
+    /// Barycentrics of the vertices within the triangle before clipping.
+    f32 u[3];
+    f32 v[3];
+    /// Inclusive pixel bounds.
+    i32 minX, minY, maxX, maxY;
+    u32 primID;
+    u32 geomID;
+    u32 instID;
+    u32 normal;
+} RasterTriangle;
+
+/// Sphere or disc, intersected per pixel of its bounds.
+typedef struct {
+    i32 minX, minY, maxX, maxY;
+    enum PrimitiveKind kind;
+    u32 index;
+} RasterSplat;
+
+typedef struct VisibilityWorker VisibilityWorker;
+
+typedef struct {
+    VisibilityBuffer* visibility;
+    const VisibilityScene* scene;
+    FrameRegion region;
+    VisibilityWorker* workers;
+    usize nWorkers;
+    usize nBinsX;
+    usize nBinsY;
+    atomic_size_t nextBin;
+    const RasterSplat* splats;
+    usize nSplats;
+} RasterFrame;
+
+struct VisibilityWorker {
+    usize id;
+    RasterFrame* frame;
+    /// Range of the frame's triangles this worker sets up, meshes first, then quads.
+    usize first;
+    usize end;
+    RasterTriangle* triangles;
+    usize nTriangles;
+    /// Triangles overlapping bin `b` are `binTriangles[binOffsets[b] .. binOffsets[b + 1])`.
+    u32* binOffsets;
+    u32* binTriangles;
+};
+
+void CreateVisibilityBuffer(VisibilityBuffer* const visibility, const usize width, const usize height, const usize nThreads) {
+    *visibility = (VisibilityBuffer) {
+        .width = width,
+        .height = height,
+        .nThreads = nThreads == 0 ? 1 : nThreads,
+        .hits = NULL,
+        .arenas = NULL,
+        .nTriangles = 0,
+        .nBinnedTriangles = 0,
+    };
+    visibility->hits = malloc(width * height * sizeof(HitRecord));
+    visibility->arenas = malloc(visibility->nThreads * sizeof(Arena));
+    if (visibility->hits == NULL || visibility->arenas == NULL) PANICM("Failed to allocate visibility buffer");
+    for (usize i = 0; i < visibility->nThreads; i++) visibility->arenas[i] = CreateArena(VISIBILITY_ARENA_SIZE);
+}
+
+void DestroyVisibilityBuffer(VisibilityBuffer* const visibility) {
+    for (usize i = 0; i < visibility->nThreads; i++) DropArena(&visibility->arenas[i]);
+    free(visibility->arenas);
+    free(visibility->hits);
+    visibility->arenas = NULL;
+    visibility->hits = NULL;
+}
+
+COMMENT(--------========[ Setup ]========--------)
+
+/// Position relative to the camera origin with the barycentrics it has within its unclipped triangle.
+typedef struct {
+    vec3 q;
+    f32 u;
+    f32 v;
+} ClipVertex;
+
+internal usize MeshTriangleCount(const VisibilityMesh* const mesh) {
+    return mesh->instances.len * (mesh->obj->nIndices / 3);
+}
+
+internal void ObjectPosition(const VisibilityMesh* const mesh, const u16 vertex, vec3 position) {
+    MeshPosition(mesh->obj, mesh->compact, vertex, position);
+}
+
+/// Embree's geometric normal of the triangle `p0`, `p1`, `p2`.
+internal u32 TriangleNormal(vec3 p0, vec3 p1, vec3 p2) {
+    vec3 e1, e2, ng;
+    glm_vec3_sub(p0, p1, e1);
+    glm_vec3_sub(p2, p0, e2);
+    glm_vec3_cross(e1, e2, ng);
+    return EncodeOctahedral(ng);
+}
+
+internal void PushRasterTriangle(VisibilityWorker* const worker, const ClipVertex* const vertices, const RasterTriangle* const ids) {
+    const RasterFrame* const frame = worker->frame;
+    const FrameRegion region = frame->region;
+    RasterTriangle triangle = *ids;
+    for (usize k = 0; k < 3; k++) {
+        const f32 invDepth = -1.f / vertices[k].q[2];
+        triangle.x[k] = (vertices[k].q[0] * invDepth + 1.f) * 0.5f * (f32)region.frameWidth - (f32)region.x;
+        triangle.y[k] = (1.f - vertices[k].q[1] * invDepth) * 0.5f * (f32)region.frameHeight - (f32)region.y;
+        triangle.invDepth[k] = invDepth;
+        triangle.u[k] = vertices[k].u;
+        triangle.v[k] = vertices[k].v;
+    }
+
+    const f32 area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0])
+        - (triangle.y[1] - triangle.y[0]) * (triangle.x[2] - triangle.x[0]);
+    if (!(fabsf(area) > 0.f)) return;
+    if (area < 0.f) {
+        // Embree does not cull back faces, orient every triangle the same way on screen instead.
+        f32* const attributes[] = { triangle.x, triangle.y, triangle.invDepth, triangle.u, triangle.v };
+        for (usize a = 0; a < ARRAY_LENGTH(attributes); a++) {
+            const f32 swap = attributes[a][1];
+            attributes[a][1] = attributes[a][2];
+            attributes[a][2] = swap;
+        }
+    }
+
+    const f32 minX = glm_min(triangle.x[0], glm_min(triangle.x[1], triangle.x[2]));
+    const f32 maxX = glm_max(triangle.x[0], glm_max(triangle.x[1], triangle.x[2]));
+    const f32 minY = glm_min(triangle.y[0], glm_min(triangle.y[1], triangle.y[2]));
+    const f32 maxY = glm_max(triangle.y[0], glm_max(triangle.y[1], triangle.y[2]));
+    const f32 width = (f32)frame->visibility->width;
+    const f32 height = (f32)frame->visibility->height;
+    if (maxX < 0.f || maxY < 0.f || minX > width - 1.f || minY > height - 1.f) return;
+    triangle.minX = (i32)ceilf(glm_max(minX, 0.f));
+    triangle.minY = (i32)ceilf(glm_max(minY, 0.f));
+    triangle.maxX = (i32)floorf(glm_min(maxX, width - 1.f));
+    triangle.maxY = (i32)floorf(glm_min(maxY, height - 1.f));
+    // Slivers between pixel rows and columns.
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) return;
+    worker->triangles[worker->nTriangles++] = triangle;
+}
+
+internal void ClipEdge(const ClipVertex* const a, const ClipVertex* const b, ClipVertex* const result) {
+    const f32 da = -a->q[2] - VISIBILITY_NEAR;
+    const f32 db = -b->q[2] - VISIBILITY_NEAR;
+    const f32 s = da / (da - db);
+    glm_vec3_lerp((f32*)a->q, (f32*)b->q, s, result->q);
+    result->q[2] = -VISIBILITY_NEAR;
+    result->u = a->u + s * (b->u - a->u);
+    result->v = a->v + s * (b->v - a->v);
+}
+
+/// Clips the camera relative triangle against the near plane and pushes what remains, at most two triangles.
+internal void SetupTriangle(VisibilityWorker* const worker, const vec3 q[3], const RasterTriangle* const ids) {
+    const ClipVertex vertices[3] = {
+        { .q = { q[0][0], q[0][1], q[0][2] }, .u = 0.f, .v = 0.f },
+        { .q = { q[1][0], q[1][1], q[1][2] }, .u = 1.f, .v = 0.f },
+        { .q = { q[2][0], q[2][1], q[2][2] }, .u = 0.f, .v = 1.f },
+    };
+    bool inside[3];
+    usize nInside = 0;
+    for (usize k = 0; k < 3; k++) {
+        inside[k] = -vertices[k].q[2] >= VISIBILITY_NEAR;
+        nInside += inside[k];
+    }
+    if (nInside == 3) {
+        PushRasterTriangle(worker, vertices, ids);
+        return;
+    }
+    if (nInside == 0) return;
+
+    ClipVertex polygon[4];
+    usize n = 0;
+    for (usize k = 0; k < 3; k++) {
+        const ClipVertex* const a = &vertices[k];
+        const ClipVertex* const b = &vertices[(k + 1) % 3];
+        if (inside[k]) polygon[n++] = *a;
+        if (inside[k] != inside[(k + 1) % 3]) ClipEdge(a, b, &polygon[n++]);
+    }
+    PushRasterTriangle(worker, polygon, ids);
+    if (n == 4) PushRasterTriangle(worker, (ClipVertex[3]) { polygon[0], polygon[2], polygon[3] }, ids);
+}
+
+internal void SetupMeshTriangle(VisibilityWorker* const worker, const VisibilityMesh* const mesh, const usize instance, const usize triangle) {
+    const f32 (*const model)[4] = (const f32 (*)[4])mesh->instances.data[instance].model;
+    const u16* const indices = &mesh->obj->indices[3 * triangle];
+    vec3 p[3];
+    vec3 q[3];
+    for (usize k = 0; k < 3; k++) {
+        ObjectPosition(mesh, indices[k], p[k]);
+        // Column major like embree's instance transforms, relative to the camera origin.
+        for (usize r = 0; r < 3; r++) {
+            q[k][r] = model[0][r] * p[k][0] + model[1][r] * p[k][1] + model[2][r] * p[k][2] + model[3][r];
+        }
+        q[k][2] -= CAMERA_ORIGIN_Z;
+    }
+    const RasterTriangle ids = {
+        .primID = (u32)triangle,
+        .geomID = 0,
+        .instID = mesh->firstInstanceId + (u32)instance,
+        .normal = TriangleNormal(p[0], p[1], p[2]),
+    };
+    SetupTriangle(worker, (const vec3*)q, &ids);
+}
+
+/// Embree splits quads into (v0, v1, v3) and (v2, v3, v1). Shading ignores barycentrics of primitives.
+internal void SetupQuad(VisibilityWorker* const worker, const Primitives* const primitives, const usize i) {
+    const QuadPrimitive* const quad = &primitives->quads[i];
+    const Position o = quad->origin, u = quad->edgeU, v = quad->edgeV;
+    vec3 corners[4] = {
+        { o.x, o.y, o.z },
+        { o.x + u.x, o.y + u.y, o.z + u.z },
+        { o.x + u.x + v.x, o.y + u.y + v.y, o.z + u.z + v.z },
+        { o.x + v.x, o.y + v.y, o.z + v.z },
+    };
+    const usize split[2][3] = { { 0, 1, 3 }, { 2, 3, 1 } };
+    for (usize s = 0; s < 2; s++) {
+        vec3 q[3];
+        for (usize k = 0; k < 3; k++) {
+            glm_vec3_copy(corners[split[s][k]], q[k]);
+            q[k][2] -= CAMERA_ORIGIN_Z;
+        }
+        const RasterTriangle ids = {
+            .primID = (u32)i,
+            .geomID = primitives->geomIds[PrimitiveKindQuad],
+            .instID = RTC_INVALID_GEOMETRY_ID,
+            .normal = TriangleNormal(corners[split[s][0]], corners[split[s][1]], corners[split[s][2]]),
+        };
+        SetupTriangle(worker, (const vec3*)q, &ids);
+    }
+}
+
+internal usize QuadCount(const VisibilityScene* const scene) {
+    return scene->primitives == NULL ? 0 : scene->primitives->counts[PrimitiveKindQuad];
+}
+
+/// Sets up the worker's range of triangles and sorts them into bins.
+internal void SetupTriangles(VisibilityWorker* const worker) {
+    const RasterFrame* const frame = worker->frame;
+    const VisibilityScene* const scene = frame->scene;
+    Arena* const arena = &frame->visibility->arenas[worker->id];
+    ResetArena(arena);
+
+    // Near plane clipping splits a triangle in at most two, quads become two triangles first.
+    usize capacity = 0;
+    usize meshTriangles = 0;
+    for (usize m = 0; m < scene->nMeshes; m++) meshTriangles += MeshTriangleCount(&scene->meshes[m]);
+    const usize meshEnd = worker->end < meshTriangles ? worker->end : meshTriangles;
+    if (worker->first < meshEnd) capacity += 2 * (meshEnd - worker->first);
+    if (worker->end > meshTriangles) capacity += 4 * (worker->end - (worker->first > meshTriangles ? worker->first : meshTriangles));
+    worker->triangles = ArenaPush(arena, capacity * sizeof(RasterTriangle), VISIBILITY_ALIGNMENT);
+    worker->nTriangles = 0;
+
+    usize base = 0;
+    for (usize m = 0; m < scene->nMeshes; m++) {
+        const VisibilityMesh* const mesh = &scene->meshes[m];
+        const usize nMeshTriangles = mesh->obj->nIndices / 3;
+        const usize end = base + MeshTriangleCount(mesh);
+        for (usize i = worker->first > base ? worker->first : base; i < worker->end && i < end; i++) {
+            SetupMeshTriangle(worker, mesh, (i - base) / nMeshTriangles, (i - base) % nMeshTriangles);
+        }
+        base = end;
+    }
+    for (usize i = worker->first > base ? worker->first : base; i < worker->end; i++) {
+        SetupQuad(worker, scene->primitives, i - base);
+    }
+
+    const usize nBins = frame->nBinsX * frame->nBinsY;
+    worker->binOffsets = ArenaPush(arena, (nBins + 1) * sizeof(u32), VISIBILITY_ALIGNMENT);
+    for (usize b = 0; b <= nBins; b++) worker->binOffsets[b] = 0;
+    for (usize t = 0; t < worker->nTriangles; t++) {
+        const RasterTriangle* const triangle = &worker->triangles[t];
+        for (i32 by = triangle->minY / VISIBILITY_BIN_SIZE; by <= triangle->maxY / VISIBILITY_BIN_SIZE; by++) {
+            for (i32 bx = triangle->minX / VISIBILITY_BIN_SIZE; bx <= triangle->maxX / VISIBILITY_BIN_SIZE; bx++) {
+                worker->binOffsets[(usize)by * frame->nBinsX + (usize)bx + 1] += 1;
+            }
+        }
+    }
+    for (usize b = 0; b < nBins; b++) worker->binOffsets[b + 1] += worker->binOffsets[b];
+
+    worker->binTriangles = ArenaPush(arena, worker->binOffsets[nBins] * sizeof(u32), VISIBILITY_ALIGNMENT);
+    u32* const cursors = ArenaPush(arena, nBins * sizeof(u32), VISIBILITY_ALIGNMENT);
+    for (usize b = 0; b < nBins; b++) cursors[b] = worker->binOffsets[b];
+    for (usize t = 0; t < worker->nTriangles; t++) {
+        const RasterTriangle* const triangle = &worker->triangles[t];
+        for (i32 by = triangle->minY / VISIBILITY_BIN_SIZE; by <= triangle->maxY / VISIBILITY_BIN_SIZE; by++) {
+            for (i32 bx = triangle->minX / VISIBILITY_BIN_SIZE; bx <= triangle->maxX / VISIBILITY_BIN_SIZE; bx++) {
+                worker->binTriangles[cursors[(usize)by * frame->nBinsX + (usize)bx]++] = (u32)t;
+            }
+        }
+    }
+}
+
+COMMENT(--------========[ Splats ]========--------)
+
+/// Bounds of the sphere around `center` on screen, the whole buffer when it reaches behind the near plane.
+///
+/// @returns false when the sphere is entirely behind the camera or off screen.
+internal bool SphereBounds(const RasterFrame* const frame, const vec3 center, const f32 radius, RasterSplat* const splat) {
+    const FrameRegion region = frame->region;
+    const i32 width = (i32)frame->visibility->width;
+    const i32 height = (i32)frame->visibility->height;
+    const f32 depth = CAMERA_ORIGIN_Z - center[2];
+    if (depth + radius < VISIBILITY_NEAR) return false;
+
+    f32 minX = 0.f, minY = 0.f, maxX = (f32)(width - 1), maxY = (f32)(height - 1);
+    if (depth - radius >= VISIBILITY_NEAR) {
+        // Corners of the bounding box, its projection contains the sphere's.
+        minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+        for (usize c = 0; c < 8; c++) {
+            const f32 x = center[0] + ((c & 1) ? radius : -radius);
+            const f32 y = center[1] + ((c & 2) ? radius : -radius);
+            const f32 d = depth + ((c & 4) ? radius : -radius);
+            const f32 sx = (x / d + 1.f) * 0.5f * (f32)region.frameWidth - (f32)region.x;
+            const f32 sy = (1.f - y / d) * 0.5f * (f32)region.frameHeight - (f32)region.y;
+            minX = glm_min(minX, sx);
+            maxX = glm_max(maxX, sx);
+            minY = glm_min(minY, sy);
+            maxY = glm_max(maxY, sy);
+        }
+    }
+    if (maxX < 0.f || maxY < 0.f || minX > (f32)(width - 1) || minY > (f32)(height - 1)) return false;
+    splat->minX = (i32)ceilf(glm_max(minX, 0.f));
+    splat->minY = (i32)ceilf(glm_max(minY, 0.f));
+    splat->maxX = (i32)floorf(glm_min(maxX, (f32)(width - 1)));
+    splat->maxY = (i32)floorf(glm_min(maxY, (f32)(height - 1)));
+    return splat->minX <= splat->maxX && splat->minY <= splat->maxY;
+}
+
+/// Spheres and discs are few compared to triangles, they are bounded here once and not binned.
+internal usize SetupSplats(const RasterFrame* const frame, RasterSplat* const splats) {
+    const Primitives* const primitives = frame->scene->primitives;
+    usize n = 0;
+    for (usize i = 0; i < primitives->counts[PrimitiveKindSphere]; i++) {
+        const SpherePrimitive* const sphere = &primitives->spheres[i];
+        splats[n] = (RasterSplat) { .kind = PrimitiveKindSphere, .index = (u32)i };
+        n += SphereBounds(frame, (vec3) { sphere->x, sphere->y, sphere->z }, sphere->radius, &splats[n]);
+    }
+    for (usize i = 0; i < primitives->counts[PrimitiveKindDisc]; i++) {
+        const DiscPrimitive* const disc = &primitives->discs[i];
+        splats[n] = (RasterSplat) { .kind = PrimitiveKindDisc, .index = (u32)i };
+        n += SphereBounds(frame, (vec3) { disc->x, disc->y, disc->z }, disc->radius, &splats[n]);
+    }
+    return n;
+}
+
+/// Intersects the camera ray `direction` with the splat like embree's point geometries.
+///
+/// @returns the ray distance, INFINITY on a miss.
+internal f32 IntersectSplat(const Primitives* const primitives, const RasterSplat* const splat, const vec3 direction, vec3 normal) {
+    const vec3 origin = { 0.f, 0.f, CAMERA_ORIGIN_Z };
+    if (splat->kind == PrimitiveKindSphere) {
+        const SpherePrimitive* const sphere = &primitives->spheres[splat->index];
+        const vec3 center = { sphere->x, sphere->y, sphere->z };
+        vec3 oc;
+        glm_vec3_sub((f32*)origin, (f32*)center, oc);
+        const f32 a = glm_vec3_dot((f32*)direction, (f32*)direction);
+        const f32 b = glm_vec3_dot((f32*)direction, oc);
+        const f32 c = glm_vec3_dot(oc, oc) - sphere->radius * sphere->radius;
+        const f32 discriminant = b * b - a * c;
+        if (discriminant < 0.f) return INFINITY;
+        const f32 root = sqrtf(discriminant);
+        f32 t = (-b - root) / a;
+        if (t < VISIBILITY_NEAR) t = (-b + root) / a;
+        if (t < VISIBILITY_NEAR) return INFINITY;
+        for (usize k = 0; k < 3; k++) normal[k] = origin[k] + t * direction[k] - center[k];
+        return t;
+    }
+    const DiscPrimitive* const disc = &primitives->discs[splat->index];
+    const vec3 center = { disc->x, disc->y, disc->z };
+    glm_vec3_copy((vec3) { disc->normal.nx, disc->normal.ny, disc->normal.nz }, normal);
+    const f32 cosine = glm_vec3_dot(normal, (f32*)direction);
+    if (cosine == 0.f) return INFINITY;
+    vec3 toCenter;
+    glm_vec3_sub((f32*)center, (f32*)origin, toCenter);
+    const f32 t = glm_vec3_dot(normal, toCenter) / cosine;
+    if (t < VISIBILITY_NEAR) return INFINITY;
+    vec3 offset;
+    for (usize k = 0; k < 3; k++) offset[k] = origin[k] + t * direction[k] - center[k];
+    return glm_vec3_dot(offset, offset) <= disc->radius * disc->radius ? t : INFINITY;
+}
+
+COMMENT(--------========[ Rasterization ]========--------)
+
+internal void RasterizeTriangle(const RasterTriangle* const triangle, const i32 binX, const i32 binY, const i32 binEndX, const i32 binEndY, const usize stride, HitRecord* const hits) {
+    const i32 minX = triangle->minX > binX ? triangle->minX : binX;
+    const i32 maxX = triangle->maxX < binEndX ? triangle->maxX : binEndX;
+    const i32 minY = triangle->minY > binY ? triangle->minY : binY;
+    const i32 maxY = triangle->maxY < binEndY ? triangle->maxY : binEndY;
+    const f32* const x = triangle->x;
+    const f32* const y = triangle->y;
+    const f32 area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+
+    for (i32 py = minY; py <= maxY; py++) {
+        const f32 sy = (f32)py;
+        for (i32 px = minX; px <= maxX; px++) {
+            const f32 sx = (f32)px;
+            // Edge functions opposite every vertex, samples on an edge belong to both triangles sharing it.
+            const f32 w0 = (x[2] - x[1]) * (sy - y[1]) - (y[2] - y[1]) * (sx - x[1]);
+            const f32 w1 = (x[0] - x[2]) * (sy - y[2]) - (y[0] - y[2]) * (sx - x[2]);
+            const f32 w2 = (x[1] - x[0]) * (sy - y[0]) - (y[1] - y[0]) * (sx - x[0]);
+            if (w0 < 0.f || w1 < 0.f || w2 < 0.f) continue;
+
+            // Inverse depth is affine in screen space, perspective correct barycentrics follow from it.
+            const f32 p0 = w0 * triangle->invDepth[0];
+            const f32 p1 = w1 * triangle->invDepth[1];
+            const f32 p2 = w2 * triangle->invDepth[2];
+            const f32 sum = p0 + p1 + p2;
+            const f32 t = area / sum;
+            HitRecord* const hit = &hits[(usize)py * stride + (usize)px];
+            if (!(t < hit->t)) continue;
+
+            const f32 scale = 1.f / sum;
+            hit->t = t;
+            hit->u = (p0 * triangle->u[0] + p1 * triangle->u[1] + p2 * triangle->u[2]) * scale;
+            hit->v = (p0 * triangle->v[0] + p1 * triangle->v[1] + p2 * triangle->v[2]) * scale;
+            hit->primID = triangle->primID;
+            hit->geomID = triangle->geomID;
+            hit->instID = triangle->instID;
+            hit->normal = triangle->normal;
+        }
+    }
+}
+
+internal void RasterizeSplat(const RasterFrame* const frame, const RasterSplat* const splat, const i32 binX, const i32 binY, const i32 binEndX, const i32 binEndY, HitRecord* const hits) {
+    const FrameRegion region = frame->region;
+    const usize stride = frame->visibility->width;
+    const i32 minX = splat->minX > binX ? splat->minX : binX;
+    const i32 maxX = splat->maxX < binEndX ? splat->maxX : binEndX;
+    const i32 minY = splat->minY > binY ? splat->minY : binY;
+    const i32 maxY = splat->maxY < binEndY ? splat->maxY : binEndY;
+    for (i32 py = minY; py <= maxY; py++) {
+        for (i32 px = minX; px <= maxX; px++) {
+            // Exactly the direction `GeneratePrimaryRays` gives the pixel.
+            const vec3 direction = {
+                (2.0f * ((f32)(region.x + (usize)px) / region.frameWidth)) - 1.0f,
+                1.0f - (2.0f * ((f32)(region.y + (usize)py) / region.frameHeight)),
+                -1.0f,
+            };
+            vec3 normal;
+            const f32 t = IntersectSplat(frame->scene->primitives, splat, direction, normal);
+            HitRecord* const hit = &hits[(usize)py * stride + (usize)px];
+            if (!(t < hit->t)) continue;
+            hit->t = t;
+            hit->u = 0.f;
+            hit->v = 0.f;
+            hit->primID = splat->index;
+            hit->geomID = frame->scene->primitives->geomIds[splat->kind];
+            hit->instID = RTC_INVALID_GEOMETRY_ID;
+            hit->normal = EncodeOctahedral(normal);
+        }
+    }
+}
+
+internal void RasterizeBins(const VisibilityWorker* const worker) {
+    RasterFrame* const frame = worker->frame;
+    VisibilityBuffer* const visibility = frame->visibility;
+    const usize nBins = frame->nBinsX * frame->nBinsY;
+    for (usize bin = atomic_fetch_add_explicit(&frame->nextBin, 1, memory_order_relaxed); bin < nBins;
+         bin = atomic_fetch_add_explicit(&frame->nextBin, 1, memory_order_relaxed)) {
+        const i32 binX = (i32)(bin % frame->nBinsX) * VISIBILITY_BIN_SIZE;
+        const i32 binY = (i32)(bin / frame->nBinsX) * VISIBILITY_BIN_SIZE;
+        const i32 binEndX = (binX + VISIBILITY_BIN_SIZE < (i32)visibility->width ? binX + VISIBILITY_BIN_SIZE : (i32)visibility->width) - 1;
+        const i32 binEndY = (binY + VISIBILITY_BIN_SIZE < (i32)visibility->height ? binY + VISIBILITY_BIN_SIZE : (i32)visibility->height) - 1;
+        for (i32 y = binY; y <= binEndY; y++) {
+            for (i32 x = binX; x <= binEndX; x++) {
+                visibility->hits[(usize)y * visibility->width + (usize)x] = (HitRecord) {
+                    .t = INFINITY,
+                    .geomID = RTC_INVALID_GEOMETRY_ID,
+                    .instID = RTC_INVALID_GEOMETRY_ID,
+                    .normal = 0,
+                    .lod = 0,
+                };
+            }
+        }
+
+        // Lists are walked in worker order, which is triangle order, so depth ties resolve the same every frame.
+        for (usize w = 0; w < frame->nWorkers; w++) {
+            const VisibilityWorker* const source = &frame->workers[w];
+            for (u32 i = source->binOffsets[bin]; i < source->binOffsets[bin + 1]; i++) {
+                RasterizeTriangle(&source->triangles[source->binTriangles[i]], binX, binY, binEndX, binEndY, visibility->width, visibility->hits);
+            }
+        }
+        for (usize s = 0; s < frame->nSplats; s++) {
+            const RasterSplat* const splat = &frame->splats[s];
+            if (splat->maxX < binX || splat->minX > binEndX || splat->maxY < binY || splat->minY > binEndY) continue;
+            RasterizeSplat(frame, splat, binX, binY, binEndX, binEndY, visibility->hits);
+        }
+    }
+}
+
+internal void SetupJob(void* const argument, const usize _, Arena* const __) {
+    PROFILE_BEGIN(setupStart);
+    SetupTriangles(argument);
+    PROFILE_END("set up triangles", setupStart);
+}
+
+internal void RasterizeJob(void* const argument, const usize _, Arena* const __) {
+    PROFILE_BEGIN(rasterStart);
+    RasterizeBins(argument);
+    PROFILE_END("rasterize bins", rasterStart);
+}
+
+/// Runs `function` once for every worker of `frame` on `pool` and waits for all of them.
+internal void RunPhase(RasterFrame* const frame, WorkerPool* const pool, const WorkFunction function) {
+    WorkBatch batch = { 0 };
+    for (usize w = 0; w < frame->nWorkers; w++) SubmitWork(pool, &batch, function, &frame->workers[w]);
+    WaitWorkBatch(pool, &batch);
+}
+
+void RasterizeVisibility(
+    VisibilityBuffer* const visibility,
+    const VisibilityScene* const scene,
+    const FrameRegion region,
+    WorkerPool* const pool
+) {
+    PROFILE_BEGIN(visibilityStart);
+    RasterFrame frame = {
+        .visibility = visibility,
+        .scene = scene,
+        .region = region,
+        .nBinsX = (visibility->width + VISIBILITY_BIN_SIZE - 1) / VISIBILITY_BIN_SIZE,
+        .nBinsY = (visibility->height + VISIBILITY_BIN_SIZE - 1) / VISIBILITY_BIN_SIZE,
+        .workers = NULL,
+        .nWorkers = visibility->nThreads,
+        .splats = NULL,
+        .nSplats = 0,
+    };
+    atomic_init(&frame.nextBin, 0);
+
+    usize nTriangles = QuadCount(scene);
+    for (usize m = 0; m < scene->nMeshes; m++) nTriangles += MeshTriangleCount(&scene->meshes[m]);
+    frame.workers = malloc(frame.nWorkers * sizeof(VisibilityWorker));
+    if (frame.workers == NULL) PANICM("Failed to allocate visibility workers");
+    for (usize tid = 0; tid < frame.nWorkers; tid++) {
+        frame.workers[tid] = (VisibilityWorker) {
+            .id = tid,
+            .frame = &frame,
+            .first = nTriangles * tid / frame.nWorkers,
+            .end = nTriangles * (tid + 1) / frame.nWorkers,
+        };
+    }
+    RunPhase(&frame, pool, SetupJob);
+
+    // Worker 0 is done with its arena until the next frame.
+    if (scene->primitives != NULL) {
+        const usize nPoints = scene->primitives->counts[PrimitiveKindSphere] + scene->primitives->counts[PrimitiveKindDisc];
+        RasterSplat* const splats = ArenaPush(&visibility->arenas[0], nPoints * sizeof(RasterSplat), VISIBILITY_ALIGNMENT);
+        frame.nSplats = SetupSplats(&frame, splats);
+        frame.splats = splats;
+    }
+    RunPhase(&frame, pool, RasterizeJob);
+
+    visibility->nTriangles = nTriangles;
+    visibility->nBinnedTriangles = 0;
+    for (usize tid = 0; tid < frame.nWorkers; tid++) visibility->nBinnedTriangles += frame.workers[tid].nTriangles;
+    free(frame.workers);
+    PROFILE_END("rasterize visibility", visibilityStart);
+}
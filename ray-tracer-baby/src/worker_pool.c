@@ -0,0 +1,146 @@
+#include "worker_pool.h"
+
+#include <cmm/cmm.h>
+
+#include "profiler.h"
+#include "render_job.h"
+
+internal void* WorkerJob(void* args) {
+    WorkerThread* const worker = args;
+    WorkerPool* const pool = worker->pool;
+    Arena* const arena = &pool->arenas.data[worker->index];
+    PROFILE_THREAD("pool worker");
+    if (worker->cpu >= 0 && !PinThreadToCpu(pthread_self(), (u32)worker->cpu)) {
+        LOGLN("Failed to pin pool worker" FS(usize) "to CPU" FS(i32), worker->index, worker->cpu);
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (worker->len == 0 && pool->len == 0 && !pool->stop) pthread_cond_wait(&pool->changed, &pool->lock);
+        WorkItem item;
+        // Items for this worker alone first, nobody else can run them.
+        if (worker->len > 0) {
+            item = worker->items.data[worker->head];
+            worker->head = (worker->head + 1) % worker->items.len;
+            worker->len -= 1;
+        } else if (pool->len > 0) {
+            item = pool->items.data[pool->head];
+            pool->head = (pool->head + 1) % pool->items.len;
+            pool->len -= 1;
+        } else {
+            break;
+        }
+        // Wakes submitters waiting for room.
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+
+        ResetArena(arena);
+        item.function(item.argument, worker->index, arena);
+
+        pthread_mutex_lock(&pool->lock);
+        item.batch->nPending -= 1;
+        if (item.batch->nPending == 0) pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+internal void StartWorkerPool(WorkerPool* const pool, const usize nWorkers, const CpuTopology* const topology) {
+    if (nWorkers == 0) PANICM("Worker pool needs at least one worker");
+    *pool = (WorkerPool) {
+        .threads = AllocateArray(pthread_t, nWorkers),
+        .workers = AllocateArray(WorkerThread, nWorkers),
+        .arenas = CreateWorkerArenas(nWorkers),
+        .items = AllocateArray(WorkItem, WORKER_POOL_QUEUE_CAPACITY),
+        .head = 0,
+        .len = 0,
+        .stop = false,
+        .nNodes = topology == NULL ? 1 : (nWorkers < topology->nNodes ? nWorkers : topology->nNodes),
+    };
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    for (usize i = 0; i < nWorkers; i++) {
+        WorkerThread* const worker = &pool->workers.data[i];
+        *worker = (WorkerThread) {
+            .pool = pool,
+            .index = i,
+            .cpu = -1,
+            .node = 0,
+            .items = AllocateArray(WorkItem, WORKER_QUEUE_CAPACITY),
+            .head = 0,
+            .len = 0,
+        };
+        if (topology != NULL) worker->cpu = (i32)TopologyWorkerCpu(topology, pool->nNodes, i, &worker->node);
+    }
+    for (usize i = 0; i < nWorkers; i++) {
+        if (0 != pthread_create(&pool->threads.data[i], NULL, WorkerJob, &pool->workers.data[i])) {
+            PANIC("Failed to create pool worker" FS(usize), i);
+        }
+    }
+}
+
+void CreateWorkerPool(WorkerPool* const pool, const usize nWorkers) {
+    StartWorkerPool(pool, nWorkers, NULL);
+}
+
+void CreatePinnedWorkerPool(WorkerPool* const pool, const usize nWorkers, const CpuTopology* const topology) {
+    StartWorkerPool(pool, nWorkers, topology);
+    LOGLN("Pinned" FS(usize) "pool workers over" FS(usize) "of" FS(usize) "NUMA nodes", nWorkers, pool->nNodes, topology->nNodes);
+}
+
+void DestroyWorkerPool(WorkerPool* const pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    for (usize i = 0; i < pool->threads.len; i++) pthread_join(pool->threads.data[i], NULL);
+
+    pthread_cond_destroy(&pool->changed);
+    pthread_mutex_destroy(&pool->lock);
+    for (usize i = 0; i < pool->workers.len; i++) FreeArray(pool->workers.data[i].items);
+    DropWorkerArenas(pool->arenas);
+    FreeArray(pool->items);
+    FreeArray(pool->workers);
+    FreeArray(pool->threads);
+}
+
+void SubmitWork(WorkerPool* const pool, WorkBatch* const batch, const WorkFunction function, void* const argument) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->len == pool->items.len) pthread_cond_wait(&pool->changed, &pool->lock);
+    pool->items.data[(pool->head + pool->len) % pool->items.len] = (WorkItem) {
+        .function = function,
+        .argument = argument,
+        .batch = batch,
+    };
+    pool->len += 1;
+    batch->nPending += 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void SubmitWorkTo(
+    WorkerPool* const pool,
+    WorkBatch* const batch,
+    const usize worker,
+    const WorkFunction function,
+    void* const argument
+) {
+    if (worker >= pool->workers.len) PANIC("Pool has" FS(usize) "workers", pool->workers.len);
+    WorkerThread* const thread = &pool->workers.data[worker];
+    pthread_mutex_lock(&pool->lock);
+    while (thread->len == thread->items.len) pthread_cond_wait(&pool->changed, &pool->lock);
+    thread->items.data[(thread->head + thread->len) % thread->items.len] = (WorkItem) {
+        .function = function,
+        .argument = argument,
+        .batch = batch,
+    };
+    thread->len += 1;
+    batch->nPending += 1;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void WaitWorkBatch(WorkerPool* const pool, const WorkBatch* const batch) {
+    pthread_mutex_lock(&pool->lock);
+    while (batch->nPending > 0) pthread_cond_wait(&pool->changed, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,851 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cglm/cglm.h>
+#include <cmm/cmm.h>
+
+#include "ray_tracing.h"
+#include "arena.h"
+#include "worker_pool.h"
+#include "denoise.h"
+#include "distributed.h"
+#include "checkpoint.h"
+#include "vec3_utilities.h"
+#include "vertex_format.h"
+#include "lights.h"
+#include "environment.h"
+#include "radiance_cache.h"
+#include "paged_mesh.h"
+#include "accel_scene.h"
+#include "texture.h"
+
+/*
+ * Unit tests of the parts of the renderer that need neither Embree nor a window, run by `make test`.
+ *
+ * Each test is a function listed in `Tests` and stops the run at its first failed `CHECK`. Arguments select the tests
+ * whose name contains any of them, without arguments every test runs. Random inputs come from a fixed seed, so a
+ * failure reproduces on every run.
+ */
+
+#define CHECK(condition) do {                                                  \
+    if (!(condition)) PANIC("%s:%d: check failed: %s", __FILE__, __LINE__, #condition); \
+} while (0)
+
+#define CHECK_NEAR(a, b, tolerance) do {                                       \
+    const f64 checkA = (f64)(a), checkB = (f64)(b);                            \
+    if (!(fabs(checkA - checkB) <= (tolerance))) {                             \
+        PANIC("%s:%d: %s = %.6f, expected %s = %.6f within %.6f", __FILE__, __LINE__, #a, checkA, #b, checkB, (f64)(tolerance)); \
+    }                                                                          \
+} while (0)
+
+#define TEST_THREADS 4
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} Test;
+
+/// xorshift64*, tests must not depend on the state of the renderer's generator.
+internal u64 TestRandomState = 0x9E3779B97F4A7C15ull;
+
+internal f32 TestRandom(void) {
+    TestRandomState ^= TestRandomState >> 12;
+    TestRandomState ^= TestRandomState << 25;
+    TestRandomState ^= TestRandomState >> 27;
+    return (f32)((TestRandomState * 0x2545F4914F6CDD1Dull) >> 40) / (f32)(1u << 24);
+}
+
+COMMENT(--------========[ Sampling ]========--------)
+
+#define RANDOM_TEST_DRAWS 1000
+
+/// Jumping ahead lands where drawing one by one does, which is what lets a resumed render continue its streams.
+internal void TestRandomAdvance(void) {
+    u32 draws[RANDOM_TEST_DRAWS];
+    SeedRandom(0x1234, 77);
+    for (usize i = 0; i < RANDOM_TEST_DRAWS; i++) draws[i] = (u32)(RandomF32() * 0x1p24f);
+    const usize skips[] = { 0, 1, 2, 3, 500, 999 };
+    for (usize k = 0; k < ARRAY_LENGTH(skips); k++) {
+        SeedRandom(0x1234, 77);
+        AdvanceRandom(skips[k]);
+        for (usize i = skips[k]; i < RANDOM_TEST_DRAWS; i++) CHECK((u32)(RandomF32() * 0x1p24f) == draws[i]);
+    }
+}
+
+COMMENT(--------========[ Checkpoint ]========--------)
+
+#define CHECKPOINT_TEST_PATH "target/test-checkpoint.bin"
+
+internal void TestCheckpointRoundTrip(void) {
+    const usize width = 37, height = 21, n = width * height;
+    Arena arena = CreateArena(2 * (AovsArenaSize(width, height) + AccumulationArenaSize(width, height)));
+    Aovs written = CreateAovs(&arena, width, height);
+    CreateAccumulation(&arena, &written);
+    for (usize i = 0; i < n; i++) {
+        for (usize c = 0; c < 3; c++) {
+            written.sum[i][c] = 10.f * TestRandom();
+            written.albedo[i][c] = TestRandom();
+            written.normal[i][c] = TestRandom() - 0.5f;
+        }
+        written.nSamples[i] = 16 + (u32)i % 3;
+        written.depth[i] = 1.f + TestRandom();
+    }
+
+    CheckpointWriter writer;
+    StartCheckpointWriter(&writer, CHECKPOINT_TEST_PATH, width, height, 0xC0FFEE);
+    CHECK(SubmitCheckpoint(&writer, &written, true));
+    StopCheckpointWriter(&writer);
+
+    Aovs loaded = CreateAovs(&arena, width, height);
+    CreateAccumulation(&arena, &loaded);
+    u64 seed = 0;
+    CHECK(LoadCheckpoint(CHECKPOINT_TEST_PATH, &loaded, &seed));
+    CHECK(seed == 0xC0FFEE);
+    CHECK(memcmp(loaded.sum, written.sum, n * sizeof(vec3)) == 0);
+    CHECK(memcmp(loaded.nSamples, written.nSamples, n * sizeof(u32)) == 0);
+    CHECK(memcmp(loaded.albedo, written.albedo, n * sizeof(vec3)) == 0);
+    CHECK(memcmp(loaded.normal, written.normal, n * sizeof(vec3)) == 0);
+    CHECK(memcmp(loaded.depth, written.depth, n * sizeof(f32)) == 0);
+    for (usize i = 0; i < n; i++) CHECK_NEAR(loaded.color[i][0], written.sum[i][0] / (f32)written.nSamples[i], 1e-6);
+    DropArena(&arena);
+    unlink(CHECKPOINT_TEST_PATH);
+}
+
+COMMENT(--------========[ Vertex format ]========--------)
+
+/// Meshes drop their full precision vertices once quantized, every position has to come from the compact copy.
+internal void TestCompactMeshWithoutVertices(void) {
+    Obj obj;
+    LoadOBJ("../scenes/sphere.obj", &obj);
+    Position* const original = malloc(obj.nVertices * sizeof(Position));
+    CHECK(original != NULL);
+    for (usize i = 0; i < obj.nVertices; i++) original[i] = obj.vertices[i].position;
+
+    Arena arena = CreateArena(CompactMeshArenaSize(&obj));
+    VertexPrecision precision;
+    const CompactMesh compact = CompressMesh(&obj, &arena, &precision);
+    FreeOBJVertices(&obj);
+    CHECK(obj.vertices == NULL);
+    CHECK(compact.nVertices == obj.nVertices);
+    for (usize i = 0; i < obj.nVertices; i++) {
+        vec3 position;
+        MeshPosition(&obj, &compact, i, position);
+        vec3 expected = { original[i].x, original[i].y, original[i].z };
+        CHECK(glm_vec3_distance(position, expected) <= precision.maxPositionError * 1.001f);
+    }
+    FreeOBJ(obj);
+    DropArena(&arena);
+    free(original);
+}
+
+COMMENT(--------========[ Ray queue ]========--------)
+
+/// `RayQueueArenaSize` has to follow the components of `RayQueue`, over as well as under.
+internal void TestRayQueueArenaSize(void) {
+    const usize capacities[] = { 1, 17, 4096 };
+    for (usize i = 0; i < ARRAY_LENGTH(capacities); i++) {
+        const usize size = RayQueueArenaSize(capacities[i]);
+        Arena arena = CreateArena(size);
+        const RayQueue queue = CreateRayQueue(&arena, capacities[i]);
+        CHECK(queue.capacity == capacities[i]);
+        CHECK(arena.offset <= size);
+        // Only alignment slack may be left, a component too many would leave 4 bytes per ray.
+        if (capacities[i] == 4096) CHECK(size - arena.offset < 4 * capacities[i]);
+        DropArena(&arena);
+    }
+}
+
+COMMENT(--------========[ Environment ]========--------)
+
+#define TEST_ENVIRONMENT_WIDTH 12
+#define TEST_ENVIRONMENT_HEIGHT 6
+#define TEST_ENVIRONMENT_DRAWS (1 << 20)
+
+/// Every fifth texel black, the others with a random red and the texel index in blue, so a sample's radiance tells
+/// which texel it came from.
+internal void CreateTestEnvironment(Environment* const environment, f64* const probabilities) {
+    const usize n = TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT;
+    f32 rgb[TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT * 3] = { 0 };
+    f64 total = 0.0;
+    for (usize i = 0; i < n; i++) {
+        if (i % 5 == 0) {
+            probabilities[i] = 0.0;
+            continue;
+        }
+        rgb[3 * i] = 4.f * TestRandom();
+        rgb[3 * i + 2] = (f32)i;
+        const f64 sinTheta = sin(M_PI * ((f64)(i / TEST_ENVIRONMENT_WIDTH) + 0.5) / TEST_ENVIRONMENT_HEIGHT);
+        probabilities[i] = (0.2126 * rgb[3 * i] + 0.0722 * rgb[3 * i + 2]) * sinTheta;
+        total += probabilities[i];
+    }
+    for (usize i = 0; i < n; i++) probabilities[i] /= total;
+    CreateEnvironment(environment, rgb, TEST_ENVIRONMENT_WIDTH, TEST_ENVIRONMENT_HEIGHT);
+}
+
+/// Every texel keeps its own share of its slot and gets what the slots aliasing it give away, which has to add up
+/// to its weight.
+internal void TestAliasTableProbabilities(void) {
+    const usize n = TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT;
+    f64 expected[TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT];
+    Environment environment;
+    CreateTestEnvironment(&environment, expected);
+    f64 implied[TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT] = { 0 };
+    for (usize i = 0; i < n; i++) {
+        const AliasEntry entry = environment.alias[i];
+        CHECK(entry.threshold >= 0.f && entry.threshold <= 1.f);
+        CHECK(entry.alias < n);
+        implied[i] += entry.threshold / (f64)n;
+        implied[entry.alias] += (1.0 - entry.threshold) / (f64)n;
+    }
+    for (usize i = 0; i < n; i++) CHECK_NEAR(implied[i], expected[i], 1e-6);
+    DestroyEnvironment(&environment);
+}
+
+/// Texels come up as often as their weight says, and the density returned with a sample is `EnvironmentPdf`'s.
+internal void TestEnvironmentSamplingFrequencies(void) {
+    const usize n = TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT;
+    f64 expected[TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT];
+    Environment environment;
+    CreateTestEnvironment(&environment, expected);
+    u32 counts[TEST_ENVIRONMENT_WIDTH * TEST_ENVIRONMENT_HEIGHT] = { 0 };
+    for (usize draw = 0; draw < TEST_ENVIRONMENT_DRAWS; draw++) {
+        const f32 random[4] = { TestRandom(), TestRandom(), TestRandom(), TestRandom() };
+        vec3 direction, radiance;
+        const f32 pdf = SampleEnvironment(&environment, random, direction, radiance);
+        const usize texel = (usize)radiance[2];
+        CHECK(radiance[2] > 0.f && texel < n);
+        counts[texel] += 1;
+        if (draw % 1024 == 0) CHECK_NEAR(pdf, EnvironmentPdf(&environment, direction), 1e-3 * pdf);
+    }
+    for (usize i = 0; i < n; i++) {
+        // Five standard deviations of a binomial count.
+        const f64 sigma = sqrt(expected[i] * (1.0 - expected[i]) / TEST_ENVIRONMENT_DRAWS);
+        CHECK_NEAR((f64)counts[i] / TEST_ENVIRONMENT_DRAWS, expected[i], 5.0 * sigma + 1e-9);
+    }
+    DestroyEnvironment(&environment);
+}
+
+COMMENT(--------========[ Radiance cache ]========--------)
+
+#define TEST_CACHE_CELLS 2000
+#define TEST_CACHE_ADDS 20000
+
+internal void TestRadianceCacheKeys(void) {
+    RadianceCache cache;
+    CreateRadianceCache(&cache, 8000, 0.5f, 1);
+    CHECK(cache.capacity == 8192);
+
+    const vec3 up = { 0.f, 1.f, 0.f }, down = { 0.f, -1.f, 0.f }, tilted = { 0.1f, 0.99f, 0.f };
+    const u32 record = FindRadianceRecord(&cache, (vec3) { 0.1f, 0.2f, 0.3f }, up);
+    CHECK(record != RADIANCE_CACHE_NONE);
+    // Same cell and normal bin, another point and a slightly different normal.
+    CHECK(FindRadianceRecord(&cache, (vec3) { 0.4f, 0.01f, 0.49f }, tilted) == record);
+    // Both sides of a thin wall, the neighbouring cell and the cell across zero are all apart.
+    CHECK(FindRadianceRecord(&cache, (vec3) { 0.1f, 0.2f, 0.3f }, down) != record);
+    CHECK(FindRadianceRecord(&cache, (vec3) { 0.6f, 0.2f, 0.3f }, up) != record);
+    CHECK(FindRadianceRecord(&cache, (vec3) { -0.1f, 0.2f, 0.3f }, up) != record);
+    CHECK(RadianceCacheRecords(&cache) == 4);
+
+    // A quarter full table places every cell of a dense block, each in a slot of its own.
+    ResetRadianceCache(&cache);
+    u8* const taken = calloc(cache.capacity, 1);
+    CHECK(taken != NULL);
+    for (usize i = 0; i < TEST_CACHE_CELLS; i++) {
+        const vec3 position = { (f32)(i % 13) * 0.5f, (f32)(i / 13 % 13) * 0.5f, (f32)(i / 169) * 0.5f };
+        const u32 slot = FindRadianceRecord(&cache, position, up);
+        CHECK(slot != RADIANCE_CACHE_NONE && !taken[slot]);
+        taken[slot] = 1;
+    }
+    CHECK(RadianceCacheRecords(&cache) == TEST_CACHE_CELLS);
+    free(taken);
+    DestroyRadianceCache(&cache);
+
+    // Once every probed slot holds another cell, there is no record instead of a wrong one.
+    CreateRadianceCache(&cache, RADIANCE_CACHE_PROBES, 1.f, 1);
+    usize nPlaced = 0;
+    for (usize i = 0; i < 2 * RADIANCE_CACHE_PROBES; i++) {
+        nPlaced += FindRadianceRecord(&cache, (vec3) { (f32)i + 0.5f, 0.5f, 0.5f }, up) != RADIANCE_CACHE_NONE;
+    }
+    CHECK(nPlaced == RADIANCE_CACHE_PROBES);
+    DestroyRadianceCache(&cache);
+}
+
+typedef struct {
+    RadianceCache* cache;
+    u32 records[8];
+} CacheWorker;
+
+internal void* RadianceCacheWorker(void* const arg) {
+    CacheWorker* const worker = arg;
+    for (usize i = 0; i < TEST_CACHE_ADDS; i++) {
+        const u32 cell = (u32)(i % 8);
+        const u32 record = FindRadianceRecord(worker->cache, (vec3) { (f32)cell, 0.5f, 0.5f }, (vec3) { 0.f, 0.f, 1.f });
+        worker->records[cell] = record;
+        AddRecordRadiance(worker->cache, record, (vec3) { 1.f, 2.f, 0.f });
+        CountRecordSample(worker->cache, record);
+    }
+    return NULL;
+}
+
+/// Threads racing for the same cells agree on their records and lose none of their additions.
+internal void TestRadianceCacheConcurrent(void) {
+    RadianceCache cache;
+    CreateRadianceCache(&cache, 64, 1.f, 1);
+    pthread_t threads[TEST_THREADS];
+    CacheWorker workers[TEST_THREADS];
+    for (usize t = 0; t < TEST_THREADS; t++) {
+        workers[t] = (CacheWorker) { .cache = &cache };
+        CHECK(0 == pthread_create(&threads[t], NULL, RadianceCacheWorker, &workers[t]));
+    }
+    for (usize t = 0; t < TEST_THREADS; t++) pthread_join(threads[t], NULL);
+
+    CHECK(RadianceCacheRecords(&cache) == 8);
+    const u32 perRecord = TEST_THREADS * TEST_CACHE_ADDS / 8;
+    for (usize cell = 0; cell < 8; cell++) {
+        const u32 record = workers[0].records[cell];
+        for (usize t = 1; t < TEST_THREADS; t++) CHECK(workers[t].records[cell] == record);
+        CHECK(RadianceRecordSamples(&cache, record) == perRecord);
+        vec3 mean;
+        RadianceRecordMean(&cache, record, mean);
+        CHECK(mean[0] == 1.f && mean[1] == 2.f && mean[2] == 0.f);
+    }
+    DestroyRadianceCache(&cache);
+}
+
+COMMENT(--------========[ Lights ]========--------)
+
+#define TEST_LIGHTS 37
+#define TEST_LIGHT_POINTS 64
+#define TEST_LIGHT_DRAWS 65536
+
+/// Shading point among the lights of `ScatterLights`, facing any direction.
+internal void RandomShadingPoint(vec3 position, vec3 normal) {
+    for (usize c = 0; c < 3; c++) {
+        position[c] = 8.f * TestRandom() - 4.f;
+        normal[c] = TestRandom() - 0.5f;
+    }
+    glm_vec3_normalize(normal);
+}
+
+/// The light tree's choice probabilities form a distribution, and the one `SampleLightTree` reports is the one
+/// `LightTreePdf` finds, before and after the lights moved.
+internal void TestLightTreePmf(void) {
+    Light lights[TEST_LIGHTS];
+    ScatterLights(lights, TEST_LIGHTS, 5, 100.f);
+    LightTree tree;
+    CreateLightTree(&tree, TEST_LIGHTS);
+    BuildLightTree(&tree, lights, TEST_LIGHTS);
+
+    for (usize round = 0; round < 2; round++) {
+        usize nLit = 0;
+        for (usize point = 0; point < TEST_LIGHT_POINTS; point++) {
+            vec3 position, normal;
+            RandomShadingPoint(position, normal);
+            f64 total = 0.0;
+            for (u32 light = 0; light < TEST_LIGHTS; light++) total += LightTreePdf(&tree, position, normal, light);
+            if (total == 0.0) continue;
+            nLit += 1;
+            CHECK_NEAR(total, 1.0, 1e-5);
+            for (usize draw = 0; draw < 16; draw++) {
+                u32 light;
+                const f32 probability = SampleLightTree(&tree, position, normal, TestRandom(), &light);
+                CHECK(light < TEST_LIGHTS);
+                CHECK(probability > 0.f);
+                CHECK_NEAR(probability, LightTreePdf(&tree, position, normal, light), 1e-6 * probability);
+            }
+        }
+        CHECK(nLit > TEST_LIGHT_POINTS / 2);
+
+        for (usize i = 0; i < TEST_LIGHTS; i++) lights[i].position[1] += 2.f * TestRandom();
+        UpdateLightTree(&tree);
+    }
+    DestroyLightTree(&tree);
+}
+
+/// Stratified draws pick every light about as often as `LightTreePdf` says.
+internal void TestLightTreeFrequencies(void) {
+    Light lights[TEST_LIGHTS];
+    ScatterLights(lights, TEST_LIGHTS, 9, 100.f);
+    LightTree tree;
+    CreateLightTree(&tree, TEST_LIGHTS);
+    BuildLightTree(&tree, lights, TEST_LIGHTS);
+
+    for (usize point = 0; point < 8; point++) {
+        vec3 position, normal;
+        RandomShadingPoint(position, normal);
+        u32 counts[TEST_LIGHTS] = { 0 };
+        usize nPicked = 0;
+        for (usize draw = 0; draw < TEST_LIGHT_DRAWS; draw++) {
+            u32 light;
+            if (SampleLightTree(&tree, position, normal, ((f32)draw + 0.5f) / TEST_LIGHT_DRAWS, &light) > 0.f) {
+                counts[light] += 1;
+                nPicked += 1;
+            }
+        }
+        if (nPicked == 0) continue;
+        CHECK(nPicked == TEST_LIGHT_DRAWS);
+        for (u32 light = 0; light < TEST_LIGHTS; light++) {
+            CHECK_NEAR((f64)counts[light] / TEST_LIGHT_DRAWS, LightTreePdf(&tree, position, normal, light), 1e-3);
+        }
+    }
+    DestroyLightTree(&tree);
+}
+
+COMMENT(--------========[ Textures ]========--------)
+
+#define TEXTURE_TEST_IMAGE "target/test-texture.ppm"
+#define TEXTURE_TEST_TILED "target/test-texture.rtbtile"
+
+/// Images one texel wide or high keep that texel in every level, each level of a single color comes out unchanged.
+internal void TestTextureThinImages(void) {
+    const u32 sizes[][2] = { { 1, 77 }, { 77, 1 }, { 3, 1 }, { 1, 1 } };
+    const u8 color[3] = { 200, 90, 17 };
+    for (usize k = 0; k < ARRAY_LENGTH(sizes); k++) {
+        const u32 width = sizes[k][0], height = sizes[k][1];
+        FILE* const file = fopen(TEXTURE_TEST_IMAGE, "wb");
+        CHECK(file != NULL);
+        fprintf(file, "P6\n%u %u\n255\n", width, height);
+        for (u32 i = 0; i < width * height; i++) CHECK(fwrite(color, sizeof color, 1, file) == 1);
+        fclose(file);
+        unlink(TEXTURE_TEST_TILED);
+        CHECK(ConvertTexture(TEXTURE_TEST_IMAGE, TEXTURE_TEST_TILED));
+
+        Texture texture;
+        OpenTexture(TEXTURE_TEST_TILED, &texture);
+        u32 expectedLevels = 1;
+        for (u32 longest = width > height ? width : height; longest > 1; longest /= 2) expectedLevels++;
+        CHECK(texture.nLevels == expectedLevels);
+        u8* const rgba = malloc((usize)width * height * 4);
+        CHECK(rgba != NULL);
+        for (u32 l = 0; l < texture.nLevels; l++) {
+            const TextureLevel* const level = &texture.levels[l];
+            CHECK(level->width >= 1 && level->height >= 1);
+            ReadTextureLevel(&texture, l, rgba);
+            for (usize i = 0; i < (usize)level->width * level->height; i++) {
+                for (usize c = 0; c < 3; c++) CHECK(rgba[4 * i + c] == color[c]);
+                CHECK(rgba[4 * i + 3] == 255);
+            }
+        }
+        free(rgba);
+        CloseTexture(&texture);
+    }
+    unlink(TEXTURE_TEST_TILED);
+    unlink(TEXTURE_TEST_IMAGE);
+}
+
+COMMENT(--------========[ Paged mesh ]========--------)
+
+#define PAGED_TEST_PATH "target/test-paged.bin"
+#define PAGED_TEST_GRID 24
+
+internal bool PagedResident(const PagedMesh* const mesh, const u32 cluster) {
+    return atomic_load(&mesh->clusterSlots[cluster]) != PAGED_MESH_NOT_RESIDENT;
+}
+
+/// With every slot taken CLOCK gives each referenced cluster a second chance and evicts the first one without.
+internal void TestPagedMeshEviction(void) {
+    const usize n = PAGED_TEST_GRID + 1;
+    Obj obj = {
+        .nVertices = n * n,
+        .nIndices = 6 * PAGED_TEST_GRID * PAGED_TEST_GRID,
+    };
+    obj.vertices = malloc(obj.nVertices * sizeof(Vertex));
+    obj.indices = malloc(obj.nIndices * sizeof(u16));
+    CHECK(obj.vertices != NULL && obj.indices != NULL);
+    for (usize y = 0; y < n; y++) {
+        for (usize x = 0; x < n; x++) {
+            obj.vertices[y * n + x] = (Vertex) { .position = { (f32)x, 0.25f * TestRandom(), (f32)y }, .normal = { 0, 1, 0 } };
+        }
+    }
+    usize nIndices = 0;
+    for (usize y = 0; y < PAGED_TEST_GRID; y++) {
+        for (usize x = 0; x < PAGED_TEST_GRID; x++) {
+            const u16 corner = (u16)(y * n + x);
+            const u16 quad[6] = { corner, corner + (u16)n, corner + 1, corner + 1, corner + (u16)n, corner + (u16)n + 1 };
+            memcpy(&obj.indices[nIndices], quad, sizeof quad);
+            nIndices += 6;
+        }
+    }
+    Instances instances = AllocateArray(Instance, 2);
+    for (usize i = 0; i < 2; i++) {
+        instances.data[i] = (Instance) { 0 };
+        glm_mat4_identity(instances.data[i].model);
+        instances.data[i].model[3][0] = 100.f * (f32)i;
+    }
+    WritePagedMesh(PAGED_TEST_PATH, &obj, instances);
+
+    PagedMesh mesh;
+    OpenPagedMesh(PAGED_TEST_PATH, 4 * PAGED_MESH_PAGE_BYTES, &mesh);
+    CHECK(mesh.nSlots == 4);
+    CHECK(mesh.nClusters >= 6);
+    u64 nTriangles = 0;
+    for (usize c = 0; c < mesh.nClusters; c++) nTriangles += mesh.clusters[c].nTriangles;
+    CHECK(nTriangles == mesh.nTriangles);
+    CHECK(nTriangles == 2 * obj.nIndices / 3);
+
+    PagedMeshStats stats;
+    for (u32 c = 0; c < 4; c++) TouchPagedCluster(&mesh, c);
+    TouchPagedCluster(&mesh, 0);
+    GetPagedMeshStats(&mesh, &stats);
+    CHECK(stats.nPageIns == 4);
+    CHECK(stats.nEvictions == 0);
+    CHECK(stats.residentBytes == stats.budgetBytes);
+
+    // Every cluster is referenced, the hand clears them all and comes back around to the oldest.
+    TouchPagedCluster(&mesh, 4);
+    GetPagedMeshStats(&mesh, &stats);
+    CHECK(stats.nPageIns == 5);
+    CHECK(stats.nEvictions == 1);
+    CHECK(!PagedResident(&mesh, 0));
+    for (u32 c = 1; c <= 4; c++) CHECK(PagedResident(&mesh, c));
+
+    // Cluster 1 is touched again after the sweep, so the hand passes it over for cluster 2.
+    TouchPagedCluster(&mesh, 1);
+    TouchPagedCluster(&mesh, 5);
+    GetPagedMeshStats(&mesh, &stats);
+    CHECK(stats.nEvictions == 2);
+    CHECK(PagedResident(&mesh, 1));
+    CHECK(!PagedResident(&mesh, 2));
+    CHECK(stats.residentBytes == stats.budgetBytes);
+    CHECK(stats.peakResidentBytes == stats.budgetBytes);
+
+    // An evicted cluster faults back in with its triangles intact.
+    const PagedTriangle* const triangles = TouchPagedCluster(&mesh, 0);
+    const PagedCluster* const cluster = &mesh.clusters[0];
+    CHECK(cluster->nTriangles == PAGED_MESH_CLUSTER_TRIANGLES);
+    for (usize t = 0; t < cluster->nTriangles; t++) {
+        for (usize k = 0; k < 3; k++) {
+            const Position p = triangles[t].corners[k];
+            CHECK(p.x >= cluster->lower[0] && p.x <= cluster->upper[0]);
+            CHECK(p.y >= cluster->lower[1] && p.y <= cluster->upper[1]);
+            CHECK(p.z >= cluster->lower[2] && p.z <= cluster->upper[2]);
+        }
+    }
+
+    EvictPagedMesh(&mesh);
+    GetPagedMeshStats(&mesh, &stats);
+    CHECK(stats.nPageIns == 0 && stats.nEvictions == 0 && stats.residentBytes == 0);
+    for (u32 c = 0; c < mesh.nClusters; c++) CHECK(!PagedResident(&mesh, c));
+
+    ClosePagedMesh(&mesh);
+    FreeArray(instances);
+    free(obj.vertices);
+    free(obj.indices);
+    unlink(PAGED_TEST_PATH);
+}
+
+COMMENT(--------========[ Accel ]========--------)
+
+/// Hits through `Accel` carry the normal Embree reports: `(p0 - p1) x (p2 - p0)` in object space, mirrored or not.
+internal void TestAccelNormalMatchesEmbree(void) {
+    Vertex vertices[3] = {
+        { .position = { 0, 0, 0 } },
+        { .position = { 1, 0, 0 } },
+        { .position = { 0, 1, 0 } },
+    };
+    u16 indices[3] = { 0, 1, 2 };
+    const Obj obj = { .nVertices = 3, .nIndices = 3, .vertices = vertices, .indices = indices };
+    Instances instances = AllocateArray(Instance, 2);
+    for (usize i = 0; i < 2; i++) {
+        instances.data[i] = (Instance) { 0 };
+        glm_mat4_identity(instances.data[i].model);
+    }
+    // A mirror with a non uniform scale flips the world space winding of the second instance.
+    instances.data[1].model[0][0] = -2.f;
+    instances.data[1].model[2][2] = 3.f;
+    instances.data[1].model[3][0] = 10.f;
+    AccelScene scene;
+    CreateAccelScene(&obj, NULL, instances, 5, &scene);
+
+    Arena arena = CreateArena(RayQueueArenaSize(2));
+    RayQueue queue = CreateRayQueue(&arena, 2);
+    PushRay(&queue, (vec3) { 0.25f, 0.25f, 5.f }, (vec3) { 0, 0, -1 }, 0);
+    PushRay(&queue, (vec3) { 9.5f, 0.25f, -5.f }, (vec3) { 0, 0, 1 }, 1);
+    const RayTracer rt = { .accelScene = &scene };
+    HitRecord hits[2];
+    RayStats stats = { 0 };
+    IntersectRays(&rt, &queue, hits, &stats);
+
+    vec3 expected = { 0, 0, -1 };
+    for (u32 i = 0; i < 2; i++) {
+        CHECK(hits[i].primID == 0);
+        CHECK(hits[i].instID == 5 + i);
+        vec3 normal;
+        DecodeOctahedral(hits[i].normal, normal);
+        CHECK(glm_vec3_distance(normal, expected) < 1e-3f);
+    }
+    DropArena(&arena);
+    DestroyAccelScene(&scene);
+    FreeArray(instances);
+}
+
+COMMENT(--------========[ Denoise ]========--------)
+
+/// Wide enough for the SIMD interior at every iteration, tall enough for several bands.
+#define DENOISE_TEST_WIDTH 96
+#define DENOISE_TEST_HEIGHT 40
+
+/// Noisy irradiance over two walls meeting at a crease, modulated by a checkered albedo.
+internal Aovs CreateTestAovs(Arena* const arena) {
+    const Aovs aovs = CreateAovs(arena, DENOISE_TEST_WIDTH, DENOISE_TEST_HEIGHT);
+    for (usize y = 0; y < aovs.height; y++) {
+        for (usize x = 0; x < aovs.width; x++) {
+            const usize p = y * aovs.width + x;
+            const bool left = x < aovs.width / 2;
+            for (usize c = 0; c < 3; c++) {
+                aovs.albedo[p][c] = (x / 4 + y / 4) % 2 == 0 ? 0.8f : 0.4f;
+                aovs.color[p][c] = aovs.albedo[p][c] * ((left ? 0.2f : 0.7f) + 0.3f * TestRandom());
+            }
+            glm_vec3_copy(left ? (vec3) { 1.f, 0.f, 0.f } : (vec3) { 0.f, 0.f, 1.f }, aovs.normal[p]);
+            aovs.depth[p] = 2.f + 0.01f * (f32)x;
+        }
+    }
+    return aovs;
+}
+
+/// The filter as published, per pixel with `expf`, against which the vectorized one is checked.
+internal void ReferenceDenoise(const Aovs* const aovs, const DenoiseParams params, vec3* const result) {
+    const isize width = (isize)aovs->width, height = (isize)aovs->height;
+    const usize n = aovs->width * aovs->height;
+    const f32 kernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+    vec3* source = malloc(n * sizeof(vec3));
+    vec3* destination = malloc(n * sizeof(vec3));
+    for (usize i = 0; i < n; i++) {
+        for (usize c = 0; c < 3; c++) source[i][c] = aovs->albedo[i][c] > 1e-4f ? aovs->color[i][c] / aovs->albedo[i][c] : aovs->color[i][c];
+    }
+    f32 sigmaColor = params.sigmaColor;
+    for (usize iteration = 0; iteration < params.nIterations; iteration++) {
+        const isize step = (isize)1 << iteration;
+        for (isize y = 0; y < height; y++) {
+            for (isize x = 0; x < width; x++) {
+                const isize p = y * width + x;
+                vec3 sum = { 0.f, 0.f, 0.f };
+                f32 weightSum = 0.f;
+                for (isize ky = 0; ky < 5; ky++) {
+                    for (isize kx = 0; kx < 5; kx++) {
+                        const isize qx = x + (kx - 2) * step, qy = y + (ky - 2) * step;
+                        if (qx < 0 || qx >= width || qy < 0 || qy >= height) continue;
+                        const isize q = qy * width + qx;
+                        const f32 weight = kernel[kx] * kernel[ky] * expf(
+                            - glm_vec3_distance2(source[q], source[p]) / (sigmaColor * sigmaColor)
+                            - glm_vec3_distance2(aovs->normal[q], aovs->normal[p]) / (params.sigmaNormal * params.sigmaNormal)
+                            - fabsf(aovs->depth[q] - aovs->depth[p]) / (params.sigmaDepth * aovs->depth[p] + 1e-4f)
+                        );
+                        glm_vec3_muladds(source[q], weight, sum);
+                        weightSum += weight;
+                    }
+                }
+                glm_vec3_scale(sum, 1.f / weightSum, destination[p]);
+            }
+        }
+        vec3* const swap = source;
+        source = destination;
+        destination = swap;
+        sigmaColor *= 0.5f;
+    }
+    for (usize i = 0; i < n; i++) {
+        for (usize c = 0; c < 3; c++) result[i][c] = aovs->albedo[i][c] > 1e-4f ? source[i][c] * aovs->albedo[i][c] : source[i][c];
+    }
+    free(source);
+    free(destination);
+}
+
+internal void TestDenoiseMatchesReference(void) {
+    Arena arena = CreateArena(AovsArenaSize(DENOISE_TEST_WIDTH, DENOISE_TEST_HEIGHT) + DenoiseArenaSize(DENOISE_TEST_WIDTH, DENOISE_TEST_HEIGHT));
+    const Aovs aovs = CreateTestAovs(&arena);
+    const usize n = aovs.width * aovs.height;
+    vec3* const expected = malloc(n * sizeof(vec3));
+    vec3* const denoised = malloc(n * sizeof(vec3));
+    ReferenceDenoise(&aovs, DENOISE_DEFAULTS, expected);
+
+    WorkerPool pool;
+    CreateWorkerPool(&pool, TEST_THREADS);
+    Denoise(&aovs, DENOISE_DEFAULTS, &pool, &arena, denoised);
+    DestroyWorkerPool(&pool);
+
+    for (usize i = 0; i < n; i++) {
+        for (usize c = 0; c < 3; c++) CHECK_NEAR(denoised[i][c], expected[i][c], 1e-4 * fabs(expected[i][c]) + 1e-6);
+    }
+    free(denoised);
+    free(expected);
+    DropArena(&arena);
+}
+
+internal void TestDenoiseKeepsCrease(void) {
+    Arena arena = CreateArena(AovsArenaSize(DENOISE_TEST_WIDTH, DENOISE_TEST_HEIGHT) + DenoiseArenaSize(DENOISE_TEST_WIDTH, DENOISE_TEST_HEIGHT));
+    const Aovs aovs = CreateTestAovs(&arena);
+    WorkerPool pool;
+    CreateWorkerPool(&pool, TEST_THREADS);
+    Denoise(&aovs, DENOISE_DEFAULTS, &pool, &arena, aovs.color);
+    DestroyWorkerPool(&pool);
+
+    // Irradiance of either wall averages to its base plus 0.15, the normals keep the walls from blending.
+    for (usize y = 0; y < aovs.height; y++) {
+        for (usize x = 0; x < aovs.width; x++) {
+            const usize p = y * aovs.width + x;
+            const f32 irradiance = aovs.color[p][0] / aovs.albedo[p][0];
+            const f32 expected = x < aovs.width / 2 ? 0.35f : 0.85f;
+            CHECK(irradiance > 0.5f * expected && irradiance < 1.5f * expected);
+        }
+    }
+    DropArena(&arena);
+}
+
+COMMENT(--------========[ Distributed ]========--------)
+
+#define DISTRIBUTED_TEST_PATH "target/test-distributed.sock"
+#define DISTRIBUTED_TEST_WORKERS 2
+
+internal void PrepareTestFrame(void* const context, const FrameDesc* const frame) {
+    (void)context;
+    (void)frame;
+}
+
+/// Color is the pixel's frame coordinates, so misplaced tiles show up.
+internal void RenderTestTile(void* const context, const FrameDesc* const frame, const TileDesc* const tile, const Aovs aovs) {
+    (void)context;
+    (void)frame;
+    for (usize i = 0; i < aovs.width * aovs.height; i++) {
+        const f32 x = (f32)(tile->x + i % aovs.width), y = (f32)(tile->y + i / aovs.width);
+        glm_vec3_copy((vec3) { x, y, 1.f }, aovs.color[i]);
+        glm_vec3_broadcast(1.f, aovs.albedo[i]);
+        glm_vec3_copy((vec3) { 0.f, 1.f, 0.f }, aovs.normal[i]);
+        aovs.depth[i] = x + y;
+    }
+}
+
+internal void* RunTestWorker(void* const argument) {
+    (void)argument;
+    RunWorker("unix:" DISTRIBUTED_TEST_PATH, (TileRenderer) { .prepare = PrepareTestFrame, .render = RenderTestTile });
+    return NULL;
+}
+
+internal bool TestSend(const i32 fd, const void* const data, const usize size) {
+    return send(fd, data, size, MSG_NOSIGNAL) == (isize)size;
+}
+
+internal bool TestRecv(const i32 fd, void* const data, const usize size) {
+    return recv(fd, data, size, MSG_WAITALL) == (isize)size;
+}
+
+/// Greets the coordinator, waits for its first tile and returns another one, filled with -1, in its place.
+internal void* RunRogueWorker(void* const argument) {
+    const i32 fd = *(const i32*)argument;
+    const u32 version = DISTRIBUTED_PROTOCOL_VERSION;
+    MessageHeader header = { .type = MessageTypeHello, .size = sizeof version };
+    FrameDesc frame;
+    TileDesc tile;
+    if (!TestSend(fd, &header, sizeof header) || !TestSend(fd, &version, sizeof version)) return NULL;
+    if (!TestRecv(fd, &header, sizeof header) || !TestRecv(fd, &frame, sizeof frame)) return NULL;
+    if (!TestRecv(fd, &header, sizeof header) || !TestRecv(fd, &tile, sizeof tile)) return NULL;
+
+    // The last tile, issued to the other workers if anyone.
+    const u32 nTilesX = (frame.width + frame.tileSize - 1) / frame.tileSize;
+    const u32 nTilesY = (frame.height + frame.tileSize - 1) / frame.tileSize;
+    const TileDesc forged = {
+        .id = nTilesX * nTilesY - 1,
+        .x = (nTilesX - 1) * frame.tileSize,
+        .y = (nTilesY - 1) * frame.tileSize,
+        .width = frame.width - (nTilesX - 1) * frame.tileSize,
+        .height = frame.height - (nTilesY - 1) * frame.tileSize,
+    };
+    const usize payloadSize = (usize)forged.width * forged.height * (3 * sizeof(vec3) + sizeof(f32));
+    f32* const payload = malloc(payloadSize);
+    if (payload == NULL) return NULL;
+    for (usize i = 0; i < payloadSize / sizeof(f32); i++) payload[i] = -1.f;
+    header = (MessageHeader) { .type = MessageTypeResult, .size = (u32)(sizeof forged + payloadSize) };
+    if (TestSend(fd, &header, sizeof header) && TestSend(fd, &forged, sizeof forged) && TestSend(fd, payload, payloadSize)) {
+        // Drain until the coordinator hangs up on us.
+        u8 sink[256];
+        while (recv(fd, sink, sizeof sink, 0) > 0) {}
+    }
+    free(payload);
+    return NULL;
+}
+
+/// Workers render a whole frame and leave once the coordinator shuts them down. A client that connects without ever
+/// greeting is rejected instead of blocking the coordinator, and one returning a tile it was not issued is dropped
+/// without its result reaching the frame.
+internal void TestDistributedFrame(void) {
+    const i32 listener = ListenCoordinator("unix:" DISTRIBUTED_TEST_PATH);
+    const i32 stalled = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address = { .sun_family = AF_UNIX, .sun_path = DISTRIBUTED_TEST_PATH };
+    CHECK(stalled >= 0 && connect(stalled, (struct sockaddr*)&address, sizeof address) == 0);
+    // Connected before the honest workers, so it is accepted and fed first.
+    i32 rogue = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(rogue >= 0 && connect(rogue, (struct sockaddr*)&address, sizeof address) == 0);
+    pthread_t rogueThread;
+    CHECK(pthread_create(&rogueThread, NULL, RunRogueWorker, &rogue) == 0);
+
+    pthread_t workers[DISTRIBUTED_TEST_WORKERS];
+    for (usize i = 0; i < DISTRIBUTED_TEST_WORKERS; i++) CHECK(pthread_create(&workers[i], NULL, RunTestWorker, NULL) == 0);
+
+    const CoordinatorConfig config = {
+        .frame = { .id = 0, .width = 70, .height = 45, .nRaysPerSample = 1, .nMaxReflections = 1, .tileSize = 16 },
+        .reissueFactor = 3.0,
+    };
+    Arena arena = CreateArena(AovsArenaSize(config.frame.width, config.frame.height));
+    const Aovs aovs = CreateAovs(&arena, config.frame.width, config.frame.height);
+    RunCoordinator(listener, &config, aovs);
+    // Joining only returns when the workers left their receive loop on shutdown.
+    for (usize i = 0; i < DISTRIBUTED_TEST_WORKERS; i++) pthread_join(workers[i], NULL);
+    pthread_join(rogueThread, NULL);
+    close(rogue);
+    close(stalled);
+
+    for (usize p = 0; p < aovs.width * aovs.height; p++) {
+        CHECK(aovs.color[p][0] == (f32)(p % aovs.width));
+        CHECK(aovs.color[p][1] == (f32)(p / aovs.width));
+        CHECK(aovs.depth[p] == (f32)(p % aovs.width + p / aovs.width));
+    }
+    DropArena(&arena);
+    unlink(DISTRIBUTED_TEST_PATH);
+}
+
+COMMENT(--------========[ Runner ]========--------)
+
+internal const Test Tests[] = {
+    { "random advance", TestRandomAdvance },
+    { "checkpoint round trip", TestCheckpointRoundTrip },
+    { "compact mesh without vertices", TestCompactMeshWithoutVertices },
+    { "ray queue arena size", TestRayQueueArenaSize },
+    { "alias table probabilities", TestAliasTableProbabilities },
+    { "environment sampling frequencies", TestEnvironmentSamplingFrequencies },
+    { "radiance cache keys", TestRadianceCacheKeys },
+    { "radiance cache concurrent", TestRadianceCacheConcurrent },
+    { "light tree pmf", TestLightTreePmf },
+    { "light tree frequencies", TestLightTreeFrequencies },
+    { "texture thin images", TestTextureThinImages },
+    { "paged mesh eviction", TestPagedMeshEviction },
+    { "accel normal matches embree", TestAccelNormalMatchesEmbree },
+    { "denoise matches reference", TestDenoiseMatchesReference },
+    { "denoise keeps crease", TestDenoiseKeepsCrease },
+    { "distributed frame", TestDistributedFrame },
+};
+
+internal bool Selected(const Test* const test, const i32 argc, char** const argv) {
+    if (argc < 2) return true;
+    for (i32 i = 1; i < argc; i++) {
+        if (strstr(test->name, argv[i]) != NULL) return true;
+    }
+    return false;
+}
+
+i32 main(const i32 argc, char** const argv) {
+    usize nRun = 0;
+    for (usize i = 0; i < ARRAY_LENGTH(Tests); i++) {
+        if (!Selected(&Tests[i], argc, argv)) continue;
+        Tests[i].run();
+        printf("ok   %s\n", Tests[i].name);
+        nRun += 1;
+    }
+    printf("%zu of %zu tests passed\n", nRun, ARRAY_LENGTH(Tests));
+    exit(EXIT_SUCCESS);
+}